@@ -2202,6 +2202,13 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.cache_type_v = kv_cache_type_from_str(value);
         }
     ).set_env("LLAMA_ARG_CACHE_TYPE_V"));
+    add_opt(common_arg(
+        {"--kv-smooth-k"},
+        string_format("subtract a per-channel mean from K before storing it in a quantized K cache, improves the accuracy of low-bit K caches (default: %s)", params.kv_smooth_k ? "true" : "false"),
+        [](common_params & params) {
+            params.kv_smooth_k = true;
+        }
+    ).set_env("LLAMA_ARG_KV_SMOOTH_K"));
     add_opt(common_arg(
         {"--hellaswag"},
         "compute HellaSwag score over random tasks from datafile supplied with -f",
@@ -2362,6 +2369,17 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.use_mlock = true;
         }
     ).set_env("LLAMA_ARG_MLOCK"));
+    add_opt(common_arg(
+        {"--moe-hot-experts"}, "N",
+        string_format("number of most frequently routed MoE experts per layer to keep locked in RAM, the others are\n"
+                      "read from the mapped model file on demand (default: %d, 0 = disabled)", params.n_expert_hot),
+        [](common_params & params, int value) {
+            if (value < 0) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.n_expert_hot = value;
+        }
+    ).set_env("LLAMA_ARG_MOE_HOT_EXPERTS"));
     add_opt(common_arg(
         {"--no-mmap"},
         "do not memory-map model (slower load but may reduce pageouts if not using mlock)",
@@ -2489,11 +2507,12 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
         }
     ).set_env("LLAMA_ARG_N_GPU_LAYERS"));
     add_opt(common_arg(
-        {"-sm", "--split-mode"}, "{none,layer,row}",
+        {"-sm", "--split-mode"}, "{none,layer,row,tensor}",
         "how to split the model across multiple GPUs, one of:\n"
         "- none: use one GPU only\n"
         "- layer (default): split layers and KV across GPUs\n"
-        "- row: split rows across GPUs",
+        "- row: split rows across GPUs\n"
+        "- tensor: split layers and KV across GPUs, shard the FFN of each layer across all GPUs",
         [](common_params & params, const std::string & value) {
             std::string arg_next = value;
             if (arg_next == "none") {
@@ -2502,6 +2521,8 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
                 params.split_mode = LLAMA_SPLIT_MODE_LAYER;
             } else if (arg_next == "row") {
                 params.split_mode = LLAMA_SPLIT_MODE_ROW;
+            } else if (arg_next == "tensor") {
+                params.split_mode = LLAMA_SPLIT_MODE_TENSOR;
             } else {
                 throw std::invalid_argument("invalid value");
             }
@@ -2894,6 +2915,30 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.pooling_type = LLAMA_POOLING_TYPE_RANK;
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_RERANKING"));
+    add_opt(common_arg(
+        {"--embd-batching"},
+        string_format("process the embedding and reranking inputs without the slots: the inputs are sorted by length and up to\n"
+            "--parallel sequences are packed into each ubatch, while no slot is processing (requires --embeddings, default: %s)", params.embd_batching ? "enabled" : "disabled"),
+        [](common_params & params) {
+            params.embd_batching = true;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_EMBD_BATCHING"));
+    add_opt(common_arg(
+        {"--embd-cache"}, "N",
+        string_format("number of pooled embedding and reranking results kept in memory, identical inputs are not evaluated again\n"
+            "(default: %d, 0 = disabled)", params.embd_cache_size),
+        [](common_params & params, int value) {
+            params.embd_cache_size = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_EMBEDDING, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_EMBD_CACHE"));
+    add_opt(common_arg(
+        {"--embd-cache-file"}, "FNAME",
+        "file where the pooled embedding and reranking results are saved and read back by the next runs, the file is\n"
+        "only valid for the same model and can be used by one process at a time (default: none)",
+        [](common_params & params, const std::string & value) {
+            params.embd_cache_file = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_EMBEDDING, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_EMBD_CACHE_FILE"));
     add_opt(common_arg(
         {"--api-key"}, "KEY",
         "API key to use for authentication (default: none)",
@@ -3072,6 +3117,34 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.slot_prompt_similarity = std::stof(value);
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}));
+    add_opt(common_arg(
+        {"--lora-dir"}, "PATH",
+        "directory of the LoRA adapters that can be loaded at runtime via POST /lora-adapters/load (default: disabled)",
+        [](common_params & params, const std::string & value) {
+            params.lora_dir = value;
+            // if doesn't end with DIRECTORY_SEPARATOR, add it
+            if (!params.lora_dir.empty() && params.lora_dir[params.lora_dir.size() - 1] != DIRECTORY_SEPARATOR) {
+                params.lora_dir += DIRECTORY_SEPARATOR;
+            }
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_LORA_DIR"));
+    add_opt(common_arg(
+        {"--lora-cache-size"}, "N",
+        string_format("max total size in MiB of the loaded LoRA adapters, when loading a new one via POST /lora-adapters/load\n"
+                      "or an offloaded one for a request, the least recently used adapters are offloaded to host memory\n"
+                      "(default: %d, 0 = unlimited)", params.lora_cache_size),
+        [](common_params & params, int value) {
+            params.lora_cache_size = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_LORA_CACHE_SIZE"));
+    add_opt(common_arg(
+        {"--lora-host-cache-size"}, "N",
+        string_format("max total size in MiB of the LoRA adapters offloaded to host memory by --lora-cache-size,\n"
+                      "the least recently used adapters are unloaded (default: %d, 0 = unlimited)", params.lora_host_cache_size),
+        [](common_params & params, int value) {
+            params.lora_host_cache_size = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_LORA_HOST_CACHE_SIZE"));
     add_opt(common_arg(
         {"--lora-init-without-apply"},
         string_format("load LoRA adapters without applying them (apply later via POST /lora-adapters) (default: %s)", params.lora_init_without_apply ? "enabled" : "disabled"),
@@ -1107,6 +1107,16 @@ void common_set_adapter_lora(struct llama_context * ctx, std::vector<common_adap
     }
 }
 
+void common_set_adapter_lora_seq(struct llama_context * ctx, llama_seq_id seq_id, std::vector<common_adapter_lora_info> & lora) {
+    for (auto & la : lora) {
+        if (la.scale != 0.0f) {
+            llama_set_adapter_lora_seq(ctx, la.ptr, seq_id, la.scale);
+        } else {
+            llama_rm_adapter_lora_seq(ctx, la.ptr, seq_id);
+        }
+    }
+}
+
 struct llama_model_params common_model_params_to_llama(common_params & params) {
     auto mparams = llama_model_default_params();
 
@@ -1165,6 +1175,7 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     cparams.yarn_beta_fast    = params.yarn_beta_fast;
     cparams.yarn_beta_slow    = params.yarn_beta_slow;
     cparams.yarn_orig_ctx     = params.yarn_orig_ctx;
+    cparams.n_expert_hot      = params.n_expert_hot;
     cparams.pooling_type      = params.pooling_type;
     cparams.attention_type    = params.attention_type;
     cparams.flash_attn_type   = params.flash_attn_type;
@@ -1175,6 +1186,7 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     cparams.op_offload        = !params.no_op_offload;
     cparams.swa_full          = params.swa_full;
     cparams.kv_unified        = params.kv_unified;
+    cparams.kv_smooth_k       = params.kv_smooth_k;
 
     cparams.type_k = params.cache_type_k;
     cparams.type_v = params.cache_type_v;
@@ -1321,6 +1333,46 @@ std::vector<llama_token> common_tokenize(
     return result;
 }
 
+std::vector<std::vector<llama_token>> common_tokenize_batch(
+    const struct llama_vocab * vocab,
+    const std::vector<std::string> & texts,
+                        bool   add_special,
+                        bool   parse_special,
+                     int32_t   n_threads) {
+    std::vector<const char *> ptrs;
+    std::vector<int32_t>      lens;
+    ptrs.reserve(texts.size());
+    lens.reserve(texts.size());
+
+    // upper limit for the number of tokens
+    size_t n_tokens_max = 0;
+    for (const auto & text : texts) {
+        ptrs.push_back(text.data());
+        lens.push_back(text.length());
+        n_tokens_max += text.length() + 2 * add_special;
+    }
+
+    std::vector<llama_token> tokens(n_tokens_max);
+    std::vector<int32_t>     offsets(texts.size() + 1);
+
+    int32_t n_tokens = llama_tokenize_batch(vocab, ptrs.data(), lens.data(), texts.size(), tokens.data(), tokens.size(), offsets.data(), add_special, parse_special, n_threads);
+    if (n_tokens == std::numeric_limits<int32_t>::min()) {
+        throw std::runtime_error("Tokenization failed: input text too large, tokenization result exceeds int32_t limit");
+    }
+    if (n_tokens < 0) {
+        tokens.resize(-n_tokens);
+        int check = llama_tokenize_batch(vocab, ptrs.data(), lens.data(), texts.size(), tokens.data(), tokens.size(), offsets.data(), add_special, parse_special, n_threads);
+        GGML_ASSERT(check == -n_tokens);
+    }
+
+    std::vector<std::vector<llama_token>> result(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+        result[i].assign(tokens.begin() + offsets[i], tokens.begin() + offsets[i + 1]);
+    }
+
+    return result;
+}
+
 std::string common_token_to_piece(const struct llama_context * ctx, llama_token token, bool special) {
     const llama_model * model = llama_get_model(ctx);
     const llama_vocab * vocab = llama_model_get_vocab(model);
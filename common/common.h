@@ -38,6 +38,8 @@ struct common_adapter_lora_info {
     std::string prompt_prefix;
 
     struct llama_adapter_lora * ptr;
+
+    uint64_t uid = 0; // server: id of the adapter in the API, never reused (unlike its index in the list or its pointer)
 };
 
 using llama_tokens = std::vector<llama_token>;
@@ -284,6 +286,7 @@ struct common_params {
     int32_t grp_attn_n            =     1; // group-attention factor
     int32_t grp_attn_w            =   512; // group-attention width
     int32_t n_print               =    -1; // print token count every n tokens (-1 = disabled)
+    int32_t n_expert_hot          =     0; // number of MoE experts per layer to keep locked in RAM (0 = disabled)
     float   rope_freq_base        =  0.0f; // RoPE base frequency
     float   rope_freq_scale       =  0.0f; // RoPE frequency scaling factor
     float   yarn_ext_factor       = -1.0f; // YaRN extrapolation mix factor
@@ -380,6 +383,7 @@ struct common_params {
     bool ctx_shift         = false;  // context shift on infinite text generation
     bool swa_full          = false; // use full-size SWA cache (https://github.com/ggml-org/llama.cpp/pull/13194#issuecomment-2868343055)
     bool kv_unified        = false; // enable unified KV cache
+    bool kv_smooth_k       = false; // subtract a per-channel mean from K before storing it in a quantized K cache
 
     bool input_prefix_bos  = false; // prefix BOS to user inputs, preceding input_prefix
     bool use_mmap          = true;  // use mmap for faster loads
@@ -412,6 +416,9 @@ struct common_params {
 
     // embedding
     bool embedding         = false; // get only sentence embedding
+    bool embd_batching     = false; // server: batch the embedding inputs by length instead of using the slots
+    int32_t embd_cache_size = 0;    // number of embedding results cached in memory
+    std::string embd_cache_file = ""; // file where the embedding results are saved and read back (empty = none)
     int32_t embd_normalize = 2;     // normalisation for embeddings (-1=none, 0=max absolute int16, 1=taxicab, 2=euclidean, >2=p-norm)
     std::string embd_out   = "";    // empty = default, "array" = [[],[]...], "json" = openai style, "json+" = same "json" + cosine similarity matrix
     std::string embd_sep   = "\n";  // separator of embeddings
@@ -424,6 +431,8 @@ struct common_params {
     int32_t n_threads_http    = -1;           // number of threads to process HTTP requests (TODO: support threadpool)
     int32_t n_cache_reuse     = 0;            // min chunk size to reuse from the cache via KV shifting
     int32_t n_swa_checkpoints = 3;            // max number of SWA checkpoints per slot
+    int32_t lora_cache_size   = 0;            // max total size of the loaded LoRA adapters in MiB, the least recently used are offloaded to host memory (0 = unlimited)
+    int32_t lora_host_cache_size = 0;         // max total size of the offloaded LoRA adapters in MiB, the least recently used are unloaded (0 = unlimited)
 
     std::string hostname      = "127.0.0.1";
     std::string public_path   = "";                                                                         // NOLINT
@@ -451,6 +460,7 @@ struct common_params {
     bool log_json = false;
 
     std::string slot_save_path;
+    std::string lora_dir; // directory of the adapters that can be loaded with POST /lora-adapters/load (empty = disabled)
 
     float slot_prompt_similarity = 0.5f;
 
@@ -623,6 +633,9 @@ struct ggml_threadpool_params ggml_threadpool_params_from_cpu_params(const cpu_p
 // clear LoRA adapters from context, then apply new list of adapters
 void common_set_adapter_lora(struct llama_context * ctx, std::vector<common_adapter_lora_info> & lora);
 
+// set the adapters of a single sequence (adapters with scale 0 are removed from it)
+void common_set_adapter_lora_seq(struct llama_context * ctx, llama_seq_id seq_id, std::vector<common_adapter_lora_info> & lora);
+
 std::string                   get_model_endpoint();
 
 //
@@ -666,6 +679,14 @@ std::vector<llama_token> common_tokenize(
                         bool   add_special,
                         bool   parse_special = false);
 
+// tokenizes multiple strings on n_threads threads
+std::vector<std::vector<llama_token>> common_tokenize_batch(
+    const struct llama_vocab * vocab,
+    const std::vector<std::string> & texts,
+                        bool   add_special,
+                        bool   parse_special,
+                     int32_t   n_threads);
+
 // tokenizes a token into a piece, optionally renders special/control tokens
 // should work similar to Python's `tokenizer.id_to_piece`
 std::string common_token_to_piece(
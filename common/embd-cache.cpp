@@ -0,0 +1,285 @@
+#include "embd-cache.h"
+#include "log.h"
+
+#include <filesystem>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#   define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/file.h>
+#include <sys/types.h>
+#endif
+
+// file format:
+//   magic (u32), version (u32)
+//   records: key (u64), n (u32), data (n x f32)
+// a record that was not completely written (e.g. the process was killed) is dropped when loading
+
+static constexpr uint32_t COMMON_EMBD_CACHE_MAGIC   = 0x43454747; // "GGEC"
+static constexpr uint32_t COMMON_EMBD_CACHE_VERSION = 1;
+
+static constexpr int64_t COMMON_EMBD_CACHE_HEADER_SIZE = 2*sizeof(uint32_t);
+static constexpr int64_t COMMON_EMBD_CACHE_RECORD_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+
+// FNV-1a
+static uint64_t embd_cache_hash(uint64_t hash, const void * data, size_t size) {
+    const uint8_t * p = (const uint8_t *) data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t embd_cache_hash(uint64_t hash, const std::string & str) {
+    // the length separates the consecutive strings
+    const uint64_t len = str.size();
+    hash = embd_cache_hash(hash, &len, sizeof(len));
+    return embd_cache_hash(hash, str.data(), str.size());
+}
+
+template <typename T>
+static uint64_t embd_cache_hash(uint64_t hash, const T & val) {
+    return embd_cache_hash(hash, &val, sizeof(val));
+}
+
+// the file can be larger than 2 GiB
+static int embd_cache_seek(FILE * file, int64_t offset) {
+#if defined(_WIN32)
+    return _fseeki64(file, (__int64) offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t) offset, SEEK_SET);
+#endif
+}
+
+// exclusive advisory lock, released when the file is closed
+static bool embd_cache_lock(FILE * file) {
+#if defined(_WIN32)
+    HANDLE handle = (HANDLE) _get_osfhandle(_fileno(file));
+    OVERLAPPED overlapped = {};
+    return LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, MAXDWORD, MAXDWORD, &overlapped) != 0;
+#else
+    return flock(fileno(file), LOCK_EX | LOCK_NB) == 0;
+#endif
+}
+
+common_embd_cache::common_embd_cache(const llama_model * model, enum llama_pooling_type pooling, size_t n_max, const std::string & path)
+    : n_max(n_max), fname(path) {
+    // the model is identified by its metadata and its size, the file path is not used so that a moved model keeps its results
+    seed = 0xcbf29ce484222325ULL;
+
+    std::vector<char> buf(256);
+
+    auto meta_str = [&](int32_t (*fn)(const llama_model *, int32_t, char *, size_t), int32_t i) {
+        int32_t n = fn(model, i, buf.data(), buf.size());
+        if (n >= (int32_t) buf.size()) {
+            buf.resize(n + 1);
+            n = fn(model, i, buf.data(), buf.size());
+        }
+        return n < 0 ? std::string() : std::string(buf.data(), n);
+    };
+
+    for (int32_t i = 0; i < llama_model_meta_count(model); ++i) {
+        seed = embd_cache_hash(seed, meta_str(llama_model_meta_key_by_index,     i));
+        seed = embd_cache_hash(seed, meta_str(llama_model_meta_val_str_by_index, i));
+    }
+
+    seed = embd_cache_hash(seed, llama_model_n_params(model));
+    seed = embd_cache_hash(seed, llama_model_size(model));
+    seed = embd_cache_hash(seed, (int32_t) llama_model_n_embd(model));
+    seed = embd_cache_hash(seed, (int32_t) pooling);
+
+    if (!fname.empty()) {
+        file_load();
+    }
+
+    LOG_INF("%s: caching up to %zu embeddings in memory%s%s, %zu results loaded\n", __func__, n_max,
+            file ? ", file: " : "", file ? fname.c_str() : "", index.size());
+}
+
+common_embd_cache::~common_embd_cache() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+uint64_t common_embd_cache::key(const std::vector<llama_token> & tokens, int32_t embd_normalize, common_embd_cache_kind kind) const {
+    uint64_t hash = seed;
+
+    hash = embd_cache_hash(hash, embd_normalize);
+    hash = embd_cache_hash(hash, (int32_t) kind);
+    hash = embd_cache_hash(hash, (uint64_t) tokens.size());
+    hash = embd_cache_hash(hash, tokens.data(), tokens.size()*sizeof(llama_token));
+
+    return hash;
+}
+
+bool common_embd_cache::contains(uint64_t key) const {
+    return map.find(key) != map.end() || index.find(key) != index.end();
+}
+
+bool common_embd_cache::get(uint64_t key, std::vector<float> & res) {
+    auto it = map.find(key);
+    if (it != map.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        res = it->second->data;
+        n_hit++;
+        return true;
+    }
+
+    auto it_rec = index.find(key);
+    if (it_rec != index.end() && file_read(it_rec->second, res)) {
+        mem_put(key, res);
+        n_hit++;
+        return true;
+    }
+
+    n_miss++;
+    return false;
+}
+
+void common_embd_cache::put(uint64_t key, const float * data, size_t n) {
+    mem_put(key, std::vector<float>(data, data + n));
+
+    if (file && index.find(key) == index.end()) {
+        file_append(key, data, n);
+    }
+}
+
+size_t common_embd_cache::n_entries() const {
+    // with a file, the results in memory are also in the file
+    return file ? index.size() : map.size();
+}
+
+void common_embd_cache::mem_put(uint64_t key, std::vector<float> data) {
+    if (n_max == 0) {
+        return;
+    }
+
+    auto it = map.find(key);
+    if (it != map.end()) {
+        it->second->data = std::move(data);
+        lru.splice(lru.begin(), lru, it->second);
+        return;
+    }
+
+    if (map.size() >= n_max) {
+        map.erase(lru.back().key);
+        lru.pop_back();
+    }
+
+    lru.push_front({ key, std::move(data) });
+    map[key] = lru.begin();
+}
+
+void common_embd_cache::file_load() {
+    bool created = false;
+
+    file = fopen(fname.c_str(), "r+b");
+    if (!file) {
+        file = fopen(fname.c_str(), "w+b");
+        if (!file) {
+            LOG_ERR("%s: failed to open %s, the results will not be saved\n", __func__, fname.c_str());
+            return;
+        }
+        created = true;
+    }
+
+    // the records are appended at the end known to this process, another process appending to the file would overwrite them
+    if (!embd_cache_lock(file)) {
+        LOG_ERR("%s: %s is used by another process, it will not be used\n", __func__, fname.c_str());
+        fclose(file);
+        file = nullptr;
+        return;
+    }
+
+    if (created) {
+        const uint32_t header[2] = { COMMON_EMBD_CACHE_MAGIC, COMMON_EMBD_CACHE_VERSION };
+        if (fwrite(header, sizeof(header), 1, file) != 1 || fflush(file) != 0) {
+            LOG_ERR("%s: failed to write %s, the results will not be saved\n", __func__, fname.c_str());
+            fclose(file);
+            file = nullptr;
+            return;
+        }
+        file_end = COMMON_EMBD_CACHE_HEADER_SIZE;
+        return;
+    }
+
+    uint32_t header[2];
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != COMMON_EMBD_CACHE_MAGIC || header[1] != COMMON_EMBD_CACHE_VERSION) {
+        LOG_ERR("%s: %s is not an embedding cache file (or was written by a different version), it will not be used\n", __func__, fname.c_str());
+        fclose(file);
+        file = nullptr;
+        return;
+    }
+
+    int64_t offset    = COMMON_EMBD_CACHE_HEADER_SIZE;
+    bool    truncated = false;
+
+    while (true) {
+        uint64_t key;
+        uint32_t n;
+        if (fread(&key, sizeof(key), 1, file) != 1) {
+            break;
+        }
+        if (fread(&n, sizeof(n), 1, file) != 1) {
+            truncated = true;
+            break;
+        }
+
+        const int64_t offset_data = offset + COMMON_EMBD_CACHE_RECORD_SIZE;
+        const int64_t offset_next = offset_data + (int64_t) n*sizeof(float);
+
+        if (embd_cache_seek(file, offset_next - 1) != 0 || fgetc(file) == EOF) {
+            truncated = true;
+            break;
+        }
+
+        index[key] = { offset_data, n };
+        offset = offset_next;
+    }
+
+    file_end = offset;
+
+    if (truncated) {
+        // otherwise a shorter record written over it would be followed by garbage
+        std::error_code ec;
+        std::filesystem::resize_file(fname, file_end, ec);
+        LOG_WRN("%s: dropped an incomplete record at the end of %s\n", __func__, fname.c_str());
+    }
+}
+
+bool common_embd_cache::file_read(const record & rec, std::vector<float> & res) {
+    res.resize(rec.n);
+
+    if (embd_cache_seek(file, rec.offset) != 0 || fread(res.data(), sizeof(float), rec.n, file) != rec.n) {
+        LOG_ERR("%s: failed to read %s\n", __func__, fname.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void common_embd_cache::file_append(uint64_t key, const float * data, size_t n) {
+    const uint32_t n32 = n;
+
+    bool ok = embd_cache_seek(file, file_end) == 0;
+    ok = ok && fwrite(&key,  sizeof(key),   1, file) == 1;
+    ok = ok && fwrite(&n32,  sizeof(n32),   1, file) == 1;
+    ok = ok && fwrite(data,  sizeof(float), n, file) == n;
+    ok = ok && fflush(file) == 0;
+
+    if (!ok) {
+        // the partial record is overwritten by the next one
+        LOG_ERR("%s: failed to write %s\n", __func__, fname.c_str());
+        return;
+    }
+
+    index[key] = { file_end + COMMON_EMBD_CACHE_RECORD_SIZE, n32 };
+    file_end += COMMON_EMBD_CACHE_RECORD_SIZE + (int64_t) n*sizeof(float);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "llama.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// what a cached result is, part of the key
+enum common_embd_cache_kind {
+    COMMON_EMBD_CACHE_EMBD   = 0, // pooled embedding, normalized
+    COMMON_EMBD_CACHE_RERANK = 1, // rerank score
+};
+
+// content-addressed cache of the results of pooled embedding inputs
+// the key is a hash of the model, the pooling type, the normalization and the input tokens, so that identical inputs
+// can skip llama_decode. the most recently used results are kept in memory, if a file is given all the results are
+// also appended to it and the results of the previous runs are read back on a miss
+// the file is locked while the cache is alive, a second process that uses the same file runs without it
+// not thread-safe
+struct common_embd_cache {
+    // n_max: number of results kept in memory
+    // path:  optional file, created if it does not exist
+    common_embd_cache(const llama_model * model, enum llama_pooling_type pooling, size_t n_max, const std::string & path = "");
+    ~common_embd_cache();
+
+    uint64_t key(const std::vector<llama_token> & tokens, int32_t embd_normalize, common_embd_cache_kind kind) const;
+
+    // does not count as a hit or a miss
+    bool contains(uint64_t key) const;
+
+    // returns false if the key is not in the cache
+    bool get(uint64_t key, std::vector<float> & res);
+    void put(uint64_t key, const float * data, size_t n);
+
+    size_t n_entries() const;
+
+    uint64_t n_hit  = 0;
+    uint64_t n_miss = 0;
+
+private:
+    struct entry {
+        uint64_t           key;
+        std::vector<float> data;
+    };
+
+    // location of a result in the file
+    struct record {
+        int64_t  offset;
+        uint32_t n;
+    };
+
+    void file_load();
+    bool file_read(const record & rec, std::vector<float> & res);
+    void file_append(uint64_t key, const float * data, size_t n);
+
+    void mem_put(uint64_t key, std::vector<float> data);
+
+    const size_t n_max;
+
+    // hash of the model and the pooling type
+    uint64_t seed = 0;
+
+    // most recently used first
+    std::list<entry> lru;
+    std::unordered_map<uint64_t, std::list<entry>::iterator> map;
+
+    std::string fname;
+    FILE *      file     = nullptr;
+    int64_t     file_end = 0;
+
+    std::unordered_map<uint64_t, record> index;
+};
@@ -1,10 +1,13 @@
 #include "arg.h"
 #include "common.h"
+#include "embd-cache.h"
 #include "log.h"
 #include "llama.h"
 
 #include <ctime>
 #include <algorithm>
+#include <memory>
+#include <unordered_map>
 
 #if defined(_MSC_VER)
 #pragma warning(disable: 4244 4267) // possible loss of data
@@ -219,10 +222,51 @@ int main(int argc, char ** argv) {
     std::vector<float> embeddings(n_embd_count * n_embd, 0);
     float * emb = embeddings.data();
 
+    std::unique_ptr<common_embd_cache> cache;
+    if (pooling_type != LLAMA_POOLING_TYPE_NONE && (params.embd_cache_size > 0 || !params.embd_cache_file.empty())) {
+        cache = std::make_unique<common_embd_cache>(model, pooling_type, params.embd_cache_size, params.embd_cache_file);
+    }
+
+    // prompts to evaluate, the prompts with a cached result and the repeated prompts are skipped
+    std::vector<int> todo;
+
+    std::vector<uint64_t>           keys(n_prompts, 0);
+    std::vector<int>                same(n_prompts, -1); // first prompt with the same input
+    std::vector<std::vector<float>> cached(n_prompts);
+
+    if (cache) {
+        std::unordered_map<uint64_t, int> first;
+
+        for (int k = 0; k < n_prompts; k++) {
+            keys[k] = cache->key(inputs[k], params.embd_normalize, COMMON_EMBD_CACHE_EMBD);
+
+            auto it = first.find(keys[k]);
+            if (it != first.end()) {
+                same[k] = it->second;
+                continue;
+            }
+            first[keys[k]] = k;
+
+            if (cache->get(keys[k], cached[k]) && (int) cached[k].size() == n_embd) {
+                continue;
+            }
+            cached[k].clear();
+
+            todo.push_back(k);
+        }
+
+        LOG_INF("%s: %d prompts, %d cached, %d repeated\n", __func__, n_prompts, (int) cache->n_hit,
+                n_prompts - (int) todo.size() - (int) cache->n_hit);
+    } else {
+        for (int k = 0; k < n_prompts; k++) {
+            todo.push_back(k);
+        }
+    }
+
     // break into batches
     int e = 0; // number of embeddings already stored
     int s = 0; // number of prompts in current batch
-    for (int k = 0; k < n_prompts; k++) {
+    for (int k : todo) {
         // clamp to n_batch tokens
         auto & inp = inputs[k];
 
@@ -243,8 +287,31 @@ int main(int argc, char ** argv) {
     }
 
     // final batch
-    float * out = emb + e * n_embd;
-    batch_decode(ctx, batch, out, s, n_embd, params.embd_normalize);
+    if (batch.n_tokens > 0) {
+        float * out = emb + e * n_embd;
+        batch_decode(ctx, batch, out, s, n_embd, params.embd_normalize);
+    }
+
+    if (cache) {
+        // the evaluated prompts are stored in order, move them to their index starting from the last one
+        for (int i = (int) todo.size() - 1; i >= 0; i--) {
+            const int k = todo[i];
+
+            cache->put(keys[k], emb + i * n_embd, n_embd);
+
+            if (k != i) {
+                std::copy(emb + i * n_embd, emb + (i + 1) * n_embd, emb + k * n_embd);
+            }
+        }
+
+        for (int k = 0; k < n_prompts; k++) {
+            if (!cached[k].empty()) {
+                std::copy(cached[k].begin(), cached[k].end(), emb + k * n_embd);
+            } else if (same[k] >= 0) {
+                std::copy(emb + same[k] * n_embd, emb + (same[k] + 1) * n_embd, emb + k * n_embd);
+            }
+        }
+    }
 
     if (params.embd_out.empty()) {
         LOG("\n");
@@ -324,6 +324,14 @@ extern "C" {
     // Set a callback to be called for each resulting node during graph compute
     GGML_API void                 ggml_backend_sched_set_eval_callback(ggml_backend_sched_t sched, ggml_backend_sched_eval_callback callback, void * user_data);
 
+    // Measure the time each backend spends copying the inputs of its splits and computing them (disabled by default)
+    // The backend is synchronized after each split, so the computations of different backends no longer overlap
+    GGML_API void                 ggml_backend_sched_set_timing(ggml_backend_sched_t sched, bool enable);
+    GGML_API bool                 ggml_backend_sched_get_timing(ggml_backend_sched_t sched);
+    // Accumulated times in microseconds since the last reset of the timing
+    GGML_API void                 ggml_backend_sched_get_backend_time(ggml_backend_sched_t sched, ggml_backend_t backend, int64_t * t_compute_us, int64_t * t_copy_us);
+    GGML_API void                 ggml_backend_sched_reset_timing(ggml_backend_sched_t sched);
+
     //
     // Utils
     //
@@ -120,6 +120,26 @@ extern "C" {
 
     GGML_BACKEND_API void ggml_cpu_init(void);
 
+    //
+    // matmul autotuning
+    //
+
+    // the work distribution of MUL_MAT (chunk size, llamafile sgemm or not) can be selected per shape
+    // (src0 type, M, N, K bucket, number of threads) from a table of measured configurations
+    // the table can be loaded with the GGML_CPU_TUNE_FILE env var and the mode set with GGML_CPU_TUNE=off|use|tune
+    enum ggml_cpu_tune_mode {
+        GGML_CPU_TUNE_MODE_OFF,  // fixed heuristics
+        GGML_CPU_TUNE_MODE_USE,  // use the table, fixed heuristics for the shapes that are not in it
+        GGML_CPU_TUNE_MODE_TUNE, // benchmark the candidate configurations of the shapes that are not in the table at first use
+    };
+
+    // note: these must not be called while a graph is being computed
+    GGML_BACKEND_API void                    ggml_cpu_tune_set_mode (enum ggml_cpu_tune_mode mode);
+    GGML_BACKEND_API enum ggml_cpu_tune_mode ggml_cpu_tune_get_mode (void);
+    GGML_BACKEND_API int                     ggml_cpu_tune_n_entries(void);
+    GGML_BACKEND_API bool                    ggml_cpu_tune_load     (const char * fname); // merge the entries of the file into the table
+    GGML_BACKEND_API bool                    ggml_cpu_tune_save     (const char * fname);
+
     //
     // CPU backend
     //
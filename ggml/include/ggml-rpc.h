@@ -8,7 +8,7 @@ extern "C" {
 #endif
 
 #define RPC_PROTO_MAJOR_VERSION    2
-#define RPC_PROTO_MINOR_VERSION    0
+#define RPC_PROTO_MINOR_VERSION    3
 #define RPC_PROTO_PATCH_VERSION    0
 #define GGML_RPC_MAX_SERVERS       16
 
@@ -24,10 +24,25 @@ GGML_BACKEND_API void ggml_backend_rpc_start_server(ggml_backend_t backend, cons
                                                     const char * cache_dir,
                                                     size_t free_mem, size_t total_mem);
 
+// client_mem: limit of the memory allocated by each client, 0 for no limit
+GGML_BACKEND_API void ggml_backend_rpc_start_server_ex(ggml_backend_t backend, const char * endpoint,
+                                                       const char * cache_dir,
+                                                       size_t free_mem, size_t total_mem, size_t client_mem);
+
 GGML_BACKEND_API ggml_backend_reg_t ggml_backend_rpc_reg(void);
 
 GGML_BACKEND_API ggml_backend_dev_t ggml_backend_rpc_add_device(const char * endpoint);
 
+// data exchanged by the clients of this process with the RPC servers since the start of the process
+struct ggml_backend_rpc_stats {
+    uint64_t bytes_sent; // bytes written to the sockets (commands and tensor data)
+    uint64_t bytes_recv; // bytes read from the sockets
+    uint64_t bytes_shm;  // tensor data exchanged through shared memory instead of the sockets
+    uint64_t n_codec;    // tensor transfers encoded with GGML_RPC_CODEC
+};
+
+GGML_BACKEND_API void ggml_backend_rpc_get_stats(struct ggml_backend_rpc_stats * stats);
+
 #ifdef  __cplusplus
 }
 #endif
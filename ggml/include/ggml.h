@@ -2148,6 +2148,14 @@ extern "C" {
             int                   k);
 
 #define GGML_KQ_MASK_PAD 64
+#define GGML_KQ_MASK_BLK 64
+
+    // summary of a block of GGML_KQ_MASK_BLK consecutive KV positions in a row of the KQ mask
+    enum ggml_kq_mask_blk {
+        GGML_KQ_MASK_BLK_MIXED  = 0,
+        GGML_KQ_MASK_BLK_MASKED = 1, // all -INF
+        GGML_KQ_MASK_BLK_ZERO   = 2, // all 0.0f
+    };
 
     // q:    [n_embd_k, n_batch,     n_head,    ne3 ]
     // k:    [n_embd_k, n_kv,        n_head_kv, ne3 ]
@@ -2181,6 +2189,12 @@ extern "C" {
             struct ggml_tensor * a,
             struct ggml_tensor * sinks);
 
+    // optional block summary of the mask, backends can use it to skip the fully masked KV blocks
+    // blk: I8 [(n_kv + GGML_KQ_MASK_BLK - 1)/GGML_KQ_MASK_BLK, n_batch_pad, ne32, ne33], values from enum ggml_kq_mask_blk
+    GGML_API void ggml_flash_attn_ext_add_mask_blk(
+            struct ggml_tensor * a,
+            struct ggml_tensor * blk);
+
     // TODO: needs to be adapted to ggml_flash_attn_ext
     GGML_API struct ggml_tensor * ggml_flash_attn_back(
            struct ggml_context * ctx,
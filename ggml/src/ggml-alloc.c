@@ -330,6 +330,17 @@ struct hash_node {
     int buffer_id;
     size_t offset; // offset within the buffer
     bool allocated;
+    int block; // index + 1 of the memory block used by the tensor, 0 = none
+};
+
+// a range of memory returned by ggml_dyn_tallocr_alloc, shared by the tensors computed in-place
+// the lifetime is in steps of ggml_gallocr_alloc_graph_impl: 0 are the leafs and inputs, i + 1 is the node i
+struct mem_block {
+    struct ggml_dyn_tallocr * alloc;
+    size_t size;
+    size_t offset;
+    int t_alloc;
+    int t_free; // INT_MAX if never freed
 };
 
 struct tensor_alloc {
@@ -361,6 +372,14 @@ struct ggml_gallocr {
 
     struct leaf_alloc * leaf_allocs; // [n_leafs]
     int n_leafs;
+
+    // lifetimes of the memory blocks of the last reserve, see ggml_gallocr_plan
+    struct mem_block * blocks; // [max_blocks]
+    int n_blocks;
+    int max_blocks;
+    int t_cur;
+
+    bool planner; // env: GGML_ALLOC_PLANNER
 };
 
 ggml_gallocr_t ggml_gallocr_new_n(ggml_backend_buffer_type_t * bufts, int n_bufs) {
@@ -395,6 +414,9 @@ ggml_gallocr_t ggml_gallocr_new_n(ggml_backend_buffer_type_t * bufts, int n_bufs
     }
     galloc->n_buffers = n_bufs;
 
+    const char * GGML_ALLOC_PLANNER = getenv("GGML_ALLOC_PLANNER");
+    galloc->planner = GGML_ALLOC_PLANNER ? atoi(GGML_ALLOC_PLANNER) != 0 : false;
+
     return galloc;
 }
 
@@ -443,6 +465,7 @@ void ggml_gallocr_free(ggml_gallocr_t galloc) {
     free(galloc->buf_tallocs);
     free(galloc->node_allocs);
     free(galloc->leaf_allocs);
+    free(galloc->blocks);
     free(galloc);
 }
 
@@ -461,6 +484,24 @@ static bool ggml_gallocr_is_allocated(ggml_gallocr_t galloc, struct ggml_tensor
     return t->data != NULL || ggml_gallocr_hash_get(galloc, t)->allocated;
 }
 
+static int ggml_gallocr_add_block(ggml_gallocr_t galloc, struct ggml_dyn_tallocr * alloc, size_t size, size_t offset) {
+    if (galloc->n_blocks == galloc->max_blocks) {
+        galloc->max_blocks = MAX(2*galloc->max_blocks, 256);
+        galloc->blocks = realloc(galloc->blocks, galloc->max_blocks * sizeof(struct mem_block));
+        GGML_ASSERT(galloc->blocks != NULL);
+    }
+
+    galloc->blocks[galloc->n_blocks] = (struct mem_block) {
+        /*.alloc   = */ alloc,
+        /*.size    = */ aligned_offset(NULL, size, alloc->alignment),
+        /*.offset  = */ offset,
+        /*.t_alloc = */ galloc->t_cur,
+        /*.t_free  = */ INT_MAX,
+    };
+
+    return ++galloc->n_blocks;
+}
+
 static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor * node, int buffer_id) {
     GGML_ASSERT(buffer_id >= 0);
     struct hash_node * hn = ggml_gallocr_hash_get(galloc, node);
@@ -504,6 +545,7 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
                             assert(view_src_hn->offset == p_hn->offset);
                             hn->buffer_id = p_hn->buffer_id;
                             hn->offset = p_hn->offset;
+                            hn->block = view_src_hn->block;
                             p_hn->allocated = false; // avoid freeing the parent
                             view_src_hn->allocated = false;
                             return;
@@ -512,6 +554,7 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
                         AT_PRINTF("reusing parent %s for %s\n", parent->name, node->name);
                         hn->buffer_id = p_hn->buffer_id;
                         hn->offset = p_hn->offset;
+                        hn->block = p_hn->block;
                         p_hn->allocated = false; // avoid freeing the parent
                         return;
                     }
@@ -525,6 +568,7 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
         size_t offset = ggml_dyn_tallocr_alloc(alloc, size, node);
         hn->buffer_id = buffer_id;
         hn->offset = offset;
+        hn->block = ggml_gallocr_add_block(galloc, alloc, size, offset);
     }
 }
 
@@ -543,6 +587,10 @@ static void ggml_gallocr_free_node(ggml_gallocr_t galloc, struct ggml_tensor * n
     size_t size = ggml_backend_buft_get_alloc_size(buft, node);
     ggml_dyn_tallocr_free_tensor(alloc, offset, size, node);
     hn->allocated = false;
+
+    if (hn->block > 0) {
+        galloc->blocks[hn->block - 1].t_free = galloc->t_cur;
+    }
 }
 
 static int get_node_buffer_id(const int * node_buffer_ids, int i) {
@@ -554,6 +602,9 @@ static void ggml_gallocr_alloc_graph_impl(ggml_gallocr_t galloc, struct ggml_cgr
     ggml_hash_set_reset(&galloc->hash_set);
     memset(galloc->hash_values, 0, sizeof(struct hash_node) * galloc->hash_set.size);
 
+    galloc->n_blocks = 0;
+    galloc->t_cur    = 0;
+
     // allocate leafs
     // these may be tensors that the application is not using in the graph, but may still want to allocate for other purposes
     for (int i = 0; i < graph->n_leafs; i++) {
@@ -599,6 +650,8 @@ static void ggml_gallocr_alloc_graph_impl(ggml_gallocr_t galloc, struct ggml_cgr
         struct ggml_tensor * node = graph->nodes[i];
         int buffer_id = get_node_buffer_id(node_buffer_ids, i);
 
+        galloc->t_cur = i + 1;
+
         // allocate parents (only leafs need to be allocated at this point)
         for (int j = 0; j < GGML_MAX_SRC; j++) {
             struct ggml_tensor * parent = node->src[j];
@@ -656,6 +709,142 @@ static void ggml_gallocr_alloc_graph_impl(ggml_gallocr_t galloc, struct ggml_cgr
     }
 }
 
+// offline planner
+// the dynamic allocator assigns the offsets in the order of the graph and cannot anticipate the tensors allocated later,
+// so large short-lived tensors can leave holes that are too small for the next ones
+// with the lifetimes of all the blocks known, the blocks are placed from the largest to the smallest, each one in the
+// smallest gap between the blocks already placed whose lifetimes overlap with it (greedy by size)
+// the result is only used if it needs less memory than the dynamic allocator
+// the planner is O(n_blocks^2) and runs on every reserve, so it is disabled by default (GGML_ALLOC_PLANNER=1 enables it)
+
+struct block_range {
+    size_t offset;
+    size_t size;
+};
+
+struct block_order {
+    size_t size;
+    int t_alloc;
+    int id;
+};
+
+static int ggml_gallocr_cmp_block_order(const void * a, const void * b) {
+    const struct block_order * oa = (const struct block_order *) a;
+    const struct block_order * ob = (const struct block_order *) b;
+    if (oa->size != ob->size) {
+        return oa->size > ob->size ? -1 : 1;
+    }
+    return oa->t_alloc - ob->t_alloc;
+}
+
+static int ggml_gallocr_cmp_range_offset(const void * a, const void * b) {
+    const struct block_range * ra = (const struct block_range *) a;
+    const struct block_range * rb = (const struct block_range *) b;
+    return ra->offset < rb->offset ? -1 : ra->offset > rb->offset ? 1 : 0;
+}
+
+static void ggml_gallocr_plan(ggml_gallocr_t galloc) {
+    const int n_blocks = galloc->n_blocks;
+    if (n_blocks == 0) {
+        return;
+    }
+
+    struct block_order * order = malloc(n_blocks * sizeof(struct block_order));
+    int * placed = malloc(n_blocks * sizeof(int));
+    size_t * offsets = malloc(n_blocks * sizeof(size_t));
+    struct block_range * ranges = malloc(n_blocks * sizeof(struct block_range));
+    GGML_ASSERT(order && placed && offsets && ranges);
+
+    for (int a = 0; a < galloc->n_buffers; a++) {
+        struct ggml_dyn_tallocr * alloc = galloc->buf_tallocs[a];
+
+        // allocators shared by several buffers are planned once
+        bool done = false;
+        for (int j = 0; j < a; j++) {
+            done = done || galloc->buf_tallocs[j] == alloc;
+        }
+        if (done) {
+            continue;
+        }
+
+        int n = 0;
+        for (int i = 0; i < n_blocks; i++) {
+            if (galloc->blocks[i].alloc == alloc) {
+                order[n++] = (struct block_order) { galloc->blocks[i].size, galloc->blocks[i].t_alloc, i };
+            }
+        }
+        if (n == 0) {
+            continue;
+        }
+
+        qsort(order, n, sizeof(struct block_order), ggml_gallocr_cmp_block_order);
+
+        size_t peak = 0;
+        int n_placed = 0;
+
+        for (int k = 0; k < n; k++) {
+            const int id = order[k].id;
+            const struct mem_block * b = &galloc->blocks[id];
+
+            int n_ranges = 0;
+            for (int j = 0; j < n_placed; j++) {
+                const struct mem_block * p = &galloc->blocks[placed[j]];
+                if (p->t_alloc <= b->t_free && b->t_alloc <= p->t_free) {
+                    ranges[n_ranges++] = (struct block_range) { offsets[placed[j]], p->size };
+                }
+            }
+            qsort(ranges, n_ranges, sizeof(struct block_range), ggml_gallocr_cmp_range_offset);
+
+            size_t best_offset = SIZE_MAX;
+            size_t best_gap    = SIZE_MAX;
+            size_t prev_end    = 0;
+            for (int j = 0; j < n_ranges; j++) {
+                if (ranges[j].offset > prev_end) {
+                    const size_t gap = ranges[j].offset - prev_end;
+                    if (gap >= b->size && gap < best_gap) {
+                        best_offset = prev_end;
+                        best_gap    = gap;
+                    }
+                }
+                prev_end = MAX(prev_end, ranges[j].offset + ranges[j].size);
+            }
+            if (best_offset == SIZE_MAX) {
+                best_offset = prev_end;
+            }
+
+            offsets[id] = best_offset;
+            placed[n_placed++] = id;
+            peak = MAX(peak, best_offset + b->size);
+        }
+
+        GGML_LOG_DEBUG("%s: %s: dynamic allocator %.2f MiB, planner %.2f MiB (%d blocks)\n", __func__,
+            ggml_backend_buft_name(galloc->bufts[a]), alloc->max_size / 1024.0 / 1024.0, peak / 1024.0 / 1024.0, n);
+
+        if (peak < alloc->max_size) {
+            for (int k = 0; k < n; k++) {
+                galloc->blocks[order[k].id].offset = offsets[order[k].id];
+            }
+            alloc->max_size = peak;
+        }
+    }
+
+    free(ranges);
+    free(offsets);
+    free(placed);
+    free(order);
+
+    // move the tensors to their blocks
+    for (size_t i = 0; i < galloc->hash_set.size; i++) {
+        if (!ggml_bitset_get(galloc->hash_set.used, i)) {
+            continue;
+        }
+        struct hash_node * hn = &galloc->hash_values[i];
+        if (hn->block > 0) {
+            hn->offset = galloc->blocks[hn->block - 1].offset;
+        }
+    }
+}
+
 bool ggml_gallocr_reserve_n(ggml_gallocr_t galloc, struct ggml_cgraph * graph, const int * node_buffer_ids, const int * leaf_buffer_ids) {
     size_t min_hash_size = graph->n_nodes + graph->n_leafs;
     // add 25% margin to avoid hash collisions
@@ -680,6 +869,10 @@ bool ggml_gallocr_reserve_n(ggml_gallocr_t galloc, struct ggml_cgraph * graph, c
     // allocate in hash table
     ggml_gallocr_alloc_graph_impl(galloc, graph, node_buffer_ids, leaf_buffer_ids);
 
+    if (galloc->planner) {
+        ggml_gallocr_plan(galloc);
+    }
+
     // set the node_allocs from the hash table
     if (galloc->n_nodes < graph->n_nodes) {
         free(galloc->node_allocs);
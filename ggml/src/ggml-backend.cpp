@@ -716,6 +716,11 @@ struct ggml_backend_sched {
     bool op_offload;
 
     int debug;
+
+    // timing of the splits, see ggml_backend_sched_set_timing
+    bool timing;
+    int64_t t_compute_us[GGML_SCHED_MAX_BACKENDS];
+    int64_t t_copy_us[GGML_SCHED_MAX_BACKENDS];
 };
 
 #define hash_id(tensor) ggml_hash_find_or_insert(&sched->hash_set, tensor)
@@ -1415,6 +1420,8 @@ static enum ggml_status ggml_backend_sched_compute_splits(ggml_backend_sched_t s
         int split_backend_id = split->backend_id;
         ggml_backend_t split_backend = sched->backends[split_backend_id];
 
+        const int64_t t_start_us = sched->timing ? ggml_time_us() : 0;
+
         // copy the input tensors to the split backend
         for (int input_id = 0; input_id < split->n_inputs; input_id++) {
             ggml_backend_t input_backend = ggml_backend_sched_get_tensor_backend(sched, split->inputs[input_id]);
@@ -1538,6 +1545,13 @@ static enum ggml_status ggml_backend_sched_compute_splits(ggml_backend_sched_t s
             }
         }
 
+        int64_t t_copy_end_us = 0;
+        if (sched->timing) {
+            ggml_backend_synchronize(split_backend);
+            t_copy_end_us = ggml_time_us();
+            sched->t_copy_us[split_backend_id] += t_copy_end_us - t_start_us;
+        }
+
         if (!sched->callback_eval) {
             enum ggml_status ec = ggml_backend_graph_compute_async(split_backend, &split->graph);
             if (ec != GGML_STATUS_SUCCESS) {
@@ -1577,6 +1591,11 @@ static enum ggml_status ggml_backend_sched_compute_splits(ggml_backend_sched_t s
             }
         }
 
+        if (sched->timing) {
+            ggml_backend_synchronize(split_backend);
+            sched->t_compute_us[split_backend_id] += ggml_time_us() - t_copy_end_us;
+        }
+
         // record the event of this copy
         if (split->n_inputs > 0) {
             if (sched->events[split_backend_id][sched->cur_copy] != NULL) {
@@ -1671,6 +1690,35 @@ void ggml_backend_sched_free(ggml_backend_sched_t sched) {
     free(sched);
 }
 
+void ggml_backend_sched_set_timing(ggml_backend_sched_t sched, bool enable) {
+    GGML_ASSERT(sched);
+    sched->timing = enable;
+}
+
+bool ggml_backend_sched_get_timing(ggml_backend_sched_t sched) {
+    GGML_ASSERT(sched);
+    return sched->timing;
+}
+
+void ggml_backend_sched_get_backend_time(ggml_backend_sched_t sched, ggml_backend_t backend, int64_t * t_compute_us, int64_t * t_copy_us) {
+    GGML_ASSERT(sched);
+    int backend_index = ggml_backend_sched_backend_id(sched, backend);
+    GGML_ASSERT(backend_index >= 0 && backend_index < sched->n_backends);
+
+    if (t_compute_us) {
+        *t_compute_us = sched->t_compute_us[backend_index];
+    }
+    if (t_copy_us) {
+        *t_copy_us = sched->t_copy_us[backend_index];
+    }
+}
+
+void ggml_backend_sched_reset_timing(ggml_backend_sched_t sched) {
+    GGML_ASSERT(sched);
+    memset(sched->t_compute_us, 0, sizeof(sched->t_compute_us));
+    memset(sched->t_copy_us,    0, sizeof(sched->t_copy_us));
+}
+
 void ggml_backend_sched_reset(ggml_backend_sched_t sched) {
     GGML_ASSERT(sched);
     // reset state for the next run
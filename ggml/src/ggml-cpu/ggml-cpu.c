@@ -4,6 +4,7 @@
 #include "ggml-backend-impl.h"
 #include "ggml-backend.h"
 #include "traits.h"
+#include "tune.h"
 #include "ggml-cpu-impl.h"
 #include "ggml-cpu.h"
 #include "ggml-impl.h"
@@ -456,6 +457,10 @@ struct ggml_threadpool {
     atomic_int GGML_CACHE_ALIGN n_barrier_passed;
     atomic_int GGML_CACHE_ALIGN current_chunk; // currently processing chunk during Mat_Mul, shared between all the threads.
 
+    // Mat_Mul configuration selected by the first thread when tuning (see ggml_cpu_tune_mode)
+    struct ggml_cpu_mm_config mm_config;
+    bool                      mm_config_found;
+
     // these are atomic as an annotation for thread-sanitizer
     atomic_bool stop;         // Used for stopping the threadpool altogether
     atomic_bool pause;        // Used for pausing the threadpool or individual threads
@@ -1204,9 +1209,71 @@ static void ggml_compute_forward_mul_mat_one_chunk(
     }
 }
 
-void ggml_compute_forward_mul_mat(
+// convert src1 to vec_dot_type into wdata, contiguous
+// src1_row: when not NULL, the rows of src1 have not been computed yet and are produced on the fly right before
+//           their conversion (see ggml_compute_forward_fused)
+static void ggml_compute_forward_mul_mat_convert_src1(
         const struct ggml_compute_params * params,
-              struct ggml_tensor * dst) {
+        const struct ggml_tensor * src1,
+        const enum ggml_type vec_dot_type,
+        ggml_from_float_t const from_float,
+        char * wdata,
+        ggml_compute_forward_row_t src1_row) {
+
+    GGML_TENSOR_LOCALS(int64_t, ne1, src1, ne);
+    GGML_TENSOR_LOCALS(size_t,  nb1, src1, nb);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const size_t nbw0 = ggml_type_size(vec_dot_type);
+    const size_t nbw1 = ggml_row_size(vec_dot_type, ne10);
+    const size_t nbw2 = nbw1*ne11;
+    const size_t nbw3 = nbw2*ne12;
+
+    GGML_ASSERT(src1->type == GGML_TYPE_F32);
+
+    const int64_t nr1 = ne11*ne12*ne13;
+
+    if (src1_row && nr1 >= nth) {
+        // produce whole rows per thread, so that row reductions are not repeated
+        for (int64_t ir1 = ith; ir1 < nr1; ir1 += nth) {
+            const int64_t i13 = ir1/(ne12*ne11);
+            const int64_t i12 = (ir1 - i13*ne12*ne11)/ne11;
+            const int64_t i11 = ir1 - i13*ne12*ne11 - i12*ne11;
+
+            src1_row(src1, i11, i12, i13, 0, ne10);
+            from_float((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11),
+                       (void *)               (wdata + i13*nbw3 + i12*nbw2 + i11*nbw1),
+                       ne10);
+        }
+        return;
+    }
+
+    for (int64_t i13 = 0; i13 < ne13; ++i13) {
+        for (int64_t i12 = 0; i12 < ne12; ++i12) {
+            for (int64_t i11 = 0; i11 < ne11; ++i11) {
+                size_t bs = ggml_blck_size(vec_dot_type);
+                int64_t ne10_block_start = (ith * ne10/bs) / nth;
+                int64_t ne10_block_end   = ((ith + 1) * ne10/bs) / nth;
+                if (src1_row) {
+                    src1_row(src1, i11, i12, i13, ne10_block_start*bs, ne10_block_end*bs);
+                }
+                from_float((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11 + ne10_block_start*bs*nb10),
+                           (void *)               (wdata + i13*nbw3 + i12*nbw2 + i11*nbw1 + ne10_block_start*nbw0),
+                           (ne10_block_end - ne10_block_start) * bs);
+            }
+        }
+    }
+}
+
+// src1_row: see ggml_compute_forward_mul_mat_convert_src1
+// cfg:      work distribution, see ggml_cpu_mm_config
+static void ggml_compute_forward_mul_mat_cfg(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst,
+        ggml_compute_forward_row_t src1_row,
+        const struct ggml_cpu_mm_config cfg) {
 
     const struct ggml_tensor * src0 = dst->src[0];
     const struct ggml_tensor * src1 = dst->src[1];
@@ -1246,7 +1313,7 @@ void ggml_compute_forward_mul_mat(
 
     const bool src1_cont = ggml_is_contiguous(src1);
 
-    if (src1_cont) {
+    if (cfg.llamafile && src1_cont && !src1_row) {
         for (int64_t i13 = 0; i13 < ne13; i13++)
             for (int64_t i12 = 0; i12 < ne12; i12++)
                 if (!llamafile_sgemm(params,
@@ -1267,40 +1334,9 @@ UseGgmlGemm1:;
 #endif
 
     if (src1->type != vec_dot_type) {
-        char * wdata = params->wdata;
-
-        const size_t nbw0 = ggml_type_size(vec_dot_type);
-        const size_t nbw1 = ggml_row_size(vec_dot_type, ne10);
-        const size_t nbw2 = nbw1*ne11;
-        const size_t nbw3 = nbw2*ne12;
-
-        assert(params->wsize >= ne13*nbw3);
-        GGML_ASSERT(src1->type == GGML_TYPE_F32);
-
-    #if 0
-        for (int64_t i13 = 0; i13 < ne13; ++i13) {
-            for (int64_t i12 = 0; i12 < ne12; ++i12) {
-                for (int64_t i11 = ith; i11 < ne11; i11 += nth) {
-                    from_float((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11),
-                               (void *)               (wdata + i13*nbw3 + i12*nbw2 + i11*nbw1),
-                                ne10);
-                }
-            }
-        }
-    #else
-        for (int64_t i13 = 0; i13 < ne13; ++i13) {
-            for (int64_t i12 = 0; i12 < ne12; ++i12) {
-                for (int64_t i11 = 0; i11 < ne11; ++i11) {
-                    size_t bs = ggml_blck_size(vec_dot_type);
-                    int64_t ne10_block_start = (ith * ne10/bs) / nth;
-                    int64_t ne10_block_end   = ((ith + 1) * ne10/bs) / nth;
-                    from_float((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11 + ne10_block_start*bs*nb10),
-                               (void *)               (wdata + i13*nbw3 + i12*nbw2 + i11*nbw1 + ne10_block_start*nbw0),
-                               (ne10_block_end - ne10_block_start) * bs);
-                }
-            }
-        }
-    #endif
+        assert(params->wsize >= ggml_row_size(vec_dot_type, ggml_nelements(src1)));
+
+        ggml_compute_forward_mul_mat_convert_src1(params, src1, vec_dot_type, from_float, params->wdata, src1_row);
     }
 
     if (ith == 0) {
@@ -1311,7 +1347,7 @@ UseGgmlGemm1:;
     ggml_barrier(params->threadpool);
 
 #if GGML_USE_LLAMAFILE
-    if (src1->type != vec_dot_type) {
+    if (cfg.llamafile && src1->type != vec_dot_type) {
         const void* wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
         const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
@@ -1348,6 +1384,10 @@ UseGgmlGemm2:;
         chunk_size = 64;
     }
 
+    if (cfg.chunk_size > 0) {
+        chunk_size = cfg.chunk_size;
+    }
+
     // distribute the work across the inner or outer loop based on which one is larger
     // The number of chunks in the 0/1 dim.
     // CEIL(nr0/chunk_size)
@@ -1357,7 +1397,8 @@ UseGgmlGemm2:;
     // If the chunking is poor for the number of threads on this setup, scrap the whole plan.  Re-chunk it by thread.
     //   Also, chunking by thread was measured to have perform better on NUMA systems.  See https://github.com/ggml-org/llama.cpp/pull/6915
     //   In theory, chunking should be just as useful on NUMA and non NUMA systems, but testing disagreed with that.
-    if (nchunk0 * nchunk1 < nth * 4 || ggml_is_numa()) {
+    //   A tuned chunk size is used as is.
+    if (cfg.chunk_size == 0 || (cfg.chunk_size < 0 && (nchunk0 * nchunk1 < nth * 4 || ggml_is_numa()))) {
         // distribute the thread work across the inner or outer loop based on which one is larger
         nchunk0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
         nchunk1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
@@ -1398,10 +1439,130 @@ UseGgmlGemm2:;
     }
 }
 
+// number of timed runs of each candidate configuration when tuning
+#define GGML_CPU_TUNE_REPS 3
+
+// benchmark the candidate configurations and add the fastest one to the tuning table
+// the result in dst is the one of the last run
+static void ggml_compute_forward_mul_mat_tune(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst,
+        ggml_compute_forward_row_t src1_row) {
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    if (src1_row) {
+        // the rows of src1 can be computed in place on their input, so they are produced once (a whole row per
+        // thread) instead of by each run of the candidates
+        const struct ggml_tensor * src1 = dst->src[1];
+
+        const int64_t ne11 = src1->ne[1];
+        const int64_t ne12 = src1->ne[2];
+        const int64_t nr1  = ggml_nrows(src1);
+
+        for (int64_t ir1 = ith; ir1 < nr1; ir1 += nth) {
+            const int64_t i13 = ir1/(ne12*ne11);
+            const int64_t i12 = (ir1 - i13*ne12*ne11)/ne11;
+            const int64_t i11 = ir1 - i13*ne12*ne11 - i12*ne11;
+
+            src1_row(src1, i11, i12, i13, 0, src1->ne[0]);
+        }
+
+        src1_row = NULL;
+    }
+
+    int64_t t_default = 0;
+    int64_t t_best    = 0;
+    struct ggml_cpu_mm_config cfg_best = GGML_CPU_MM_CONFIG_DEFAULT;
+
+    for (int i = 0; i < ggml_cpu_tune_n_candidates(); ++i) {
+        const struct ggml_cpu_mm_config cfg = ggml_cpu_tune_get_candidate(i);
+
+        int64_t t_min = INT64_MAX;
+
+        for (int rep = 0; rep < GGML_CPU_TUNE_REPS; ++rep) {
+            ggml_barrier(params->threadpool);
+
+            const int64_t t_start = ggml_time_us();
+
+            ggml_compute_forward_mul_mat_cfg(params, dst, src1_row, cfg);
+
+            ggml_barrier(params->threadpool);
+
+            t_min = MIN(t_min, ggml_time_us() - t_start);
+        }
+
+        if (ith != 0) {
+            continue;
+        }
+
+        // the first candidate is the default, the others need to be at least 5% faster than it to replace it
+        if (i == 0) {
+            t_default = t_min;
+            t_best    = t_min;
+        } else if (t_min < t_best && t_min*20 < t_default*19) {
+            t_best   = t_min;
+            cfg_best = cfg;
+        }
+    }
+
+    if (ith == 0) {
+        ggml_cpu_tune_insert(dst, params->nth, cfg_best);
+    }
+}
+
+// src1_row: see ggml_compute_forward_mul_mat_convert_src1
+static void ggml_compute_forward_mul_mat_impl(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst,
+        ggml_compute_forward_row_t src1_row) {
+
+    struct ggml_cpu_mm_config cfg = GGML_CPU_MM_CONFIG_DEFAULT;
+
+    switch (ggml_cpu_tune_get_mode()) {
+        case GGML_CPU_TUNE_MODE_OFF:
+            break;
+        case GGML_CPU_TUNE_MODE_USE:
+            // the table is constant, every thread gets the same result
+            ggml_cpu_tune_lookup(dst, params->nth, &cfg);
+            break;
+        case GGML_CPU_TUNE_MODE_TUNE:
+            {
+                struct ggml_threadpool * tp = params->threadpool;
+
+                // the table can change concurrently, the first thread decides for all of them
+                if (params->ith == 0) {
+                    tp->mm_config_found = ggml_cpu_tune_lookup(dst, params->nth, &tp->mm_config);
+                }
+
+                ggml_barrier(tp);
+
+                if (!tp->mm_config_found) {
+                    ggml_compute_forward_mul_mat_tune(params, dst, src1_row);
+                    return;
+                }
+
+                cfg = tp->mm_config;
+            } break;
+    }
+
+    ggml_compute_forward_mul_mat_cfg(params, dst, src1_row, cfg);
+}
+
+void ggml_compute_forward_mul_mat(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst) {
+    ggml_compute_forward_mul_mat_impl(params, dst, NULL);
+}
+
 // ggml_compute_forward_mul_mat_id
 
 #define MMID_MATRIX_ROW(row_id, i1) matrix_rows[(row_id)*ids->ne[0]*ids->ne[1] + (i1)]
 
+// max number of MUL_MAT_ID nodes computed together
+#define MMID_MAX_FUSED 2
+
 struct mmid_row_mapping {
     int32_t i1;
     int32_t i2;
@@ -1478,9 +1639,38 @@ static void * incr_ptr_aligned(void ** p, size_t size, size_t align) {
     return ptr;
 }
 
-static void ggml_compute_forward_mul_mat_id(
+// number of chunks of the rows assigned to one expert
+static void ggml_compute_forward_mul_mat_id_nchunk(
+        const int64_t nr0,
+        const int64_t nr1,
+        const int nth,
+        const bool disable_chunking,
+        int64_t * nchunk0,
+        int64_t * nchunk1) {
+
+    if (disable_chunking) {
+        *nchunk0 = nr0 > nr1 ? nth : 1;
+        *nchunk1 = nr0 > nr1 ? 1 : nth;
+        return;
+    }
+
+    // the chunks of all experts are in a single queue, so small experts do not need to be split across all threads
+    const int chunk_size = (nr0 == 1 || nr1 == 1) ? 64 : 16;
+
+    *nchunk0 = (nr0 + chunk_size - 1) / chunk_size;
+    *nchunk1 = (nr1 + chunk_size - 1) / chunk_size;
+}
+
+// dsts:     MUL_MAT_ID nodes sharing src1 and ids, with src0 of the same vec_dot_type and number of experts
+//           (e.g. the up and gate projections of a MoE FFN), computed together from a single conversion of src1
+// src1_row: see ggml_compute_forward_mul_mat_convert_src1
+static void ggml_compute_forward_mul_mat_id_impl(
         const struct ggml_compute_params * params,
-              struct ggml_tensor * dst) {
+              struct ggml_tensor ** dsts,
+        const int n_dsts,
+        ggml_compute_forward_row_t src1_row) {
+
+    struct ggml_tensor * dst = dsts[0];
 
     const struct ggml_tensor * src0 = dst->src[0];
     const struct ggml_tensor * src1 = dst->src[1];
@@ -1488,6 +1678,8 @@ static void ggml_compute_forward_mul_mat_id(
 
     GGML_TENSOR_BINARY_OP_LOCALS
 
+    GGML_ASSERT(n_dsts >= 1 && n_dsts <= MMID_MAX_FUSED);
+
     const int ith = params->ith;
     const int nth = params->nth;
 
@@ -1498,15 +1690,24 @@ static void ggml_compute_forward_mul_mat_id(
     enum ggml_type    const vec_dot_type    = type_traits_cpu[type].vec_dot_type;
     ggml_from_float_t const from_float      = type_traits_cpu[vec_dot_type].from_float;
 
-    // we don't support permuted src0 or src1
-    GGML_ASSERT(nb00 == ggml_type_size(type));
-    GGML_ASSERT(nb10 == ggml_type_size(src1->type));
+    for (int m = 0; m < n_dsts; ++m) {
+        const struct ggml_tensor * src0_m = dsts[m]->src[0];
 
-    // dst cannot be transposed or permuted
-    GGML_ASSERT(nb0 == sizeof(float));
-    GGML_ASSERT(nb0 <= nb1);
-    GGML_ASSERT(nb1 <= nb2);
-    GGML_ASSERT(nb2 <= nb3);
+        GGML_ASSERT(dsts[m]->src[1] == src1 && dsts[m]->src[2] == ids);
+        GGML_ASSERT(type_traits_cpu[src0_m->type].vec_dot_type == vec_dot_type);
+        GGML_ASSERT(src0_m->ne[2] == ne02);
+
+        // we don't support permuted src0 or src1
+        GGML_ASSERT(src0_m->nb[0] == ggml_type_size(src0_m->type));
+
+        // dst cannot be transposed or permuted
+        GGML_ASSERT(dsts[m]->nb[0] == sizeof(float));
+        GGML_ASSERT(dsts[m]->nb[0] <= dsts[m]->nb[1]);
+        GGML_ASSERT(dsts[m]->nb[1] <= dsts[m]->nb[2]);
+        GGML_ASSERT(dsts[m]->nb[2] <= dsts[m]->nb[3]);
+    }
+
+    GGML_ASSERT(nb10 == ggml_type_size(src1->type));
 
     // row groups
     const int n_ids = ids->ne[0]; // n_expert_used
@@ -1524,48 +1725,23 @@ static void ggml_compute_forward_mul_mat_id(
     struct mmid_row_mapping * matrix_rows = // [n_as][ids->ne[0]*ids->ne[1]]
         incr_ptr_aligned(&wdata_cur, n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping), sizeof(int64_t));
 
-    char (*atomic_current_chunk)[CACHE_LINE_SIZE] = // [n_as]
-        incr_ptr_aligned(&wdata_cur, CACHE_LINE_SIZE * n_as, CACHE_LINE_SIZE);
+    int64_t * chunk_offs = // [n_dsts][n_as] + 1, first chunk of each (dst, expert) pair in the work queue
+        incr_ptr_aligned(&wdata_cur, (MMID_MAX_FUSED*n_as + 1)*sizeof(int64_t), sizeof(int64_t));
 
     GGML_ASSERT(params->wsize >= (size_t)((char *) wdata_cur - (char *) params->wdata));
 
     if (src1->type != vec_dot_type) {
-        char * wdata = params->wdata;
-
-        const size_t nbw0 = ggml_type_size(vec_dot_type);
-        const size_t nbw1 = ggml_row_size(vec_dot_type, ne10);
-        const size_t nbw2 = nbw1*ne11;
-        const size_t nbw3 = nbw2*ne12;
-
-        assert(params->wsize >= ne13*nbw3);
-        GGML_ASSERT(src1->type == GGML_TYPE_F32);
-
-#if 0
-        for (int64_t i13 = 0; i13 < ne13; ++i13) {
-            for (int64_t i12 = ith; i12 < ne12; i12 += nth) {
-                for (int64_t i11 = 0; i11 < ne11; ++i11) {
-                    from_float((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11),
-                               (void *)               (wdata + i13*nbw3 + i12*nbw2 + i11*nbw1),
-                               ne10);
-                }
-            }
-        }
-#else
-        for (int64_t i13 = 0; i13 < ne13; ++i13) {
-            for (int64_t i12 = 0; i12 < ne12; ++i12) {
-                for (int64_t i11 = 0; i11 < ne11; ++i11) {
-                    size_t bs = ggml_blck_size(vec_dot_type);
-                    int64_t ne10_block_start = (ith * ne10/bs) / nth;
-                    int64_t ne10_block_end   = ((ith + 1) * ne10/bs) / nth;
-                    from_float((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11 + ne10_block_start*bs*nb10),
-                               (void *)               (wdata + i13*nbw3 + i12*nbw2 + i11*nbw1 + ne10_block_start*nbw0),
-                               (ne10_block_end - ne10_block_start) * bs);
-                }
-            }
-        }
-#endif
+        ggml_compute_forward_mul_mat_convert_src1(params, src1, vec_dot_type, from_float, params->wdata, src1_row);
     }
 
+#if defined(__aarch64__)
+    // disable for ARM
+    const bool disable_chunking = true;
+#else
+    // disable for NUMA
+    const bool disable_chunking = ggml_is_numa();
+#endif // defined(__aarch64__)
+
     if (ith == 0) {
         // initialize matrix_row_counts
         memset(matrix_row_counts, 0, n_as*sizeof(int64_t));
@@ -1581,83 +1757,97 @@ static void ggml_compute_forward_mul_mat_id(
                 matrix_row_counts[i02] += 1;
             }
         }
-    }
 
-    // reset current_chunk
-    for (int cur_a = ith; cur_a < n_as; cur_a += nth) {
-        atomic_int * current_chunk_ctr = (atomic_int *)(atomic_current_chunk + cur_a);
-        *current_chunk_ctr = nth;
-    }
+        // lay out the chunks of all experts of all dsts in a single work queue
+        int64_t n_chunks = 0;
 
-    ggml_barrier(params->threadpool);
+        for (int m = 0; m < n_dsts; ++m) {
+            for (int cur_a = 0; cur_a < n_as; ++cur_a) {
+                chunk_offs[m*n_as + cur_a] = n_chunks;
 
-    for (int cur_a = 0; cur_a < n_as; ++cur_a) {
-        const int64_t cne1 = matrix_row_counts[cur_a];
+                if (matrix_row_counts[cur_a] == 0) {
+                    continue;
+                }
 
-        if (cne1 == 0) {
-            continue;
+                int64_t nchunk0;
+                int64_t nchunk1;
+                ggml_compute_forward_mul_mat_id_nchunk(dsts[m]->ne[0], matrix_row_counts[cur_a], nth, disable_chunking, &nchunk0, &nchunk1);
+
+                n_chunks += nchunk0*nchunk1;
+            }
         }
 
-        const char * src0_cur = (const char *) src0->data + cur_a * nb02;
-        const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
-        const size_t row_size = ggml_row_size(vec_dot_type, ne10);
+        chunk_offs[n_dsts*n_as] = n_chunks;
 
-        const int64_t nr0 = ne01;
-        const int64_t nr1 = cne1;
+        // Every thread starts at ith, so the first unprocessed chunk is nth.
+        atomic_store_explicit(&params->threadpool->current_chunk, nth, memory_order_relaxed);
+    }
 
-        int chunk_size = 16;
-        if (nr0 == 1 || nr1 == 1) {
-            chunk_size = 64;
-        }
+    ggml_barrier(params->threadpool);
 
-#if defined(__aarch64__)
-        // disable for ARM
-        const bool disable_chunking = true;
-#else
-        // disable for NUMA
-        const bool disable_chunking = ggml_is_numa();
-#endif // defined(__aarch64__)
+    const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
+    const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
-        int64_t nchunk0 = (nr0 + chunk_size - 1) / chunk_size;
-        int64_t nchunk1 = (nr1 + chunk_size - 1) / chunk_size;
+    const int64_t n_chunks = chunk_offs[n_dsts*n_as];
 
-        if (nchunk0 * nchunk1 < nth * 4 || disable_chunking) {
-            nchunk0 = nr0 > nr1 ? nth : 1;
-            nchunk1 = nr0 > nr1 ? 1 : nth;
+    // chunks are taken in increasing order, so the (dst, expert) pair of the current chunk is found by a forward scan
+    int pair = 0;
+
+    int64_t current_chunk = ith;
+
+    while (current_chunk < n_chunks) {
+        while (chunk_offs[pair + 1] <= current_chunk) {
+            pair++;
         }
 
-        const int64_t dr0 = (nr0 + nchunk0 - 1) / nchunk0;
-        const int64_t dr1 = (nr1 + nchunk1 - 1) / nchunk1;
+        const int m     = pair / n_as;
+        const int cur_a = pair % n_as;
 
-        int current_chunk = ith;
+        struct ggml_tensor * dst_m  = dsts[m];
+        const struct ggml_tensor * src0_m = dst_m->src[0];
 
-        atomic_int * current_chunk_ctr = (atomic_int *)(atomic_current_chunk + cur_a);
+        const char * src0_cur = (const char *) src0_m->data + cur_a*src0_m->nb[2];
 
-        while (current_chunk < nchunk0 * nchunk1) {
-            const int64_t ith0 = current_chunk % nchunk0;
-            const int64_t ith1 = current_chunk / nchunk0;
+        const int64_t nr0 = dst_m->ne[0];
+        const int64_t nr1 = matrix_row_counts[cur_a];
 
-            const int64_t ir0_start = dr0 * ith0;
-            const int64_t ir0_end = MIN(ir0_start + dr0, nr0);
+        int64_t nchunk0;
+        int64_t nchunk1;
+        ggml_compute_forward_mul_mat_id_nchunk(nr0, nr1, nth, disable_chunking, &nchunk0, &nchunk1);
 
-            const int64_t ir1_start = dr1 * ith1;
-            const int64_t ir1_end = MIN(ir1_start + dr1, nr1);
+        const int64_t dr0 = (nr0 + nchunk0 - 1) / nchunk0;
+        const int64_t dr1 = (nr1 + nchunk1 - 1) / nchunk1;
 
-            ggml_compute_forward_mul_mat_id_one_chunk(
-                dst, src0, src1, ids, cur_a,
-                ir0_start, ir0_end, ir1_start, ir1_end,
-                src0_cur, matrix_rows, row_size, src1_cont, wdata
-            );
+        const int64_t ith0 = (current_chunk - chunk_offs[pair]) % nchunk0;
+        const int64_t ith1 = (current_chunk - chunk_offs[pair]) / nchunk0;
 
-            if (nth >= nchunk0 * nchunk1) {
-                break;
-            }
+        const int64_t ir0_start = dr0 * ith0;
+        const int64_t ir0_end = MIN(ir0_start + dr0, nr0);
 
-            current_chunk = atomic_fetch_add_explicit(current_chunk_ctr, 1, memory_order_relaxed);
+        const int64_t ir1_start = dr1 * ith1;
+        const int64_t ir1_end = MIN(ir1_start + dr1, nr1);
+
+        ggml_compute_forward_mul_mat_id_one_chunk(
+            dst_m, src0_m, src1, ids, cur_a,
+            ir0_start, ir0_end, ir1_start, ir1_end,
+            src0_cur, matrix_rows, row_size, src1_cont, wdata
+        );
+
+        if (disable_chunking) {
+            // every expert has nth chunks, each thread computes the same chunk of every expert
+            current_chunk += nth;
+        } else {
+            current_chunk = atomic_fetch_add_explicit(&params->threadpool->current_chunk, 1, memory_order_relaxed);
         }
     }
 }
 
+static void ggml_compute_forward_mul_mat_id(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst) {
+    ggml_compute_forward_mul_mat_id_impl(params, &dst, 1, NULL);
+}
+
 /////////////////////////////////
 
 static void ggml_compute_forward(struct ggml_compute_params * params, struct ggml_tensor * tensor) {
@@ -2117,6 +2307,170 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
     }
 }
 
+// CPU graph fusion
+//
+// node sequences emitted by build_norm and build_ffn are computed together:
+//   RMS_NORM -> MUL                 : the norm weight is applied in the same pass over the rows
+//   RMS_NORM -> MUL -> MUL_MAT      : the normalized rows are produced while converting src1 to vec_dot_type
+//   GLU (swiglu)    -> MUL_MAT      : same, for the down projection
+//   MUL_MAT_ID -> MUL_MAT_ID        : the up and gate projections of a MoE FFN share one src1 conversion and work queue
+//   GLU (swiglu)    -> MUL_MAT_ID   : same as MUL_MAT, for the MoE down projection
+// this saves a barrier per fused node and the round trip of the intermediate activations through memory
+// all threads run the same checks, so they agree on the number of nodes that were consumed
+
+static bool ggml_cpu_disable_fusion = false;
+
+static bool ggml_cpu_can_fuse_rms_norm_mul(const struct ggml_cgraph * cgraph, int node_n) {
+    static const enum ggml_op ops[] = { GGML_OP_RMS_NORM, GGML_OP_MUL };
+
+    if (!ggml_can_fuse(cgraph, node_n, ops, 2)) {
+        return false;
+    }
+
+    const struct ggml_tensor * norm = cgraph->nodes[node_n];
+    const struct ggml_tensor * mul  = cgraph->nodes[node_n + 1];
+    const struct ggml_tensor * w    = mul->src[1];
+
+    return !ggml_is_empty(mul) && mul->src[0] == norm && w != norm &&
+        norm->src[0]->type == GGML_TYPE_F32 && norm->src[0]->nb[0] == sizeof(float) &&
+        w->type == GGML_TYPE_F32 && ggml_is_contiguous(w) && w->ne[0] == mul->ne[0] && ggml_nrows(w) == 1 &&
+        mul->type == GGML_TYPE_F32 && mul->nb[0] == sizeof(float);
+}
+
+static bool ggml_cpu_tensors_overlap(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    const char * a0 = (const char *) a->data;
+    const char * b0 = (const char *) b->data;
+
+    return a0 < b0 + ggml_nbytes(b) && b0 < a0 + ggml_nbytes(a);
+}
+
+// the node at node_n is only used as src1 of the MUL_MAT or MUL_MAT_ID that follows it
+static bool ggml_cpu_can_fuse_mul_mat_src1(const struct ggml_cgraph * cgraph, int node_n) {
+    if (node_n + 1 >= cgraph->n_nodes) {
+        return false;
+    }
+
+    const struct ggml_tensor * node = cgraph->nodes[node_n];
+    const struct ggml_tensor * mm   = cgraph->nodes[node_n + 1];
+
+    if ((mm->op != GGML_OP_MUL_MAT && mm->op != GGML_OP_MUL_MAT_ID) || mm->src[1] != node || mm->src[0] == node || ggml_is_empty(mm)) {
+        return false;
+    }
+
+    if (!ggml_node_has_n_uses(cgraph, node_n, 1)) {
+        return false;
+    }
+
+    // the rows are produced during the conversion of src1, which is skipped for F32 src0
+    if (node->type != GGML_TYPE_F32 || !ggml_is_contiguous(node) ||
+        type_traits_cpu[mm->src[0]->type].vec_dot_type == GGML_TYPE_F32) {
+        return false;
+    }
+
+    // extra buffer types compute the whole MUL_MAT on their own
+    return !ggml_cpu_extra_has_tensor_traits(mm);
+}
+
+// the MUL_MAT_ID nodes at node_n and node_n + 1 use the same src1 and ids
+static bool ggml_cpu_can_fuse_mul_mat_id_pair(const struct ggml_cgraph * cgraph, int node_n) {
+    if (node_n + 1 >= cgraph->n_nodes) {
+        return false;
+    }
+
+    const struct ggml_tensor * a = cgraph->nodes[node_n];
+    const struct ggml_tensor * b = cgraph->nodes[node_n + 1];
+
+    if (b->op != GGML_OP_MUL_MAT_ID || b->src[0] == a || a->src[1] != b->src[1] || a->src[2] != b->src[2]) {
+        return false;
+    }
+
+    if (ggml_is_empty(a) || ggml_is_empty(b)) {
+        return false;
+    }
+
+    // the work buffer is laid out for the first node
+    if (type_traits_cpu[a->src[0]->type].vec_dot_type != type_traits_cpu[b->src[0]->type].vec_dot_type ||
+        a->src[0]->ne[2] != b->src[0]->ne[2]) {
+        return false;
+    }
+
+    return !ggml_cpu_extra_has_tensor_traits(a) && !ggml_cpu_extra_has_tensor_traits(b);
+}
+
+static void ggml_compute_forward_mul_mat_src1_fused(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst,
+        ggml_compute_forward_row_t src1_row) {
+    if (dst->op == GGML_OP_MUL_MAT_ID) {
+        ggml_compute_forward_mul_mat_id_impl(params, &dst, 1, src1_row);
+    } else {
+        ggml_compute_forward_mul_mat_impl(params, dst, src1_row);
+    }
+}
+
+// returns the number of nodes computed starting at node_n, or 0 if there is nothing to fuse
+static int ggml_compute_forward_fused(struct ggml_compute_params * params, const struct ggml_cgraph * cgraph, int node_n) {
+    if (ggml_cpu_disable_fusion) {
+        return 0;
+    }
+
+    struct ggml_tensor * node = cgraph->nodes[node_n];
+
+    switch (node->op) {
+        case GGML_OP_RMS_NORM:
+            {
+                if (!ggml_cpu_can_fuse_rms_norm_mul(cgraph, node_n)) {
+                    return 0;
+                }
+
+                const struct ggml_tensor * mul = cgraph->nodes[node_n + 1];
+
+                // with fewer rows than threads, the rows are split across the threads and each of them sums the whole
+                // input row, which the other threads overwrite when MUL is computed in place on it
+                const bool split_inplace = ggml_nrows(mul) < params->nth && ggml_cpu_tensors_overlap(mul, node->src[0]);
+
+                if (!split_inplace && ggml_cpu_can_fuse_mul_mat_src1(cgraph, node_n + 1)) {
+                    ggml_compute_forward_mul_mat_src1_fused(params, cgraph->nodes[node_n + 2], ggml_compute_forward_rms_norm_mul_row);
+                    return 3;
+                }
+
+                ggml_compute_forward_rms_norm_mul(params, cgraph->nodes[node_n + 1]);
+                return 2;
+            }
+        case GGML_OP_GLU:
+            {
+                const struct ggml_tensor * src0 = node->src[0];
+                const struct ggml_tensor * src1 = node->src[1];
+
+                if (ggml_get_glu_op(node) != GGML_GLU_OP_SWIGLU || ggml_is_empty(node) ||
+                    src0->type != GGML_TYPE_F32 || !ggml_is_contiguous_1(src0) ||
+                    (src1 && (src1->type != GGML_TYPE_F32 || !ggml_is_contiguous_1(src1)))) {
+                    return 0;
+                }
+
+                if (ggml_cpu_can_fuse_mul_mat_src1(cgraph, node_n)) {
+                    ggml_compute_forward_mul_mat_src1_fused(params, cgraph->nodes[node_n + 1], ggml_compute_forward_swiglu_row);
+                    return 2;
+                }
+
+                return 0;
+            }
+        case GGML_OP_MUL_MAT_ID:
+            {
+                if (ggml_cpu_can_fuse_mul_mat_id_pair(cgraph, node_n)) {
+                    struct ggml_tensor * dsts[2] = { node, cgraph->nodes[node_n + 1] };
+
+                    ggml_compute_forward_mul_mat_id_impl(params, dsts, 2, NULL);
+                    return 2;
+                }
+
+                return 0;
+            }
+        default:
+            return 0;
+    }
+}
+
 // Android's libc implementation "bionic" does not support setting affinity
 #if defined(__gnu_linux__)
 static void set_numa_thread_affinity(int thread_n) {
@@ -2813,8 +3167,8 @@ struct ggml_cplan ggml_graph_plan(
                         cur += n_as * sizeof(int64_t) + sizeof(int64_t);
                         // matrix_rows
                         cur += n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping) + sizeof(int64_t);
-                        // atomic_current_chunk
-                        cur += CACHE_LINE_SIZE*n_as + CACHE_LINE_SIZE;
+                        // chunk_offs
+                        cur += (MMID_MAX_FUSED*n_as + 1)*sizeof(int64_t) + sizeof(int64_t);
                     } break;
                 case GGML_OP_OUT_PROD:
                     {
@@ -2874,10 +3228,15 @@ struct ggml_cplan ggml_graph_plan(
                     } break;
                 case GGML_OP_FLASH_ATTN_EXT:
                     {
+                        const int64_t ne02 = node->src[0]->ne[2]; // n_head
                         const int64_t ne10 = node->src[1]->ne[0]; // DK
+                        const int64_t ne12 = node->src[1]->ne[2]; // n_head_kv
                         const int64_t ne20 = node->src[2]->ne[0]; // DV
 
-                        cur = sizeof(float)*(1*ne10 + 2*ne20)*n_tasks; // 1x head size K + 2x head size V (per thread)
+                        // tiled path: Q, VKQ and KQ of up to nr query rows, their max and sum, 1x head size V (per thread)
+                        const int64_t nr = MAX(GGML_FA_TILE_Q, ne02/ne12);
+
+                        cur = sizeof(float)*MAX(1*ne10 + 2*ne20, nr*(ne10 + ne20 + GGML_FA_TILE_KV + 2) + ne20)*n_tasks;
                     } break;
                 case GGML_OP_FLASH_ATTN_BACK:
                     {
@@ -2944,7 +3303,13 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
     for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
         struct ggml_tensor * node = cgraph->nodes[node_n];
 
-        ggml_compute_forward(&params, node);
+        const int n_fused = ggml_compute_forward_fused(&params, cgraph, node_n);
+
+        if (n_fused > 0) {
+            node_n += n_fused - 1;
+        } else {
+            ggml_compute_forward(&params, node);
+        }
 
         if (state->ith == 0 && cplan->abort_callback &&
                 cplan->abort_callback(cplan->abort_callback_data)) {
@@ -3616,6 +3981,10 @@ void ggml_cpu_init(void) {
         ggml_init_arm_arch_features();
 #endif
 
+        ggml_cpu_disable_fusion = getenv("GGML_CPU_DISABLE_FUSION") != NULL;
+
+        ggml_cpu_tune_init();
+
         is_first_call = false;
     }
 
@@ -3,10 +3,13 @@
 #include "ggml-cpu.h"
 #include "repack.h"
 #include "traits.h"
+#include "tune.h"
 #include "ggml-impl.h"
 #include "amx/amx.h"
 
+#include <algorithm>
 #include <cctype>
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -86,6 +89,14 @@ static bool ggml_backend_cpu_is_extra_buffer_type(ggml_backend_buffer_type_t buf
 
 // CPU backend - backend (stream)
 
+// number of graphs whose plan is kept, the scheduler may give several splits per evaluation to the CPU backend
+#define GGML_CPU_PLAN_CACHE_SIZE 16
+
+struct ggml_backend_cpu_cached_plan {
+    std::vector<uint64_t> desc; // see ggml_backend_cpu_graph_desc
+    struct ggml_cplan     cplan;
+};
+
 struct ggml_backend_cpu_context {
     int                 n_threads;
     ggml_threadpool_t   threadpool;
@@ -95,6 +106,12 @@ struct ggml_backend_cpu_context {
 
     ggml_abort_callback abort_callback;
     void *              abort_callback_data;
+
+    // plans of the last graphs, the most recently used last
+    std::vector<ggml_backend_cpu_cached_plan> plans;
+
+    // description of the graph being computed, reused to avoid the allocations
+    std::vector<uint64_t> desc;
 };
 
 static const char * ggml_backend_cpu_get_name(ggml_backend_t backend) {
@@ -108,6 +125,9 @@ static void ggml_backend_cpu_free(ggml_backend_t backend) {
     delete[] cpu_ctx->work_data;
     delete cpu_ctx;
     delete backend;
+
+    // persist the shapes tuned by this backend
+    ggml_cpu_tune_flush();
 }
 
 struct ggml_backend_plan_cpu {
@@ -154,10 +174,72 @@ static enum ggml_status ggml_backend_cpu_graph_plan_compute(ggml_backend_t backe
     GGML_UNUSED(backend);
 }
 
+// the inputs of ggml_graph_plan: the op, type, shape and op params of each node, and the type, shape and buffer of its
+// sources. the graphs with the same description have the same plan
+// a node is | op, type, mask of the sources | ne | op params | followed by | type | ne | buffer | for each source
+static void ggml_backend_cpu_graph_desc(const struct ggml_backend_cpu_context * cpu_ctx, const struct ggml_cgraph * cgraph, std::vector<uint64_t> & desc) {
+    desc.clear();
+
+    desc.push_back((uint64_t) cpu_ctx->n_threads);
+    desc.push_back((uint64_t) (uintptr_t) cpu_ctx->threadpool);
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
+
+        uint64_t src_mask = 0;
+        for (int k = 0; k < GGML_MAX_SRC; k++) {
+            if (node->src[k] != NULL) {
+                src_mask |= 1ull << k;
+            }
+        }
+
+        desc.push_back(((uint64_t) node->op << 40) | ((uint64_t) node->type << 16) | src_mask);
+        desc.insert(desc.end(), node->ne, node->ne + GGML_MAX_DIMS);
+
+        static_assert(GGML_MAX_OP_PARAMS % sizeof(uint64_t) == 0, "unexpected op params size");
+        uint64_t op_params[GGML_MAX_OP_PARAMS/sizeof(uint64_t)];
+        memcpy(op_params, node->op_params, GGML_MAX_OP_PARAMS);
+        desc.insert(desc.end(), op_params, op_params + GGML_MAX_OP_PARAMS/sizeof(uint64_t));
+
+        for (int k = 0; k < GGML_MAX_SRC; k++) {
+            const struct ggml_tensor * src = node->src[k];
+            if (src == NULL) {
+                continue;
+            }
+            desc.push_back((uint64_t) src->type);
+            desc.insert(desc.end(), src->ne, src->ne + GGML_MAX_DIMS);
+            desc.push_back((uint64_t) (uintptr_t) src->buffer);
+        }
+    }
+}
+
+static struct ggml_cplan ggml_backend_cpu_graph_get_plan(struct ggml_backend_cpu_context * cpu_ctx, const struct ggml_cgraph * cgraph) {
+    auto & desc = cpu_ctx->desc;
+    ggml_backend_cpu_graph_desc(cpu_ctx, cgraph, desc);
+
+    auto & plans = cpu_ctx->plans;
+
+    for (size_t i = plans.size(); i-- > 0; ) {
+        if (plans[i].desc == desc) {
+            std::rotate(plans.begin() + i, plans.begin() + i + 1, plans.end());
+            return plans.back().cplan;
+        }
+    }
+
+    struct ggml_cplan cplan = ggml_graph_plan(cgraph, cpu_ctx->n_threads, cpu_ctx->threadpool);
+
+    if (plans.size() >= GGML_CPU_PLAN_CACHE_SIZE) {
+        plans.erase(plans.begin());
+    }
+    plans.push_back({ desc, cplan });
+
+    return cplan;
+}
+
 static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, struct ggml_cgraph * cgraph) {
     struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
 
-    struct ggml_cplan cplan = ggml_graph_plan(cgraph, cpu_ctx->n_threads, cpu_ctx->threadpool);
+    struct ggml_cplan cplan = ggml_backend_cpu_graph_get_plan(cpu_ctx, cgraph);
 
     if (cpu_ctx->work_size < cplan.work_size) {
         delete[] cpu_ctx->work_data;
@@ -631,6 +713,18 @@ static void * ggml_backend_cpu_get_proc_address(ggml_backend_reg_t reg, const ch
     if (strcmp(name, "ggml_backend_cpu_is_numa") == 0) {
         return (void *)ggml_is_numa;
     }
+    if (strcmp(name, "ggml_cpu_tune_set_mode") == 0) {
+        return (void *)ggml_cpu_tune_set_mode;
+    }
+    if (strcmp(name, "ggml_cpu_tune_n_entries") == 0) {
+        return (void *)ggml_cpu_tune_n_entries;
+    }
+    if (strcmp(name, "ggml_cpu_tune_load") == 0) {
+        return (void *)ggml_cpu_tune_load;
+    }
+    if (strcmp(name, "ggml_cpu_tune_save") == 0) {
+        return (void *)ggml_cpu_tune_save;
+    }
 
     // threadpool - TODO:  move to ggml-base
     if (strcmp(name, "ggml_threadpool_new") == 0) {
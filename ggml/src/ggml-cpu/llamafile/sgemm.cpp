@@ -1075,6 +1075,280 @@ class tinyBLAS_Q0_AVX {
 };
 #endif // __AVX__
 
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+// GCC 12 warns about the undefined vectors that its AVX-512 intrinsics pass to the masked builtins
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+
+// K-quant and IQ4_XS weights times Q8_K activations
+//
+// The super-blocks of RM rows of A are unpacked into unsigned 8-bit quants and 16-bit sub-block
+// scales once, and reused for RN columns of B. The products are accumulated with maddubs (u8 * s8
+// -> s16 pairs) followed by a multiply-add with the scales (s16 * s16 -> s32, fused with VNNI).
+// The mins (and the -32 offset of Q6_K) are applied with the bsums of Q8_K.
+template <typename TA>
+class tinyBLAS_K_AVX512 {
+  public:
+    tinyBLAS_K_AVX512(int64_t k,
+                      const TA *A, int64_t lda,
+                      const block_q8_K *B, int64_t ldb,
+                      float *C, int64_t ldc,
+                      int ith, int nth)
+        : A(A), B(B), C(C), k(k), lda(lda), ldb(ldb), ldc(ldc), ith(ith), nth(nth) {
+    }
+
+    void matmul(int64_t m, int64_t n) {
+        mnpack(0, m, 0, n);
+    }
+
+  private:
+    // a super-block of A, unpacked
+    struct unpacked {
+        __m512i q[4];    // quants of the 4 groups of 64, unsigned
+        __m512i s[4];    // scales of the 32 pairs of quants (maddubs lanes) of each group
+        __m256i m;       // mins of the 16 groups of 16 quants (bsums of Q8_K)
+        __mmask64 neg[4]; // IQ4_XS: negative quants, the sign is moved to B
+        float d;
+        float dmin;
+    };
+
+    static constexpr bool has_min = !std::is_same_v<TA, block_iq4_xs>;
+    static constexpr bool has_neg =  std::is_same_v<TA, block_iq4_xs>;
+
+    void mnpack(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t mc, nc, mp, np;
+        switch ((MIN(m - m0, 2) << 4) | MIN(n - n0, 4)) {
+        case 0x24:
+            mc = 2;
+            nc = 4;
+            gemm<2, 4>(m0, m, n0, n);
+            break;
+        case 0x23:
+            mc = 2;
+            nc = 3;
+            gemm<2, 3>(m0, m, n0, n);
+            break;
+        case 0x22:
+            mc = 2;
+            nc = 2;
+            gemm<2, 2>(m0, m, n0, n);
+            break;
+        case 0x21:
+            mc = 2;
+            nc = 1;
+            gemm<2, 1>(m0, m, n0, n);
+            break;
+        case 0x14:
+            mc = 1;
+            nc = 4;
+            gemm<1, 4>(m0, m, n0, n);
+            break;
+        case 0x13:
+            mc = 1;
+            nc = 3;
+            gemm<1, 3>(m0, m, n0, n);
+            break;
+        case 0x12:
+            mc = 1;
+            nc = 2;
+            gemm<1, 2>(m0, m, n0, n);
+            break;
+        case 0x11:
+            mc = 1;
+            nc = 1;
+            gemm<1, 1>(m0, m, n0, n);
+            break;
+        default:
+            return;
+        }
+        mp = m0 + (m - m0) / mc * mc;
+        np = n0 + (n - n0) / nc * nc;
+        mnpack(mp, m, n0, np);
+        mnpack(m0, m, np, n);
+    }
+
+    template <int RM, int RN>
+    NOINLINE void gemm(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t ytiles = (m - m0) / RM;
+        int64_t xtiles = (n - n0) / RN;
+        int64_t tiles = xtiles * ytiles;
+        int64_t duty = (tiles + nth - 1) / nth;
+        int64_t start = duty * ith;
+        int64_t end = start + duty;
+        if (end > tiles)
+            end = tiles;
+        for (int64_t job = start; job < end; ++job) {
+            int64_t ii = m0 + job / xtiles * RM;
+            int64_t jj = n0 + job % xtiles * RN;
+            __m512 Cv[RN][RM] = {};
+            for (int64_t l = 0; l < k; ++l) {
+                unpacked a[RM];
+                for (int64_t i = 0; i < RM; ++i)
+                    unpack(A + lda * (ii + i) + l, a[i]);
+                for (int64_t j = 0; j < RN; ++j) {
+                    const block_q8_K * b = B + ldb * (jj + j) + l;
+                    for (int64_t i = 0; i < RM; ++i) {
+                        __m512i acc = _mm512_setzero_si512();
+                        for (int p = 0; p < 4; ++p) {
+                            __m512i y = _mm512_loadu_si512((const __m512i *)(b->qs + 64 * p));
+                            if constexpr (has_neg) {
+                                y = _mm512_mask_sub_epi8(y, a[i].neg[p], _mm512_setzero_si512(), y);
+                            }
+                            const __m512i dot = _mm512_maddubs_epi16(a[i].q[p], y);
+#if defined(__AVX512VNNI__)
+                            acc = _mm512_dpwssd_epi32(acc, dot, a[i].s[p]);
+#else
+                            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(dot, a[i].s[p]));
+#endif
+                        }
+                        Cv[j][i] = madd(_mm512_set1_ps(a[i].d * b->d), _mm512_cvtepi32_ps(acc), Cv[j][i]);
+                        if constexpr (has_min) {
+                            const __m256i mins = _mm256_madd_epi16(a[i].m, _mm256_loadu_si256((const __m256i *)b->bsums));
+                            Cv[j][i] = _mm512_fnmadd_ps(_mm512_set1_ps(a[i].dmin * b->d),
+                                                        _mm512_cvtepi32_ps(_mm512_zextsi256_si512(mins)), Cv[j][i]);
+                        }
+                    }
+                }
+            }
+            for (int64_t j = 0; j < RN; ++j)
+                for (int64_t i = 0; i < RM; ++i)
+                    C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]);
+        }
+    }
+
+    static inline __m512i combine(__m256i lo, __m256i hi) {
+        return _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+    }
+
+    // 8 scales of 32 quants -> scales of the maddubs lanes of each group of 64 quants
+    static inline void scales_32(__m128i sc, __m512i s[4]) {
+        const __m512i sc16 = _mm512_castsi256_si512(_mm256_cvtepi8_epi16(sc)); // only the lower half is indexed
+        for (int p = 0; p < 4; ++p) {
+            const __m512i idx = combine(_mm256_set1_epi16(2 * p), _mm256_set1_epi16(2 * p + 1));
+            s[p] = _mm512_permutexvar_epi16(idx, sc16);
+        }
+    }
+
+    // Q4_K and Q5_K scales and mins, see get_scale_min_k4
+    static inline void scales_mins_k4(const uint8_t * scales, unpacked & a) {
+        uint32_t utmp[4];
+        memcpy(utmp, scales, 12);
+        utmp[3] = ((utmp[2] >> 4) & 0x0f0f0f0f) | (((utmp[1] >> 6) & 0x03030303) << 4);
+        const uint32_t uaux = utmp[1] & 0x3f3f3f3f;
+        utmp[1] = (utmp[2] & 0x0f0f0f0f) | (((utmp[0] >> 6) & 0x03030303) << 4);
+        utmp[2] = uaux;
+        utmp[0] &= 0x3f3f3f3f;
+
+        const __m128i sm = _mm_loadu_si128((const __m128i *)utmp);
+        scales_32(sm, a.s);
+
+        // each min covers 2 bsums
+        const __m128i mins = _mm_shuffle_epi8(sm, _mm_set_epi8(15, 15, 14, 14, 13, 13, 12, 12, 11, 11, 10, 10, 9, 9, 8, 8));
+        a.m = _mm256_cvtepu8_epi16(mins);
+    }
+
+    inline void unpack(const block_q4_K * x, unpacked & a) {
+        a.d    = unhalf(x->d);
+        a.dmin = unhalf(x->dmin);
+        scales_mins_k4(x->scales, a);
+        for (int p = 0; p < 4; ++p) {
+            const __m256i q = _mm256_loadu_si256((const __m256i *)(x->qs + 32 * p));
+            a.q[p] = combine(_mm256_and_si256(q, _mm256_set1_epi8(15)),
+                             _mm256_and_si256(_mm256_srli_epi16(q, 4), _mm256_set1_epi8(15)));
+        }
+    }
+
+    inline void unpack(const block_q5_K * x, unpacked & a) {
+        a.d    = unhalf(x->d);
+        a.dmin = unhalf(x->dmin);
+        scales_mins_k4(x->scales, a);
+        const __m256i qh = _mm256_loadu_si256((const __m256i *)x->qh);
+        for (int p = 0; p < 4; ++p) {
+            const __m256i q  = _mm256_loadu_si256((const __m256i *)(x->qs + 32 * p));
+            const __m256i h0 = _mm256_slli_epi16(_mm256_and_si256(_mm256_srl_epi16(qh, _mm_cvtsi32_si128(2 * p + 0)), _mm256_set1_epi8(1)), 4);
+            const __m256i h1 = _mm256_slli_epi16(_mm256_and_si256(_mm256_srl_epi16(qh, _mm_cvtsi32_si128(2 * p + 1)), _mm256_set1_epi8(1)), 4);
+            a.q[p] = combine(_mm256_or_si256(_mm256_and_si256(q, _mm256_set1_epi8(15)), h0),
+                             _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(q, 4), _mm256_set1_epi8(15)), h1));
+        }
+    }
+
+    inline void unpack(const block_q6_K * x, unpacked & a) {
+        a.d    = unhalf(x->d);
+        a.dmin = a.d;
+
+        // 16 scales of 16 quants
+        const __m512i sc16 = _mm512_castsi256_si512(_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)x->scales))); // only the lower half is indexed
+        for (int p = 0; p < 4; ++p) {
+            const __m512i idx = combine(MM256_SET_M128I(_mm_set1_epi16(4 * p + 1), _mm_set1_epi16(4 * p + 0)),
+                                        MM256_SET_M128I(_mm_set1_epi16(4 * p + 3), _mm_set1_epi16(4 * p + 2)));
+            a.s[p] = _mm512_permutexvar_epi16(idx, sc16);
+        }
+
+        // the quants are stored with an offset of 32
+        a.m = _mm256_slli_epi16(_mm512_castsi512_si256(sc16), 5);
+
+        const __m256i m4 = _mm256_set1_epi8(15);
+        const __m256i m2 = _mm256_set1_epi8(3);
+        for (int c = 0; c < 2; ++c) {
+            const __m256i ql0 = _mm256_loadu_si256((const __m256i *)(x->ql + 64 * c));
+            const __m256i ql1 = _mm256_loadu_si256((const __m256i *)(x->ql + 64 * c + 32));
+            const __m256i qh  = _mm256_loadu_si256((const __m256i *)(x->qh + 32 * c));
+            a.q[2 * c + 0] = combine(
+                _mm256_or_si256(_mm256_and_si256(ql0, m4), _mm256_slli_epi16(_mm256_and_si256(qh, m2), 4)),
+                _mm256_or_si256(_mm256_and_si256(ql1, m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 2), m2), 4)));
+            a.q[2 * c + 1] = combine(
+                _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql0, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 4), m2), 4)),
+                _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql1, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 6), m2), 4)));
+        }
+    }
+
+    inline void unpack(const block_iq4_xs * x, unpacked & a) {
+        a.d    = unhalf(x->d);
+        a.dmin = 0.0f;
+
+        int8_t ls[16] = {};
+        for (int ib = 0; ib < QK_K/32; ++ib) {
+            ls[ib] = (int8_t) ((((x->scales_l[ib/2] >> 4*(ib%2)) & 0xf) | (((x->scales_h >> 2*ib) & 3) << 4)) - 32);
+        }
+        scales_32(_mm_loadu_si128((const __m128i *)ls), a.s);
+
+        static const int8_t kvalues_iq4nl[16] = {
+            -127, -104, -83, -65,
+            -49,  -35,  -22, -10,
+              1,   13,   25,  38,
+             53,   69,   89, 113
+        };
+        const __m512i values = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)kvalues_iq4nl));
+        for (int p = 0; p < 4; ++p) {
+            // 2 blocks of 32: 16 low nibbles followed by 16 high nibbles each
+            const __m256i q  = _mm256_loadu_si256((const __m256i *)(x->qs + 32 * p));
+            const __m512i qi = combine(_mm256_and_si256(q, _mm256_set1_epi8(15)),
+                                       _mm256_and_si256(_mm256_srli_epi16(q, 4), _mm256_set1_epi8(15)));
+            const __m512i v  = _mm512_shuffle_epi8(values, _mm512_shuffle_i64x2(qi, qi, _MM_SHUFFLE(3, 1, 2, 0)));
+            a.neg[p] = _mm512_movepi8_mask(v);
+            a.q[p]   = _mm512_abs_epi8(v);
+        }
+    }
+
+    const TA *const A;
+    const block_q8_K *const B;
+    float *const C;
+    const int64_t k;
+    const int64_t lda;
+    const int64_t ldb;
+    const int64_t ldc;
+    const int ith;
+    const int nth;
+};
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // __AVX512F__ && __AVX512BW__
+
 //PPC Implementation
 #if defined(__MMA__)
 
@@ -2932,6 +3206,70 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
 #endif
     }
 
+    case GGML_TYPE_Q4_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+        tinyBLAS_K_AVX512<block_q4_K> tb{
+            k, (const block_q4_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q5_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+        tinyBLAS_K_AVX512<block_q5_K> tb{
+            k, (const block_q5_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q6_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+        tinyBLAS_K_AVX512<block_q6_K> tb{
+            k, (const block_q6_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_IQ4_XS: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+        tinyBLAS_K_AVX512<block_iq4_xs> tb{
+            k, (const block_iq4_xs *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
     default:
         return false;
     }
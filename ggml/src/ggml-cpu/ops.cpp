@@ -4,6 +4,7 @@
 #include "ggml-impl.h"
 #include "binary-ops.h"
 #include "ggml.h"
+#include "quants.h"
 #include "unary-ops.h"
 #include "vec.h"
 
@@ -3607,6 +3608,31 @@ static void ggml_compute_forward_swiglu_f32(
     }
 }
 
+void ggml_compute_forward_swiglu_row(
+        const ggml_tensor * dst,
+        int64_t i01, int64_t i02, int64_t i03,
+        int64_t i00_start, int64_t i00_end) {
+
+    const ggml_tensor * src0 = dst->src[0];
+    const ggml_tensor * src1 = dst->src[1];
+
+    const int64_t nc = dst->ne[0];
+
+    const int32_t swapped = ggml_get_op_params_i32(dst, 1);
+
+    const float * src0_p = (const float *) ((const char *) src0->data + i01*src0->nb[1] + i02*src0->nb[2] + i03*src0->nb[3]);
+    const float * src1_p = src1 ? (const float *) ((const char *) src1->data + i01*src1->nb[1] + i02*src1->nb[2] + i03*src1->nb[3]) : src0_p;
+
+    if (!src1) {
+        src0_p += swapped ? nc : 0;
+        src1_p += swapped ? 0 : nc;
+    }
+
+    float * y = (float *) ((char *) dst->data + i01*dst->nb[1] + i02*dst->nb[2] + i03*dst->nb[3]);
+
+    ggml_vec_swiglu_f32(i00_end - i00_start, y + i00_start, src0_p + i00_start, src1_p + i00_start);
+}
+
 static void ggml_compute_forward_swiglu_f16(
     const ggml_compute_params * params,
     ggml_tensor * dst) {
@@ -4204,6 +4230,69 @@ void ggml_compute_forward_rms_norm(
     }
 }
 
+// ggml_compute_forward_rms_norm_mul
+
+void ggml_compute_forward_rms_norm_mul_row(
+        const ggml_tensor * dst,
+        int64_t i01, int64_t i02, int64_t i03,
+        int64_t i00_start, int64_t i00_end) {
+
+    const ggml_tensor * norm = dst->src[0];
+    const ggml_tensor * w    = dst->src[1];
+    const ggml_tensor * src0 = norm->src[0];
+
+    const int64_t ne00 = src0->ne[0];
+
+    float eps;
+    memcpy(&eps, norm->op_params, sizeof(float));
+
+    const float * x = (const float *) ((const char *) src0->data + i01*src0->nb[1] + i02*src0->nb[2] + i03*src0->nb[3]);
+          float * y = (float *)       ((char *)       dst->data  + i01*dst->nb[1]  + i02*dst->nb[2]  + i03*dst->nb[3]);
+
+    // the sum covers the whole row even if only a part of it is produced
+    ggml_float sum = 0.0;
+    for (int64_t i00 = 0; i00 < ne00; i00++) {
+        sum += (ggml_float)(x[i00] * x[i00]);
+    }
+
+    const float mean  = sum/ne00;
+    const float scale = 1.0f/sqrtf(mean + eps);
+
+    assert(scale > 0.0f);
+
+    // same order of operations as RMS_NORM followed by MUL
+    const int n = i00_end - i00_start;
+
+    memcpy(y + i00_start, x + i00_start, n*sizeof(float));
+    ggml_vec_scale_f32(n, y + i00_start, scale);
+    ggml_vec_mul_f32  (n, y + i00_start, y + i00_start, (const float *) w->data + i00_start);
+}
+
+void ggml_compute_forward_rms_norm_mul(
+        const ggml_compute_params * params,
+        ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = dst->src[0];
+    const ggml_tensor * w    = dst->src[1];
+
+    GGML_ASSERT(src0->op == GGML_OP_RMS_NORM);
+    GGML_ASSERT(src0->src[0]->type == GGML_TYPE_F32 && w->type == GGML_TYPE_F32 && dst->type == GGML_TYPE_F32);
+    GGML_ASSERT(w->ne[0] == dst->ne[0] && ggml_nrows(w) == 1);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+
+    for (int64_t i03 = 0; i03 < ne03; i03++) {
+        for (int64_t i02 = 0; i02 < ne02; i02++) {
+            for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
+                ggml_compute_forward_rms_norm_mul_row(dst, i01, i02, i03, 0, ne00);
+            }
+        }
+    }
+}
+
 static void ggml_compute_forward_rms_norm_back_f32(
         const ggml_compute_params * params,
         ggml_tensor * dst) {
@@ -8760,6 +8849,382 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     }
 }
 
+// tiled version of ggml_compute_forward_flash_attn_ext_f16
+// each task processes a tile of query positions for all query heads that share a KV head (GQA group),
+// so every K/V row is loaded once per tile instead of once per query row, and the online softmax
+// rescaling is done once per KV tile
+// when there are fewer tiles than threads, the KV positions of each tile are split between threads (split-KV)
+static void ggml_compute_forward_flash_attn_ext_f16_tiled(
+        const ggml_compute_params * params,
+        ggml_tensor * dst) {
+
+    const ggml_tensor * q     = dst->src[0];
+    const ggml_tensor * k     = dst->src[1];
+    const ggml_tensor * v     = dst->src[2];
+    const ggml_tensor * mask  = dst->src[3];
+    const ggml_tensor * sinks = dst->src[4];
+    const ggml_tensor * mblk  = dst->src[5]; // optional block summary of the mask
+
+    GGML_TENSOR_LOCALS(int64_t, neq, q,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nek, k,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbk, k,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nev, v,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbv, v,   nb)
+    GGML_TENSOR_LOCALS(int64_t, ne,  dst, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb)
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t DK = nek0;
+    const int64_t DV = nev0;
+    const int64_t N  = neq1;
+
+    GGML_ASSERT(ne0 == DV);
+    GGML_ASSERT(ne2 == N);
+
+    // input tensor rows must be contiguous
+    GGML_ASSERT(nbq0 == ggml_type_size(q->type));
+    GGML_ASSERT(nbk0 == ggml_type_size(k->type));
+    GGML_ASSERT(nbv0 == ggml_type_size(v->type));
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+
+    // the KV tiles must be aligned with the blocks of the mask summary
+    static_assert(GGML_FA_TILE_KV == GGML_KQ_MASK_BLK, "fattn: KV tile size must match GGML_KQ_MASK_BLK");
+
+    // broadcast factors (K and V are broadcast in the same way)
+    const int64_t rk2 = neq2/nek2;
+    const int64_t rk3 = neq3/nek3;
+
+    GGML_ASSERT(rk2 == neq2/nev2 && rk3 == neq3/nev3);
+
+    // a tile is made of all query heads of a GQA group for np query positions
+    const int64_t np  = MAX(1, GGML_FA_TILE_Q/rk2);
+    const int64_t nr  = MAX(GGML_FA_TILE_Q, rk2); // work buffer rows, must match ggml_graph_plan
+    const int64_t npt = (N + np - 1)/np;          // tiles per KV head
+
+    // parallelize by tiles
+    const int64_t nt = neq3*nek2*npt;
+
+    // split-KV: with fewer tiles than threads (e.g. single sequence decode), the KV positions of each tile are
+    // split in nsplit chunks that are processed by different threads, and the partial results are reduced at the end
+    const int64_t nsplit = nt < nth ? MIN(nth/nt, (nek1 + GGML_FA_TILE_KV - 1)/GGML_FA_TILE_KV) : 1;
+
+    float scale         = 1.0f;
+    float max_bias      = 0.0f;
+    float logit_softcap = 0.0f;
+
+    memcpy(&scale,         (float *) dst->op_params + 0, sizeof(float));
+    memcpy(&max_bias,      (float *) dst->op_params + 1, sizeof(float));
+    memcpy(&logit_softcap, (float *) dst->op_params + 2, sizeof(float));
+
+    if (logit_softcap != 0) {
+        scale /= logit_softcap;
+    }
+
+    const uint32_t n_head      = neq2;
+    const uint32_t n_head_log2 = 1u << (uint32_t) floor(log2(n_head));
+
+    const float m0 = powf(2.0f, -(max_bias       ) / n_head_log2);
+    const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_head_log2);
+
+    ggml_type         const k_vec_dot_type = ggml_get_type_traits_cpu(k->type)->vec_dot_type;
+    ggml_from_float_t const q_to_vec_dot   = ggml_get_type_traits_cpu(k_vec_dot_type)->from_float;
+    ggml_vec_dot_t    const kq_vec_dot     = ggml_get_type_traits_cpu(k->type)->vec_dot;
+    ggml_to_float_t   const v_to_float     = ggml_get_type_traits(v->type)->to_float;
+
+    GGML_ASSERT((                            q_to_vec_dot) && "fattn: unsupported K-type");
+    GGML_ASSERT((v->type == GGML_TYPE_F32 || v_to_float  ) && "fattn: unsupported V-type");
+
+    // softmax(KQ)*V directly from the quantized V rows, one block at a time
+    void (*v_mad_tile)(int, int, float *, size_t, const void *, const float *) = NULL;
+    switch (v->type) {
+        case GGML_TYPE_Q4_0: v_mad_tile = ggml_vec_mad_tile_q4_0; break;
+        case GGML_TYPE_Q4_1: v_mad_tile = ggml_vec_mad_tile_q4_1; break;
+        case GGML_TYPE_Q8_0: v_mad_tile = ggml_vec_mad_tile_q8_0; break;
+        default: break;
+    }
+
+    const size_t q_row_size = ggml_row_size(k_vec_dot_type, DK);
+
+    // per thread work buffer, in floats
+    const int64_t wsize = nr*(DK + DV + GGML_FA_TILE_KV + 2) + DV + CACHE_LINE_SIZE_F32;
+
+    // layout of the work buffer of thread i:
+    //   Q_q   [nr][DK]  Q converted to the vec dot type of K
+    //   VKQ32 [nr][DV]  FP32 VKQ accumulators
+    //   KQ    [nr][GGML_FA_TILE_KV] KQ values of the current KV tile
+    //   M     [nr]      maximum KQ value
+    //   S     [nr]      sum
+    //   V32   [DV]      (temporary) FP32 V row
+    const auto wbuf_VKQ = [&](int64_t i) { return (float *) params->wdata + i*wsize + nr*DK; };
+    const auto wbuf_M   = [&](int64_t i) { return wbuf_VKQ(i) + nr*DV + nr*GGML_FA_TILE_KV; };
+    const auto wbuf_S   = [&](int64_t i) { return wbuf_M(i) + nr; };
+
+    char  * Q_q   = (char *) ((float *) params->wdata + ith*wsize);
+    float * VKQ32 = wbuf_VKQ(ith);
+    float * KQ    = VKQ32 + nr*DV;
+    float * M     = wbuf_M(ith);
+    float * S     = wbuf_S(ith);
+    float * V32   = S + nr;
+
+    GGML_ASSERT(rk2 <= GGML_FA_TILE_Q);
+
+    const ggml_fp16_t * mp[GGML_FA_TILE_Q]; // mask row of each row of the tile
+    const int8_t      * mb[GGML_FA_TILE_Q]; // mask summary row of each row of the tile
+    int8_t              bs[GGML_FA_TILE_Q]; // mask summary of each row for the current KV tile
+    float slope[GGML_FA_TILE_Q];           // ALiBi slope of each row of the tile
+
+    // tile it covers the query positions [ip0, ip1) of all query heads of KV head ik2
+    // the rows of the tile are r = (iq1 - ip0)*rk2 + (iq2 - ik2*rk2)
+    const auto tile_pos = [&](int64_t it, int64_t & iq3, int64_t & ik2, int64_t & ip0, int64_t & ip1) {
+        iq3 = it/(nek2*npt);
+        ik2 = (it - iq3*nek2*npt)/npt;
+        ip0 = (it - iq3*nek2*npt - ik2*npt)*np;
+        ip1 = MIN(ip0 + np, N);
+    };
+
+    // accumulate the KV positions [ic_start, ic_end) of tile it into VKQ32, M and S of this thread
+    const auto process_tile = [&](int64_t it, int64_t ic_start, int64_t ic_end) {
+        int64_t iq3, ik2, ip0, ip1;
+        tile_pos(it, iq3, ik2, ip0, ip1);
+
+        const int64_t ik3 = iq3/rk3;
+
+        const int64_t n_rows = (ip1 - ip0)*rk2;
+
+        for (int64_t r = 0; r < n_rows; ++r) {
+            const int64_t iq1 = ip0 + r/rk2;
+            const int64_t iq2 = ik2*rk2 + r%rk2;
+
+            const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
+            q_to_vec_dot(pq, Q_q + r*q_row_size, DK);
+
+            memset(VKQ32 + r*DV, 0, DV*sizeof(float));
+            M[r] = -INFINITY;
+            S[r] = 0.0f;
+
+            const uint32_t h = iq2; // head index
+            slope[r] = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+            mp[r]    = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]) : NULL;
+            mb[r]    = mblk ? (int8_t      *)((char *) mblk->data + iq1*mblk->nb[1] + (iq2%mblk->ne[2])*mblk->nb[2] + (iq3%mblk->ne[3])*mblk->nb[3]) : NULL;
+        }
+
+        // online softmax / attention, one KV tile at a time
+        // ref: https://arxiv.org/pdf/2112.05682.pdf
+        for (int64_t ic0 = ic_start; ic0 < ic_end; ic0 += GGML_FA_TILE_KV) {
+            const int64_t nc = MIN(GGML_FA_TILE_KV, ic_end - ic0);
+
+            // skip the KV tile if it is fully masked for all rows of the tile, without loading K and V
+            bool skip = mblk != NULL;
+            for (int64_t r = 0; r < n_rows; ++r) {
+                bs[r] = mb[r] ? mb[r][ic0/GGML_KQ_MASK_BLK] : (int8_t) GGML_KQ_MASK_BLK_MIXED;
+                skip  = skip && bs[r] == GGML_KQ_MASK_BLK_MASKED;
+            }
+            if (skip) {
+                continue;
+            }
+
+            // KQ = Q*K^T for the tile, each K row is used by all rows of the tile
+            for (int64_t ic = 0; ic < nc; ++ic) {
+                const char * k_data = (const char *) k->data + ((ic0 + ic)*nbk1 + ik2*nbk2 + ik3*nbk3);
+
+                for (int64_t r = 0; r < n_rows; ++r) {
+                    if (bs[r] == GGML_KQ_MASK_BLK_MASKED) {
+                        KQ[r*GGML_FA_TILE_KV + ic] = -INFINITY;
+                        continue;
+                    }
+
+                    // the mask values of the zero blocks do not need to be read
+                    const float mv = mp[r] && bs[r] != GGML_KQ_MASK_BLK_ZERO ? slope[r]*GGML_CPU_FP16_TO_FP32(mp[r][ic0 + ic]) : 0.0f;
+                    if (mv == -INFINITY) {
+                        KQ[r*GGML_FA_TILE_KV + ic] = -INFINITY;
+                        continue;
+                    }
+
+                    float s; // KQ value
+
+                    kq_vec_dot(DK, &s, 0, k_data, 0, Q_q + r*q_row_size, 0, 1);
+
+                    s = s*scale; // scale KQ value
+
+                    if (logit_softcap != 0.0f) {
+                        s = logit_softcap*tanhf(s);
+                    }
+
+                    KQ[r*GGML_FA_TILE_KV + ic] = s + mv; // apply mask
+                }
+            }
+
+            // update the running max and sum, KQ = expf(KQ - M)
+            for (int64_t r = 0; r < n_rows; ++r) {
+                float * kq = KQ + r*GGML_FA_TILE_KV;
+
+                float Mt = -INFINITY;
+                ggml_vec_max_f32(nc, &Mt, kq);
+
+                if (Mt == -INFINITY) {
+                    // fully masked for this row
+                    memset(kq, 0, nc*sizeof(float));
+                    continue;
+                }
+
+                if (Mt > M[r]) {
+                    // new maximum, scale VKQ and KQ sum with expf(Mold - M)
+                    const float ms = expf(M[r] - Mt);
+
+                    ggml_vec_scale_f32(DV, VKQ32 + r*DV, ms);
+                    S[r] *= ms;
+                    M[r]  = Mt;
+                }
+
+                S[r] += (float) ggml_vec_soft_max_f32(nc, kq, kq, M[r]);
+            }
+
+            // VKQ += softmax(KQ)*V for the tile, each V row is used by all rows of the tile
+            if (v_mad_tile) {
+                float vs[GGML_FA_TILE_Q];
+
+                for (int64_t ic = 0; ic < nc; ++ic) {
+                    const char * v_data = (const char *) v->data + ((ic0 + ic)*nbv1 + ik2*nbv2 + ik3*nbv3);
+
+                    for (int64_t r = 0; r < n_rows; ++r) {
+                        vs[r] = KQ[r*GGML_FA_TILE_KV + ic];
+                    }
+
+                    v_mad_tile(DV, n_rows, VKQ32, DV, v_data, vs);
+                }
+
+                continue;
+            }
+
+            for (int64_t ic = 0; ic < nc; ++ic) {
+                const char * v_data = (const char *) v->data + ((ic0 + ic)*nbv1 + ik2*nbv2 + ik3*nbv3);
+
+                const float * v32 = (const float *) v_data;
+                bool converted = false;
+
+                for (int64_t r = 0; r < n_rows; ++r) {
+                    const float vs = KQ[r*GGML_FA_TILE_KV + ic];
+                    if (vs == 0.0f) {
+                        continue;
+                    }
+
+                    if (v_to_float && !converted) {
+                        if (v->type == GGML_TYPE_F16) {
+                            ggml_cpu_fp16_to_fp32((const ggml_fp16_t *) v_data, V32, DV);
+                        } else {
+                            v_to_float(v_data, V32, DV);
+                        }
+                        v32 = V32;
+                        converted = true;
+                    }
+
+                    ggml_vec_mad_f32(DV, VKQ32 + r*DV, v32, vs);
+                }
+            }
+        }
+    };
+
+    // apply the sinks, normalize and store row r of tile it
+    const auto store_row = [&](int64_t it, int64_t r, float * VKQ, float Mr, float Sr) {
+        int64_t iq3, ik2, ip0, ip1;
+        tile_pos(it, iq3, ik2, ip0, ip1);
+
+        const int64_t iq1 = ip0 + r/rk2;
+        const int64_t iq2 = ik2*rk2 + r%rk2;
+
+        // sinks
+        if (sinks) {
+            const float s = ((float *)((char *) sinks->data))[iq2];
+
+            float ms = 1.0f;
+            float vs = 1.0f;
+
+            if (s > Mr) {
+                ms = expf(Mr - s);
+                ggml_vec_scale_f32(DV, VKQ, ms);
+            } else {
+                vs = expf(s - Mr);
+            }
+
+            Sr = Sr*ms + vs;
+        }
+
+        // V /= S
+        const float S_inv = Sr == 0.0f ? 0.0f : 1.0f/Sr;
+        ggml_vec_scale_f32(DV, VKQ, S_inv);
+
+        // permute(0, 2, 1, 3)
+        memcpy((char *) dst->data + (iq3*ne2*ne1 + iq2 + iq1*ne1)*nb1, VKQ, nb1);
+    };
+
+    if (nsplit == 1) {
+        const int64_t dt  = (nt + nth - 1)/nth;
+        const int64_t it0 = dt*ith;
+        const int64_t it1 = MIN(it0 + dt, nt);
+
+        for (int64_t it = it0; it < it1; ++it) {
+            int64_t iq3, ik2, ip0, ip1;
+            tile_pos(it, iq3, ik2, ip0, ip1);
+
+            process_tile(it, 0, nek1);
+
+            for (int64_t r = 0; r < (ip1 - ip0)*rk2; ++r) {
+                store_row(it, r, VKQ32 + r*DV, M[r], S[r]);
+            }
+        }
+
+        return;
+    }
+
+    // thread i processes chunk i%nsplit of tile i/nsplit, the chunks are multiples of the KV tile
+    const int64_t ck = ((nek1 + nsplit - 1)/nsplit + GGML_FA_TILE_KV - 1)/GGML_FA_TILE_KV*GGML_FA_TILE_KV;
+
+    if (ith < nt*nsplit) {
+        const int64_t is = ith%nsplit;
+
+        process_tile(ith/nsplit, MIN(is*ck, nek1), MIN((is + 1)*ck, nek1));
+    }
+
+    ggml_barrier(params->threadpool);
+
+    // reduce the partial results of the chunks, V32 is not read by other threads and is used as the accumulator
+    for (int64_t it = ith; it < nt; it += nth) {
+        int64_t iq3, ik2, ip0, ip1;
+        tile_pos(it, iq3, ik2, ip0, ip1);
+
+        for (int64_t r = 0; r < (ip1 - ip0)*rk2; ++r) {
+            float Mr = -INFINITY;
+            for (int64_t is = 0; is < nsplit; ++is) {
+                Mr = MAX(Mr, wbuf_M(it*nsplit + is)[r]);
+            }
+
+            float Sr = 0.0f;
+            memset(V32, 0, DV*sizeof(float));
+
+            if (Mr != -INFINITY) {
+                for (int64_t is = 0; is < nsplit; ++is) {
+                    const int64_t i = it*nsplit + is;
+
+                    const float ms = expf(wbuf_M(i)[r] - Mr);
+                    if (ms == 0.0f) {
+                        continue;
+                    }
+
+                    Sr += wbuf_S(i)[r]*ms;
+                    ggml_vec_mad_f32(DV, V32, wbuf_VKQ(i) + r*DV, ms);
+                }
+            }
+
+            store_row(it, r, V32, Mr, Sr);
+        }
+    }
+}
+
 void ggml_compute_forward_flash_attn_ext(
         const ggml_compute_params * params,
         ggml_tensor * dst) {
@@ -8767,8 +9232,28 @@ void ggml_compute_forward_flash_attn_ext(
         case GGML_PREC_DEFAULT:
         case GGML_PREC_F32:
             {
+                const ggml_tensor * q = dst->src[0];
+                const ggml_tensor * k = dst->src[1];
+                const ggml_tensor * v = dst->src[2];
+
+                const int64_t rk2 = q->ne[2]/k->ne[2];
+                const int64_t np  = MAX(1, GGML_FA_TILE_Q/rk2);
+
+                // number of tiles of the tiled version
+                const int64_t nt = q->ne[3]*k->ne[2]*((q->ne[1] + np - 1)/np);
+
+                // the tiled version shares K/V rows between query rows,
+                // and splits the KV sequence between threads when there are fewer tiles than threads
+                const bool use_tiled =
+                    (rk2 > 1 || q->ne[1] > 1 || nt < params->nth) && rk2 <= GGML_FA_TILE_Q &&
+                    k->ne[2] == v->ne[2] && k->ne[3] == v->ne[3];
+
                 // uses F32 accumulators
-                ggml_compute_forward_flash_attn_ext_f16(params, dst);
+                if (use_tiled) {
+                    ggml_compute_forward_flash_attn_ext_f16_tiled(params, dst);
+                } else {
+                    ggml_compute_forward_flash_attn_ext_f16(params, dst);
+                }
             } break;
         default:
             {
@@ -23,6 +23,10 @@ static const size_t CACHE_LINE_SIZE_F32 = CACHE_LINE_SIZE/sizeof(float);
 // Work buffer size for im2col operations in CONV2D
 #define GGML_IM2COL_WORK_SIZE (16 * 1024 * 1024)
 
+// Tile sizes of the tiled flash attention
+#define GGML_FA_TILE_Q  32 // max query rows per tile (query heads of a GQA group x query positions)
+#define GGML_FA_TILE_KV GGML_KQ_MASK_BLK // KV positions per tile, matches the blocks of the mask summary
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -110,6 +114,19 @@ void ggml_compute_forward_cross_entropy_loss_back(const struct ggml_compute_para
 void ggml_compute_forward_opt_step_adamw(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_mul_mat(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_opt_step_sgd(const struct ggml_compute_params * params, struct ggml_tensor * dst);
+
+// fused ops
+
+// dst = MUL(RMS_NORM(x), w) in a single pass
+void ggml_compute_forward_rms_norm_mul(const struct ggml_compute_params * params, struct ggml_tensor * dst);
+
+// compute elements [i00_start, i00_end) of row (i01, i02, i03) of dst
+// used to produce the src1 rows of a fused MUL_MAT while they are converted to vec_dot_type
+typedef void (*ggml_compute_forward_row_t)(const struct ggml_tensor * dst, int64_t i01, int64_t i02, int64_t i03, int64_t i00_start, int64_t i00_end);
+
+void ggml_compute_forward_rms_norm_mul_row(const struct ggml_tensor * dst, int64_t i01, int64_t i02, int64_t i03, int64_t i00_start, int64_t i00_end);
+void ggml_compute_forward_swiglu_row(const struct ggml_tensor * dst, int64_t i01, int64_t i02, int64_t i03, int64_t i00_start, int64_t i00_end);
+
 #ifdef __cplusplus
 }
 #endif
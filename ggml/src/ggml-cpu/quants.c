@@ -110,6 +110,91 @@ void quantize_row_q8_K_generic(const float * GGML_RESTRICT x, void * GGML_RESTRI
     quantize_row_q8_K_ref(x, y, k);
 }
 
+//===================================== Multiply-add =================================
+
+// the quantized row is dequantized one block at a time and the block is accumulated into all the rows,
+// so that the flash attention can compute softmax(KQ)*V for a tile of rows without converting V to F32
+
+static inline void ggml_vec_mad_tile_block(int nr, float * GGML_RESTRICT y, size_t ys, const float * GGML_RESTRICT x, int qk, const float * GGML_RESTRICT v) {
+    for (int r = 0; r < nr; ++r) {
+        if (v[r] == 0.0f) {
+            continue;
+        }
+
+        float * GGML_RESTRICT yr = y + r*ys;
+
+        for (int j = 0; j < qk; ++j) {
+            yr[j] += v[r]*x[j];
+        }
+    }
+}
+
+void ggml_vec_mad_tile_q4_0(int n, int nr, float * GGML_RESTRICT y, size_t ys, const void * GGML_RESTRICT vx, const float * GGML_RESTRICT v) {
+    const int qk = QK4_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q4_0 * GGML_RESTRICT x = vx;
+
+    float tmp[QK4_0];
+
+    for (int ib = 0; ib < nb; ++ib) {
+        const float d = GGML_CPU_FP16_TO_FP32(x[ib].d);
+
+        for (int j = 0; j < qk/2; ++j) {
+            tmp[j       ] = d*((x[ib].qs[j] & 0x0F) - 8);
+            tmp[j + qk/2] = d*((x[ib].qs[j] >>   4) - 8);
+        }
+
+        ggml_vec_mad_tile_block(nr, y + ib*qk, ys, tmp, qk, v);
+    }
+}
+
+void ggml_vec_mad_tile_q4_1(int n, int nr, float * GGML_RESTRICT y, size_t ys, const void * GGML_RESTRICT vx, const float * GGML_RESTRICT v) {
+    const int qk = QK4_1;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q4_1 * GGML_RESTRICT x = vx;
+
+    float tmp[QK4_1];
+
+    for (int ib = 0; ib < nb; ++ib) {
+        const float d = GGML_CPU_FP16_TO_FP32(x[ib].d);
+        const float m = GGML_CPU_FP16_TO_FP32(x[ib].m);
+
+        for (int j = 0; j < qk/2; ++j) {
+            tmp[j       ] = d*(x[ib].qs[j] & 0x0F) + m;
+            tmp[j + qk/2] = d*(x[ib].qs[j] >>   4) + m;
+        }
+
+        ggml_vec_mad_tile_block(nr, y + ib*qk, ys, tmp, qk, v);
+    }
+}
+
+void ggml_vec_mad_tile_q8_0(int n, int nr, float * GGML_RESTRICT y, size_t ys, const void * GGML_RESTRICT vx, const float * GGML_RESTRICT v) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q8_0 * GGML_RESTRICT x = vx;
+
+    float tmp[QK8_0];
+
+    for (int ib = 0; ib < nb; ++ib) {
+        const float d = GGML_CPU_FP16_TO_FP32(x[ib].d);
+
+        for (int j = 0; j < qk; ++j) {
+            tmp[j] = d*x[ib].qs[j];
+        }
+
+        ggml_vec_mad_tile_block(nr, y + ib*qk, ys, tmp, qk, v);
+    }
+}
+
 //===================================== Dot products =================================
 
 void ggml_vec_dot_q4_0_q8_0_generic(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, size_t bx, const void * GGML_RESTRICT vy, size_t by, int nrc) {
@@ -62,6 +62,11 @@ void ggml_vec_dot_iq4_nl_q8_0 (int n, float * GGML_RESTRICT s, size_t bs, const
 void ggml_vec_dot_iq4_xs_q8_K (int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, size_t bx, const void * GGML_RESTRICT vy, size_t by, int nrc);
 void ggml_vec_dot_iq3_s_q8_K  (int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, size_t bx, const void * GGML_RESTRICT vy, size_t by, int nrc);
 
+// Multiply-add of a quantized row into nr F32 rows: y[r*ys + i] += v[r]*x[i]
+void ggml_vec_mad_tile_q4_0(int n, int nr, float * GGML_RESTRICT y, size_t ys, const void * GGML_RESTRICT vx, const float * GGML_RESTRICT v);
+void ggml_vec_mad_tile_q4_1(int n, int nr, float * GGML_RESTRICT y, size_t ys, const void * GGML_RESTRICT vx, const float * GGML_RESTRICT v);
+void ggml_vec_mad_tile_q8_0(int n, int nr, float * GGML_RESTRICT y, size_t ys, const void * GGML_RESTRICT vx, const float * GGML_RESTRICT v);
+
 // Generic implementation
 void quantize_row_q8_0_generic(const float * GGML_RESTRICT x, void * GGML_RESTRICT vy, int64_t k);
 void quantize_row_q8_1_generic(const float * GGML_RESTRICT x, void * GGML_RESTRICT vy, int64_t k);
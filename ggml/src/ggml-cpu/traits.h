@@ -11,6 +11,8 @@ extern "C" {
 // return true if op part of extra "accelerator"
 bool ggml_cpu_extra_compute_forward(struct ggml_compute_params * params, struct ggml_tensor * op);
 bool ggml_cpu_extra_work_size(int n_threads, const struct ggml_tensor * op, size_t * size);
+// return true if op may be handled by an extra "accelerator"
+bool ggml_cpu_extra_has_tensor_traits(const struct ggml_tensor * op);
 
 #ifdef __cplusplus
 }
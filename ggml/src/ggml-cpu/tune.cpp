@@ -0,0 +1,303 @@
+#include "tune.h"
+
+#include "ggml-impl.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+// the matmul shapes are bucketed by rounding M, N and K up to the next power of 2
+// the key packs: src0 type (8 bits), src1 type (8 bits), log2 M, log2 N, log2 K (6 bits each), n_threads (16 bits)
+
+static uint32_t ggml_cpu_tune_log2(int64_t n) {
+    uint32_t res = 0;
+    while (res < 63 && (int64_t(1) << res) < n) {
+        res++;
+    }
+    return res;
+}
+
+static uint64_t ggml_cpu_tune_key(ggml_type type0, ggml_type type1, uint32_t lm, uint32_t ln, uint32_t lk, int nth) {
+    return (uint64_t(type0)          << 56) |
+           (uint64_t(type1)          << 48) |
+           (uint64_t(lm & 0x3f)      << 36) |
+           (uint64_t(ln & 0x3f)      << 28) |
+           (uint64_t(lk & 0x3f)      << 20) |
+           (uint64_t(nth & 0xffff));
+}
+
+static uint64_t ggml_cpu_tune_key(const ggml_tensor * dst, int nth) {
+    const ggml_tensor * src0 = dst->src[0];
+    const ggml_tensor * src1 = dst->src[1];
+
+    const int64_t m = dst->ne[0];
+    const int64_t n = dst->ne[1]*dst->ne[2]*dst->ne[3];
+    const int64_t k = src0->ne[0];
+
+    return ggml_cpu_tune_key(src0->type, src1->type, ggml_cpu_tune_log2(m), ggml_cpu_tune_log2(n), ggml_cpu_tune_log2(k), nth);
+}
+
+static const ggml_cpu_mm_config ggml_cpu_tune_candidates[] = {
+    { -1, true  },
+    { -1, false },
+    {  0, false },
+    { 16, false },
+    { 32, false },
+    { 64, false },
+    {128, false },
+};
+
+struct ggml_cpu_tune_state {
+    std::atomic<int> mode { GGML_CPU_TUNE_MODE_OFF };
+
+    // only modified in GGML_CPU_TUNE_MODE_TUNE, where the lookups are done under the mutex
+    std::mutex mutex;
+    std::unordered_map<uint64_t, ggml_cpu_mm_config> table;
+
+    // GGML_CPU_TUNE_FILE, empty if not set
+    std::string fname;
+    bool        dirty = false;
+};
+
+static ggml_cpu_tune_state & ggml_cpu_tune_get_state() {
+    static ggml_cpu_tune_state state;
+    return state;
+}
+
+int ggml_cpu_tune_n_candidates(void) {
+#ifdef GGML_USE_LLAMAFILE
+    return (int) (sizeof(ggml_cpu_tune_candidates)/sizeof(ggml_cpu_tune_candidates[0]));
+#else
+    // without llamafile the first two candidates are the same
+    return (int) (sizeof(ggml_cpu_tune_candidates)/sizeof(ggml_cpu_tune_candidates[0])) - 1;
+#endif
+}
+
+ggml_cpu_mm_config ggml_cpu_tune_get_candidate(int i) {
+#ifdef GGML_USE_LLAMAFILE
+    return ggml_cpu_tune_candidates[i];
+#else
+    return ggml_cpu_tune_candidates[i + 1];
+#endif
+}
+
+bool ggml_cpu_tune_lookup(const ggml_tensor * dst, int nth, ggml_cpu_mm_config * cfg) {
+    auto & state = ggml_cpu_tune_get_state();
+
+    const uint64_t key = ggml_cpu_tune_key(dst, nth);
+
+    if (state.mode.load(std::memory_order_relaxed) == GGML_CPU_TUNE_MODE_TUNE) {
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        auto it = state.table.find(key);
+        if (it == state.table.end()) {
+            return false;
+        }
+        *cfg = it->second;
+        return true;
+    }
+
+    // the table is not modified in the other modes
+    auto it = state.table.find(key);
+    if (it == state.table.end()) {
+        return false;
+    }
+    *cfg = it->second;
+    return true;
+}
+
+void ggml_cpu_tune_insert(const ggml_tensor * dst, int nth, ggml_cpu_mm_config cfg) {
+    auto & state = ggml_cpu_tune_get_state();
+
+    GGML_ASSERT(state.mode.load(std::memory_order_relaxed) == GGML_CPU_TUNE_MODE_TUNE);
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    state.table[ggml_cpu_tune_key(dst, nth)] = cfg;
+    state.dirty = true;
+}
+
+void ggml_cpu_tune_init(void) {
+    auto & state = ggml_cpu_tune_get_state();
+
+    const char * fname = getenv("GGML_CPU_TUNE_FILE");
+    const char * mode  = getenv("GGML_CPU_TUNE");
+
+    if (fname) {
+        state.fname = fname;
+
+        // a missing file is not an error when tuning, it is created on flush
+        FILE * f = fopen(fname, "r");
+        if (f) {
+            fclose(f);
+            if (ggml_cpu_tune_load(fname)) {
+                state.mode = GGML_CPU_TUNE_MODE_USE;
+            }
+        }
+    }
+
+    if (mode) {
+        if (strcmp(mode, "tune") == 0 || strcmp(mode, "1") == 0) {
+            state.mode = GGML_CPU_TUNE_MODE_TUNE;
+        } else if (strcmp(mode, "use") == 0) {
+            state.mode = GGML_CPU_TUNE_MODE_USE;
+        } else if (strcmp(mode, "off") == 0 || strcmp(mode, "0") == 0) {
+            state.mode = GGML_CPU_TUNE_MODE_OFF;
+        } else {
+            GGML_LOG_WARN("%s: invalid GGML_CPU_TUNE value '%s', expected off, use or tune\n", __func__, mode);
+        }
+    }
+}
+
+void ggml_cpu_tune_flush(void) {
+    auto & state = ggml_cpu_tune_get_state();
+
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.fname.empty() || !state.dirty) {
+            return;
+        }
+    }
+
+    ggml_cpu_tune_save(state.fname.c_str());
+}
+
+//
+// public API
+//
+
+void ggml_cpu_tune_set_mode(enum ggml_cpu_tune_mode mode) {
+    ggml_cpu_tune_get_state().mode = mode;
+}
+
+enum ggml_cpu_tune_mode ggml_cpu_tune_get_mode(void) {
+    return (enum ggml_cpu_tune_mode) ggml_cpu_tune_get_state().mode.load(std::memory_order_relaxed);
+}
+
+int ggml_cpu_tune_n_entries(void) {
+    auto & state = ggml_cpu_tune_get_state();
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return (int) state.table.size();
+}
+
+// format: one entry per line
+//   <src0 type> <src1 type> <M> <N> <K> <n_threads> <llamafile> <chunk_size>
+// M, N and K are the upper bounds of the buckets, lines starting with # are comments
+
+bool ggml_cpu_tune_load(const char * fname) {
+    auto & state = ggml_cpu_tune_get_state();
+
+    std::ifstream file(fname);
+    if (!file) {
+        GGML_LOG_ERROR("%s: failed to open %s\n", __func__, fname);
+        return false;
+    }
+
+    auto parse_type = [](const std::string & name, ggml_type & type) {
+        for (int t = 0; t < GGML_TYPE_COUNT; ++t) {
+            const char * tname = ggml_type_name((ggml_type) t);
+            if (tname && name == tname) {
+                type = (ggml_type) t;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    std::unordered_map<uint64_t, ggml_cpu_mm_config> entries;
+
+    std::string line;
+    int         line_no = 0;
+
+    while (std::getline(file, line)) {
+        line_no++;
+
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream ss(line);
+
+        std::string name0;
+        std::string name1;
+        int64_t     m;
+        int64_t     n;
+        int64_t     k;
+        int         nth;
+        int         llamafile;
+        int         chunk_size;
+
+        ggml_type type0;
+        ggml_type type1;
+
+        if (!(ss >> name0 >> name1 >> m >> n >> k >> nth >> llamafile >> chunk_size) ||
+            !parse_type(name0, type0) || !parse_type(name1, type1) ||
+            m <= 0 || n <= 0 || k <= 0 || nth <= 0 || nth > 0xffff || chunk_size < -1) {
+            GGML_LOG_ERROR("%s: %s:%d: invalid entry '%s'\n", __func__, fname, line_no, line.c_str());
+            return false;
+        }
+
+        const uint64_t key = ggml_cpu_tune_key(type0, type1, ggml_cpu_tune_log2(m), ggml_cpu_tune_log2(n), ggml_cpu_tune_log2(k), nth);
+
+        entries[key] = { chunk_size, llamafile != 0 };
+    }
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    for (const auto & e : entries) {
+        state.table[e.first] = e.second;
+    }
+
+    GGML_LOG_INFO("%s: loaded %zu matmul configurations from %s\n", __func__, entries.size(), fname);
+
+    return true;
+}
+
+bool ggml_cpu_tune_save(const char * fname) {
+    auto & state = ggml_cpu_tune_get_state();
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    FILE * f = fopen(fname, "w");
+    if (!f) {
+        GGML_LOG_ERROR("%s: failed to open %s\n", __func__, fname);
+        return false;
+    }
+
+    // sorted by key for stable diffs
+    const std::map<uint64_t, ggml_cpu_mm_config> sorted(state.table.begin(), state.table.end());
+
+    fprintf(f, "# ggml-cpu matmul configurations, the results are specific to the machine they were measured on\n");
+    fprintf(f, "# src0_type src1_type M N K n_threads llamafile chunk_size\n");
+
+    for (const auto & e : sorted) {
+        const uint64_t key = e.first;
+
+        fprintf(f, "%s %s %lld %lld %lld %d %d %d\n",
+                ggml_type_name((ggml_type) ((key >> 56) & 0xff)),
+                ggml_type_name((ggml_type) ((key >> 48) & 0xff)),
+                1LL << ((key >> 36) & 0x3f),
+                1LL << ((key >> 28) & 0x3f),
+                1LL << ((key >> 20) & 0x3f),
+                (int) (key & 0xffff),
+                e.second.llamafile ? 1 : 0,
+                e.second.chunk_size);
+    }
+
+    const bool ok = ferror(f) == 0;
+    fclose(f);
+
+    if (ok) {
+        state.dirty = false;
+    }
+
+    return ok;
+}
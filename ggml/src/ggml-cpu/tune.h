@@ -0,0 +1,38 @@
+#pragma once
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// how MUL_MAT distributes its work across the threads
+struct ggml_cpu_mm_config {
+    int32_t chunk_size; // -1: default heuristic, 0: one chunk per thread, > 0: chunks of chunk_size x chunk_size rows
+    bool    llamafile;  // try the llamafile sgemm kernels first
+};
+
+#define GGML_CPU_MM_CONFIG_DEFAULT ((struct ggml_cpu_mm_config) { -1, true })
+
+// candidate configurations that are benchmarked when tuning, the first one is the default
+int                       ggml_cpu_tune_n_candidates(void);
+struct ggml_cpu_mm_config ggml_cpu_tune_get_candidate(int i);
+
+// look up the configuration of a MUL_MAT node computed with nth threads
+// returns false if the shape is not in the table
+bool ggml_cpu_tune_lookup(const struct ggml_tensor * dst, int nth, struct ggml_cpu_mm_config * cfg);
+void ggml_cpu_tune_insert(const struct ggml_tensor * dst, int nth, struct ggml_cpu_mm_config cfg);
+
+// reads GGML_CPU_TUNE and GGML_CPU_TUNE_FILE
+void ggml_cpu_tune_init(void);
+
+// write the table back to GGML_CPU_TUNE_FILE if new shapes have been tuned
+void ggml_cpu_tune_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,10 +4,15 @@
 #include "ggml-cpp.h"
 
 #include <cinttypes>
+#include <cmath>
+#include <deque>
+#include <list>
 #include <string>
 #include <vector>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <unordered_map>
 #include <unordered_set>
 #ifdef _WIN32
@@ -26,10 +31,18 @@
 #  include <netdb.h>
 #  include <unistd.h>
 #endif
+#if !defined(_WIN32) && !defined(__ANDROID__)
+#  define RPC_USE_SHM
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+#include <atomic>
 #include <cstring>
 #include <fstream>
 #include <filesystem>
 #include <algorithm>
+#include <random>
 
 namespace fs = std::filesystem;
 
@@ -42,11 +55,68 @@ using ssize_t = __int64;
 typedef int sockfd_t;
 #endif
 
+// response of an asynchronous command, received on synchronize or before the response of the next synchronous command
+struct rpc_pending_rsp {
+    uint8_t cmd;
+    void *  output;
+    size_t  output_size;
+    // RPC_CMD_GET_TENSOR_SHM: the data is copied from the download ring to dst when the response is received
+    // RPC_CMD_GET_TENSOR_CODEC: the response is decoded to f32 and written to dst
+    // RPC_CMD_GRAPH_COMPUTE, RPC_CMD_GRAPH_RECOMPUTE: dst is the ggml_status of the backend, set if the graph failed
+    void *   dst  = nullptr;
+    uint64_t pos  = 0;
+    uint64_t size = 0;
+    ggml_type codec = GGML_TYPE_F32;
+};
+
+// Shared memory between a client and a server on the same host, the tensor data of SET_TENSOR and GET_TENSOR is
+// exchanged through it instead of the socket
+// layout: | rpc_shm_header | upload ring (RPC_SHM_RING_SIZE) | download ring (RPC_SHM_RING_SIZE) |
+// The positions in the rings grow monotonically, the data of a command is never split at the end of a ring
+// upload ring  : written by the client, up_tail is advanced by the server after the data has been copied
+// download ring: written by the server, the space is released by the client when the response is received
+struct rpc_shm_header {
+    uint64_t magic;
+    std::atomic<uint64_t> up_tail;
+    uint8_t padding[48];
+};
+
+static constexpr size_t RPC_SHM_RING_SIZE = 32ull * 1024ull * 1024ull; // 32 MiB
+static constexpr size_t RPC_SHM_SIZE      = sizeof(rpc_shm_header) + 2*RPC_SHM_RING_SIZE;
+
+// graph cached by the server, identified on the client by its tensors (see graph_key) and on the server by the hash
+// of its serialization
+struct rpc_graph_id {
+    std::vector<uint64_t> key;
+    uint64_t id;
+};
+
 // cross-platform socket
 struct socket_t {
     sockfd_t fd;
+    // the server executes the commands and sends their responses in order, so the commands are identified by their
+    // position in the stream: n_sent is the id of the last command with a response, n_recv of the last response
+    uint64_t n_sent = 0;
+    uint64_t n_recv = 0;
+    std::deque<rpc_pending_rsp> pending;
+    // encoding of the f32 activations on the wire, see rpc_codec_init
+    ggml_type codec = GGML_TYPE_F32;
+    // shared memory with a server on the same host, nullptr if not used
+    uint8_t * shm = nullptr;
+    uint64_t shm_up_head   = 0;
+    uint64_t shm_down_head = 0;
+    uint64_t shm_down_tail = 0;
+    // the server supports RPC_CMD_GRAPH_RECOMPUTE
+    bool graph_recompute = false;
+    // graphs cached by the server, most recently used first
+    std::list<rpc_graph_id> graph_ids;
     socket_t(sockfd_t fd) : fd(fd) {}
     ~socket_t() {
+#ifdef RPC_USE_SHM
+        if (shm) {
+            munmap(shm, RPC_SHM_SIZE);
+        }
+#endif
         GGML_PRINT_DEBUG("[%s] closing socket %d\n", __func__, this->fd);
 #ifdef _WIN32
         closesocket(this->fd);
@@ -56,6 +126,14 @@ struct socket_t {
     }
 };
 
+// see ggml_backend_rpc_stats
+static struct {
+    std::atomic<uint64_t> bytes_sent { 0 };
+    std::atomic<uint64_t> bytes_recv { 0 };
+    std::atomic<uint64_t> bytes_shm  { 0 };
+    std::atomic<uint64_t> n_codec    { 0 };
+} rpc_stats;
+
 // macro for nicer error messages on server crash
 #define RPC_STATUS_ASSERT(x) if (!(x)) GGML_ABORT("Remote RPC server crashed or returned malformed response")
 
@@ -99,12 +177,23 @@ enum rpc_cmd {
     RPC_CMD_INIT_TENSOR,
     RPC_CMD_GET_ALLOC_SIZE,
     RPC_CMD_HELLO,
+    RPC_CMD_GRAPH_RECOMPUTE,
+    RPC_CMD_SHM_ATTACH,
+    RPC_CMD_SET_TENSOR_SHM,
+    RPC_CMD_GET_TENSOR_SHM,
+    RPC_CMD_SET_TENSOR_CODEC,
+    RPC_CMD_GET_TENSOR_CODEC,
     RPC_CMD_COUNT,
 };
 
 // Try RPC_CMD_SET_TENSOR_HASH first when data size is larger than this threshold
 const size_t HASH_THRESHOLD = 10 * 1024 * 1024;
 
+// Number of graphs cached by the server, the graphs are identified by the hash of their serialization
+// Both sides evict the least recently used graph when the cache is full and clear it when a buffer is freed,
+// so the client always knows which graphs can be computed with RPC_CMD_GRAPH_RECOMPUTE
+const size_t GRAPH_CACHE_SIZE = 16;
+
 struct rpc_msg_hello_rsp {
     uint8_t major;
     uint8_t minor;
@@ -186,6 +275,41 @@ struct rpc_msg_graph_compute_rsp {
     uint8_t result;
 };
 
+struct rpc_msg_graph_recompute_req {
+    uint64_t id;
+};
+
+struct rpc_msg_shm_attach_req {
+    char name[64];
+    uint64_t size;
+    uint64_t magic;
+};
+
+struct rpc_msg_shm_attach_rsp {
+    uint8_t result;
+};
+
+struct rpc_msg_set_tensor_shm_req {
+    rpc_tensor tensor;
+    uint64_t offset;
+    uint64_t pos;
+    uint64_t size;
+};
+
+struct rpc_msg_get_tensor_shm_req {
+    rpc_tensor tensor;
+    uint64_t offset;
+    uint64_t pos;
+    uint64_t size;
+};
+
+struct rpc_msg_get_tensor_codec_req {
+    rpc_tensor tensor;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t codec;
+};
+
 struct rpc_msg_get_device_memory_rsp {
     uint64_t free_mem;
     uint64_t total_mem;
@@ -209,6 +333,10 @@ struct ggml_backend_rpc_buffer_type_context {
 struct ggml_backend_rpc_context {
     std::string endpoint;
     std::string name;
+    // the graphs are computed asynchronously, the responses are received in compute_rsp
+    rpc_msg_graph_compute_rsp compute_rsp;
+    // first failure of a graph whose response was received, returned by the next graph_compute or fatal in synchronize
+    enum ggml_status compute_status;
 };
 
 struct ggml_backend_rpc_buffer_context {
@@ -231,6 +359,25 @@ static uint64_t fnv_hash(const uint8_t * data, size_t len) {
     return hash;
 }
 
+// FNV-1a over 64-bit words, used for the serialized graphs
+static uint64_t fnv_hash64(const uint8_t * data, size_t len) {
+    const uint64_t fnv_prime = 0x100000001b3ULL;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash ^= word;
+        hash *= fnv_prime;
+    }
+    for (; i < len; ++i) {
+        hash ^= data[i];
+        hash *= fnv_prime;
+    }
+    return hash;
+}
+
 static std::shared_ptr<socket_t> make_socket(sockfd_t fd) {
 #ifdef _WIN32
     if (fd == INVALID_SOCKET) {
@@ -412,15 +559,86 @@ static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cm
     if (!send_data(sock->fd, input, input_size)) {
         return false;
     }
+    rpc_stats.bytes_sent += sizeof(cmd_byte) + sizeof(input_size) + input_size;
     return true;
 }
 
+// Send a command without waiting for its response, the response is written to output by recv_pending
+static bool send_rpc_cmd_async(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size,
+                               void * output, size_t output_size) {
+    if (!send_rpc_cmd(sock, cmd, input, input_size)) {
+        return false;
+    }
+    sock->pending.push_back({ (uint8_t) cmd, output, output_size });
+    sock->n_sent++;
+    return true;
+}
+
+// receive the responses of the asynchronous commands up to and including the command with the given id
+static bool recv_pending(const std::shared_ptr<socket_t> & sock, uint64_t id) {
+    while (sock->n_recv < id) {
+        GGML_ASSERT(!sock->pending.empty());
+        const rpc_pending_rsp rsp = sock->pending.front();
+        sock->pending.pop_front();
+        if (rsp.cmd == RPC_CMD_GET_TENSOR_CODEC) {
+            // response: | codec (4 bytes) | encoded data |, the codec is f32 if the data could not be encoded
+            std::vector<uint8_t> response;
+            if (!recv_msg(sock->fd, response)) {
+                return false;
+            }
+            rpc_stats.bytes_recv += sizeof(uint64_t) + response.size();
+            uint32_t codec = GGML_TYPE_COUNT;
+            if (response.size() >= sizeof(codec)) {
+                memcpy(&codec, response.data(), sizeof(codec));
+            }
+            const size_t n = rsp.size/sizeof(float);
+            if (codec == GGML_TYPE_F32 && response.size() == sizeof(codec) + rsp.size) {
+                memcpy(rsp.dst, response.data() + sizeof(codec), rsp.size);
+            } else if (codec == (uint32_t) rsp.codec && response.size() == sizeof(codec) + ggml_row_size(rsp.codec, n)) {
+                ggml_get_type_traits(rsp.codec)->to_float(response.data() + sizeof(codec), (float *) rsp.dst, n);
+                rpc_stats.n_codec++;
+            } else {
+                return false;
+            }
+        } else if (!recv_msg(sock->fd, rsp.output, rsp.output_size)) {
+            return false;
+        } else {
+            rpc_stats.bytes_recv += sizeof(uint64_t) + rsp.output_size;
+        }
+        sock->n_recv++;
+        if (rsp.cmd == RPC_CMD_GET_TENSOR_SHM) {
+            const uint8_t * ring = sock->shm + sizeof(rpc_shm_header) + RPC_SHM_RING_SIZE;
+            memcpy(rsp.dst, ring + rsp.pos % RPC_SHM_RING_SIZE, rsp.size);
+            sock->shm_down_tail = rsp.pos + rsp.size;
+        }
+        if (rsp.cmd == RPC_CMD_GRAPH_COMPUTE || rsp.cmd == RPC_CMD_GRAPH_RECOMPUTE) {
+            const rpc_msg_graph_compute_rsp * response = (const rpc_msg_graph_compute_rsp *) rsp.output;
+            enum ggml_status * compute_status = (enum ggml_status *) rsp.dst;
+            if (response->result != GGML_STATUS_SUCCESS) {
+                GGML_LOG_ERROR("%s: remote graph compute failed with status %d\n", __func__, response->result);
+                if (*compute_status == GGML_STATUS_SUCCESS) {
+                    *compute_status = (enum ggml_status) response->result;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static bool recv_pending(const std::shared_ptr<socket_t> & sock) {
+    return recv_pending(sock, sock->n_sent);
+}
+
 // RPC request : | rpc_cmd (1 byte) | request_size (8 bytes) | request_data (request_size bytes) |
 // RPC response: | response_size (8 bytes) | response_data (response_size bytes) |
 static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cmd, const void * input, size_t input_size, void * output, size_t output_size) {
     if (!send_rpc_cmd(sock, cmd, input, input_size)) {
         return false;
     }
+    // the server processes the commands in order, the responses of the asynchronous commands come first
+    if (!recv_pending(sock)) {
+        return false;
+    }
     // TODO: currently the output_size is always known, do we need support for commands with variable output size?
     // even if we do, we can skip sending output_size from the server for commands with known output size
     uint64_t out_size;
@@ -433,11 +651,133 @@ static bool send_rpc_cmd(const std::shared_ptr<socket_t> & sock, enum rpc_cmd cm
     if (!recv_data(sock->fd, output, output_size)) {
         return false;
     }
+    rpc_stats.bytes_recv += sizeof(out_size) + output_size;
     return true;
 }
 
 // RPC client-side implementation
 
+// GGML_RPC_CODEC selects a lossy encoding of the f32 activations that are sent over the network
+// weights and other tensors are not affected
+static ggml_type rpc_codec_init() {
+    const char * codec = getenv("GGML_RPC_CODEC");
+    if (codec == nullptr || strcmp(codec, "none") == 0 || strcmp(codec, "f32") == 0) {
+        return GGML_TYPE_F32;
+    }
+    if (strcmp(codec, "f16") == 0) {
+        return GGML_TYPE_F16;
+    }
+    if (strcmp(codec, "bf16") == 0) {
+        return GGML_TYPE_BF16;
+    }
+    if (strcmp(codec, "q8_0") == 0) {
+        return GGML_TYPE_Q8_0;
+    }
+    GGML_LOG_WARN("%s: unknown GGML_RPC_CODEC '%s', expected none, f16, bf16 or q8_0\n", __func__, codec);
+    return GGML_TYPE_F32;
+}
+
+static bool rpc_codec_is_valid(uint32_t codec) {
+    return codec == GGML_TYPE_F16 || codec == GGML_TYPE_BF16 || codec == GGML_TYPE_Q8_0;
+}
+
+// f16 overflows above 65504 and a single inf or nan (e.g. in the KQ mask) spoils a whole q8_0 block,
+// such data is sent as f32
+static bool rpc_codec_can_encode(ggml_type codec, const float * data, size_t n) {
+    switch (codec) {
+        case GGML_TYPE_F16:
+            for (size_t i = 0; i < n; ++i) {
+                if (!(std::fabs(data[i]) <= 65504.0f)) {
+                    return false;
+                }
+            }
+            return true;
+        case GGML_TYPE_Q8_0:
+            for (size_t i = 0; i < n; ++i) {
+                if (!std::isfinite(data[i])) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+// the codec is used for the data of f32 tensors in compute buffers, i.e. the activations copied between the splits
+// the inputs and the outputs of the graph (e.g. the logits) are sent as is: the copies of the scheduler have neither
+// flag, or both of them with pipeline parallelism
+static bool rpc_codec_applies(const std::shared_ptr<socket_t> & sock, ggml_backend_buffer_t buffer, const ggml_tensor * tensor, size_t offset, size_t size) {
+    const int32_t io = tensor->flags & (GGML_TENSOR_FLAG_INPUT | GGML_TENSOR_FLAG_OUTPUT);
+    return sock->codec != GGML_TYPE_F32 &&
+           tensor->type == GGML_TYPE_F32 &&
+           (io == 0 || io == (GGML_TENSOR_FLAG_INPUT | GGML_TENSOR_FLAG_OUTPUT)) &&
+           ggml_backend_buffer_get_usage(buffer) == GGML_BACKEND_BUFFER_USAGE_COMPUTE &&
+           offset % sizeof(float) == 0 &&
+           size % (sizeof(float)*ggml_blck_size(sock->codec)) == 0;
+}
+
+// position of size bytes in a ring with the given head and tail, returns false if there is not enough free space
+static bool shm_ring_alloc(uint64_t head, uint64_t tail, size_t size, uint64_t * pos) {
+    uint64_t p = head;
+    if (p % RPC_SHM_RING_SIZE + size > RPC_SHM_RING_SIZE) {
+        // skip to the start of the ring
+        p += RPC_SHM_RING_SIZE - p % RPC_SHM_RING_SIZE;
+    }
+    if (p + size - tail > RPC_SHM_RING_SIZE) {
+        return false;
+    }
+    *pos = p;
+    return true;
+}
+
+// create a shared memory object and ask the server to map it, this only succeeds if the server is on the same host
+// GGML_RPC_NO_SHM=1 always uses the socket (e.g. to measure the codecs with a local server)
+static void shm_attach(const std::shared_ptr<socket_t> & sock) {
+#ifdef RPC_USE_SHM
+    const char * no_shm = getenv("GGML_RPC_NO_SHM");
+    if (no_shm != nullptr && atoi(no_shm) != 0) {
+        return;
+    }
+    static std::atomic<int> counter { 0 };
+    rpc_msg_shm_attach_req request = {};
+    snprintf(request.name, sizeof(request.name), "/ggml-rpc-%d-%d", (int) getpid(), counter++);
+    request.size = RPC_SHM_SIZE;
+    request.magic = ((uint64_t) std::random_device{}() << 32) | std::random_device{}();
+
+    int fd = shm_open(request.name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        return;
+    }
+    void * ptr = MAP_FAILED;
+    if (ftruncate(fd, RPC_SHM_SIZE) == 0) {
+        ptr = mmap(NULL, RPC_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        shm_unlink(request.name);
+        return;
+    }
+    rpc_shm_header * header = (rpc_shm_header *) ptr;
+    header->magic = request.magic;
+    header->up_tail.store(0);
+
+    rpc_msg_shm_attach_rsp response;
+    bool status = send_rpc_cmd(sock, RPC_CMD_SHM_ATTACH, &request, sizeof(request), &response, sizeof(response));
+    // the server has mapped the object or failed to open it
+    shm_unlink(request.name);
+    RPC_STATUS_ASSERT(status);
+    if (!response.result) {
+        munmap(ptr, RPC_SHM_SIZE);
+        return;
+    }
+    sock->shm = (uint8_t *) ptr;
+    GGML_PRINT_DEBUG("[%s] using shared memory %s\n", __func__, request.name);
+#else
+    GGML_UNUSED(sock);
+#endif
+}
+
 static bool check_server_version(const std::shared_ptr<socket_t> & sock) {
     rpc_msg_hello_rsp response;
     bool status = send_rpc_cmd(sock, RPC_CMD_HELLO, nullptr, 0, &response, sizeof(response));
@@ -449,6 +789,13 @@ static bool check_server_version(const std::shared_ptr<socket_t> & sock) {
     if (response.minor != RPC_PROTO_MINOR_VERSION || response.patch != RPC_PROTO_PATCH_VERSION) {
         fprintf(stderr, "WARNING: RPC server version mismatch: %d.%d.%d\n", response.major, response.minor, response.patch);
     }
+    sock->graph_recompute = response.minor >= 1;
+    if (response.minor >= 2) {
+        shm_attach(sock);
+    }
+    if (response.minor >= 3) {
+        sock->codec = rpc_codec_init();
+    }
     return true;
 }
 
@@ -497,6 +844,8 @@ static void ggml_backend_rpc_buffer_free_buffer(ggml_backend_buffer_t buffer) {
     ggml_backend_rpc_buffer_context * ctx = (ggml_backend_rpc_buffer_context *)buffer->context;
     rpc_msg_free_buffer_req request = {ctx->remote_ptr};
     bool status = send_rpc_cmd(ctx->sock, RPC_CMD_FREE_BUFFER, &request, sizeof(request), nullptr, 0);
+    // the cached graphs may reference the buffer, the server drops them
+    ctx->sock->graph_ids.clear();
     RPC_STATUS_ASSERT(status);
     delete ctx;
 }
@@ -582,6 +931,40 @@ static void ggml_backend_rpc_buffer_set_tensor(ggml_backend_buffer_t buffer, ggm
             return;
         }
     }
+    if (ctx->sock->shm) {
+        auto & sock = ctx->sock;
+        const rpc_shm_header * header = (const rpc_shm_header *) sock->shm;
+        rpc_msg_set_tensor_shm_req request;
+        if (shm_ring_alloc(sock->shm_up_head, header->up_tail.load(std::memory_order_acquire), size, &request.pos)) {
+            uint8_t * ring = sock->shm + sizeof(rpc_shm_header);
+            memcpy(ring + request.pos % RPC_SHM_RING_SIZE, data, size);
+            sock->shm_up_head = request.pos + size;
+            rpc_stats.bytes_shm += size;
+            request.tensor = rpc_tensor;
+            request.offset = offset;
+            request.size = size;
+            bool status = send_rpc_cmd(sock, RPC_CMD_SET_TENSOR_SHM, &request, sizeof(request));
+            RPC_STATUS_ASSERT(status);
+            return;
+        }
+        // the ring is full, send the data through the socket
+    }
+    if (rpc_codec_applies(ctx->sock, buffer, tensor, offset, size) &&
+        rpc_codec_can_encode(ctx->sock->codec, (const float *) data, size/sizeof(float))) {
+        // input serialization format: | rpc_tensor | offset (8 bytes) | codec (4 bytes) | encoded data |
+        const uint32_t codec = ctx->sock->codec;
+        const size_t encoded_size = ggml_row_size(ctx->sock->codec, size/sizeof(float));
+        std::vector<uint8_t> input(sizeof(rpc_tensor) + sizeof(uint64_t) + sizeof(codec) + encoded_size);
+        memcpy(input.data(), &rpc_tensor, sizeof(rpc_tensor));
+        memcpy(input.data() + sizeof(rpc_tensor), &offset, sizeof(offset));
+        memcpy(input.data() + sizeof(rpc_tensor) + sizeof(offset), &codec, sizeof(codec));
+        ggml_get_type_traits(ctx->sock->codec)->from_float_ref((const float *) data,
+            input.data() + sizeof(rpc_tensor) + sizeof(offset) + sizeof(codec), size/sizeof(float));
+        bool status = send_rpc_cmd(ctx->sock, RPC_CMD_SET_TENSOR_CODEC, input.data(), input.size());
+        RPC_STATUS_ASSERT(status);
+        rpc_stats.n_codec++;
+        return;
+    }
     // input serialization format: | rpc_tensor | offset (8 bytes) | data (size bytes)
     size_t input_size = sizeof(rpc_tensor) + sizeof(uint64_t) + size;
     std::vector<uint8_t> input(input_size, 0);
@@ -592,8 +975,61 @@ static void ggml_backend_rpc_buffer_set_tensor(ggml_backend_buffer_t buffer, ggm
     RPC_STATUS_ASSERT(status);
 }
 
+// send RPC_CMD_GET_TENSOR_CODEC, the data is decoded and written to dst when the response is received
+static bool get_tensor_codec_async(const std::shared_ptr<socket_t> & sock, ggml_backend_buffer_t buffer, const ggml_tensor * tensor, void * dst, size_t offset, size_t size) {
+    if (!rpc_codec_applies(sock, buffer, tensor, offset, size)) {
+        return false;
+    }
+    rpc_msg_get_tensor_codec_req request;
+    request.tensor = serialize_tensor(tensor);
+    request.offset = offset;
+    request.size = size;
+    request.codec = sock->codec;
+    bool status = send_rpc_cmd_async(sock, RPC_CMD_GET_TENSOR_CODEC, &request, sizeof(request), nullptr, 0);
+    RPC_STATUS_ASSERT(status);
+    rpc_pending_rsp & rsp = sock->pending.back();
+    rsp.dst   = dst;
+    rsp.size  = size;
+    rsp.codec = sock->codec;
+    return true;
+}
+
+// send RPC_CMD_GET_TENSOR_SHM, the data is written to dst when the response is received
+// returns false if shared memory is not used or the data does not fit in the download ring
+static bool get_tensor_shm_async(const std::shared_ptr<socket_t> & sock, const ggml_tensor * tensor, void * dst, size_t offset, size_t size) {
+    if (!sock->shm || size > RPC_SHM_RING_SIZE) {
+        return false;
+    }
+    rpc_msg_get_tensor_shm_req request;
+    if (!shm_ring_alloc(sock->shm_down_head, sock->shm_down_tail, size, &request.pos)) {
+        // wait for the pending responses to release the space
+        bool status = recv_pending(sock);
+        RPC_STATUS_ASSERT(status);
+        bool ok = shm_ring_alloc(sock->shm_down_head, sock->shm_down_tail, size, &request.pos);
+        GGML_ASSERT(ok);
+    }
+    sock->shm_down_head = request.pos + size;
+    rpc_stats.bytes_shm += size;
+    request.tensor = serialize_tensor(tensor);
+    request.offset = offset;
+    request.size = size;
+    bool status = send_rpc_cmd_async(sock, RPC_CMD_GET_TENSOR_SHM, &request, sizeof(request), nullptr, 0);
+    RPC_STATUS_ASSERT(status);
+    rpc_pending_rsp & rsp = sock->pending.back();
+    rsp.dst  = dst;
+    rsp.pos  = request.pos;
+    rsp.size = size;
+    return true;
+}
+
 static void ggml_backend_rpc_buffer_get_tensor(ggml_backend_buffer_t buffer, const ggml_tensor * tensor, void * data, size_t offset, size_t size) {
     ggml_backend_rpc_buffer_context * ctx = (ggml_backend_rpc_buffer_context *)buffer->context;
+    if (get_tensor_shm_async(ctx->sock, tensor, data, offset, size) ||
+        get_tensor_codec_async(ctx->sock, buffer, tensor, data, offset, size)) {
+        bool status = recv_pending(ctx->sock);
+        RPC_STATUS_ASSERT(status);
+        return;
+    }
     rpc_msg_get_tensor_req request;
     request.tensor = serialize_tensor(tensor);
     request.offset = offset;
@@ -724,13 +1160,48 @@ static const char * ggml_backend_rpc_name(ggml_backend_t backend) {
 
 static void ggml_backend_rpc_free(ggml_backend_t backend) {
     ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    // the responses of the pending computations are written to the context
+    auto sock = get_socket(rpc_ctx->endpoint);
+    if (sock != nullptr) {
+        bool status = recv_pending(sock);
+        RPC_STATUS_ASSERT(status);
+    }
     delete rpc_ctx;
     delete backend;
 }
 
 static void ggml_backend_rpc_synchronize(ggml_backend_t backend) {
-    GGML_UNUSED(backend);
-    // this is no-op because we don't have any async operations
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    auto sock = get_socket(rpc_ctx->endpoint);
+    bool status = recv_pending(sock);
+    RPC_STATUS_ASSERT(status);
+    // the outputs of the failed graph would be read next and the error cannot be returned from here
+    if (rpc_ctx->compute_status != GGML_STATUS_SUCCESS) {
+        GGML_ABORT("remote graph compute failed with status %d", rpc_ctx->compute_status);
+    }
+}
+
+static void ggml_backend_rpc_set_tensor_async(ggml_backend_t backend, ggml_tensor * tensor, const void * data, size_t offset, size_t size) {
+    ggml_backend_buffer_t buf = tensor->view_src ? tensor->view_src->buffer : tensor->buffer;
+    GGML_ASSERT(buf->buft == ggml_backend_get_default_buffer_type(backend) && "unsupported buffer type");
+    // RPC_CMD_SET_TENSOR has no response, the data is sent before returning
+    buf->iface.set_tensor(buf, tensor, data, offset, size);
+}
+
+static void ggml_backend_rpc_get_tensor_async(ggml_backend_t backend, const ggml_tensor * tensor, void * data, size_t offset, size_t size) {
+    ggml_backend_buffer_t buf = tensor->view_src ? tensor->view_src->buffer : tensor->buffer;
+    GGML_ASSERT(buf->buft == ggml_backend_get_default_buffer_type(backend) && "unsupported buffer type");
+    ggml_backend_rpc_buffer_context * ctx = (ggml_backend_rpc_buffer_context *)buf->context;
+    if (get_tensor_shm_async(ctx->sock, tensor, data, offset, size) ||
+        get_tensor_codec_async(ctx->sock, buf, tensor, data, offset, size)) {
+        return;
+    }
+    rpc_msg_get_tensor_req request;
+    request.tensor = serialize_tensor(tensor);
+    request.offset = offset;
+    request.size = size;
+    bool status = send_rpc_cmd_async(ctx->sock, RPC_CMD_GET_TENSOR, &request, sizeof(request), data, size);
+    RPC_STATUS_ASSERT(status);
 }
 
 static void add_tensor(ggml_tensor * tensor, std::vector<rpc_tensor> & tensors, std::unordered_set<ggml_tensor*> & visited) {
@@ -770,22 +1241,112 @@ static void serialize_graph(const ggml_cgraph * cgraph, std::vector<uint8_t> & o
     memcpy(out_tensors, tensors.data(), n_tensors * sizeof(rpc_tensor));
 }
 
+// identity of a graph for the cache of the graphs: the tensors of the nodes, their shapes and parameters and the data
+// of their sources - unlike the serialization, it does not need to visit the whole graph
+// the graphs are only serialized and hashed when they are not in the cache
+static void graph_key(const ggml_cgraph * cgraph, std::vector<uint64_t> & key) {
+    key.clear();
+    key.reserve(1 + cgraph->n_nodes*(16 + GGML_MAX_OP_PARAMS/sizeof(uint64_t) + 2*GGML_MAX_SRC));
+    key.push_back(cgraph->n_nodes);
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        const ggml_tensor * node = cgraph->nodes[i];
+        key.push_back(reinterpret_cast<uint64_t>(node));
+        key.push_back(reinterpret_cast<uint64_t>(node->data));
+        key.push_back(reinterpret_cast<uint64_t>(node->buffer));
+        key.push_back(((uint64_t) node->op << 32) | (uint64_t) node->type);
+        key.push_back((uint64_t) (uint32_t) node->flags);
+        for (int j = 0; j < GGML_MAX_DIMS; j++) {
+            key.push_back(node->ne[j]);
+            key.push_back(node->nb[j]);
+        }
+        for (size_t j = 0; j < GGML_MAX_OP_PARAMS/sizeof(uint64_t); j++) {
+            uint64_t op_params;
+            memcpy(&op_params, (const uint8_t *) node->op_params + j*sizeof(uint64_t), sizeof(op_params));
+            key.push_back(op_params);
+        }
+        key.push_back(reinterpret_cast<uint64_t>(node->view_src));
+        key.push_back(node->view_offs);
+        for (int j = 0; j < GGML_MAX_SRC; j++) {
+            const ggml_tensor * src = node->src[j];
+            key.push_back(reinterpret_cast<uint64_t>(src));
+            key.push_back(src ? reinterpret_cast<uint64_t>(src->data) : 0);
+        }
+    }
+}
+
 static enum ggml_status ggml_backend_rpc_graph_compute(ggml_backend_t backend, ggml_cgraph * cgraph) {
     ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
-    std::vector<uint8_t> input;
-    serialize_graph(cgraph, input);
-    rpc_msg_graph_compute_rsp response;
+    if (rpc_ctx->compute_status != GGML_STATUS_SUCCESS) {
+        // a previous graph failed and its response has already been received
+        const enum ggml_status status = rpc_ctx->compute_status;
+        rpc_ctx->compute_status = GGML_STATUS_SUCCESS;
+        return status;
+    }
     auto sock = get_socket(rpc_ctx->endpoint);
-    bool status = send_rpc_cmd(sock, RPC_CMD_GRAPH_COMPUTE, input.data(), input.size(), &response, sizeof(response));
+    std::vector<uint8_t> input;
+    bool status;
+    if (sock->graph_recompute) {
+        // the graphs of consecutive batches are usually the same, only the data of their inputs changes and it has
+        // already been sent with RPC_CMD_SET_TENSOR - in that case only the id of the graph is sent
+        std::vector<uint64_t> key;
+        graph_key(cgraph, key);
+        auto & ids = sock->graph_ids;
+        auto it = std::find_if(ids.begin(), ids.end(), [&](const rpc_graph_id & g) { return g.key == key; });
+        if (it != ids.end()) {
+            ids.splice(ids.begin(), ids, it);
+            rpc_msg_graph_recompute_req request = {it->id};
+            status = send_rpc_cmd_async(sock, RPC_CMD_GRAPH_RECOMPUTE, &request, sizeof(request), &rpc_ctx->compute_rsp, sizeof(rpc_ctx->compute_rsp));
+        } else {
+            serialize_graph(cgraph, input);
+            const uint64_t id = fnv_hash64(input.data(), input.size());
+            // the server replaces the graph with the same id, if any (see rpc_server::graph_compute)
+            ids.remove_if([&](const rpc_graph_id & g) { return g.id == id; });
+            ids.push_front({ std::move(key), id });
+            if (ids.size() > GRAPH_CACHE_SIZE) {
+                ids.pop_back();
+            }
+            status = send_rpc_cmd_async(sock, RPC_CMD_GRAPH_COMPUTE, input.data(), input.size(), &rpc_ctx->compute_rsp, sizeof(rpc_ctx->compute_rsp));
+        }
+    } else {
+        serialize_graph(cgraph, input);
+        status = send_rpc_cmd_async(sock, RPC_CMD_GRAPH_COMPUTE, input.data(), input.size(), &rpc_ctx->compute_rsp, sizeof(rpc_ctx->compute_rsp));
+    }
+    RPC_STATUS_ASSERT(status);
+    sock->pending.back().dst = &rpc_ctx->compute_status;
+    return GGML_STATUS_SUCCESS;
+}
+
+// events
+
+struct ggml_backend_rpc_event_context {
+    std::shared_ptr<socket_t> sock;
+    // id of the last command sent before the event was recorded
+    uint64_t id = 0;
+};
+
+static void ggml_backend_rpc_event_record(ggml_backend_t backend, ggml_backend_event_t event) {
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    ggml_backend_rpc_event_context * event_ctx = (ggml_backend_rpc_event_context *)event->context;
+    event_ctx->sock = get_socket(rpc_ctx->endpoint);
+    event_ctx->id = event_ctx->sock->n_sent;
+}
+
+static void ggml_backend_rpc_event_wait(ggml_backend_t backend, ggml_backend_event_t event) {
+    ggml_backend_rpc_context * rpc_ctx = (ggml_backend_rpc_context *)backend->context;
+    ggml_backend_rpc_event_context * event_ctx = (ggml_backend_rpc_event_context *)event->context;
+    if (event_ctx->sock == nullptr || event_ctx->sock == get_socket(rpc_ctx->endpoint)) {
+        // the commands of the same server are executed in order
+        return;
+    }
+    bool status = recv_pending(event_ctx->sock, event_ctx->id);
     RPC_STATUS_ASSERT(status);
-    return (enum ggml_status)response.result;
 }
 
 static ggml_backend_i ggml_backend_rpc_interface = {
     /* .get_name                = */ ggml_backend_rpc_name,
     /* .free                    = */ ggml_backend_rpc_free,
-    /* .set_tensor_async        = */ NULL,
-    /* .get_tensor_async        = */ NULL,
+    /* .set_tensor_async        = */ ggml_backend_rpc_set_tensor_async,
+    /* .get_tensor_async        = */ ggml_backend_rpc_get_tensor_async,
     /* .cpy_tensor_async        = */ NULL,
     /* .synchronize             = */ ggml_backend_rpc_synchronize,
     /* .graph_plan_create       = */ NULL,
@@ -793,8 +1354,8 @@ static ggml_backend_i ggml_backend_rpc_interface = {
     /* .graph_plan_update       = */ NULL,
     /* .graph_plan_compute      = */ NULL,
     /* .graph_compute           = */ ggml_backend_rpc_graph_compute,
-    /* .event_record            = */ NULL,
-    /* .event_wait              = */ NULL,
+    /* .event_record            = */ ggml_backend_rpc_event_record,
+    /* .event_wait              = */ ggml_backend_rpc_event_wait,
 };
 
 ggml_backend_buffer_type_t ggml_backend_rpc_buffer_type(const char * endpoint) {
@@ -833,6 +1394,8 @@ ggml_backend_t ggml_backend_rpc_init(const char * endpoint) {
     ggml_backend_rpc_context * ctx = new ggml_backend_rpc_context {
         /* .endpoint  = */ endpoint,
         /* .name      = */ "RPC[" + std::string(endpoint) + "]",
+        /* .compute_rsp = */ {},
+        /* .compute_status = */ GGML_STATUS_SUCCESS,
     };
 
     ggml_backend_t backend = new ggml_backend {
@@ -868,10 +1431,50 @@ void ggml_backend_rpc_get_device_memory(const char * endpoint, size_t * free, si
 
 // RPC server-side implementation
 
+// Mutex that is acquired in the order in which it is requested, so that the clients of a server get their turns
+// to use the backend fairly even when one of them keeps sending commands
+class rpc_fair_mutex {
+public:
+    void lock() {
+        std::unique_lock<std::mutex> lock(mutex);
+        const uint64_t ticket = next_ticket++;
+        cv.wait(lock, [&] { return serving == ticket; });
+    }
+
+    void unlock() {
+        std::lock_guard<std::mutex> lock(mutex);
+        serving++;
+        cv.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint64_t next_ticket = 0;
+    uint64_t serving     = 0;
+};
+
+// state shared by the clients of a server
+struct rpc_server_state {
+    ggml_backend_t backend;
+    const char * cache_dir;
+    size_t free_mem;
+    size_t total_mem;
+    // limit of the memory allocated by each client, 0 for no limit
+    size_t client_mem;
+
+    // the backend is used by one client at a time
+    rpc_fair_mutex backend_mutex;
+    // memory allocated by all the clients
+    std::atomic<size_t> allocated { 0 };
+    std::atomic<int>    n_clients { 0 };
+};
+
+// Each client has its own rpc_server and can only access the buffers that it has allocated
 class rpc_server {
 public:
-    rpc_server(ggml_backend_t backend, const char * cache_dir)
-        : backend(backend), cache_dir(cache_dir) {
+    rpc_server(rpc_server_state & state)
+        : backend(state.backend), cache_dir(state.cache_dir), state(state) {
     }
     ~rpc_server();
 
@@ -887,8 +1490,15 @@ public:
     bool get_tensor(const rpc_msg_get_tensor_req & request, std::vector<uint8_t> & response);
     bool copy_tensor(const rpc_msg_copy_tensor_req & request, rpc_msg_copy_tensor_rsp & response);
     bool graph_compute(const std::vector<uint8_t> & input, rpc_msg_graph_compute_rsp & response);
+    bool graph_recompute(const rpc_msg_graph_recompute_req & request, rpc_msg_graph_compute_rsp & response);
+    void shm_attach(const rpc_msg_shm_attach_req & request, rpc_msg_shm_attach_rsp & response);
+    bool set_tensor_shm(const rpc_msg_set_tensor_shm_req & request);
+    bool get_tensor_shm(const rpc_msg_get_tensor_shm_req & request);
+    bool set_tensor_codec(const std::vector<uint8_t> & input);
+    bool get_tensor_codec(const rpc_msg_get_tensor_codec_req & request, std::vector<uint8_t> & response);
     bool init_tensor(const rpc_msg_init_tensor_req & request);
     bool get_alloc_size(const rpc_msg_get_alloc_size_req & request, rpc_msg_get_alloc_size_rsp & response);
+    void get_device_memory(rpc_msg_get_device_memory_rsp & response);
 
 private:
     bool get_cached_file(uint64_t hash, std::vector<uint8_t> & data);
@@ -898,10 +1508,24 @@ private:
                               const std::unordered_map<uint64_t, const rpc_tensor*> & tensor_ptrs,
                               std::unordered_map<uint64_t, struct ggml_tensor*> & tensor_map);
 
+    struct cached_graph {
+        uint64_t id;
+        // serialized graph, compared with the graphs that have the same id to detect hash collisions
+        std::vector<uint8_t> input;
+        ggml_context_ptr ctx;
+        ggml_cgraph * graph;
+    };
 
     ggml_backend_t backend;
     const char * cache_dir;
+    rpc_server_state & state;
     std::unordered_set<ggml_backend_buffer_t> buffers;
+    // memory allocated by this client
+    size_t allocated = 0;
+    // deserialized graphs, most recently used first, see GRAPH_CACHE_SIZE
+    std::list<cached_graph> graphs;
+    // shared memory with the client, see rpc_shm_header
+    uint8_t * shm = nullptr;
 };
 
 void rpc_server::hello(rpc_msg_hello_rsp & response) {
@@ -942,15 +1566,23 @@ bool rpc_server::get_alloc_size(const rpc_msg_get_alloc_size_req & request, rpc_
 }
 
 void rpc_server::alloc_buffer(const rpc_msg_alloc_buffer_req & request, rpc_msg_alloc_buffer_rsp & response) {
-    ggml_backend_buffer_type_t buft = ggml_backend_get_default_buffer_type(backend);
-    ggml_backend_buffer_t buffer = ggml_backend_buft_alloc_buffer(buft, request.size);
     response.remote_ptr = 0;
     response.remote_size = 0;
+    if (state.client_mem > 0 && allocated + request.size > state.client_mem) {
+        GGML_LOG_ERROR("[%s] size: %" PRIu64 " -> exceeds the client memory limit (%zu MB allocated, %zu MB limit)\n",
+                       __func__, request.size, allocated/1024/1024, state.client_mem/1024/1024);
+        return;
+    }
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
+    ggml_backend_buffer_type_t buft = ggml_backend_get_default_buffer_type(backend);
+    ggml_backend_buffer_t buffer = ggml_backend_buft_alloc_buffer(buft, request.size);
     if (buffer != nullptr) {
         response.remote_ptr = reinterpret_cast<uint64_t>(buffer);
         response.remote_size = buffer->size;
         GGML_PRINT_DEBUG("[%s] size: %" PRIu64 " -> remote_ptr: %" PRIx64 ", remote_size: %" PRIu64 "\n", __func__, request.size, response.remote_ptr, response.remote_size);
         buffers.insert(buffer);
+        allocated += buffer->size;
+        state.allocated += buffer->size;
     } else {
         GGML_LOG_ERROR("[%s] size: %" PRIu64 " -> failed\n", __func__, request.size);
     }
@@ -989,12 +1621,17 @@ bool rpc_server::free_buffer(const rpc_msg_free_buffer_req & request) {
         GGML_LOG_ERROR("[%s] buffer not found\n", __func__);
         return false;
     }
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
+    allocated -= buffer->size;
+    state.allocated -= buffer->size;
     ggml_backend_buffer_free(buffer);
     buffers.erase(buffer);
+    graphs.clear();
     return true;
 }
 
 bool rpc_server::buffer_clear(const rpc_msg_buffer_clear_req & request) {
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
     GGML_PRINT_DEBUG("[%s] remote_ptr: %" PRIx64 ", value: %u\n", __func__, request.remote_ptr, request.value);
     ggml_backend_buffer_t buffer = reinterpret_cast<ggml_backend_buffer_t>(request.remote_ptr);
     if (buffers.find(buffer) == buffers.end()) {
@@ -1024,9 +1661,16 @@ ggml_tensor * rpc_server::deserialize_tensor(struct ggml_context * ctx, const rp
     for (uint32_t i = 0; i < GGML_MAX_DIMS; i++) {
         result->nb[i] = tensor->nb[i];
     }
+    // the client can only access the memory of the buffers that it has allocated, the data of a tensor without a
+    // buffer would otherwise point anywhere (e.g. into the buffers of another client)
     result->buffer = reinterpret_cast<ggml_backend_buffer_t>(tensor->buffer);
     if (result->buffer && buffers.find(result->buffer) == buffers.end()) {
-        result->buffer = nullptr;
+        GGML_LOG_ERROR("[%s] buffer %" PRIx64 " not found\n", __func__, tensor->buffer);
+        return nullptr;
+    }
+    if (!result->buffer && tensor->data != 0) {
+        GGML_LOG_ERROR("[%s] tensor data %" PRIx64 " without a buffer\n", __func__, tensor->data);
+        return nullptr;
     }
 
     if (result->buffer) {
@@ -1050,6 +1694,7 @@ ggml_tensor * rpc_server::deserialize_tensor(struct ggml_context * ctx, const rp
 
 
 bool rpc_server::set_tensor(const std::vector<uint8_t> & input) {
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
     // serialization format: | rpc_tensor | offset (8 bytes) | data (size bytes) |
     if (input.size() < sizeof(rpc_tensor) + sizeof(uint64_t)) {
         return false;
@@ -1101,6 +1746,240 @@ bool rpc_server::set_tensor(const std::vector<uint8_t> & input) {
     return true;
 }
 
+void rpc_server::shm_attach(const rpc_msg_shm_attach_req & request, rpc_msg_shm_attach_rsp & response) {
+    response.result = 0;
+#ifdef RPC_USE_SHM
+    if (shm || request.size != RPC_SHM_SIZE) {
+        return;
+    }
+    char name[sizeof(request.name) + 1] = {};
+    memcpy(name, request.name, sizeof(request.name));
+    // fails if the client is on another host
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    void * ptr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (uint64_t) st.st_size == request.size) {
+        ptr = mmap(NULL, RPC_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        return;
+    }
+    // an object with the same name on this host that was not created by the client
+    if (((const rpc_shm_header *) ptr)->magic != request.magic) {
+        munmap(ptr, RPC_SHM_SIZE);
+        return;
+    }
+    shm = (uint8_t *) ptr;
+    response.result = 1;
+    printf("[%s] using shared memory for tensor data\n", __func__);
+#else
+    GGML_UNUSED(request);
+#endif
+}
+
+bool rpc_server::set_tensor_shm(const rpc_msg_set_tensor_shm_req & request) {
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
+    const uint64_t ring_offset = request.pos % RPC_SHM_RING_SIZE;
+    if (!shm || request.size > RPC_SHM_RING_SIZE - ring_offset) {
+        GGML_LOG_ERROR("[%s] invalid shared memory region (pos=%" PRIu64 ", size=%" PRIu64 ")\n", __func__, request.pos, request.size);
+        return false;
+    }
+    struct ggml_init_params params {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    ggml_context_ptr ctx_ptr { ggml_init(params) };
+    GGML_ASSERT(ctx_ptr != nullptr);
+    ggml_context * ctx = ctx_ptr.get();
+    ggml_tensor * tensor = deserialize_tensor(ctx, &request.tensor);
+    if (tensor == nullptr || tensor->buffer == nullptr) {
+        GGML_LOG_ERROR("[%s] error deserializing tensor\n", __func__);
+        return false;
+    }
+    GGML_PRINT_DEBUG("[%s] buffer: %p, data: %p, offset: %" PRIu64 ", size: %" PRIu64 "\n", __func__, (void*)tensor->buffer, tensor->data, request.offset, request.size);
+
+    // sanitize tensor->data
+    {
+        const size_t p0 = (size_t) ggml_backend_buffer_get_base(tensor->buffer);
+        const size_t p1 = p0 + ggml_backend_buffer_get_size(tensor->buffer);
+
+        if (request.tensor.data + request.offset < p0 ||
+            request.tensor.data + request.offset >= p1 ||
+            request.size > (p1 - request.tensor.data - request.offset)) {
+                GGML_LOG_ERROR("[%s] tensor data region (data=0x%" PRIx64 ", offset=%" PRIu64 ", size=%" PRIu64 ") out of buffer bounds [0x%zx, 0x%zx)\n",
+                               __func__, request.tensor.data, request.offset, request.size, p0, p1);
+                return false;
+        }
+    }
+
+    const uint8_t * ring = shm + sizeof(rpc_shm_header);
+    ggml_backend_tensor_set(tensor, ring + ring_offset, request.offset, request.size);
+    // release the space in the upload ring
+    ((rpc_shm_header *) shm)->up_tail.store(request.pos + request.size, std::memory_order_release);
+    return true;
+}
+
+bool rpc_server::get_tensor_shm(const rpc_msg_get_tensor_shm_req & request) {
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
+    const uint64_t ring_offset = request.pos % RPC_SHM_RING_SIZE;
+    if (!shm || request.size > RPC_SHM_RING_SIZE - ring_offset) {
+        GGML_LOG_ERROR("[%s] invalid shared memory region (pos=%" PRIu64 ", size=%" PRIu64 ")\n", __func__, request.pos, request.size);
+        return false;
+    }
+    struct ggml_init_params params {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    ggml_context_ptr ctx_ptr { ggml_init(params) };
+    GGML_ASSERT(ctx_ptr != nullptr);
+    ggml_context * ctx = ctx_ptr.get();
+    ggml_tensor * tensor = deserialize_tensor(ctx, &request.tensor);
+    if (tensor == nullptr || tensor->buffer == nullptr) {
+        GGML_LOG_ERROR("[%s] error deserializing tensor\n", __func__);
+        return false;
+    }
+    GGML_PRINT_DEBUG("[%s] buffer: %p, data: %p, offset: %" PRIu64 ", size: %" PRIu64 "\n", __func__, (void*)tensor->buffer, tensor->data, request.offset, request.size);
+
+    // sanitize tensor->data
+    {
+        const size_t p0 = (size_t) ggml_backend_buffer_get_base(tensor->buffer);
+        const size_t p1 = p0 + ggml_backend_buffer_get_size(tensor->buffer);
+
+        if (request.tensor.data + request.offset < p0 ||
+            request.tensor.data + request.offset >= p1 ||
+            request.size > (p1 - request.tensor.data - request.offset)) {
+                GGML_LOG_ERROR("[%s] requested tensor region (data=0x%" PRIx64 ", offset=%" PRIu64 ", size=%" PRIu64 ") out of buffer bounds [0x%zx, 0x%zx)\n",
+                               __func__, request.tensor.data, request.offset, request.size, p0, p1);
+                return false;
+        }
+    }
+
+    uint8_t * ring = shm + sizeof(rpc_shm_header) + RPC_SHM_RING_SIZE;
+    ggml_backend_tensor_get(tensor, ring + ring_offset, request.offset, request.size);
+    return true;
+}
+
+void rpc_server::get_device_memory(rpc_msg_get_device_memory_rsp & response) {
+    // the memory used by the other clients is not available
+    const size_t used = state.allocated - allocated;
+    size_t free_mem = state.free_mem > used ? state.free_mem - used : 0;
+    if (state.client_mem > 0) {
+        free_mem = std::min(free_mem, state.client_mem > allocated ? state.client_mem - allocated : 0);
+    }
+    response.free_mem = free_mem;
+    response.total_mem = state.client_mem > 0 ? std::min(state.total_mem, state.client_mem) : state.total_mem;
+}
+
+bool rpc_server::set_tensor_codec(const std::vector<uint8_t> & input) {
+    // serialization format: | rpc_tensor | offset (8 bytes) | codec (4 bytes) | encoded data |
+    if (input.size() < sizeof(rpc_tensor) + sizeof(uint64_t) + sizeof(uint32_t)) {
+        return false;
+    }
+    const rpc_tensor * in_tensor = (const rpc_tensor *)input.data();
+    uint64_t offset;
+    memcpy(&offset, input.data() + sizeof(rpc_tensor), sizeof(offset));
+    uint32_t codec;
+    memcpy(&codec, input.data() + sizeof(rpc_tensor) + sizeof(offset), sizeof(codec));
+    const uint8_t * encoded = input.data() + sizeof(rpc_tensor) + sizeof(offset) + sizeof(codec);
+    const size_t encoded_size = input.size() - sizeof(rpc_tensor) - sizeof(offset) - sizeof(codec);
+    if (!rpc_codec_is_valid(codec) || encoded_size % ggml_type_size((ggml_type) codec) != 0) {
+        GGML_LOG_ERROR("[%s] invalid codec %u or size %zu\n", __func__, codec, encoded_size);
+        return false;
+    }
+    const size_t n = encoded_size/ggml_type_size((ggml_type) codec)*ggml_blck_size((ggml_type) codec);
+    const size_t size = n*sizeof(float);
+
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
+    struct ggml_init_params params {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    ggml_context_ptr ctx_ptr { ggml_init(params) };
+    GGML_ASSERT(ctx_ptr != nullptr);
+    ggml_context * ctx = ctx_ptr.get();
+    ggml_tensor * tensor = deserialize_tensor(ctx, in_tensor);
+    if (tensor == nullptr || tensor->buffer == nullptr) {
+        GGML_LOG_ERROR("[%s] error deserializing tensor\n", __func__);
+        return false;
+    }
+    GGML_PRINT_DEBUG("[%s] buffer: %p, data: %p, offset: %" PRIu64 ", size: %zu, codec: %s\n", __func__, (void*)tensor->buffer, tensor->data, offset, size, ggml_type_name((ggml_type) codec));
+
+    // sanitize tensor->data
+    {
+        const size_t p0 = (size_t) ggml_backend_buffer_get_base(tensor->buffer);
+        const size_t p1 = p0 + ggml_backend_buffer_get_size(tensor->buffer);
+
+        if (in_tensor->data + offset < p0 || in_tensor->data + offset >= p1 || size > (p1 - in_tensor->data - offset)) {
+            GGML_LOG_ERROR("[%s] tensor data region (data=0x%" PRIx64 ", offset=%" PRIu64 ", size=%zu) out of buffer bounds [0x%zx, 0x%zx)\n",
+                           __func__, in_tensor->data, offset, size, p0, p1);
+            return false;
+        }
+    }
+
+    std::vector<float> data(n);
+    ggml_get_type_traits((ggml_type) codec)->to_float(encoded, data.data(), n);
+    ggml_backend_tensor_set(tensor, data.data(), offset, size);
+    return true;
+}
+
+bool rpc_server::get_tensor_codec(const rpc_msg_get_tensor_codec_req & request, std::vector<uint8_t> & response) {
+    if (!rpc_codec_is_valid(request.codec) || request.size % (sizeof(float)*ggml_blck_size((ggml_type) request.codec)) != 0) {
+        GGML_LOG_ERROR("[%s] invalid codec %u or size %" PRIu64 "\n", __func__, request.codec, request.size);
+        return false;
+    }
+    std::vector<float> data;
+    {
+        std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
+        struct ggml_init_params params {
+            /*.mem_size   =*/ ggml_tensor_overhead(),
+            /*.mem_buffer =*/ NULL,
+            /*.no_alloc   =*/ true,
+        };
+        ggml_context_ptr ctx_ptr { ggml_init(params) };
+        GGML_ASSERT(ctx_ptr != nullptr);
+        ggml_context * ctx = ctx_ptr.get();
+        ggml_tensor * tensor = deserialize_tensor(ctx, &request.tensor);
+        if (tensor == nullptr || tensor->buffer == nullptr) {
+            GGML_LOG_ERROR("[%s] error deserializing tensor\n", __func__);
+            return false;
+        }
+
+        // sanitize tensor->data
+        {
+            const size_t p0 = (size_t) ggml_backend_buffer_get_base(tensor->buffer);
+            const size_t p1 = p0 + ggml_backend_buffer_get_size(tensor->buffer);
+
+            if (request.tensor.data + request.offset < p0 ||
+                request.tensor.data + request.offset >= p1 ||
+                request.size > (p1 - request.tensor.data - request.offset)) {
+                    GGML_LOG_ERROR("[%s] requested tensor region (data=0x%" PRIx64 ", offset=%" PRIu64 ", size=%" PRIu64 ") out of buffer bounds [0x%zx, 0x%zx)\n",
+                                   __func__, request.tensor.data, request.offset, request.size, p0, p1);
+                    return false;
+            }
+        }
+
+        data.resize(request.size/sizeof(float));
+        ggml_backend_tensor_get(tensor, data.data(), request.offset, request.size);
+    }
+    // response: | codec (4 bytes) | encoded data |
+    const uint32_t codec = rpc_codec_can_encode((ggml_type) request.codec, data.data(), data.size()) ? request.codec : (uint32_t) GGML_TYPE_F32;
+    response.resize(sizeof(codec) + ggml_row_size((ggml_type) codec, data.size()));
+    memcpy(response.data(), &codec, sizeof(codec));
+    if (codec == GGML_TYPE_F32) {
+        memcpy(response.data() + sizeof(codec), data.data(), request.size);
+    } else {
+        ggml_get_type_traits((ggml_type) codec)->from_float_ref(data.data(), response.data() + sizeof(codec), data.size());
+    }
+    return true;
+}
+
 bool rpc_server::get_cached_file(uint64_t hash, std::vector<uint8_t> & data) {
     if (!cache_dir) {
         return false;
@@ -1122,6 +2001,7 @@ bool rpc_server::get_cached_file(uint64_t hash, std::vector<uint8_t> & data) {
 
 bool rpc_server::set_tensor_hash(const rpc_msg_set_tensor_hash_req & request, rpc_msg_set_tensor_hash_rsp & response)
 {
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
     std::vector<uint8_t> cached_file;
     if (!get_cached_file(request.hash, cached_file)) {
         response.result = 0;
@@ -1163,6 +2043,7 @@ bool rpc_server::set_tensor_hash(const rpc_msg_set_tensor_hash_req & request, rp
 }
 
 bool rpc_server::init_tensor(const rpc_msg_init_tensor_req & request) {
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
     struct ggml_init_params params {
         /*.mem_size   =*/ ggml_tensor_overhead(),
         /*.mem_buffer =*/ NULL,
@@ -1196,6 +2077,7 @@ bool rpc_server::init_tensor(const rpc_msg_init_tensor_req & request) {
 }
 
 bool rpc_server::get_tensor(const rpc_msg_get_tensor_req & request, std::vector<uint8_t> & response) {
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
     struct ggml_init_params params {
         /*.mem_size   =*/ ggml_tensor_overhead(),
         /*.mem_buffer =*/ NULL,
@@ -1231,6 +2113,7 @@ bool rpc_server::get_tensor(const rpc_msg_get_tensor_req & request, std::vector<
 }
 
 bool rpc_server::copy_tensor(const rpc_msg_copy_tensor_req & request, rpc_msg_copy_tensor_rsp & response) {
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
     struct ggml_init_params params {
         /*.mem_size   =*/ 2*ggml_tensor_overhead(),
         /*.mem_buffer =*/ NULL,
@@ -1324,6 +2207,21 @@ ggml_tensor * rpc_server::create_node(uint64_t id,
 }
 
 bool rpc_server::graph_compute(const std::vector<uint8_t> & input, rpc_msg_graph_compute_rsp & response) {
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
+    // the client identifies the graphs by their tensors, it can send a graph that is already cached (e.g. with other
+    // tensors at the same addresses) - a cached graph with the same id but another serialization is a hash collision,
+    // it is replaced since the client only keeps the last graph with a given id
+    const uint64_t id = fnv_hash64(input.data(), input.size());
+    auto it = std::find_if(graphs.begin(), graphs.end(), [&](const cached_graph & g) { return g.id == id; });
+    if (it != graphs.end()) {
+        if (it->input == input) {
+            graphs.splice(graphs.begin(), graphs, it);
+            response.result = ggml_backend_graph_compute(backend, it->graph);
+            return true;
+        }
+        GGML_LOG_WARN("[%s] hash collision of graph %" PRIx64 ", replacing the cached graph\n", __func__, id);
+        graphs.erase(it);
+    }
     // serialization format:
     // | n_nodes (4 bytes) | nodes (n_nodes * sizeof(uint64_t) | n_tensors (4 bytes) | tensors (n_tensors * sizeof(rpc_tensor)) |
     if (input.size() < sizeof(uint32_t)) {
@@ -1375,18 +2273,111 @@ bool rpc_server::graph_compute(const std::vector<uint8_t> & input, rpc_msg_graph
     }
     ggml_status status = ggml_backend_graph_compute(backend, graph);
     response.result = status;
+
+    // keep the graph for RPC_CMD_GRAPH_RECOMPUTE, the client does the same bookkeeping of the ids
+    graphs.push_front({ id, input, std::move(ctx_ptr), graph });
+    if (graphs.size() > GRAPH_CACHE_SIZE) {
+        graphs.pop_back();
+    }
+    return true;
+}
+
+bool rpc_server::graph_recompute(const rpc_msg_graph_recompute_req & request, rpc_msg_graph_compute_rsp & response) {
+    std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
+    auto it = std::find_if(graphs.begin(), graphs.end(), [&](const cached_graph & g) { return g.id == request.id; });
+    if (it == graphs.end()) {
+        GGML_LOG_ERROR("[%s] graph %" PRIx64 " not found\n", __func__, request.id);
+        return false;
+    }
+    graphs.splice(graphs.begin(), graphs, it);
+    GGML_PRINT_DEBUG("[%s] id: %" PRIx64 ", n_nodes: %d\n", __func__, request.id, it->graph->n_nodes);
+    response.result = ggml_backend_graph_compute(backend, it->graph);
     return true;
 }
 
 rpc_server::~rpc_server() {
-    for (auto buffer : buffers) {
-        ggml_backend_buffer_free(buffer);
+    {
+        std::lock_guard<rpc_fair_mutex> lock(state.backend_mutex);
+        for (auto buffer : buffers) {
+            ggml_backend_buffer_free(buffer);
+        }
     }
+    state.allocated -= allocated;
+#ifdef RPC_USE_SHM
+    if (shm) {
+        munmap(shm, RPC_SHM_SIZE);
+    }
+#endif
 }
 
-static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
-                             sockfd_t sockfd, size_t free_mem, size_t total_mem) {
-    rpc_server server(backend, cache_dir);
+// a command received from the client
+struct rpc_request {
+    uint8_t cmd;
+    std::vector<uint8_t> input;
+};
+
+// commands that have been received but not executed yet
+// the size of the queued data is limited, the reader blocks when the client is too far ahead (e.g. loading the weights)
+class rpc_request_queue {
+public:
+    bool push(rpc_request && req) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_push.wait(lock, [&] { return closed || requests.empty() || size + req.input.size() <= max_size; });
+        if (closed) {
+            return false;
+        }
+        size += req.input.size();
+        requests.push_back(std::move(req));
+        cv_pop.notify_one();
+        return true;
+    }
+
+    // returns false when the queue is closed and empty
+    bool pop(rpc_request & req) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_pop.wait(lock, [&] { return closed || !requests.empty(); });
+        if (requests.empty()) {
+            return false;
+        }
+        req = std::move(requests.front());
+        requests.pop_front();
+        size -= req.input.size();
+        cv_push.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        cv_push.notify_all();
+        cv_pop.notify_all();
+    }
+
+private:
+    static constexpr size_t max_size = 256 * 1024 * 1024;
+
+    std::mutex mutex;
+    std::condition_variable cv_push;
+    std::condition_variable cv_pop;
+    std::deque<rpc_request> requests;
+    size_t size = 0;
+    bool closed = false;
+};
+
+static bool parse_msg(const rpc_request & req, void * msg, size_t msg_size) {
+    if (req.input.size() != msg_size) {
+        return false;
+    }
+    if (msg_size > 0) {
+        memcpy(msg, req.input.data(), msg_size);
+    }
+    return true;
+}
+
+static void rpc_serve_requests(rpc_server & server, rpc_request_queue & queue, sockfd_t sockfd);
+
+static void rpc_serve_client(rpc_server_state & state, sockfd_t sockfd) {
+    rpc_server server(state);
     uint8_t cmd;
     if (!recv_data(sockfd, &cmd, 1)) {
         return;
@@ -1404,23 +2395,52 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
     if (!send_msg(sockfd, &response, sizeof(response))) {
         return;
     }
-    while (true) {
-        if (!recv_data(sockfd, &cmd, 1)) {
-            break;
-        }
-        if (cmd >= RPC_CMD_COUNT) {
-            // fail fast if the command is invalid
-            fprintf(stderr, "Unknown command: %d\n", cmd);
-            break;
+
+    // the commands are received by a separate thread, so that the data of the next commands (e.g. the inputs of the
+    // next micro-batch with pipeline parallelism) is received while a graph is being computed
+    rpc_request_queue queue;
+    std::thread reader([&]() {
+        while (true) {
+            rpc_request req;
+            if (!recv_data(sockfd, &req.cmd, 1)) {
+                break;
+            }
+            if (req.cmd >= RPC_CMD_COUNT) {
+                // fail fast if the command is invalid
+                fprintf(stderr, "Unknown command: %d\n", req.cmd);
+                break;
+            }
+            if (!recv_msg(sockfd, req.input)) {
+                break;
+            }
+            if (!queue.push(std::move(req))) {
+                break;
+            }
         }
-        switch (cmd) {
+        queue.close();
+    });
+    rpc_serve_requests(server, queue, sockfd);
+    // unblock the reader
+    queue.close();
+#ifdef _WIN32
+    shutdown(sockfd, SD_BOTH);
+#else
+    shutdown(sockfd, SHUT_RDWR);
+#endif
+    reader.join();
+}
+
+static void rpc_serve_requests(rpc_server & server, rpc_request_queue & queue, sockfd_t sockfd) {
+    rpc_request req;
+    while (queue.pop(req)) {
+        switch (req.cmd) {
             case RPC_CMD_HELLO: {
                 // HELLO command is handled above
                 return;
             }
             case RPC_CMD_ALLOC_BUFFER: {
                 rpc_msg_alloc_buffer_req request;
-                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                if (!parse_msg(req, &request, sizeof(request))) {
                     return;
                 }
                 rpc_msg_alloc_buffer_rsp response;
@@ -1432,7 +2452,7 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
             }
             case RPC_CMD_GET_ALLOC_SIZE: {
                 rpc_msg_get_alloc_size_req request;
-                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                if (!parse_msg(req, &request, sizeof(request))) {
                     return;
                 }
                 rpc_msg_get_alloc_size_rsp response;
@@ -1445,7 +2465,7 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
                 break;
             }
             case RPC_CMD_GET_ALIGNMENT: {
-                if (!recv_msg(sockfd, nullptr, 0)) {
+                if (!parse_msg(req, nullptr, 0)) {
                     return;
                 }
                 rpc_msg_get_alignment_rsp response;
@@ -1456,7 +2476,7 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
                 break;
             }
             case RPC_CMD_GET_MAX_SIZE: {
-                if (!recv_msg(sockfd, nullptr, 0)) {
+                if (!parse_msg(req, nullptr, 0)) {
                     return;
                 }
                 rpc_msg_get_max_size_rsp response;
@@ -1468,7 +2488,7 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
             }
             case RPC_CMD_BUFFER_GET_BASE: {
                 rpc_msg_buffer_get_base_req request;
-                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                if (!parse_msg(req, &request, sizeof(request))) {
                     return;
                 }
                 rpc_msg_buffer_get_base_rsp response;
@@ -1482,7 +2502,7 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
             }
             case RPC_CMD_FREE_BUFFER: {
                 rpc_msg_free_buffer_req request;
-                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                if (!parse_msg(req, &request, sizeof(request))) {
                     return;
                 }
                 if (!server.free_buffer(request)) {
@@ -1495,7 +2515,7 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
             }
             case RPC_CMD_BUFFER_CLEAR: {
                 rpc_msg_buffer_clear_req request;
-                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                if (!parse_msg(req, &request, sizeof(request))) {
                     return;
                 }
                 if (!server.buffer_clear(request)) {
@@ -1507,10 +2527,7 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
                 break;
             }
             case RPC_CMD_SET_TENSOR: {
-                std::vector<uint8_t> input;
-                if (!recv_msg(sockfd, input)) {
-                    return;
-                }
+                const std::vector<uint8_t> & input = req.input;
                 if (!server.set_tensor(input)) {
                     return;
                 }
@@ -1518,7 +2535,7 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
             }
             case RPC_CMD_SET_TENSOR_HASH: {
                 rpc_msg_set_tensor_hash_req request;
-                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                if (!parse_msg(req, &request, sizeof(request))) {
                     return;
                 }
                 rpc_msg_set_tensor_hash_rsp response;
@@ -1532,7 +2549,7 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
             }
             case RPC_CMD_INIT_TENSOR: {
                 rpc_msg_init_tensor_req request;
-                if (!recv_msg(sockfd, &request,sizeof(request))) {
+                if (!parse_msg(req, &request, sizeof(request))) {
                     return;
                 }
                 if (!server.init_tensor(request)) {
@@ -1545,7 +2562,7 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
             }
             case RPC_CMD_GET_TENSOR: {
                 rpc_msg_get_tensor_req request;
-                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                if (!parse_msg(req, &request, sizeof(request))) {
                     return;
                 }
                 std::vector<uint8_t> response;
@@ -1559,7 +2576,7 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
             }
             case RPC_CMD_COPY_TENSOR: {
                 rpc_msg_copy_tensor_req request;
-                if (!recv_msg(sockfd, &request, sizeof(request))) {
+                if (!parse_msg(req, &request, sizeof(request))) {
                     return;
                 }
                 rpc_msg_copy_tensor_rsp response;
@@ -1572,12 +2589,23 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
                 break;
             }
             case RPC_CMD_GRAPH_COMPUTE: {
-                std::vector<uint8_t> input;
-                if (!recv_msg(sockfd, input)) {
+                const std::vector<uint8_t> & input = req.input;
+                rpc_msg_graph_compute_rsp response;
+                if (!server.graph_compute(input, response)) {
+                    return;
+                }
+                if (!send_msg(sockfd, &response, sizeof(response))) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_GRAPH_RECOMPUTE: {
+                rpc_msg_graph_recompute_req request;
+                if (!parse_msg(req, &request, sizeof(request))) {
                     return;
                 }
                 rpc_msg_graph_compute_rsp response;
-                if (!server.graph_compute(input, response)) {
+                if (!server.graph_recompute(request, response)) {
                     return;
                 }
                 if (!send_msg(sockfd, &response, sizeof(response))) {
@@ -1585,20 +2613,75 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
                 }
                 break;
             }
+            case RPC_CMD_SHM_ATTACH: {
+                rpc_msg_shm_attach_req request;
+                if (!parse_msg(req, &request, sizeof(request))) {
+                    return;
+                }
+                rpc_msg_shm_attach_rsp response;
+                server.shm_attach(request, response);
+                if (!send_msg(sockfd, &response, sizeof(response))) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_SET_TENSOR_SHM: {
+                rpc_msg_set_tensor_shm_req request;
+                if (!parse_msg(req, &request, sizeof(request))) {
+                    return;
+                }
+                if (!server.set_tensor_shm(request)) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_GET_TENSOR_SHM: {
+                rpc_msg_get_tensor_shm_req request;
+                if (!parse_msg(req, &request, sizeof(request))) {
+                    return;
+                }
+                if (!server.get_tensor_shm(request)) {
+                    return;
+                }
+                if (!send_msg(sockfd, nullptr, 0)) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_SET_TENSOR_CODEC: {
+                const std::vector<uint8_t> & input = req.input;
+                if (!server.set_tensor_codec(input)) {
+                    return;
+                }
+                break;
+            }
+            case RPC_CMD_GET_TENSOR_CODEC: {
+                rpc_msg_get_tensor_codec_req request;
+                if (!parse_msg(req, &request, sizeof(request))) {
+                    return;
+                }
+                std::vector<uint8_t> response;
+                if (!server.get_tensor_codec(request, response)) {
+                    return;
+                }
+                if (!send_msg(sockfd, response.data(), response.size())) {
+                    return;
+                }
+                break;
+            }
             case RPC_CMD_GET_DEVICE_MEMORY: {
-                if (!recv_msg(sockfd, nullptr, 0)) {
+                if (!parse_msg(req, nullptr, 0)) {
                     return;
                 }
                 rpc_msg_get_device_memory_rsp response;
-                response.free_mem = free_mem;
-                response.total_mem = total_mem;
+                server.get_device_memory(response);
                 if (!send_msg(sockfd, &response, sizeof(response))) {
                     return;
                 }
                 break;
             }
             default: {
-                fprintf(stderr, "Unknown command: %d\n", cmd);
+                fprintf(stderr, "Unknown command: %d\n", req.cmd);
                 return;
             }
         }
@@ -1608,6 +2691,12 @@ static void rpc_serve_client(ggml_backend_t backend, const char * cache_dir,
 void ggml_backend_rpc_start_server(ggml_backend_t backend, const char * endpoint,
                                    const char * cache_dir,
                                    size_t free_mem, size_t total_mem) {
+    ggml_backend_rpc_start_server_ex(backend, endpoint, cache_dir, free_mem, total_mem, 0);
+}
+
+void ggml_backend_rpc_start_server_ex(ggml_backend_t backend, const char * endpoint,
+                                      const char * cache_dir,
+                                      size_t free_mem, size_t total_mem, size_t client_mem) {
     printf("Starting RPC server v%d.%d.%d\n",
         RPC_PROTO_MAJOR_VERSION,
         RPC_PROTO_MINOR_VERSION,
@@ -1615,6 +2704,9 @@ void ggml_backend_rpc_start_server(ggml_backend_t backend, const char * endpoint
     printf("  endpoint       : %s\n", endpoint);
     printf("  local cache    : %s\n", cache_dir ? cache_dir : "n/a");
     printf("  backend memory : %zu MB\n", free_mem / (1024 * 1024));
+    if (client_mem > 0) {
+        printf("  client memory  : %zu MB\n", client_mem / (1024 * 1024));
+    }
 
     std::string host;
     int port;
@@ -1636,17 +2728,28 @@ void ggml_backend_rpc_start_server(ggml_backend_t backend, const char * endpoint
         fprintf(stderr, "Failed to create server socket\n");
         return;
     }
+    auto state = std::make_shared<rpc_server_state>();
+    state->backend    = backend;
+    state->cache_dir  = cache_dir;
+    state->free_mem   = free_mem;
+    state->total_mem  = total_mem;
+    state->client_mem = client_mem;
     while (true) {
         auto client_socket = socket_accept(server_socket->fd);
         if (client_socket == nullptr) {
             fprintf(stderr, "Failed to accept client connection\n");
             return;
         }
-        printf("Accepted client connection, free_mem=%zu, total_mem=%zu\n", free_mem, total_mem);
-        fflush(stdout);
-        rpc_serve_client(backend, cache_dir, client_socket->fd, free_mem, total_mem);
-        printf("Client connection closed\n");
-        fflush(stdout);
+        // each client is served by its own thread, the socket is closed when the thread exits
+        std::thread([state, client_socket]() {
+            const int n_clients = ++state->n_clients;
+            printf("Accepted client connection, free_mem=%zu, total_mem=%zu, clients=%d\n", state->free_mem, state->total_mem, n_clients);
+            fflush(stdout);
+            rpc_serve_client(*state, client_socket->fd);
+            state->n_clients--;
+            printf("Client connection closed\n");
+            fflush(stdout);
+        }).detach();
     }
 #ifdef _WIN32
     WSACleanup();
@@ -1693,10 +2796,10 @@ static void ggml_backend_rpc_device_get_props(ggml_backend_dev_t dev, struct ggm
     props->type        = ggml_backend_rpc_device_get_type(dev);
     ggml_backend_rpc_device_get_memory(dev, &props->memory_free, &props->memory_total);
     props->caps = {
-        /* .async                 = */ false,
+        /* .async                 = */ true,
         /* .host_buffer           = */ false,
         /* .buffer_from_host_ptr  = */ false,
-        /* .events                = */ false,
+        /* .events                = */ true,
     };
 }
 
@@ -1732,6 +2835,31 @@ static bool ggml_backend_rpc_device_supports_buft(ggml_backend_dev_t dev, ggml_b
     return buft_ctx->endpoint == dev_ctx->endpoint;
 }
 
+static ggml_backend_event_t ggml_backend_rpc_device_event_new(ggml_backend_dev_t dev) {
+    return new ggml_backend_event {
+        /* .device  = */ dev,
+        /* .context = */ new ggml_backend_rpc_event_context,
+    };
+}
+
+static void ggml_backend_rpc_device_event_free(ggml_backend_dev_t dev, ggml_backend_event_t event) {
+    delete (ggml_backend_rpc_event_context *)event->context;
+    delete event;
+
+    GGML_UNUSED(dev);
+}
+
+static void ggml_backend_rpc_device_event_synchronize(ggml_backend_dev_t dev, ggml_backend_event_t event) {
+    ggml_backend_rpc_event_context * event_ctx = (ggml_backend_rpc_event_context *)event->context;
+    if (event_ctx->sock == nullptr) {
+        return;
+    }
+    bool status = recv_pending(event_ctx->sock, event_ctx->id);
+    RPC_STATUS_ASSERT(status);
+
+    GGML_UNUSED(dev);
+}
+
 static const struct ggml_backend_device_i ggml_backend_rpc_device_i = {
     /* .get_name             = */ ggml_backend_rpc_device_get_name,
     /* .get_description      = */ ggml_backend_rpc_device_get_description,
@@ -1745,9 +2873,9 @@ static const struct ggml_backend_device_i ggml_backend_rpc_device_i = {
     /* .supports_op          = */ ggml_backend_rpc_device_supports_op,
     /* .supports_buft        = */ ggml_backend_rpc_device_supports_buft,
     /* .offload_op           = */ NULL,
-    /* .event_new            = */ NULL,
-    /* .event_free           = */ NULL,
-    /* .event_synchronize    = */ NULL,
+    /* .event_new            = */ ggml_backend_rpc_device_event_new,
+    /* .event_free           = */ ggml_backend_rpc_device_event_free,
+    /* .event_synchronize    = */ ggml_backend_rpc_device_event_synchronize,
 };
 
 // backend reg interface
@@ -1778,6 +2906,12 @@ static void * ggml_backend_rpc_get_proc_address(ggml_backend_reg_t reg, const ch
     if (std::strcmp(name, "ggml_backend_rpc_start_server") == 0) {
         return (void *)ggml_backend_rpc_start_server;
     }
+    if (std::strcmp(name, "ggml_backend_rpc_start_server_ex") == 0) {
+        return (void *)ggml_backend_rpc_start_server_ex;
+    }
+    if (std::strcmp(name, "ggml_backend_rpc_get_stats") == 0) {
+        return (void *)ggml_backend_rpc_get_stats;
+    }
     return NULL;
 
     GGML_UNUSED(reg);
@@ -1826,4 +2960,11 @@ ggml_backend_dev_t ggml_backend_rpc_add_device(const char * endpoint) {
     return dev;
 }
 
+void ggml_backend_rpc_get_stats(struct ggml_backend_rpc_stats * stats) {
+    stats->bytes_sent = rpc_stats.bytes_sent;
+    stats->bytes_recv = rpc_stats.bytes_recv;
+    stats->bytes_shm  = rpc_stats.bytes_shm;
+    stats->n_codec    = rpc_stats.n_codec;
+}
+
 GGML_BACKEND_DL_IMPL(ggml_backend_rpc_reg)
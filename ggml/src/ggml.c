@@ -5055,6 +5055,26 @@ void ggml_flash_attn_ext_add_sinks(
     a->src[4] = sinks;
 }
 
+void ggml_flash_attn_ext_add_mask_blk(
+        struct ggml_tensor * a,
+        struct ggml_tensor * blk) {
+    if (!blk) {
+        a->src[5] = NULL;
+        return;
+    }
+
+    GGML_ASSERT(a->op == GGML_OP_FLASH_ATTN_EXT);
+    GGML_ASSERT(a->src[3] != NULL);
+    GGML_ASSERT(a->src[5] == NULL);
+    GGML_ASSERT(blk->type == GGML_TYPE_I8);
+    GGML_ASSERT(blk->ne[0] == (a->src[3]->ne[0] + GGML_KQ_MASK_BLK - 1)/GGML_KQ_MASK_BLK);
+    GGML_ASSERT(blk->ne[1] == a->src[3]->ne[1]);
+    GGML_ASSERT(blk->ne[2] == a->src[3]->ne[2]);
+    GGML_ASSERT(blk->ne[3] == a->src[3]->ne[3]);
+
+    a->src[5] = blk;
+}
+
 // ggml_flash_attn_back
 
 struct ggml_tensor * ggml_flash_attn_back(
@@ -42,10 +42,10 @@
 #define LLAMA_FILE_MAGIC_GGSQ 0x67677371u // 'ggsq'
 
 #define LLAMA_SESSION_MAGIC   LLAMA_FILE_MAGIC_GGSN
-#define LLAMA_SESSION_VERSION 9
+#define LLAMA_SESSION_VERSION 10
 
 #define LLAMA_STATE_SEQ_MAGIC   LLAMA_FILE_MAGIC_GGSQ
-#define LLAMA_STATE_SEQ_VERSION 2
+#define LLAMA_STATE_SEQ_VERSION 3
 
 #ifdef __cplusplus
 extern "C" {
@@ -188,9 +188,10 @@ extern "C" {
     LLAMA_API const char * llama_flash_attn_type_name(enum llama_flash_attn_type flash_attn_type);
 
     enum llama_split_mode {
-        LLAMA_SPLIT_MODE_NONE  = 0, // single GPU
-        LLAMA_SPLIT_MODE_LAYER = 1, // split layers and KV across GPUs
-        LLAMA_SPLIT_MODE_ROW   = 2, // split layers and KV across GPUs, use tensor parallelism if supported
+        LLAMA_SPLIT_MODE_NONE   = 0, // single GPU
+        LLAMA_SPLIT_MODE_LAYER  = 1, // split layers and KV across GPUs
+        LLAMA_SPLIT_MODE_ROW    = 2, // split layers and KV across GPUs, use tensor parallelism if supported
+        LLAMA_SPLIT_MODE_TENSOR = 3, // split layers and KV across GPUs, shard the FFN of each layer across all GPUs
     };
 
     // TODO: simplify (https://github.com/ggml-org/llama.cpp/pull/9294#pullrequestreview-2286561979)
@@ -322,6 +323,8 @@ extern "C" {
         float    yarn_beta_slow;   // YaRN high correction dim
         uint32_t yarn_orig_ctx;    // YaRN original context size
         float    defrag_thold;     // [DEPRECATED] defragment the KV cache if holes/size > thold, <= 0 disabled (default)
+        uint32_t n_expert_hot;     // MoE: number of experts per layer kept locked in RAM based on their routing frequency,
+                                   // the others are paged in from the model file on demand, 0 = disabled [EXPERIMENTAL]
 
         ggml_backend_sched_eval_callback cb_eval;
         void * cb_eval_user_data;
@@ -346,6 +349,8 @@ extern "C" {
         bool kv_unified;  // use a unified buffer across the input sequences when computing the attention
                           // try to disable when n_seq_max > 1 for improved performance when the sequences do not share a large prefix
                           // ref: https://github.com/ggml-org/llama.cpp/pull/14363
+        bool kv_smooth_k; // subtract a per-channel mean from K before storing it in a quantized K cache [EXPERIMENTAL]
+                          // improves the accuracy of low-bit K caches (e.g. q4_0), has no effect with F16/F32 K caches
     };
 
     // model quantization parameters
@@ -583,6 +588,19 @@ extern "C" {
     // Note: loaded adapters will be free when the associated model is deleted
     LLAMA_API void llama_adapter_lora_free(struct llama_adapter_lora * adapter);
 
+    // Returns the total size of the adapter tensors in bytes
+    LLAMA_API uint64_t llama_adapter_lora_size(const struct llama_adapter_lora * adapter);
+
+    // Copy the adapter tensors to host memory and free their buffers (e.g. to free device memory)
+    // The adapter cannot be set on a context while it is offloaded, remove it from the contexts first
+    LLAMA_API void llama_adapter_lora_offload(struct llama_adapter_lora * adapter);
+
+    // Allocate the buffers of an offloaded adapter again and copy the tensors back
+    // Returns false if the buffers cannot be allocated, the adapter then stays offloaded
+    LLAMA_API bool llama_adapter_lora_reload(struct llama_adapter_lora * adapter);
+
+    LLAMA_API bool llama_adapter_lora_is_offloaded(const struct llama_adapter_lora * adapter);
+
     // Get the invocation tokens if the current lora is an alora
     LLAMA_API uint64_t            llama_adapter_get_alora_n_invocation_tokens(const struct llama_adapter_lora * adapter);
     LLAMA_API const llama_token * llama_adapter_get_alora_invocation_tokens  (const struct llama_adapter_lora * adapter);
@@ -605,6 +623,27 @@ extern "C" {
     // Remove all LoRA adapters from given context
     LLAMA_API void llama_clear_adapter_lora(struct llama_context * ctx);
 
+    // Add a loaded LoRA adapter to a single sequence of the given context
+    // Only the tokens of seq_id are affected, so a batch can mix sequences that use different adapters
+    // If the adapter is already set for the sequence, its scale will be updated
+    LLAMA_API int32_t llama_set_adapter_lora_seq(
+            struct llama_context * ctx,
+            struct llama_adapter_lora * adapter,
+            llama_seq_id seq_id,
+            float scale);
+
+    // Remove a specific LoRA adapter from a sequence of the given context
+    // Return -1 if the adapter is not set for the sequence
+    LLAMA_API int32_t llama_rm_adapter_lora_seq(
+            struct llama_context * ctx,
+            struct llama_adapter_lora * adapter,
+            llama_seq_id seq_id);
+
+    // Remove all per-sequence LoRA adapters of a sequence (seq_id < 0 : of all sequences)
+    LLAMA_API void llama_clear_adapter_lora_seq(
+            struct llama_context * ctx,
+            llama_seq_id seq_id);
+
     // Apply a loaded control vector to a llama_context, or if data is NULL, clear
     // the currently loaded vector.
     // n_embd should be the size of a single layer's control, and data should point
@@ -1020,6 +1059,37 @@ extern "C" {
                             bool   add_special,
                             bool   parse_special);
 
+    /// @details Same as llama_tokenize(), but for large inputs the BPE merges are distributed over n_threads threads.
+    /// The input is chunked at pre-tokenizer (word) boundaries, so the result is identical to llama_tokenize().
+    /// Vocabularies other than BPE ignore n_threads.
+    LLAMA_API int32_t llama_tokenize_parallel(
+        const struct llama_vocab * vocab,
+                      const char * text,
+                         int32_t   text_len,
+                     llama_token * tokens,
+                         int32_t   n_tokens_max,
+                            bool   add_special,
+                            bool   parse_special,
+                         int32_t   n_threads);
+
+    /// @details Convert n_texts strings into tokens, distributing the texts over n_threads threads.
+    /// The tokens of all texts are written to one contiguous buffer: the tokens of texts[i] are tokens[offsets[i], offsets[i + 1]).
+    /// @param offsets Must hold n_texts + 1 entries. Filled also on failure, so the caller can size the buffer from offsets[n_texts].
+    /// @return Returns the total number of tokens on success, no more than n_tokens_max
+    /// @return Returns a negative number on failure - the total number of tokens that would have been returned
+    /// @return Returns INT32_MIN on overflow (e.g., tokenization result size exceeds int32_t limit)
+    LLAMA_API int32_t llama_tokenize_batch(
+        const struct llama_vocab * vocab,
+              const char * const * texts,
+                   const int32_t * text_lens,
+                         int32_t   n_texts,
+                     llama_token * tokens,
+                         int32_t   n_tokens_max,
+                         int32_t * offsets,
+                            bool   add_special,
+                            bool   parse_special,
+                         int32_t   n_threads);
+
     // Token Id -> Piece.
     // Uses the vocabulary in the provided context.
     // Does not write null terminator to the buffer.
@@ -1341,6 +1411,10 @@ extern "C" {
         int32_t n_p_eval;
         int32_t n_eval;
         int32_t n_reused; // number of times a ggml compute graph had been reused
+
+        // updated every few ubatches, when the hot experts are re-selected
+        int64_t n_expert_hit;  // MoE expert cache: routed experts that were hot
+        int64_t n_expert_miss; // MoE expert cache: routed experts that were not hot
     };
 
     struct llama_perf_sampler_data {
@@ -146,6 +146,78 @@ llama_adapter_lora_weight * llama_adapter_lora::get_weight(ggml_tensor * w) {
     return nullptr;
 }
 
+void llama_adapter_lora::offload() {
+    if (!host_bufs.empty()) {
+        return;
+    }
+
+    for (auto & ctx : ctxs) {
+        ggml_tensor * first = ggml_get_first_tensor(ctx.get());
+        if (first == nullptr) {
+            continue;
+        }
+
+        llama_adapter_lora_host_buf hb;
+        hb.ctx  = ctx.get();
+        hb.buft = ggml_backend_buffer_get_type(first->buffer);
+        hb.size = ggml_backend_buffer_get_size(first->buffer);
+
+        for (ggml_tensor * t = first; t != nullptr; t = ggml_get_next_tensor(ctx.get(), t)) {
+            const size_t offs = hb.data.size();
+            hb.data.resize(offs + ggml_nbytes(t));
+            ggml_backend_tensor_get(t, hb.data.data() + offs, 0, ggml_nbytes(t));
+        }
+
+        host_bufs.push_back(std::move(hb));
+    }
+
+    for (auto & ctx : ctxs) {
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx.get()); t != nullptr; t = ggml_get_next_tensor(ctx.get(), t)) {
+            t->buffer = nullptr;
+            t->data   = nullptr;
+        }
+    }
+
+    bufs.clear();
+}
+
+bool llama_adapter_lora::reload() {
+    if (host_bufs.empty()) {
+        return true;
+    }
+
+    GGML_ASSERT(bufs.empty());
+
+    for (const auto & hb : host_bufs) {
+        ggml_backend_buffer_ptr buf { ggml_backend_alloc_ctx_tensors_from_buft(hb.ctx, hb.buft) };
+        if (!buf) {
+            LLAMA_LOG_ERROR("%s: failed to allocate %s buffer for lora adapter\n", __func__, ggml_backend_buft_name(hb.buft));
+
+            // keep the host copy, the tensors are allocated again by the next reload
+            for (auto & ctx : ctxs) {
+                for (ggml_tensor * t = ggml_get_first_tensor(ctx.get()); t != nullptr; t = ggml_get_next_tensor(ctx.get(), t)) {
+                    t->buffer = nullptr;
+                    t->data   = nullptr;
+                }
+            }
+            bufs.clear();
+
+            return false;
+        }
+        bufs.emplace_back(std::move(buf));
+
+        size_t offs = 0;
+        for (ggml_tensor * t = ggml_get_first_tensor(hb.ctx); t != nullptr; t = ggml_get_next_tensor(hb.ctx, t)) {
+            ggml_backend_tensor_set(t, hb.data.data() + offs, 0, ggml_nbytes(t));
+            offs += ggml_nbytes(t);
+        }
+    }
+
+    host_bufs.clear();
+
+    return true;
+}
+
 static void llama_adapter_lora_init_impl(llama_model & model, const char * path_lora, llama_adapter_lora & adapter) {
     LLAMA_LOG_INFO("%s: loading lora adapter from '%s' ...\n", __func__, path_lora);
 
@@ -326,6 +398,16 @@ static void llama_adapter_lora_init_impl(llama_model & model, const char * path_
             throw std::runtime_error("LoRA tensor pair for '" + name + "' is missing one component");
         }
 
+        // LLAMA_SPLIT_MODE_TENSOR: the graph uses the shards of the FFN weights, the adapter would not be applied
+        for (const auto & split : model.ffn_split) {
+            for (const ggml_tensor * t : { split.up, split.gate, split.down }) {
+                if (t && name == ggml_get_name(t)) {
+                    throw std::runtime_error("LoRA tensor '" + name + "' targets an FFN weight that is sharded by the tensor split mode, "
+                            "LoRA adapters of the FFN are not supported with --split-mode tensor");
+                }
+            }
+        }
+
         // device buft and device ctx
         const auto * model_tensor = model.get_tensor(name.c_str());
         if (!model_tensor) {
@@ -472,6 +554,29 @@ void llama_adapter_lora_free(llama_adapter_lora * adapter) {
     delete adapter;
 }
 
+uint64_t llama_adapter_lora_size(const llama_adapter_lora * adapter) {
+    uint64_t size = 0;
+    for (const auto & buf : adapter->bufs) {
+        size += ggml_backend_buffer_get_size(buf.get());
+    }
+    for (const auto & hb : adapter->host_bufs) {
+        size += hb.size;
+    }
+    return size;
+}
+
+void llama_adapter_lora_offload(llama_adapter_lora * adapter) {
+    adapter->offload();
+}
+
+bool llama_adapter_lora_reload(llama_adapter_lora * adapter) {
+    return adapter->reload();
+}
+
+bool llama_adapter_lora_is_offloaded(const llama_adapter_lora * adapter) {
+    return !adapter->host_bufs.empty();
+}
+
 uint64_t llama_adapter_get_alora_n_invocation_tokens(const struct llama_adapter_lora * adapter) {
     if (!adapter) {
         return 0;
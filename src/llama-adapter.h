@@ -58,6 +58,15 @@ struct llama_adapter_lora_weight {
     llama_adapter_lora_weight(ggml_tensor * a, ggml_tensor * b) : a(a), b(b) {}
 };
 
+// tensor data of the buffer of a context while the adapter is offloaded
+struct llama_adapter_lora_host_buf {
+    ggml_context * ctx;
+    ggml_backend_buffer_type_t buft;
+    size_t size; // size of the buffer
+
+    std::vector<uint8_t> data; // tensors of ctx, in order
+};
+
 struct llama_adapter_lora {
     // map tensor name to lora_a_b
     std::unordered_map<std::string, llama_adapter_lora_weight> ab_map;
@@ -65,6 +74,9 @@ struct llama_adapter_lora {
     std::vector<ggml_context_ptr> ctxs;
     std::vector<ggml_backend_buffer_ptr> bufs;
 
+    // not empty while the adapter is offloaded, bufs is then empty
+    std::vector<llama_adapter_lora_host_buf> host_bufs;
+
     float alpha;
 
     // gguf metadata
@@ -77,6 +89,12 @@ struct llama_adapter_lora {
     ~llama_adapter_lora() = default;
 
     llama_adapter_lora_weight * get_weight(ggml_tensor * w);
+
+    void offload();
+    bool reload();
 };
 
 using llama_adapter_loras = std::unordered_map<llama_adapter_lora *, float>;
+
+// adapter -> (seq_id -> scale)
+using llama_adapter_loras_seq = std::unordered_map<llama_adapter_lora *, std::unordered_map<llama_seq_id, float>>;
@@ -39,6 +39,7 @@ llama_context::llama_context(
     cparams.yarn_attn_factor = params.yarn_attn_factor;
     cparams.yarn_beta_fast   = params.yarn_beta_fast;
     cparams.yarn_beta_slow   = params.yarn_beta_slow;
+    cparams.n_expert_hot     = params.n_expert_hot;
     cparams.embeddings       = params.embeddings;
     cparams.offload_kqv      = params.offload_kqv;
     cparams.no_perf          = params.no_perf;
@@ -110,6 +111,13 @@ llama_context::llama_context(
         if (graph_reuse_disable) {
             LLAMA_LOG_WARN("%s: graph reuse disabled\n", __func__);
         }
+
+        const char * LLAMA_SCHED_TIMING = getenv("LLAMA_SCHED_TIMING");
+        sched_timing = LLAMA_SCHED_TIMING ? (atoi(LLAMA_SCHED_TIMING) != 0) : sched_timing;
+
+        if (sched_timing) {
+            LLAMA_LOG_WARN("%s: scheduler timing enabled, the backends will not overlap their computations\n", __func__);
+        }
     }
 
     const uint32_t n_ctx_per_seq = cparams.n_ctx / cparams.n_seq_max;
@@ -197,11 +205,25 @@ llama_context::llama_context(
             /*.type_k   =*/ params.type_k,
             /*.type_v   =*/ params.type_v,
             /*.swa_full =*/ params.swa_full,
+            /*.smooth_k =*/ params.kv_smooth_k,
         };
 
         memory.reset(model.create_memory(params_mem, cparams));
     }
 
+    if (!hparams.vocab_only && cparams.n_expert_hot > 0 && hparams.n_expert > 0) {
+        expert_cache = std::make_unique<llama_expert_cache>(model, cparams.n_expert_hot);
+
+        if (expert_cache->n_layer() == 0) {
+            LLAMA_LOG_WARN("%s: no MoE experts in host memory, the expert cache is disabled\n", __func__);
+            expert_cache.reset();
+        }
+    }
+
+    if (!expert_cache) {
+        cparams.n_expert_hot = 0;
+    }
+
     // init backends
     if (!hparams.vocab_only) {
         LLAMA_LOG_DEBUG("%s: enumerating backends\n", __func__);
@@ -268,6 +290,8 @@ llama_context::llama_context(
         if (pipeline_parallel) {
             LLAMA_LOG_INFO("%s: pipeline parallelism enabled (n_copies=%d)\n", __func__, ggml_backend_sched_get_n_copies(sched.get()));
         }
+
+        ggml_backend_sched_set_timing(sched.get(), sched_timing);
     }
 
     if (!hparams.vocab_only) {
@@ -718,6 +742,50 @@ void llama_context::clear_adapter_lora() {
     loras.clear();
 }
 
+void llama_context::set_adapter_lora_seq(
+            llama_adapter_lora * adapter,
+            llama_seq_id seq_id,
+            float scale) {
+    LLAMA_LOG_DEBUG("%s: adapter = %p, seq_id = %d, scale = %f\n", __func__, (void *) adapter, seq_id, scale);
+
+    loras_seq[adapter][seq_id] = scale;
+}
+
+bool llama_context::rm_adapter_lora_seq(
+            llama_adapter_lora * adapter,
+            llama_seq_id seq_id) {
+    LLAMA_LOG_DEBUG("%s: adapter = %p, seq_id = %d\n", __func__, (void *) adapter, seq_id);
+
+    auto pos = loras_seq.find(adapter);
+    if (pos == loras_seq.end() || pos->second.erase(seq_id) == 0) {
+        return false;
+    }
+
+    if (pos->second.empty()) {
+        loras_seq.erase(pos);
+    }
+
+    return true;
+}
+
+void llama_context::clear_adapter_lora_seq(llama_seq_id seq_id) {
+    LLAMA_LOG_DEBUG("%s: seq_id = %d\n", __func__, seq_id);
+
+    if (seq_id < 0) {
+        loras_seq.clear();
+        return;
+    }
+
+    for (auto it = loras_seq.begin(); it != loras_seq.end();) {
+        it->second.erase(seq_id);
+        if (it->second.empty()) {
+            it = loras_seq.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 bool llama_context::apply_adapter_cvec(
             const float * data,
                  size_t   len,
@@ -1118,6 +1186,12 @@ int llama_context::decode(const llama_batch & batch_inp) {
             }
         }
 
+        if (expert_cache && expert_cache->step()) {
+            // the routing counts are accumulated by the graph, they are read back only to re-select the hot experts
+            ggml_backend_sched_synchronize(sched.get());
+            expert_cache->rebalance();
+        }
+
         // plot the computation graph in dot format (for debugging purposes)
         //if (n_past%100 == 0) {
         //    ggml_graph_dump_dot(gf, NULL, "llama.dot");
@@ -1430,8 +1504,11 @@ llm_graph_params llama_context::graph_params(
         /*.backend_cpu =*/ backend_cpu,
         /*.cvec        =*/ &cvec,
         /*.loras       =*/ &loras,
+        /*.loras_seq   =*/ &loras_seq,
         /*.mctx        =*/ mctx,
         /*.cross       =*/ &cross,
+        /*.ffn_split   =*/ &model.ffn_split,
+        /*.expert_cache=*/ expert_cache.get(),
         /*.n_outputs   =*/ n_outputs,
         /*.cb          =*/ graph_get_cb(),
         /*.res         =*/ res,
@@ -2015,6 +2092,11 @@ llama_perf_context_data llama_context::perf_get_data() const {
     data.n_eval      = std::max(1, n_eval);
     data.n_reused    = std::max(0, n_reused);
 
+    if (expert_cache) {
+        data.n_expert_hit  = expert_cache->n_hit;
+        data.n_expert_miss = expert_cache->n_miss;
+    }
+
     return data;
 }
 
@@ -2023,6 +2105,76 @@ void llama_context::perf_reset() {
     t_eval_us   = n_eval = 0;
     t_p_eval_us = n_p_eval = 0;
     n_reused    = 0;
+
+    if (expert_cache) {
+        expert_cache->n_hit  = 0;
+        expert_cache->n_miss = 0;
+    }
+
+    if (sched) {
+        ggml_backend_sched_reset_timing(sched.get());
+    }
+}
+
+void llama_context::perf_print_sched() const {
+    if (!sched || !ggml_backend_sched_get_timing(sched.get())) {
+        return;
+    }
+
+    // compute time of the model devices, used to suggest a better split of the layers
+    std::vector<int64_t> t_dev(model.devices.size(), 0);
+
+    for (auto * backend : backend_ptrs) {
+        int64_t t_compute_us = 0;
+        int64_t t_copy_us    = 0;
+        ggml_backend_sched_get_backend_time(sched.get(), backend, &t_compute_us, &t_copy_us);
+
+        LLAMA_LOG_INFO("%s: %10s compute = %10.2f ms, input copies = %10.2f ms\n", __func__,
+                ggml_backend_name(backend), 1e-3*t_compute_us, 1e-3*t_copy_us);
+
+        auto * dev = ggml_backend_get_device(backend);
+        for (size_t i = 0; i < model.devices.size(); ++i) {
+            if (model.devices[i] == dev) {
+                t_dev[i] += t_compute_us;
+            }
+        }
+    }
+
+    // the layers are not moved between the devices at runtime since that would require uploading the weights again,
+    // instead suggest a split for the next load that gives each device a number of layers proportional to its speed
+    std::vector<int> n_layer_dev(model.devices.size(), 0);
+
+    for (int il = 0; il < (int) model.hparams.n_layer; ++il) {
+        for (size_t i = 0; i < model.devices.size(); ++i) {
+            if (model.dev_layer(il) == model.devices[i]) {
+                n_layer_dev[i]++;
+            }
+        }
+    }
+
+    int    n_used    = 0;
+    double sum_speed = 0.0;
+
+    std::vector<double> speed(model.devices.size(), 0.0);
+
+    for (size_t i = 0; i < model.devices.size(); ++i) {
+        if (n_layer_dev[i] > 0 && t_dev[i] > 0) {
+            speed[i]   = (double) n_layer_dev[i]/t_dev[i];
+            sum_speed += speed[i];
+            n_used++;
+        }
+    }
+
+    if (n_used < 2 || model.params.split_mode != LLAMA_SPLIT_MODE_LAYER) {
+        return;
+    }
+
+    std::string split;
+    for (size_t i = 0; i < model.devices.size(); ++i) {
+        split += format("%s%.3f", i == 0 ? "" : ",", speed[i]/sum_speed);
+    }
+
+    LLAMA_LOG_INFO("%s: suggested layer split = %s (--tensor-split)\n", __func__, split.c_str());
 }
 
 //
@@ -2266,6 +2418,7 @@ llama_context_params llama_context_default_params() {
         /*.yarn_beta_slow              =*/ 1.0f,
         /*.yarn_orig_ctx               =*/ 0,
         /*.defrag_thold                =*/ -1.0f,
+        /*.n_expert_hot                =*/ 0,
         /*.cb_eval                     =*/ nullptr,
         /*.cb_eval_user_data           =*/ nullptr,
         /*.type_k                      =*/ GGML_TYPE_F16,
@@ -2278,6 +2431,7 @@ llama_context_params llama_context_default_params() {
         /*.op_offload                  =*/ true,
         /*.swa_full                    =*/ true,
         /*.kv_unified                  =*/ false,
+        /*.kv_smooth_k                 =*/ false,
     };
 
     return result;
@@ -2453,6 +2607,11 @@ int32_t llama_set_adapter_lora(
             llama_context * ctx,
             llama_adapter_lora * adapter,
             float scale) {
+    if (llama_adapter_lora_is_offloaded(adapter)) {
+        LLAMA_LOG_ERROR("%s: the adapter is offloaded\n", __func__);
+        return -1;
+    }
+
     ctx->set_adapter_lora(adapter, scale);
 
     return 0;
@@ -2470,6 +2629,34 @@ void llama_clear_adapter_lora(llama_context * ctx) {
     ctx->clear_adapter_lora();
 }
 
+int32_t llama_set_adapter_lora_seq(
+            llama_context * ctx,
+            llama_adapter_lora * adapter,
+            llama_seq_id seq_id,
+            float scale) {
+    if (llama_adapter_lora_is_offloaded(adapter)) {
+        LLAMA_LOG_ERROR("%s: the adapter is offloaded\n", __func__);
+        return -1;
+    }
+
+    ctx->set_adapter_lora_seq(adapter, seq_id, scale);
+
+    return 0;
+}
+
+int32_t llama_rm_adapter_lora_seq(
+            llama_context * ctx,
+            llama_adapter_lora * adapter,
+            llama_seq_id seq_id) {
+    bool res = ctx->rm_adapter_lora_seq(adapter, seq_id);
+
+    return res ? 0 : -1;
+}
+
+void llama_clear_adapter_lora_seq(llama_context * ctx, llama_seq_id seq_id) {
+    ctx->clear_adapter_lora_seq(seq_id);
+}
+
 int32_t llama_apply_adapter_cvec(
         llama_context * ctx,
                  const float * data,
@@ -2757,6 +2944,13 @@ void llama_perf_context_print(const llama_context * ctx) {
             __func__, data.t_eval_ms, data.n_eval, data.t_eval_ms / data.n_eval, 1e3 / data.t_eval_ms * data.n_eval);
     LLAMA_LOG_INFO("%s:       total time = %10.2f ms / %5d tokens\n", __func__, (t_end_ms - data.t_start_ms), (data.n_p_eval + data.n_eval));
     LLAMA_LOG_INFO("%s:    graphs reused = %10d\n", __func__, data.n_reused);
+
+    if (data.n_expert_hit + data.n_expert_miss > 0) {
+        LLAMA_LOG_INFO("%s:     expert cache = %10" PRId64 " hits, %" PRId64 " misses (%.2f%% hit rate)\n", __func__,
+                data.n_expert_hit, data.n_expert_miss, 100.0*data.n_expert_hit/(data.n_expert_hit + data.n_expert_miss));
+    }
+
+    ctx->perf_print_sched();
 }
 
 void llama_perf_context_reset(llama_context * ctx) {
@@ -4,6 +4,7 @@
 #include "llama-cparams.h"
 #include "llama-graph.h"
 #include "llama-adapter.h"
+#include "llama-expert-cache.h"
 
 #include "ggml-cpp.h"
 #include "ggml-opt.h"
@@ -81,6 +82,17 @@ struct llama_context {
 
     void clear_adapter_lora();
 
+    void set_adapter_lora_seq(
+            llama_adapter_lora * adapter,
+            llama_seq_id seq_id,
+            float scale);
+
+    bool rm_adapter_lora_seq(
+            llama_adapter_lora * adapter,
+            llama_seq_id seq_id);
+
+    void clear_adapter_lora_seq(llama_seq_id seq_id);
+
     bool apply_adapter_cvec(
             const float * data,
                  size_t   len,
@@ -144,6 +156,9 @@ struct llama_context {
     llama_perf_context_data perf_get_data() const;
     void perf_reset();
 
+    // print the time spent in each backend, requires LLAMA_SCHED_TIMING
+    void perf_print_sched() const;
+
     //
     // training
     //
@@ -222,12 +237,16 @@ private:
 
     llama_cparams       cparams;
     llama_adapter_cvec  cvec;
-    llama_adapter_loras loras;
+    llama_adapter_loras     loras;
+    llama_adapter_loras_seq loras_seq;
 
     llama_cross cross; // TODO: tmp for handling cross-attention - need something better probably
 
     std::unique_ptr<llama_memory_i> memory;
 
+    // MoE expert cache (n_expert_hot > 0)
+    std::unique_ptr<llama_expert_cache> expert_cache;
+
     // decode output (2-dimensional array: [n_outputs][n_vocab])
     size_t  logits_size = 0; // capacity (of floats) for logits
     float * logits      = nullptr;
@@ -286,6 +305,9 @@ private:
     // env: LLAMA_GRAPH_REUSE_DISABLE
     bool graph_reuse_disable = false;
 
+    // env: LLAMA_SCHED_TIMING
+    bool sched_timing = false;
+
     // perf
     mutable int64_t t_start_us  = 0;
     mutable int64_t t_load_us   = 0;
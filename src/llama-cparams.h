@@ -25,6 +25,8 @@ struct llama_cparams {
     float yarn_beta_fast;
     float yarn_beta_slow;
 
+    uint32_t n_expert_hot;
+
     bool embeddings;
     bool causal_attn;
     bool offload_kqv;
@@ -0,0 +1,281 @@
+#include "llama-expert-cache.h"
+
+#include "llama-impl.h"
+#include "llama-mmap.h"
+#include "llama-model.h"
+
+#include "ggml-backend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+// the routing frequencies are halved every ~64 ubatches
+static constexpr float LLAMA_EXPERT_CACHE_DECAY = 0.989f;
+
+// number of ubatches between two selections of the hot experts
+static constexpr uint32_t LLAMA_EXPERT_CACHE_INTERVAL = 16;
+
+// a cold expert must be routed to this much more often than a hot one to replace it,
+// so that experts with similar frequencies are not swapped back and forth
+static constexpr float LLAMA_EXPERT_CACHE_HYSTERESIS = 1.25f;
+
+std::vector<llama_expert_tensor> llama_expert_tensors(const llama_layer & layer) {
+    std::vector<llama_expert_tensor> res;
+
+    int64_t n_expert = 0;
+
+    for (ggml_tensor * t : { layer.ffn_up_exps, layer.ffn_gate_exps, layer.ffn_down_exps }) {
+        if (t == nullptr || t->buffer == nullptr || !ggml_backend_buffer_is_host(t->buffer)) {
+            continue;
+        }
+
+        if (!res.empty() && t->ne[2] != n_expert) {
+            continue;
+        }
+
+        res.push_back({ (const uint8_t *) t->data, t->nb[2] });
+        n_expert = t->ne[2];
+    }
+
+    return res;
+}
+
+llama_expert_cache::llama_expert_cache(const llama_model & model, uint32_t n_hot) : model(model), n_hot(n_hot) {
+    const auto & hparams = model.hparams;
+
+    const int64_t n_expert = hparams.n_expert;
+
+    layers.resize(hparams.n_layer);
+
+    size_t nb_expert = 0;
+
+    for (uint32_t il = 0; il < hparams.n_layer; ++il) {
+        const auto & ml = model.layers[il];
+
+        // the experts are counted with the rows of the identity matrix, which has n_expert rows
+        const ggml_tensor * t = ml.ffn_up_exps ? ml.ffn_up_exps : ml.ffn_down_exps;
+        if (t == nullptr || t->ne[2] != n_expert) {
+            continue;
+        }
+
+        auto & l = layers[il];
+
+        l.tensors = llama_expert_tensors(ml);
+
+        size_t nb = 0;
+        for (const auto & et : l.tensors) {
+            nb += et.nb;
+        }
+        nb_expert = std::max(nb_expert, nb);
+
+        l.freq  .resize(n_expert, 0.0f);
+        l.hot   .resize(n_expert, false);
+        l.locked.resize(n_expert, false);
+    }
+
+    LLAMA_LOG_INFO("%s: %u MoE layers with experts in host memory, keeping %u hot experts per layer (%.2f MiB per expert)\n",
+            __func__, n_layer(), n_hot, nb_expert/1024.0/1024.0);
+
+    if (n_layer() == 0) {
+        return;
+    }
+
+    ggml_init_params params = {
+        /*.mem_size   =*/ (n_layer() + 1)*ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+
+    ctx.reset(ggml_init(params));
+    if (!ctx) {
+        throw std::runtime_error("failed to create ggml context for the expert cache");
+    }
+
+    eye = ggml_new_tensor_2d(ctx.get(), GGML_TYPE_F32, n_expert, n_expert);
+    ggml_format_name(eye, "expert_cache_eye");
+
+    for (uint32_t il = 0; il < hparams.n_layer; ++il) {
+        auto & l = layers[il];
+        if (l.tensors.empty()) {
+            continue;
+        }
+
+        l.counts = ggml_new_tensor_1d(ctx.get(), GGML_TYPE_F32, n_expert);
+        ggml_format_name(l.counts, "expert_cache_counts_l%d", il);
+    }
+
+    buf.reset(ggml_backend_alloc_ctx_tensors_from_buft(ctx.get(), ggml_backend_cpu_buffer_type()));
+    if (!buf) {
+        throw std::runtime_error("failed to allocate buffer for the expert cache");
+    }
+
+    ggml_backend_buffer_clear(buf.get(), 0);
+
+    std::vector<float> data(n_expert*n_expert, 0.0f);
+    for (int64_t ie = 0; ie < n_expert; ++ie) {
+        data[ie*n_expert + ie] = 1.0f;
+    }
+    ggml_backend_tensor_set(eye, data.data(), 0, ggml_nbytes(eye));
+}
+
+llama_expert_cache::~llama_expert_cache() {
+    for (int32_t il = 0; il < (int32_t) layers.size(); ++il) {
+        for (int32_t ie = 0; ie < (int32_t) layers[il].locked.size(); ++ie) {
+            if (layers[il].locked[ie]) {
+                unlock(il, ie);
+            }
+        }
+    }
+}
+
+uint32_t llama_expert_cache::n_layer() const {
+    uint32_t res = 0;
+
+    for (const auto & l : layers) {
+        res += l.tensors.empty() ? 0 : 1;
+    }
+
+    return res;
+}
+
+bool llama_expert_cache::has_layer(int32_t il) const {
+    return il >= 0 && il < (int32_t) layers.size() && !layers[il].tensors.empty();
+}
+
+ggml_tensor * llama_expert_cache::get_eye() const {
+    return eye;
+}
+
+ggml_tensor * llama_expert_cache::get_counts(int32_t il) const {
+    GGML_ASSERT(has_layer(il));
+
+    return layers[il].counts;
+}
+
+bool llama_expert_cache::step() {
+    // the first ubatch (usually the prompt) gives the initial selection
+    return n_ubatch++ % LLAMA_EXPERT_CACHE_INTERVAL == 0;
+}
+
+void llama_expert_cache::rebalance() {
+    const float decay = std::pow(LLAMA_EXPERT_CACHE_DECAY, (float) (n_ubatch - n_ubatch_select));
+    n_ubatch_select = n_ubatch;
+
+    std::vector<float> cnt;
+
+    for (int32_t il = 0; il < (int32_t) layers.size(); ++il) {
+        auto & l = layers[il];
+        if (l.tensors.empty()) {
+            continue;
+        }
+
+        cnt.resize(ggml_nelements(l.counts));
+        ggml_backend_tensor_get(l.counts, cnt.data(), 0, ggml_nbytes(l.counts));
+        ggml_backend_tensor_memset(l.counts, 0, 0, ggml_nbytes(l.counts));
+
+        for (size_t ie = 0; ie < l.freq.size(); ++ie) {
+            if (l.hot[ie]) {
+                n_hit  += (uint64_t) cnt[ie];
+            } else {
+                n_miss += (uint64_t) cnt[ie];
+            }
+
+            l.freq[ie] = l.freq[ie]*decay + cnt[ie];
+        }
+
+        select(il);
+
+        // the cold experts that were routed to recently are likely to be routed to again
+        for (size_t ie = 0; ie < l.freq.size(); ++ie) {
+            if (!l.hot[ie] && cnt[ie] > 0.0f) {
+                prefetch(l, ie);
+            }
+        }
+    }
+}
+
+void llama_expert_cache::select(int32_t il) {
+    auto & l = layers[il];
+
+    const int32_t n_expert = l.freq.size();
+
+    std::vector<int32_t> order(n_expert);
+    std::iota(order.begin(), order.end(), 0);
+
+    auto score = [&](int32_t ie) {
+        return l.hot[ie] ? l.freq[ie]*LLAMA_EXPERT_CACHE_HYSTERESIS : l.freq[ie];
+    };
+
+    std::stable_sort(order.begin(), order.end(), [&](int32_t a, int32_t b) {
+        return score(a) > score(b);
+    });
+
+    std::vector<bool> hot(n_expert, false);
+
+    for (int32_t i = 0; i < std::min<int32_t>(n_hot, n_expert); ++i) {
+        // never routed to, not worth keeping
+        if (l.freq[order[i]] <= 0.0f) {
+            break;
+        }
+        hot[order[i]] = true;
+    }
+
+    for (int32_t ie = 0; ie < n_expert; ++ie) {
+        if (l.hot[ie] && !hot[ie]) {
+            if (l.locked[ie]) {
+                unlock(il, ie);
+            }
+            release(l, ie);
+        }
+    }
+
+    for (int32_t ie = 0; ie < n_expert; ++ie) {
+        if (!l.hot[ie] && hot[ie]) {
+            lock(il, ie);
+        }
+    }
+
+    l.hot = std::move(hot);
+}
+
+void llama_expert_cache::lock(int32_t il, int32_t ie) {
+    auto & l = layers[il];
+
+    // locking pages the weights in
+    if (can_lock && model.expert_lock(il, ie)) {
+        l.locked[ie] = true;
+        return;
+    }
+
+    if (can_lock) {
+        LLAMA_LOG_WARN("%s: failed to lock expert weights, hot experts will only be paged in - try increasing RLIMIT_MEMLOCK ('ulimit -l')\n", __func__);
+        can_lock = false;
+    }
+
+    touch(l, ie);
+}
+
+void llama_expert_cache::unlock(int32_t il, int32_t ie) {
+    model.expert_unlock(il, ie);
+    layers[il].locked[ie] = false;
+}
+
+void llama_expert_cache::prefetch(const layer & l, int32_t ie) const {
+    for (const auto & t : l.tensors) {
+        llama_mem_prefetch_range(t.data + ie*t.nb, t.nb);
+    }
+}
+
+void llama_expert_cache::touch(const layer & l, int32_t ie) const {
+    for (const auto & t : l.tensors) {
+        llama_mem_touch_range(t.data + ie*t.nb, t.nb);
+    }
+}
+
+void llama_expert_cache::release(const layer & l, int32_t ie) const {
+    for (const auto & t : l.tensors) {
+        llama_mem_release_range(t.data + ie*t.nb, t.nb);
+    }
+}
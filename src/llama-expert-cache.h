@@ -0,0 +1,98 @@
+#pragma once
+
+#include "ggml-cpp.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct ggml_tensor;
+struct llama_layer;
+struct llama_model;
+
+// expert tensor of a MoE layer in host memory, the weights of expert ie are [data + ie*nb, data + (ie + 1)*nb)
+struct llama_expert_tensor {
+    const uint8_t * data;
+    size_t          nb; // bytes per expert
+};
+
+// the up, gate and down expert tensors of a layer that are in host memory
+std::vector<llama_expert_tensor> llama_expert_tensors(const llama_layer & layer);
+
+//
+// llama_expert_cache
+//
+
+// tracks how often each expert of each MoE layer is routed to and keeps the most used ones ("hot") locked in RAM
+// the other experts stay in the mapped model file and are paged in on demand
+// the graph adds the number of tokens routed to each expert to the routing counts of the layer (see get_counts), which
+// are read back only when the hot experts are re-selected, so the routing does not have to be read back every ubatch
+// only the expert tensors in host buffers are managed
+class llama_expert_cache {
+public:
+    llama_expert_cache(const llama_model & model, uint32_t n_hot);
+    ~llama_expert_cache();
+
+    // number of layers with managed experts
+    uint32_t n_layer() const;
+
+    bool has_layer(int32_t il) const;
+
+    // F32 [n_expert, n_expert] identity matrix, its rows are the one-hot encodings of the experts
+    ggml_tensor * get_eye() const;
+
+    // F32 [n_expert] number of tokens routed to each expert of layer il since the last re-selection
+    ggml_tensor * get_counts(int32_t il) const;
+
+    // call after each ubatch, returns true when the hot experts must be re-selected with rebalance()
+    bool step();
+
+    // read back the routing counts once the graph has been computed, update the routing frequencies and re-select
+    // the hot experts
+    void rebalance();
+
+    // routed experts that were hot / not hot, updated by rebalance()
+    uint64_t n_hit  = 0;
+    uint64_t n_miss = 0;
+
+private:
+    struct layer {
+        std::vector<llama_expert_tensor> tensors;
+
+        ggml_tensor * counts = nullptr;
+
+        std::vector<float> freq; // decayed routing frequency of each expert
+        std::vector<bool>  hot;
+        std::vector<bool>  locked;
+    };
+
+    void lock  (int32_t il, int32_t ie);
+    void unlock(int32_t il, int32_t ie);
+
+    void prefetch(const layer & l, int32_t ie) const;
+    void touch   (const layer & l, int32_t ie) const;
+    void release (const layer & l, int32_t ie) const;
+
+    // re-select the hot experts of a layer
+    void select(int32_t il);
+
+    const llama_model & model;
+
+    const uint32_t n_hot;
+
+    // indexed by layer, empty if the layer has no managed experts
+    std::vector<layer> layers;
+
+    ggml_tensor * eye = nullptr;
+
+    ggml_context_ptr        ctx;
+    ggml_backend_buffer_ptr buf;
+
+    uint32_t n_ubatch = 0;
+
+    // ubatch of the last re-selection
+    uint32_t n_ubatch_select = 0;
+
+    // cleared when locking fails (e.g. RLIMIT_MEMLOCK), the hot experts are then only paged in
+    bool can_lock = true;
+};
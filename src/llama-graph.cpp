@@ -3,12 +3,14 @@
 #include "llama-impl.h"
 #include "llama-batch.h"
 #include "llama-cparams.h"
+#include "llama-expert-cache.h"
 
 #include "llama-kv-cache.h"
 #include "llama-kv-cache-iswa.h"
 #include "llama-memory-hybrid.h"
 #include "llama-memory-recurrent.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstring>
@@ -143,6 +145,120 @@ bool llm_graph_input_out_ids::can_reuse(const llm_graph_params & params) {
     return res;
 }
 
+std::vector<llama_adapter_lora *> llm_graph_input_lora_seq::get_active(const llama_adapter_loras_seq * loras_seq, const llama_ubatch & ubatch) {
+    std::vector<llama_adapter_lora *> res;
+
+    if (loras_seq == nullptr || ubatch.seq_id_unq == nullptr) {
+        return res;
+    }
+
+    for (const auto & [adapter, seq_scales] : *loras_seq) {
+        for (uint32_t s = 0; s < ubatch.n_seqs_unq; ++s) {
+            if (seq_scales.find(ubatch.seq_id_unq[s]) != seq_scales.end()) {
+                res.push_back(adapter);
+                break;
+            }
+        }
+    }
+
+    // stable order, independent of the hash map
+    std::sort(res.begin(), res.end());
+
+    return res;
+}
+
+void llm_graph_input_lora_seq::get_n_rows(
+        const llama_adapter_loras_seq * loras_seq,
+        const std::vector<llama_adapter_lora *> & adapters,
+        const llama_ubatch & ubatch,
+        std::vector<int64_t> & n_rows,
+        std::vector<int64_t> & n_rows_out) {
+    n_rows    .assign(adapters.size(), 0);
+    n_rows_out.assign(adapters.size(), 0);
+
+    for (size_t i = 0; i < adapters.size(); ++i) {
+        const auto & seq_scales = loras_seq->at(adapters[i]);
+
+        for (uint32_t t = 0; t < ubatch.n_tokens; ++t) {
+            // tokens that belong to multiple sequences use the adapters of the first one
+            if (seq_scales.find(ubatch.seq_id[t][0]) != seq_scales.end()) {
+                n_rows[i]++;
+                n_rows_out[i] += ubatch.output[t] ? 1 : 0;
+            }
+        }
+    }
+}
+
+// the inputs are not allocated if no weight of the graph uses them
+template <typename T>
+static T * lora_seq_input_data(ggml_tensor * t) {
+    if (t == nullptr || t->buffer == nullptr) {
+        return nullptr;
+    }
+
+    GGML_ASSERT(ggml_backend_buffer_is_host(t->buffer));
+
+    return (T *) t->data;
+}
+
+void llm_graph_input_lora_seq::set_input(const llama_ubatch * ubatch) {
+    const int64_t n_tokens = ubatch->n_tokens;
+
+    for (size_t i = 0; i < adapters.size(); ++i) {
+        const auto & seq_scales = loras_seq->at(adapters[i]);
+
+        int32_t * data_rows     = lora_seq_input_data<int32_t>(rows[i]);
+        int64_t * data_rows_i64 = lora_seq_input_data<int64_t>(rows_i64[i]);
+        float   * data_scales   = lora_seq_input_data<float>  (scales[i]);
+
+        int32_t * data_rows_out     = lora_seq_input_data<int32_t>(rows_out[i]);
+        int64_t * data_rows_out_i64 = lora_seq_input_data<int64_t>(rows_out_i64[i]);
+        float   * data_scales_out   = lora_seq_input_data<float>  (scales_out[i]);
+
+        int64_t n_row     = 0;
+        int64_t n_row_out = 0;
+        int64_t n_out     = 0;
+
+        for (int64_t t = 0; t < n_tokens; ++t) {
+            const bool output = ubatch->output[t];
+
+            const auto it = seq_scales.find(ubatch->seq_id[t][0]);
+            if (it != seq_scales.end()) {
+                GGML_ASSERT(n_row < n_rows[i]);
+
+                if (data_rows)     { data_rows    [n_row] = t; }
+                if (data_rows_i64) { data_rows_i64[n_row] = t; }
+                if (data_scales)   { data_scales  [n_row] = it->second; }
+                n_row++;
+
+                if (output) {
+                    GGML_ASSERT(n_row_out < n_rows_out[i]);
+
+                    if (data_rows_out)     { data_rows_out    [n_row_out] = n_out; }
+                    if (data_rows_out_i64) { data_rows_out_i64[n_row_out] = n_out; }
+                    if (data_scales_out)   { data_scales_out  [n_row_out] = it->second; }
+                    n_row_out++;
+                }
+            }
+
+            n_out += output ? 1 : 0;
+        }
+    }
+}
+
+bool llm_graph_input_lora_seq::can_reuse(const llm_graph_params & params) {
+    if (get_active(params.loras_seq, params.ubatch) != adapters) {
+        return false;
+    }
+
+    // the shapes of the gathered rows depend on how many tokens use each adapter
+    std::vector<int64_t> n_rows_cur;
+    std::vector<int64_t> n_rows_out_cur;
+    get_n_rows(params.loras_seq, adapters, params.ubatch, n_rows_cur, n_rows_out_cur);
+
+    return n_rows_cur == n_rows && n_rows_out_cur == n_rows_out;
+}
+
 void llm_graph_input_mean::set_input(const llama_ubatch * ubatch) {
     if (cparams.embeddings && cparams.pooling_type == LLAMA_POOLING_TYPE_MEAN) {
         const int64_t n_tokens     = ubatch->n_tokens;
@@ -339,11 +455,57 @@ void llm_graph_input_attn_no_cache::set_input(const llama_ubatch * ubatch) {
     }
 }
 
+// summarize each block of GGML_KQ_MASK_BLK KV positions of the mask rows,
+// so that flash attention can skip the blocks that are fully masked (other sequences, outside of the SWA window, ...)
+static void set_input_kq_mask_blk(const ggml_tensor * mask, ggml_tensor * blk) {
+    if (blk == nullptr || blk->buffer == nullptr) {
+        return;
+    }
+
+    GGML_ASSERT(ggml_backend_buffer_is_host(mask->buffer));
+    GGML_ASSERT(ggml_backend_buffer_is_host(blk->buffer));
+
+    const int64_t n_kv   = mask->ne[0];
+    const int64_t n_blk  = blk->ne[0];
+    const int64_t n_rows = ggml_nrows(mask);
+
+    for (int64_t ir = 0; ir < n_rows; ++ir) {
+        const float * m = (const float *) mask->data + ir*n_kv;
+        int8_t      * b = (int8_t      *) blk->data  + ir*n_blk;
+
+        for (int64_t ib = 0; ib < n_blk; ++ib) {
+            bool all_inf  = true;
+            bool all_zero = true;
+
+            for (int64_t i = ib*GGML_KQ_MASK_BLK; i < std::min(n_kv, (ib + 1)*GGML_KQ_MASK_BLK) && (all_inf || all_zero); ++i) {
+                all_inf  = all_inf  && m[i] == -INFINITY;
+                all_zero = all_zero && m[i] == 0.0f;
+            }
+
+            b[ib] = all_inf ? GGML_KQ_MASK_BLK_MASKED : all_zero ? GGML_KQ_MASK_BLK_ZERO : GGML_KQ_MASK_BLK_MIXED;
+        }
+    }
+}
+
+// block summary of the KQ mask, only used by flash attention
+static ggml_tensor * build_input_kq_mask_blk(ggml_context * ctx0, const llama_cparams & cparams, const ggml_tensor * mask) {
+    if (!cparams.flash_attn) {
+        return nullptr;
+    }
+
+    ggml_tensor * blk = ggml_new_tensor_4d(ctx0, GGML_TYPE_I8, (mask->ne[0] + GGML_KQ_MASK_BLK - 1)/GGML_KQ_MASK_BLK, mask->ne[1], mask->ne[2], mask->ne[3]);
+    ggml_set_input(blk);
+
+    return blk;
+}
+
 void llm_graph_input_attn_kv::set_input(const llama_ubatch * ubatch) {
     mctx->set_input_k_idxs(self_k_idxs, ubatch);
     mctx->set_input_v_idxs(self_v_idxs, ubatch);
 
     mctx->set_input_kq_mask(self_kq_mask, ubatch, cparams.causal_attn);
+
+    set_input_kq_mask_blk(self_kq_mask, self_kq_mask_blk);
 }
 
 bool llm_graph_input_attn_kv::can_reuse(const llm_graph_params & params) {
@@ -359,6 +521,8 @@ bool llm_graph_input_attn_kv::can_reuse(const llm_graph_params & params) {
     res &= self_kq_mask->ne[0] == mctx->get_n_kv();
     res &= self_kq_mask->ne[1] == GGML_PAD(params.ubatch.n_tokens, GGML_KQ_MASK_PAD);
 
+    res &= self_k_mean_upd == mctx->get_k_mean_upd();
+
     return res;
 }
 
@@ -368,10 +532,14 @@ void llm_graph_input_attn_kv_iswa::set_input(const llama_ubatch * ubatch) {
 
     mctx->get_base()->set_input_kq_mask(self_kq_mask, ubatch, cparams.causal_attn);
 
+    set_input_kq_mask_blk(self_kq_mask, self_kq_mask_blk);
+
     mctx->get_swa()->set_input_k_idxs(self_k_idxs_swa, ubatch);
     mctx->get_swa()->set_input_v_idxs(self_v_idxs_swa, ubatch);
 
     mctx->get_swa()->set_input_kq_mask(self_kq_mask_swa, ubatch, cparams.causal_attn);
+
+    set_input_kq_mask_blk(self_kq_mask_swa, self_kq_mask_swa_blk);
 }
 
 bool llm_graph_input_attn_kv_iswa::can_reuse(const llm_graph_params & params) {
@@ -393,6 +561,9 @@ bool llm_graph_input_attn_kv_iswa::can_reuse(const llm_graph_params & params) {
     res &= self_kq_mask_swa->ne[0] == mctx->get_swa()->get_n_kv();
     res &= self_kq_mask_swa->ne[1] == GGML_PAD(params.ubatch.n_tokens, GGML_KQ_MASK_PAD);
 
+    res &= self_k_mean_upd     == mctx->get_base()->get_k_mean_upd();
+    res &= self_k_mean_upd_swa == mctx->get_swa()->get_k_mean_upd();
+
     return res;
 }
 
@@ -560,13 +731,51 @@ llm_graph_context::llm_graph_context(const llm_graph_params & params) :
     backend_cpu      (params.backend_cpu),
     cvec             (params.cvec),
     loras            (params.loras),
+    loras_seq        (params.loras_seq),
     mctx             (params.mctx),
     cross            (params.cross),
+    ffn_split        (params.ffn_split),
+    expert_cache     (params.expert_cache),
     cb_func          (params.cb),
     res              (params.res),
     ctx0             (res->get_ctx()),
     gf               (res->get_gf()) {
         res->set_params(params);
+
+        // note: the input is added even without active adapters, so that the graph is not reused once some become active
+        if (loras_seq) {
+            auto inp = std::make_unique<llm_graph_input_lora_seq>(loras_seq, llm_graph_input_lora_seq::get_active(loras_seq, ubatch));
+
+            llm_graph_input_lora_seq::get_n_rows(loras_seq, inp->adapters, ubatch, inp->n_rows, inp->n_rows_out);
+
+            for (size_t i = 0; i < inp->adapters.size(); ++i) {
+                const int64_t n_rows = inp->n_rows[i];
+
+                inp->rows    .push_back(ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_rows));
+                inp->rows_i64.push_back(ggml_new_tensor_1d(ctx0, GGML_TYPE_I64, n_rows));
+                inp->scales  .push_back(ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 1, n_rows));
+                ggml_set_input(inp->rows.back());
+                ggml_set_input(inp->rows_i64.back());
+                ggml_set_input(inp->scales.back());
+
+                inp->rows_out    .push_back(nullptr);
+                inp->rows_out_i64.push_back(nullptr);
+                inp->scales_out  .push_back(nullptr);
+
+                const int64_t n_rows_out = inp->n_rows_out[i];
+
+                if (n_outputs != n_tokens && n_rows_out > 0) {
+                    inp->rows_out    .back() = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_rows_out);
+                    inp->rows_out_i64.back() = ggml_new_tensor_1d(ctx0, GGML_TYPE_I64, n_rows_out);
+                    inp->scales_out  .back() = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 1, n_rows_out);
+                    ggml_set_input(inp->rows_out.back());
+                    ggml_set_input(inp->rows_out_i64.back());
+                    ggml_set_input(inp->scales_out.back());
+                }
+            }
+
+            inp_lora_seq = static_cast<llm_graph_input_lora_seq *>(res->add_input(std::move(inp)));
+        }
     }
 
 void llm_graph_context::cb(ggml_tensor * cur, const char * name, int il) const {
@@ -604,7 +813,7 @@ ggml_tensor * llm_graph_context::build_lora_mm(
         res = ggml_add(ctx0, res, ab_cur);
     }
 
-    return res;
+    return build_lora_mm_seq(w, cur, res, nullptr);
 }
 
 ggml_tensor * llm_graph_context::build_lora_mm_id(
@@ -632,6 +841,97 @@ ggml_tensor * llm_graph_context::build_lora_mm_id(
         res = ggml_add(ctx0, res, ab_cur);
     }
 
+    return build_lora_mm_seq(w, cur, res, ids);
+}
+
+ggml_tensor * llm_graph_context::build_lora_mm_seq(
+          ggml_tensor * w,
+          ggml_tensor * cur,
+          ggml_tensor * res,
+          ggml_tensor * ids) const {
+    if (!inp_lora_seq || inp_lora_seq->adapters.empty()) {
+        return res;
+    }
+
+    // rows of the result: all tokens of the ubatch, or only the outputs (e.g. for the output layer)
+    const int64_t n_rows = ids ? res->ne[2] : ggml_nrows(res);
+
+    for (size_t i = 0; i < inp_lora_seq->adapters.size(); ++i) {
+        llama_adapter_lora * adapter = inp_lora_seq->adapters[i];
+
+        llama_adapter_lora_weight * lw = adapter->get_weight(w);
+        if (lw == nullptr) {
+            continue;
+        }
+
+        ggml_tensor * rows     = nullptr;
+        ggml_tensor * rows_i64 = nullptr;
+        ggml_tensor * scales   = nullptr;
+        int64_t       n_rows_a = 0;
+        if (n_rows == n_tokens) {
+            rows     = inp_lora_seq->rows[i];
+            rows_i64 = inp_lora_seq->rows_i64[i];
+            scales   = inp_lora_seq->scales[i];
+            n_rows_a = inp_lora_seq->n_rows[i];
+        } else if (n_rows == n_outputs) {
+            rows     = inp_lora_seq->rows_out[i];
+            rows_i64 = inp_lora_seq->rows_out_i64[i];
+            scales   = inp_lora_seq->scales_out[i];
+            n_rows_a = inp_lora_seq->n_rows_out[i];
+        }
+
+        if (scales == nullptr) {
+            continue; // the rows cannot be mapped to sequences, or none of them uses the adapter
+        }
+
+        if (n_rows_a == n_rows) {
+            // all the rows use the adapter, in order
+            ggml_tensor * ab_cur = nullptr;
+            if (ids) {
+                ab_cur = ggml_mul_mat_id(ctx0, lw->b, ggml_mul_mat_id(ctx0, lw->a, cur, ids), ids);
+                scales = ggml_reshape_3d(ctx0, scales, 1, 1, res->ne[2]);
+            } else {
+                ab_cur = ggml_mul_mat(ctx0, lw->b, ggml_mul_mat(ctx0, lw->a, cur));
+                scales = ggml_reshape_4d(ctx0, scales, 1, res->ne[1], res->ne[2], res->ne[3]);
+            }
+
+            ab_cur = ggml_scale(ctx0, ab_cur, lw->get_scale(adapter->alpha, 1.0f));
+            ab_cur = ggml_mul(ctx0, ab_cur, scales);
+
+            res = ggml_add(ctx0, res, ab_cur);
+            continue;
+        }
+
+        // gather the rows that use the adapter, the rows are the last dimension of cur and res
+        ggml_tensor * cur_2d = ggml_is_contiguous(cur) ? cur : ggml_cont(ctx0, cur);
+        cur_2d = ggml_reshape_2d(ctx0, cur_2d, ggml_nelements(cur_2d)/n_rows, n_rows);
+
+        ggml_tensor * res_2d = ggml_reshape_2d(ctx0, res, ggml_nelements(res)/n_rows, n_rows);
+
+        ggml_tensor * cur_a = ggml_get_rows(ctx0, cur_2d, rows);
+
+        ggml_tensor * ab_cur = nullptr;
+        if (ids) {
+            cur_a = ggml_reshape_3d(ctx0, cur_a, cur->ne[0], cur->ne[1], n_rows_a);
+
+            ggml_tensor * ids_a = ggml_get_rows(ctx0, ids, rows);
+
+            ab_cur = ggml_mul_mat_id(ctx0, lw->b, ggml_mul_mat_id(ctx0, lw->a, cur_a, ids_a), ids_a);
+            ab_cur = ggml_reshape_2d(ctx0, ab_cur, res_2d->ne[0], n_rows_a);
+        } else {
+            ab_cur = ggml_mul_mat(ctx0, lw->b, ggml_mul_mat(ctx0, lw->a, cur_a));
+        }
+
+        ab_cur = ggml_scale(ctx0, ab_cur, lw->get_scale(adapter->alpha, 1.0f));
+        ab_cur = ggml_mul(ctx0, ab_cur, scales);
+
+        // scatter: res[rows] += ab_cur
+        ab_cur = ggml_add(ctx0, ggml_get_rows(ctx0, res_2d, rows), ab_cur);
+        res_2d = ggml_set_rows(ctx0, res_2d, ab_cur, rows_i64);
+
+        res = ggml_reshape(ctx0, res_2d, res);
+    }
+
     return res;
 }
 
@@ -685,6 +985,30 @@ ggml_tensor * llm_graph_context::build_ffn(
      llm_ffn_op_type   type_op,
    llm_ffn_gate_type   type_gate,
                  int   il) const {
+    if (up && ffn_split && il >= 0 && il < (int) ffn_split->size() && (*ffn_split)[il].up == up) {
+        // the weights are sharded across the devices - sum the partial outputs of the shards
+        GGML_ASSERT(!up_b && !up_s && !gate_b && !gate_s && !down_b && !down_s && !act_scales);
+        GGML_ASSERT((!gate || type_gate == LLM_FFN_PAR) && "a sequential gate cannot be sharded");
+
+        ggml_tensor * res = nullptr;
+
+        for (const auto & shard : (*ffn_split)[il].shards) {
+            ggml_tensor * y = build_ffn(cur,
+                    shard.up,   nullptr, nullptr,
+                    shard.gate, nullptr, nullptr,
+                    shard.down, nullptr, nullptr,
+                    nullptr,
+                    type_op, type_gate, il);
+
+            // add all the shards to the graph before the reduction, so that the devices can compute them concurrently
+            ggml_build_forward_expand(gf, y);
+
+            res = res ? ggml_add(ctx0, res, y) : y;
+        }
+
+        return res;
+    }
+
     ggml_tensor * tmp = up ? build_lora_mm(up, cur) : cur;
     cb(tmp, "ffn_up", il);
 
@@ -925,6 +1249,18 @@ ggml_tensor * llm_graph_context::build_moe_ffn(
     cb(selected_experts->src[0], "ffn_moe_argsort", il);
     cb(selected_experts, "ffn_moe_topk", il);
 
+    if (expert_cache && expert_cache->has_layer(il)) {
+        // add the number of tokens routed to each expert to the routing counts of the layer, the expert cache reads
+        // them back only when it re-selects the hot experts
+        ggml_tensor * ids = ggml_reshape_1d(ctx0, ggml_cont(ctx0, selected_experts), n_expert_used*n_tokens);
+        ggml_tensor * counts = ggml_get_rows(ctx0, expert_cache->get_eye(), ids); // [n_expert, n_expert_used*n_tokens]
+        counts = ggml_sum_rows(ctx0, ggml_cont(ctx0, ggml_transpose(ctx0, counts))); // [1, n_expert]
+        counts = ggml_add(ctx0, expert_cache->get_counts(il), ggml_reshape_1d(ctx0, counts, n_expert));
+        cb(counts, "ffn_moe_counts", il);
+
+        ggml_build_forward_expand(gf, ggml_cpy(ctx0, counts, expert_cache->get_counts(il)));
+    }
+
     ggml_tensor * weights = ggml_get_rows(ctx0,
             ggml_reshape_3d(ctx0, probs, 1, n_expert, n_tokens), selected_experts); // [1, n_expert_used, n_tokens]
     cb(weights, "ffn_moe_weights", il);
@@ -1264,6 +1600,7 @@ ggml_tensor * llm_graph_context::build_attn_mha(
          ggml_tensor * v,
          ggml_tensor * kq_b,
          ggml_tensor * kq_mask,
+         ggml_tensor * kq_mask_blk,
          ggml_tensor * sinks,
          ggml_tensor * v_mla,
                float   kq_scale,
@@ -1304,8 +1641,9 @@ ggml_tensor * llm_graph_context::build_attn_mha(
                                   hparams.attn_soft_cap ? hparams.f_attn_logit_softcapping : 0.0f);
         cb(cur, LLAMA_TENSOR_NAME_FATTN, il);
 
-        ggml_flash_attn_ext_add_sinks(cur, sinks);
-        ggml_flash_attn_ext_set_prec (cur, GGML_PREC_F32);
+        ggml_flash_attn_ext_add_sinks   (cur, sinks);
+        ggml_flash_attn_ext_add_mask_blk(cur, kq_mask_blk);
+        ggml_flash_attn_ext_set_prec    (cur, GGML_PREC_F32);
 
         if (v_mla) {
 #if 0
@@ -1437,7 +1775,7 @@ ggml_tensor * llm_graph_context::build_attn(
     ggml_tensor * k = k_cur;
     ggml_tensor * v = v_cur;
 
-    ggml_tensor * cur = build_attn_mha(q, k, v, kq_b, kq_mask, sinks, v_mla, kq_scale, il);
+    ggml_tensor * cur = build_attn_mha(q, k, v, kq_b, kq_mask, nullptr, sinks, v_mla, kq_scale, il);
     cb(cur, "kqv_out", il);
 
     if (wo) {
@@ -1474,10 +1812,13 @@ static std::unique_ptr<llm_graph_input_attn_kv> build_attn_inp_kv_impl(
         inp->self_k_idxs = mctx_cur->build_input_k_idxs(ctx0, ubatch);
         inp->self_v_idxs = mctx_cur->build_input_v_idxs(ctx0, ubatch);
 
+        inp->self_k_mean_upd = mctx_cur->get_k_mean_upd();
+
         inp->self_kq_mask = ggml_new_tensor_4d(ctx0, GGML_TYPE_F32, n_kv, GGML_PAD(n_tokens/n_stream, GGML_KQ_MASK_PAD), 1, n_stream);
         ggml_set_input(inp->self_kq_mask);
 
         inp->self_kq_mask_cnv = cparams.flash_attn ? ggml_cast(ctx0, inp->self_kq_mask, GGML_TYPE_F16) : inp->self_kq_mask;
+        inp->self_kq_mask_blk = build_input_kq_mask_blk(ctx0, cparams, inp->self_kq_mask);
     }
 
     return inp;
@@ -1516,17 +1857,18 @@ ggml_tensor * llm_graph_context::build_attn(
         const auto & k_idxs = inp->get_k_idxs();
         const auto & v_idxs = inp->get_v_idxs();
 
-        ggml_build_forward_expand(gf, mctx_cur->cpy_k(ctx0, k_cur, k_idxs, il));
+        ggml_build_forward_expand(gf, mctx_cur->cpy_k(ctx0, k_cur, k_idxs, inp->get_k_mean_upd(), il));
         ggml_build_forward_expand(gf, mctx_cur->cpy_v(ctx0, v_cur, v_idxs, il));
     }
 
-    const auto & kq_mask = inp->get_kq_mask();
+    const auto & kq_mask     = inp->get_kq_mask();
+    const auto & kq_mask_blk = inp->get_kq_mask_blk();
 
     ggml_tensor * q = q_cur;
     ggml_tensor * k = mctx_cur->get_k(ctx0, il);
     ggml_tensor * v = mctx_cur->get_v(ctx0, il);
 
-    ggml_tensor * cur = build_attn_mha(q, k, v, kq_b, kq_mask, sinks, v_mla, kq_scale, il);
+    ggml_tensor * cur = build_attn_mha(q, k, v, kq_b, kq_mask, kq_mask_blk, sinks, v_mla, kq_scale, il);
     cb(cur, "kqv_out", il);
 
     if (wo) {
@@ -1576,9 +1918,10 @@ ggml_tensor * llm_graph_context::build_attn(
 
     // optionally store to KV cache
     if (k_cur) {
-        const auto & k_idxs = is_swa ? inp->get_k_idxs_swa() : inp->get_k_idxs();
+        const auto & k_idxs     = is_swa ? inp->get_k_idxs_swa()     : inp->get_k_idxs();
+        const bool k_mean_upd = is_swa ? inp->get_k_mean_upd_swa() : inp->get_k_mean_upd();
 
-        ggml_build_forward_expand(gf, mctx_cur->cpy_k(ctx0, k_cur, k_idxs, il));
+        ggml_build_forward_expand(gf, mctx_cur->cpy_k(ctx0, k_cur, k_idxs, k_mean_upd, il));
     }
 
     if (v_cur) {
@@ -1587,13 +1930,14 @@ ggml_tensor * llm_graph_context::build_attn(
         ggml_build_forward_expand(gf, mctx_cur->cpy_v(ctx0, v_cur, v_idxs, il));
     }
 
-    const auto & kq_mask = is_swa ? inp->get_kq_mask_swa() : inp->get_kq_mask();
+    const auto & kq_mask     = is_swa ? inp->get_kq_mask_swa()     : inp->get_kq_mask();
+    const auto & kq_mask_blk = is_swa ? inp->get_kq_mask_swa_blk() : inp->get_kq_mask_blk();
 
     ggml_tensor * q = q_cur;
     ggml_tensor * k = mctx_cur->get_k(ctx0, il);
     ggml_tensor * v = mctx_cur->get_v(ctx0, il);
 
-    ggml_tensor * cur = build_attn_mha(q, k, v, kq_b, kq_mask, sinks, v_mla, kq_scale, il);
+    ggml_tensor * cur = build_attn_mha(q, k, v, kq_b, kq_mask, kq_mask_blk, sinks, v_mla, kq_scale, il);
     cb(cur, "kqv_out", il);
 
     if (wo) {
@@ -1648,7 +1992,7 @@ ggml_tensor * llm_graph_context::build_attn(
     ggml_tensor * k = k_cur;
     ggml_tensor * v = v_cur;
 
-    ggml_tensor * cur = build_attn_mha(q, k, v, kq_b, kq_mask, sinks, v_mla, kq_scale, il);
+    ggml_tensor * cur = build_attn_mha(q, k, v, kq_b, kq_mask, nullptr, sinks, v_mla, kq_scale, il);
     cb(cur, "kqv_out", il);
 
     if (wo) {
@@ -1682,10 +2026,13 @@ llm_graph_input_attn_kv_iswa * llm_graph_context::build_attn_inp_kv_iswa() const
         inp->self_k_idxs = mctx_cur->get_base()->build_input_k_idxs(ctx0, ubatch);
         inp->self_v_idxs = mctx_cur->get_base()->build_input_v_idxs(ctx0, ubatch);
 
+        inp->self_k_mean_upd = mctx_cur->get_base()->get_k_mean_upd();
+
         inp->self_kq_mask = ggml_new_tensor_4d(ctx0, GGML_TYPE_F32, n_kv, GGML_PAD(n_tokens/n_stream, GGML_KQ_MASK_PAD), 1, n_stream);
         ggml_set_input(inp->self_kq_mask);
 
         inp->self_kq_mask_cnv = cparams.flash_attn ? ggml_cast(ctx0, inp->self_kq_mask, GGML_TYPE_F16) : inp->self_kq_mask;
+        inp->self_kq_mask_blk = build_input_kq_mask_blk(ctx0, cparams, inp->self_kq_mask);
     }
 
     {
@@ -1696,10 +2043,13 @@ llm_graph_input_attn_kv_iswa * llm_graph_context::build_attn_inp_kv_iswa() const
         inp->self_k_idxs_swa = mctx_cur->get_swa()->build_input_k_idxs(ctx0, ubatch);
         inp->self_v_idxs_swa = mctx_cur->get_swa()->build_input_v_idxs(ctx0, ubatch);
 
+        inp->self_k_mean_upd_swa = mctx_cur->get_swa()->get_k_mean_upd();
+
         inp->self_kq_mask_swa = ggml_new_tensor_4d(ctx0, GGML_TYPE_F32, n_kv, GGML_PAD(n_tokens/n_stream, GGML_KQ_MASK_PAD), 1, n_stream);
         ggml_set_input(inp->self_kq_mask_swa);
 
         inp->self_kq_mask_swa_cnv = cparams.flash_attn ? ggml_cast(ctx0, inp->self_kq_mask_swa, GGML_TYPE_F16) : inp->self_kq_mask_swa;
+        inp->self_kq_mask_swa_blk = build_input_kq_mask_blk(ctx0, cparams, inp->self_kq_mask_swa);
     }
 
     return (llm_graph_input_attn_kv_iswa *) res->add_input(std::move(inp));
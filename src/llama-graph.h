@@ -19,6 +19,8 @@ struct llama_cparams;
 
 struct llama_memory_context_i;
 
+class llama_expert_cache;
+
 class llama_kv_cache_context;
 class llama_kv_cache_iswa_context;
 class llama_memory_recurrent_context;
@@ -192,6 +194,47 @@ public:
     const uint32_t n_outputs;
 };
 
+// per-token scales of the per-sequence LoRA adapters that are set for the sequences in the ubatch
+class llm_graph_input_lora_seq : public llm_graph_input_i {
+public:
+    llm_graph_input_lora_seq(
+            const llama_adapter_loras_seq * loras_seq,
+            std::vector<llama_adapter_lora *> adapters) : loras_seq(loras_seq), adapters(std::move(adapters)) {}
+    virtual ~llm_graph_input_lora_seq() = default;
+
+    void set_input(const llama_ubatch * ubatch) override;
+
+    bool can_reuse(const llm_graph_params & params) override;
+
+    // adapters that are set for at least one of the sequences in the ubatch
+    static std::vector<llama_adapter_lora *> get_active(const llama_adapter_loras_seq * loras_seq, const llama_ubatch & ubatch);
+
+    // number of tokens of the ubatch that use each of the adapters, and how many of them are outputs
+    static void get_n_rows(
+            const llama_adapter_loras_seq * loras_seq,
+            const std::vector<llama_adapter_lora *> & adapters,
+            const llama_ubatch & ubatch,
+            std::vector<int64_t> & n_rows,
+            std::vector<int64_t> & n_rows_out);
+
+    // per adapter, for the tokens that use it: their index in the ubatch and their scale
+    std::vector<ggml_tensor *> rows;     // I32 [n_rows]
+    std::vector<ggml_tensor *> rows_i64; // I64 [n_rows]
+    std::vector<ggml_tensor *> scales;   // F32 [1, n_rows]
+
+    // same for the outputs, the index is the one of the output (only if n_outputs != n_tokens, nullptr if n_rows_out == 0)
+    std::vector<ggml_tensor *> rows_out;     // I32 [n_rows_out]
+    std::vector<ggml_tensor *> rows_out_i64; // I64 [n_rows_out]
+    std::vector<ggml_tensor *> scales_out;   // F32 [1, n_rows_out]
+
+    std::vector<int64_t> n_rows;
+    std::vector<int64_t> n_rows_out;
+
+    const llama_adapter_loras_seq * loras_seq;
+
+    const std::vector<llama_adapter_lora *> adapters;
+};
+
 class llm_graph_input_mean : public llm_graph_input_i {
 public:
     llm_graph_input_mean(const llama_cparams & cparams) : cparams(cparams) {}
@@ -284,13 +327,19 @@ public:
     ggml_tensor * get_k_idxs() const { return self_k_idxs; }
     ggml_tensor * get_v_idxs() const { return self_v_idxs; }
 
-    ggml_tensor * get_kq_mask() const { return self_kq_mask_cnv; }
+    bool get_k_mean_upd() const { return self_k_mean_upd; }
+
+    ggml_tensor * get_kq_mask()     const { return self_kq_mask_cnv; }
+    ggml_tensor * get_kq_mask_blk() const { return self_kq_mask_blk; }
 
     ggml_tensor * self_k_idxs = nullptr; // I64 [n_batch]
     ggml_tensor * self_v_idxs = nullptr; // I64 [n_batch] or [n_batch*n_embd_v_gqa]
 
+    bool self_k_mean_upd = false; // re-estimate the K means (K smoothing only)
+
     ggml_tensor * self_kq_mask     = nullptr; // F32 [n_kv, n_batch/n_stream, 1, n_stream]
     ggml_tensor * self_kq_mask_cnv = nullptr; //     [n_kv, n_batch/n_stream, 1, n_stream]
+    ggml_tensor * self_kq_mask_blk = nullptr; // I8  [n_kv/GGML_KQ_MASK_BLK, n_batch/n_stream, 1, n_stream] (flash attention only)
 
     // note: these have to be copies because in order to be able to reuse a graph, its inputs
     //       need to carry these parameters with them. otherwise, they can point to freed
@@ -322,18 +371,28 @@ public:
     ggml_tensor * get_k_idxs_swa() const { return self_k_idxs_swa; }
     ggml_tensor * get_v_idxs_swa() const { return self_v_idxs_swa; }
 
-    ggml_tensor * get_kq_mask()     const { return self_kq_mask_cnv; }
-    ggml_tensor * get_kq_mask_swa() const { return self_kq_mask_swa_cnv; }
+    bool get_k_mean_upd()     const { return self_k_mean_upd; }
+    bool get_k_mean_upd_swa() const { return self_k_mean_upd_swa; }
+
+    ggml_tensor * get_kq_mask()         const { return self_kq_mask_cnv; }
+    ggml_tensor * get_kq_mask_swa()     const { return self_kq_mask_swa_cnv; }
+    ggml_tensor * get_kq_mask_blk()     const { return self_kq_mask_blk; }
+    ggml_tensor * get_kq_mask_swa_blk() const { return self_kq_mask_swa_blk; }
 
     ggml_tensor * self_k_idxs     = nullptr; // I64 [n_batch]
     ggml_tensor * self_v_idxs     = nullptr; // I64 [n_batch] or [n_batch*n_embd_v_gqa]
     ggml_tensor * self_k_idxs_swa = nullptr; // I64 [n_batch]
     ggml_tensor * self_v_idxs_swa = nullptr; // I64 [n_batch] or [n_batch*n_embd_v_gqa]
 
+    bool self_k_mean_upd     = false; // re-estimate the K means (K smoothing only)
+    bool self_k_mean_upd_swa = false; // re-estimate the K means (K smoothing only)
+
     ggml_tensor * self_kq_mask         = nullptr; // F32 [n_kv, n_batch/n_stream, 1, n_stream]
     ggml_tensor * self_kq_mask_cnv     = nullptr; //     [n_kv, n_batch/n_stream, 1, n_stream]
     ggml_tensor * self_kq_mask_swa     = nullptr; // F32 [n_kv, n_batch/n_stream, 1, n_stream]
     ggml_tensor * self_kq_mask_swa_cnv = nullptr; //     [n_kv, n_batch/n_stream, 1, n_stream]
+    ggml_tensor * self_kq_mask_blk     = nullptr; // I8  [n_kv/GGML_KQ_MASK_BLK, n_batch/n_stream, 1, n_stream] (flash attention only)
+    ggml_tensor * self_kq_mask_swa_blk = nullptr; // I8  [n_kv/GGML_KQ_MASK_BLK, n_batch/n_stream, 1, n_stream] (flash attention only)
 
     const llama_hparams hparams;
     const llama_cparams cparams;
@@ -393,6 +452,24 @@ using llm_graph_cb = std::function<void(const llama_ubatch & ubatch, ggml_tensor
 
 class llm_graph_result;
 
+// a slice of the dense FFN of a layer, see LLAMA_SPLIT_MODE_TENSOR
+struct llm_ffn_shard {
+    ggml_tensor * up   = nullptr;
+    ggml_tensor * gate = nullptr;
+    ggml_tensor * down = nullptr;
+};
+
+// the FFN of a layer sharded across devices
+// up and gate are split by rows and down by columns, so each shard computes a partial sum of the FFN output
+struct llm_ffn_split {
+    // the unsplit tensors, not allocated
+    const ggml_tensor * up   = nullptr;
+    const ggml_tensor * gate = nullptr;
+    const ggml_tensor * down = nullptr;
+
+    std::vector<llm_ffn_shard> shards;
+};
+
 struct llm_graph_params {
     llm_arch arch = LLM_ARCH_UNKNOWN;
 
@@ -407,9 +484,14 @@ struct llm_graph_params {
     ggml_backend_t backend_cpu;
 
     const llama_adapter_cvec     * cvec;
-    const llama_adapter_loras    * loras;
-    const llama_memory_context_i * mctx;
-    const llama_cross            * cross;
+    const llama_adapter_loras     * loras;
+    const llama_adapter_loras_seq * loras_seq;
+    const llama_memory_context_i  * mctx;
+    const llama_cross             * cross;
+
+    const std::vector<llm_ffn_split> * ffn_split; // [n_layer], empty if the model is not split by tensor
+
+    const llama_expert_cache * expert_cache; // nullptr if disabled
 
     uint32_t n_outputs;
 
@@ -457,6 +539,7 @@ struct llm_graph_params {
             gtype     == other.gtype &&
             cvec      == other.cvec  &&
             loras     == other.loras &&
+            loras_seq == other.loras_seq &&
             cross     == other.cross &&
             n_outputs == other.n_outputs;
     }
@@ -570,9 +653,14 @@ struct llm_graph_context {
     ggml_backend_t backend_cpu; // TODO: needed by build_attn_mha, figure out a way to remove?
 
     const llama_adapter_cvec     * cvec;
-    const llama_adapter_loras    * loras;
-    const llama_memory_context_i * mctx;
-    const llama_cross            * cross;
+    const llama_adapter_loras     * loras;
+    const llama_adapter_loras_seq * loras_seq;
+    const llama_memory_context_i  * mctx;
+    const llama_cross             * cross;
+
+    const std::vector<llm_ffn_split> * ffn_split;
+
+    const llama_expert_cache * expert_cache;
 
     const llm_graph_cb & cb_func;
 
@@ -581,6 +669,8 @@ struct llm_graph_context {
     ggml_context * ctx0 = nullptr;
     ggml_cgraph  * gf   = nullptr;
 
+    llm_graph_input_lora_seq * inp_lora_seq = nullptr;
+
     llm_graph_context(const llm_graph_params & params);
     virtual ~llm_graph_context() = default;
 
@@ -605,6 +695,14 @@ struct llm_graph_context {
               ggml_tensor * cur, // ggml_tensor * b
               ggml_tensor * ids) const;
 
+    // add the per-sequence lora deltas of weight w to res
+    // only the rows of the tokens that use an adapter are gathered for its A/B matmuls, and scattered back to res
+    ggml_tensor * build_lora_mm_seq(
+              ggml_tensor * w,
+              ggml_tensor * cur,
+              ggml_tensor * res,
+              ggml_tensor * ids) const;
+
     ggml_tensor * build_norm(
              ggml_tensor * cur,
              ggml_tensor * mw,
@@ -693,6 +791,7 @@ struct llm_graph_context {
             ggml_tensor * v,       // [n_embd_head_v, n_head_v, n_tokens] (v_trans == false)
             ggml_tensor * kq_b,
             ggml_tensor * kq_mask,
+            ggml_tensor * kq_mask_blk, // optional block summary of kq_mask, used by flash attention
             ggml_tensor * sinks,   // [n_head_q]
             ggml_tensor * v_mla,   // [n_embd_head_v_mla, n_embd_head_v, n_head_v]
                   float   kq_scale,
@@ -8,6 +8,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <limits>
 #include <map>
 #include <stdexcept>
@@ -20,6 +21,7 @@ llama_kv_cache::llama_kv_cache(
         const llama_model & model,
                 ggml_type   type_k,
                 ggml_type   type_v,
+                     bool   smooth_k,
                      bool   v_trans,
                      bool   offload,
                      bool   unified,
@@ -43,7 +45,7 @@ llama_kv_cache::llama_kv_cache(
         auto it = ctx_map.find(buft);
         if (it == ctx_map.end()) {
             ggml_init_params params = {
-                /*.mem_size   =*/ size_t(2u*(1 + n_stream)*n_layer_kv*ggml_tensor_overhead()),
+                /*.mem_size   =*/ size_t((2u*(1 + n_stream) + 1)*n_layer_kv*ggml_tensor_overhead()),
                 /*.mem_buffer =*/ NULL,
                 /*.no_alloc   =*/ true,
             };
@@ -84,6 +86,17 @@ llama_kv_cache::llama_kv_cache(
         }
     }
 
+    // K smoothing only helps quantized K caches and requires the attention to be invariant to a per-query shift of the KQ values
+    if (smooth_k && !ggml_is_quantized(type_k)) {
+        LLAMA_LOG_WARN("%s: K smoothing has no effect with K cache type %s - disabling\n", __func__, ggml_type_name(type_k));
+        smooth_k = false;
+    }
+
+    if (smooth_k && hparams.attn_soft_cap) {
+        LLAMA_LOG_WARN("%s: K smoothing is not supported with attention logit soft-capping - disabling\n", __func__);
+        smooth_k = false;
+    }
+
     // [TAG_V_CACHE_VARIABLE]
     if (v_trans && hparams.is_n_embd_v_gqa_variable()) {
         LLAMA_LOG_WARN("%s: the V embeddings have different sizes across layers and FA is not enabled - padding V cache to %d\n",
@@ -132,6 +145,14 @@ llama_kv_cache::llama_kv_cache(
         ggml_format_name(k, "cache_k_l%d", il);
         ggml_format_name(v, "cache_v_l%d", il);
 
+        ggml_tensor * k_mean = nullptr;
+
+        // the attention sinks are not shifted together with the KQ values
+        if (smooth_k && model.layers[il].attn_sinks == nullptr) {
+            k_mean = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_embd_k_gqa);
+            ggml_format_name(k_mean, "cache_k_mean_l%d", il);
+        }
+
         std::vector<ggml_tensor *> k_stream;
         std::vector<ggml_tensor *> v_stream;
 
@@ -142,7 +163,7 @@ llama_kv_cache::llama_kv_cache(
 
         map_layer_ids[il] = layers.size();
 
-        layers.push_back({ il, k, v, k_stream, v_stream, });
+        layers.push_back({ il, k, v, k_stream, v_stream, k_mean, });
     }
 
     if (reuse) {
@@ -961,6 +982,24 @@ uint32_t llama_kv_cache::get_n_kv(const slot_info & sinfo) const {
     return result;
 }
 
+bool llama_kv_cache::get_k_mean_upd(const slot_info & sinfo) const {
+    bool smooth_k = false;
+    for (const auto & layer : layers) {
+        smooth_k = smooth_k || layer.k_mean != nullptr;
+    }
+
+    if (!smooth_k) {
+        return false;
+    }
+
+    uint32_t n_used = 0;
+    for (uint32_t s = 0; s < n_stream; ++s) {
+        n_used += v_cells[s].get_used();
+    }
+
+    return n_used == sinfo.size()*sinfo.n_stream();
+}
+
 ggml_tensor * llama_kv_cache::get_k(ggml_context * ctx, int32_t il, uint32_t n_kv, const slot_info & sinfo) const {
     const int32_t ikv = map_layer_ids.at(il);
 
@@ -1013,7 +1052,7 @@ ggml_tensor * llama_kv_cache::get_v(ggml_context * ctx, int32_t il, uint32_t n_k
             ggml_row_size(v->type, kv_size*n_embd_v_gqa)*sinfo.s0);
 }
 
-ggml_tensor * llama_kv_cache::cpy_k(ggml_context * ctx, ggml_tensor * k_cur, ggml_tensor * k_idxs, int32_t il, const slot_info & sinfo) const {
+ggml_tensor * llama_kv_cache::cpy_k(ggml_context * ctx, ggml_tensor * k_cur, ggml_tensor * k_idxs, bool k_mean_upd, int32_t il, const slot_info & sinfo) const {
     GGML_UNUSED(sinfo);
 
     const int32_t ikv = map_layer_ids.at(il);
@@ -1024,6 +1063,19 @@ ggml_tensor * llama_kv_cache::cpy_k(ggml_context * ctx, ggml_tensor * k_cur, ggm
 
     k_cur = ggml_reshape_2d(ctx, k_cur, k->ne[0], n_tokens);
 
+    if (auto * k_mean = layers[ikv].k_mean) {
+        // the mean is re-estimated only when the cache holds no other cells, otherwise the stored one is kept
+        if (k_mean_upd) {
+            // per-channel mean of the ubatch: [1, n_embd_k_gqa]
+            ggml_tensor * k_mean_cur = ggml_mean(ctx, ggml_cont(ctx, ggml_transpose(ctx, k_cur)));
+            k_mean_cur = ggml_reshape_1d(ctx, k_mean_cur, k->ne[0]);
+
+            k_mean = ggml_cpy(ctx, k_mean_cur, k_mean);
+        }
+
+        k_cur = ggml_sub(ctx, k_cur, k_mean);
+    }
+
     if (k->ne[2] > 1) {
         k = ggml_reshape_2d(ctx, k, k->ne[0], k->ne[1]*k->ne[2]);
     }
@@ -1382,7 +1434,19 @@ ggml_cgraph * llama_kv_cache::build_graph_shift(llm_graph_result * res, llama_co
                 ggml_row_size(layer.k->type, n_embd_k_gqa),
                 0);
 
-        ggml_tensor * cur = build_rope_shift(cparams, ctx, k, inp->k_shift, rope_factors, freq_base_l, freq_scale_l);
+        ggml_tensor * cur;
+
+        if (layer.k_mean) {
+            // the smoothed K has to be rotated together with its mean
+            ggml_tensor * k_mean = ggml_reshape_2d(ctx, layer.k_mean, n_embd_head_k, n_head_kv);
+
+            cur = ggml_add(ctx, ggml_cast(ctx, k, GGML_TYPE_F32), k_mean);
+            cur = build_rope_shift(cparams, ctx, cur, inp->k_shift, rope_factors, freq_base_l, freq_scale_l);
+            cur = ggml_sub(ctx, cur, k_mean);
+            cur = ggml_cpy(ctx, cur, k);
+        } else {
+            cur = build_rope_shift(cparams, ctx, k, inp->k_shift, rope_factors, freq_base_l, freq_scale_l);
+        }
 
         ggml_build_forward_expand(gf, cur);
     }
@@ -1460,6 +1524,21 @@ void llama_kv_cache::state_read(llama_io_read_i & io, llama_seq_id seq_id, llama
         throw std::runtime_error("n_stream mismatch");
     }
 
+    // the saved K smoothing means can be used only if no other sequence is stored in the cache
+    bool k_mean_set = true;
+    if (seq_id != -1) {
+        for (uint32_t s = 0; s < n_stream && k_mean_set; ++s) {
+            const auto & cells = v_cells[s];
+
+            for (uint32_t i = 0; i < cells.size(); ++i) {
+                if (!cells.is_empty(i) && !(cells.seq_count(i) == 1 && cells.seq_has(i, seq_id))) {
+                    k_mean_set = false;
+                    break;
+                }
+            }
+        }
+    }
+
     for (uint32_t s = 0; s < n_stream; ++s) {
         uint32_t cell_count;
         io.read_to(&cell_count, sizeof(cell_count));
@@ -1472,7 +1551,7 @@ void llama_kv_cache::state_read(llama_io_read_i & io, llama_seq_id seq_id, llama
 
         bool res = true;
         res = res && state_read_meta(io, strm, cell_count, seq_id);
-        res = res && state_read_data(io, strm, cell_count);
+        res = res && state_read_data(io, strm, cell_count, k_mean_set);
 
         if (!res) {
             if (seq_id == -1) {
@@ -1547,6 +1626,14 @@ void llama_kv_cache::state_write_data(llama_io_write_i & io, const cell_ranges_t
             const size_t buf_size = range_size * k_size_row;
             io.write_tensor(k, range.first * k_size_row, buf_size);
         }
+
+        // Write whether K smoothing is used, followed by the mean that has been subtracted from the keys
+        const uint32_t k_mean_i = layer.k_mean ? 1 : 0;
+        io.write(&k_mean_i, sizeof(k_mean_i));
+
+        if (layer.k_mean) {
+            io.write_tensor(layer.k_mean, 0, ggml_nbytes(layer.k_mean));
+        }
     }
 
     if (!v_trans) {
@@ -1705,7 +1792,7 @@ bool llama_kv_cache::state_read_meta(llama_io_read_i & io, uint32_t strm, uint32
     return true;
 }
 
-bool llama_kv_cache::state_read_data(llama_io_read_i & io, uint32_t strm, uint32_t cell_count) {
+bool llama_kv_cache::state_read_data(llama_io_read_i & io, uint32_t strm, uint32_t cell_count, bool k_mean_set) {
     auto & cells = v_cells[strm];
     auto & head  = v_heads[strm];
 
@@ -1760,6 +1847,33 @@ bool llama_kv_cache::state_read_data(llama_io_read_i & io, uint32_t strm, uint32
             // Read and set the keys for the whole cell range
             ggml_backend_tensor_set(k, io.read(cell_count * k_size_row), head * k_size_row, cell_count * k_size_row);
         }
+
+        // Read the K smoothing mean, the keys of all the cells in the cache must be stored with the same mean
+        uint32_t k_mean_i_ref;
+        io.read_to(&k_mean_i_ref, sizeof(k_mean_i_ref));
+        if ((bool) k_mean_i_ref != (layer.k_mean != nullptr)) {
+            LLAMA_LOG_ERROR("%s: mismatched K smoothing (%s instead of %s, layer %d)\n", __func__,
+                    k_mean_i_ref ? "enabled" : "disabled", layer.k_mean ? "enabled" : "disabled", il);
+            return false;
+        }
+
+        if (layer.k_mean) {
+            const size_t k_mean_size = ggml_nbytes(layer.k_mean);
+
+            const uint8_t * k_mean_ref = io.read(k_mean_size);
+
+            if (k_mean_set) {
+                ggml_backend_tensor_set(layer.k_mean, k_mean_ref, 0, k_mean_size);
+            } else {
+                std::vector<uint8_t> k_mean_cur(k_mean_size);
+                ggml_backend_tensor_get(layer.k_mean, k_mean_cur.data(), 0, k_mean_size);
+
+                if (memcmp(k_mean_cur.data(), k_mean_ref, k_mean_size) != 0) {
+                    LLAMA_LOG_ERROR("%s: mismatched K smoothing mean (layer %d) - the cache holds other sequences\n", __func__, il);
+                    return false;
+                }
+            }
+        }
     }
 
     if (!this->v_trans) {
@@ -1930,8 +2044,8 @@ ggml_tensor * llama_kv_cache_context::get_v(ggml_context * ctx, int32_t il) cons
     return kv->get_v(ctx, il, n_kv, sinfos[i_cur]);
 }
 
-ggml_tensor * llama_kv_cache_context::cpy_k(ggml_context * ctx, ggml_tensor * k_cur, ggml_tensor * k_idxs, int32_t il) const {
-    return kv->cpy_k(ctx, k_cur, k_idxs, il, sinfos[i_cur]);
+ggml_tensor * llama_kv_cache_context::cpy_k(ggml_context * ctx, ggml_tensor * k_cur, ggml_tensor * k_idxs, bool k_mean_upd, int32_t il) const {
+    return kv->cpy_k(ctx, k_cur, k_idxs, k_mean_upd, il, sinfos[i_cur]);
 }
 
 ggml_tensor * llama_kv_cache_context::cpy_v(ggml_context * ctx, ggml_tensor * v_cur, ggml_tensor * v_idxs, int32_t il) const {
@@ -1946,6 +2060,10 @@ ggml_tensor * llama_kv_cache_context::build_input_v_idxs(ggml_context * ctx, con
     return kv->build_input_v_idxs(ctx, ubatch);
 }
 
+bool llama_kv_cache_context::get_k_mean_upd() const {
+    return ubatches.empty() || kv->get_k_mean_upd(sinfos[i_cur]);
+}
+
 void llama_kv_cache_context::set_input_k_shift(ggml_tensor * dst) const {
     kv->set_input_k_shift(dst);
 }
@@ -1958,6 +2076,7 @@ void llama_kv_cache_context::set_input_v_idxs(ggml_tensor * dst, const llama_uba
     kv->set_input_v_idxs(dst, ubatch, sinfos[i_cur]);
 }
 
+
 void llama_kv_cache_context::set_input_kq_mask(ggml_tensor * dst, const llama_ubatch * ubatch, bool causal_attn) const {
     kv->set_input_kq_mask(dst, ubatch, causal_attn);
 }
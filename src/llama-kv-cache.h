@@ -82,6 +82,7 @@ public:
             const llama_model & model,
                     ggml_type   type_k,
                     ggml_type   type_v,
+                         bool   smooth_k,
                          bool   v_trans,
                          bool   offload,
                          bool   unified,
@@ -145,8 +146,13 @@ public:
     ggml_tensor * get_k(ggml_context * ctx, int32_t il, uint32_t n_kv, const slot_info & sinfo) const;
     ggml_tensor * get_v(ggml_context * ctx, int32_t il, uint32_t n_kv, const slot_info & sinfo) const;
 
+    // K smoothing: true if the K means are re-estimated from the ubatch, i.e. it occupies all the used cells
+    // (the ubatch must have been applied)
+    bool get_k_mean_upd(const slot_info & sinfo) const;
+
     // store k_cur and v_cur in the cache based on the provided head location
-    ggml_tensor * cpy_k(ggml_context * ctx, ggml_tensor * k_cur, ggml_tensor * k_idxs, int32_t il, const slot_info & sinfo) const;
+    // k_mean_upd: see get_k_mean_upd(), ignored if K smoothing is disabled
+    ggml_tensor * cpy_k(ggml_context * ctx, ggml_tensor * k_cur, ggml_tensor * k_idxs, bool k_mean_upd, int32_t il, const slot_info & sinfo) const;
     ggml_tensor * cpy_v(ggml_context * ctx, ggml_tensor * v_cur, ggml_tensor * v_idxs, int32_t il, const slot_info & sinfo) const;
 
     //
@@ -196,6 +202,10 @@ private:
 
         std::vector<ggml_tensor *> k_stream;
         std::vector<ggml_tensor *> v_stream;
+
+        // K smoothing: per-channel mean that is subtracted from K before storing it in the cache
+        // the attention is not affected because, for a given query q, q*k_mean is the same for all KV cells
+        ggml_tensor * k_mean = nullptr; // F32 [n_embd_k_gqa]
     };
 
     bool v_trans = true;  // the value tensor is transposed
@@ -265,7 +275,7 @@ private:
     void state_write_data(llama_io_write_i & io, const cell_ranges_t & cr) const;
 
     bool state_read_meta(llama_io_read_i & io, uint32_t strm, uint32_t cell_count, llama_seq_id dest_seq_id = -1);
-    bool state_read_data(llama_io_read_i & io, uint32_t strm, uint32_t cell_count);
+    bool state_read_data(llama_io_read_i & io, uint32_t strm, uint32_t cell_count, bool k_mean_set);
 };
 
 class llama_kv_cache_context : public llama_memory_context_i {
@@ -317,12 +327,15 @@ public:
     ggml_tensor * get_v(ggml_context * ctx, int32_t il) const;
 
     // store k_cur and v_cur in the cache based on the provided head location
-    ggml_tensor * cpy_k(ggml_context * ctx, ggml_tensor * k_cur, ggml_tensor * k_idxs, int32_t il) const;
+    ggml_tensor * cpy_k(ggml_context * ctx, ggml_tensor * k_cur, ggml_tensor * k_idxs, bool k_mean_upd, int32_t il) const;
     ggml_tensor * cpy_v(ggml_context * ctx, ggml_tensor * v_cur, ggml_tensor * v_idxs, int32_t il) const;
 
     ggml_tensor * build_input_k_idxs(ggml_context * ctx, const llama_ubatch & ubatch) const;
     ggml_tensor * build_input_v_idxs(ggml_context * ctx, const llama_ubatch & ubatch) const;
 
+    // the graph of a reservation (no ubatch) re-estimates the K means
+    bool get_k_mean_upd() const;
+
     void set_input_k_idxs(ggml_tensor * dst, const llama_ubatch * ubatch) const;
     void set_input_v_idxs(ggml_tensor * dst, const llama_ubatch * ubatch) const;
 
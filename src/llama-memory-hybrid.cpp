@@ -13,6 +13,7 @@ llama_memory_hybrid::llama_memory_hybrid(
                             /* attn */
                 ggml_type   type_k,
                 ggml_type   type_v,
+                     bool   smooth_k,
                      bool   v_trans,
                  uint32_t   kv_size,
                  uint32_t   n_pad,
@@ -34,6 +35,7 @@ llama_memory_hybrid::llama_memory_hybrid(
         model,
         type_k,
         type_v,
+        smooth_k,
         v_trans,
         offload,
         unified,
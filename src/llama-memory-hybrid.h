@@ -23,6 +23,7 @@ public:
                             /* attn */
                 ggml_type   type_k,
                 ggml_type   type_v,
+                     bool   smooth_k,
                      bool   v_trans,
                  uint32_t   kv_size,
                  uint32_t   n_pad,
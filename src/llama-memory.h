@@ -19,6 +19,9 @@ struct llama_memory_params {
 
     // use full-size SWA cache
     bool swa_full;
+
+    // subtract a per-channel mean from K before storing it in a quantized K cache
+    bool smooth_k;
 };
 
 enum llama_memory_status {
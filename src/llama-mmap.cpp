@@ -595,6 +595,98 @@ const bool llama_mlock::SUPPORTED = true;
 const bool llama_mlock::SUPPORTED = false;
 #endif
 
+// memory ranges
+
+#if defined(_POSIX_MEMLOCK_RANGE) || defined(_POSIX_MAPPED_FILES)
+static size_t llama_page_size() {
+    static const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+#endif
+
+bool llama_mem_lock_range(const void * addr, size_t size) {
+#ifdef _POSIX_MEMLOCK_RANGE
+    const size_t page_size = llama_page_size();
+    const uintptr_t first = (uintptr_t) addr & ~(page_size - 1);
+    const uintptr_t last  = ((uintptr_t) addr + size + page_size - 1) & ~(page_size - 1);
+
+    return mlock((const void *) first, last - first) == 0;
+#elif defined(_WIN32)
+    return VirtualLock((void *) addr, size);
+#else
+    GGML_UNUSED(addr);
+    GGML_UNUSED(size);
+    return false;
+#endif
+}
+
+void llama_mem_unlock_range(const void * addr, size_t size) {
+#ifdef _POSIX_MEMLOCK_RANGE
+    const size_t page_size = llama_page_size();
+    const uintptr_t first = ((uintptr_t) addr + page_size - 1) & ~(page_size - 1);
+    const uintptr_t last  = ((uintptr_t) addr + size) & ~(page_size - 1);
+
+    if (last > first && munlock((const void *) first, last - first)) {
+        LLAMA_LOG_WARN("warning: failed to munlock %zu-byte buffer: %s\n", (size_t) (last - first), std::strerror(errno));
+    }
+#elif defined(_WIN32)
+    if (!VirtualUnlock((void *) addr, size)) {
+        LLAMA_LOG_WARN("warning: failed to VirtualUnlock %zu-byte buffer: %s\n", size, llama_format_win_err(GetLastError()).c_str());
+    }
+#else
+    GGML_UNUSED(addr);
+    GGML_UNUSED(size);
+#endif
+}
+
+void llama_mem_prefetch_range(const void * addr, size_t size) {
+#ifdef _POSIX_MAPPED_FILES
+    const size_t page_size = llama_page_size();
+    const uintptr_t first = (uintptr_t) addr & ~(page_size - 1);
+
+    // this is only a hint, failures are not reported
+    posix_madvise((void *) first, (uintptr_t) addr + size - first, POSIX_MADV_WILLNEED);
+#else
+    GGML_UNUSED(addr);
+    GGML_UNUSED(size);
+#endif
+}
+
+void llama_mem_touch_range(const void * addr, size_t size) {
+#ifdef _POSIX_MAPPED_FILES
+    const size_t page_size = llama_page_size();
+#else
+    const size_t page_size = 4096;
+#endif
+    const volatile uint8_t * p = (const volatile uint8_t *) addr;
+
+    uint8_t sum = 0;
+    for (size_t i = 0; i < size; i += page_size) {
+        sum += p[i];
+    }
+    // the range does not start at a page boundary
+    if (size > 0) {
+        sum += p[size - 1];
+    }
+    GGML_UNUSED(sum);
+}
+
+void llama_mem_release_range(const void * addr, size_t size) {
+#if defined(_POSIX_MAPPED_FILES) && defined(MADV_COLD)
+    const size_t page_size = llama_page_size();
+    const uintptr_t first = ((uintptr_t) addr + page_size - 1) & ~(page_size - 1);
+    const uintptr_t last  = ((uintptr_t) addr + size) & ~(page_size - 1);
+
+    // this is only a hint, failures are not reported
+    if (last > first) {
+        madvise((void *) first, last - first, MADV_COLD);
+    }
+#else
+    GGML_UNUSED(addr);
+    GGML_UNUSED(size);
+#endif
+}
+
 size_t llama_path_max() {
     return PATH_MAX;
 }
@@ -65,4 +65,15 @@ private:
     std::unique_ptr<impl> pimpl;
 };
 
+// lock, unlock, page in and out arbitrary ranges of memory (e.g. parts of a mapped model file)
+// locking rounds the range out to whole pages, unlocking and releasing round it in, so that neighbouring ranges are
+// not affected
+// prefetch only hints that the range will be needed soon, touch reads a byte of each page to fault it in now,
+// release hints that the range is not needed anymore and can be reclaimed first
+bool llama_mem_lock_range    (const void * addr, size_t size);
+void llama_mem_unlock_range  (const void * addr, size_t size);
+void llama_mem_prefetch_range(const void * addr, size_t size);
+void llama_mem_touch_range   (const void * addr, size_t size);
+void llama_mem_release_range (const void * addr, size_t size);
+
 size_t llama_path_max();
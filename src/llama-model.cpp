@@ -4,6 +4,7 @@
 #include "llama-mmap.h"
 #include "llama-batch.h"
 #include "llama-cparams.h"
+#include "llama-expert-cache.h"
 #include "llama-model-loader.h"
 
 #include "llama-kv-cache.h"
@@ -14,6 +15,7 @@
 #include "ggml-cpp.h"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
 #include <cfloat>
@@ -21,9 +23,11 @@
 #include <cmath>
 #include <functional>
 #include <map>
+#include <mutex>
 #include <regex>
 #include <sstream>
 #include <stdexcept>
+#include <unordered_set>
 
 const char * llm_type_name(llm_type type) {
     switch (type) {
@@ -433,6 +437,10 @@ struct llama_model::impl {
     std::vector<layer_dev> dev_layer;
 
     bool has_tensor_overrides;
+
+    // MoE expert cache: number of contexts that keep each expert locked, by layer and expert
+    std::mutex expert_lock_mutex;
+    std::map<std::pair<int32_t, int32_t>, uint32_t> expert_lock_cnt;
 };
 
 llama_model::llama_model(const llama_model_params & params) : params(params), pimpl(std::make_unique<impl>()) {
@@ -2050,6 +2058,10 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
     const size_t ctx_size = ggml_tensor_overhead()*max_n_tensors;
 
     std::map<ggml_backend_buffer_type_t, ggml_context *> ctx_map;
+    std::map<ggml_backend_buffer_type_t, ggml_context *> ctx_map_split; // FFN shards
+
+    // LLAMA_SPLIT_MODE_TENSOR: the tensors of the unsplit FFN weights
+    ggml_context_ptr ctx_ffn_unsplit;
     auto ctx_for_buft = [&](ggml_backend_buffer_type_t buft) -> ggml_context * {
         auto it = ctx_map.find(buft);
         if (it == ctx_map.end()) {
@@ -2104,6 +2116,43 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
         ggml_backend_buffer_type_t first_moved_from_buft = nullptr;
         ggml_backend_buffer_type_t first_moved_to_buft = nullptr;
 
+        // LLAMA_SPLIT_MODE_TENSOR: the FFN weights of the offloaded layers are sharded across all the devices
+        // the tensors of the unsplit weights are created in a separate context without a buffer
+        std::vector<int> ffn_can_split(n_layer, -1);
+        auto can_split_ffn = [&](int il) -> bool {
+            if (split_mode != LLAMA_SPLIT_MODE_TENSOR || n_devices() < 2 || pimpl->dev_layer.at(il).dev == cpu_dev) {
+                return false;
+            }
+
+            if (ffn_can_split[il] < 0) {
+                const LLM_TN tn(arch);
+
+                const ggml_tensor * up   = ml.get_tensor_meta(tn(LLM_TENSOR_FFN_UP,   "weight", il).str().c_str());
+                const ggml_tensor * gate = ml.get_tensor_meta(tn(LLM_TENSOR_FFN_GATE, "weight", il).str().c_str());
+                const ggml_tensor * down = ml.get_tensor_meta(tn(LLM_TENSOR_FFN_DOWN, "weight", il).str().c_str());
+
+                bool ok = up && gate && down && ggml_is_matrix(up) && ggml_is_matrix(gate) && ggml_is_matrix(down) &&
+                    gate->ne[0] == up->ne[0] && gate->ne[1] == up->ne[1] &&
+                    down->ne[0] == up->ne[1] && down->ne[1] == up->ne[0] &&
+                    // the columns of down are split in whole blocks
+                    down->ne[0] % ggml_blck_size(down->type) == 0;
+
+                // biases and scales would have to be sharded too
+                for (llm_tensor t : { LLM_TENSOR_FFN_UP, LLM_TENSOR_FFN_GATE, LLM_TENSOR_FFN_DOWN }) {
+                    for (const char * suffix : { "bias", "scale" }) {
+                        ok = ok && ml.get_tensor_meta(tn(t, suffix, il).str().c_str()) == nullptr;
+                    }
+                }
+                ok = ok && ml.get_tensor_meta(tn(LLM_TENSOR_FFN_ACT, "scales", il).str().c_str()) == nullptr;
+
+                ffn_can_split[il] = ok;
+            }
+
+            return ffn_can_split[il];
+        };
+
+        std::vector<std::array<ggml_tensor *, 3>> ffn_unsplit(n_layer, { nullptr, nullptr, nullptr }); // up, gate, down
+
         auto create_tensor = [&](const LLM_TN_IMPL & tn, const std::initializer_list<int64_t> & ne, int flags) -> ggml_tensor * {
             ggml_tensor * t_meta = ml.get_tensor_meta(tn.str().c_str());
 
@@ -2164,6 +2213,35 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
                 }
             }
 
+            if (info.layer == LLM_TENSOR_LAYER_REPEATING && tn.suffix && strcmp(tn.suffix, "weight") == 0 && can_split_ffn(tn.bid)) {
+                int idx = -1;
+                switch (tn.tensor) {
+                    case LLM_TENSOR_FFN_UP:   idx = 0; break;
+                    case LLM_TENSOR_FFN_GATE: idx = 1; break;
+                    case LLM_TENSOR_FFN_DOWN: idx = 2; break;
+                    default: break;
+                }
+
+                if (idx >= 0) {
+                    if (!ctx_ffn_unsplit) {
+                        ggml_init_params params = {
+                            /*.mem_size   =*/ ggml_tensor_overhead()*n_layer*3,
+                            /*.mem_buffer =*/ NULL,
+                            /*.no_alloc   =*/ true,
+                        };
+                        ctx_ffn_unsplit.reset(ggml_init(params));
+                    }
+
+                    // the data is loaded into the shards, not by load_all_data
+                    ggml_tensor * t = ml.create_tensor(ctx_ffn_unsplit.get(), tn, ne, flags);
+                    ml.size_data -= ggml_nbytes(t);
+
+                    ffn_unsplit[tn.bid][idx] = t;
+
+                    return t;
+                }
+            }
+
             // select the buffer type for this tensor
             buft_list_t * buft_list;
             switch (info.layer) {
@@ -5728,6 +5806,79 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
                 __func__, first_moved_tensor->name, ggml_type_name(first_moved_tensor->type), n_moved_tensors - 1,
                 ggml_backend_buft_name(first_moved_from_buft), ggml_backend_buft_name(first_moved_to_buft));
         }
+
+        // create the FFN shards, each device gets a range of rows of up and gate and the same range of columns of down
+        int n_split_layers = 0;
+
+        for (int il = 0; il < n_layer; ++il) {
+            const auto & src = ffn_unsplit[il];
+            if (!src[0] && !src[1] && !src[2]) {
+                continue;
+            }
+            if (!src[0] || !src[1] || !src[2]) {
+                throw std::runtime_error(format("%s: the FFN of layer %d cannot be split by tensor, the %s architecture does not load up, gate and down",
+                        __func__, il, llm_arch_name(arch)));
+            }
+
+            if (ffn_split.empty()) {
+                ffn_split.resize(n_layer);
+            }
+
+            auto & split = ffn_split[il];
+            split.up   = src[0];
+            split.gate = src[1];
+            split.down = src[2];
+
+            const int64_t n_embd_ffn = src[0]->ne[0];
+            const int64_t n_ff       = src[0]->ne[1];
+            const int64_t n_blck     = n_ff/ggml_blck_size(src[2]->type);
+
+            int64_t i0 = 0;
+            for (size_t id = 0; id < n_devices(); ++id) {
+                const int64_t i1 = id + 1 == n_devices() ? n_ff : std::min<int64_t>(n_ff, std::lround(splits[id]*n_blck)*ggml_blck_size(src[2]->type));
+                if (i1 <= i0) {
+                    continue;
+                }
+
+                ggml_backend_buffer_type_t buft = ggml_backend_dev_buffer_type(devices[id]);
+
+                // the shards are allocated in their own buffers, the model buffers may be mapped from the model file
+                ggml_context * ctx = ctx_map_split[buft];
+                if (!ctx) {
+                    ggml_init_params params = {
+                        /*.mem_size   =*/ ggml_tensor_overhead()*n_layer*3,
+                        /*.mem_buffer =*/ NULL,
+                        /*.no_alloc   =*/ true,
+                    };
+                    ctx = ggml_init(params);
+                    if (!ctx) {
+                        throw std::runtime_error(format("failed to create ggml context"));
+                    }
+                    ctx_map_split[buft] = ctx;
+                    pimpl->ctxs.emplace_back(ctx);
+                }
+
+                llm_ffn_shard shard;
+                shard.up   = ggml_new_tensor_2d(ctx, src[0]->type, n_embd_ffn, i1 - i0);
+                shard.gate = ggml_new_tensor_2d(ctx, src[1]->type, n_embd_ffn, i1 - i0);
+                shard.down = ggml_new_tensor_2d(ctx, src[2]->type, i1 - i0, n_embd_ffn);
+
+                for (int k = 0; k < 3; ++k) {
+                    ggml_tensor * t = k == 0 ? shard.up : k == 1 ? shard.gate : shard.down;
+                    ggml_format_name(t, "%s.shard%zu", src[k]->name, id);
+                }
+
+                split.shards.push_back(shard);
+
+                i0 = i1;
+            }
+
+            n_split_layers++;
+        }
+
+        if (n_split_layers > 0) {
+            LLAMA_LOG_INFO("%s: sharded the FFN of %d layers across %zu devices\n", __func__, n_split_layers, n_devices());
+        }
     }
 
     ml.done_getting_tensors();
@@ -5741,7 +5892,7 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
 
     // Ensure we have enough capacity for the maximum backend buffer we will potentially create
     const size_t n_max_backend_buffer = ctx_map.size() * ml.files.size();
-    pimpl->bufs.reserve(n_max_backend_buffer);
+    pimpl->bufs.reserve(n_max_backend_buffer + ctx_map_split.size());
 
     for (auto & it : ctx_map) {
         ggml_backend_buffer_type_t buft = it.first;
@@ -5819,6 +5970,15 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
         ctx_bufs.emplace_back(ctx, buf_map);
     }
 
+    for (auto & it : ctx_map_split) {
+        ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(it.second, it.first);
+        if (buf == nullptr) {
+            throw std::runtime_error(format("unable to allocate %s buffer", ggml_backend_buft_name(it.first)));
+        }
+        ggml_backend_buffer_set_usage(buf, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+        pimpl->bufs.emplace_back(buf);
+    }
+
     if (llama_supports_gpu_offload()) {
         const int n_gpu = std::min(n_gpu_layers, int(hparams.n_layer));
 
@@ -5845,6 +6005,53 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
         }
     }
 
+    // load the FFN shards
+    if (ctx_ffn_unsplit) {
+        std::vector<uint8_t> read_buf;
+        std::vector<uint8_t> down_buf;
+
+        for (const auto & split : ffn_split) {
+            for (const ggml_tensor * unsplit : { split.up, split.gate, split.down }) {
+                if (!unsplit) {
+                    continue;
+                }
+
+                ggml_tensor * src = ggml_get_tensor(ctx_ffn_unsplit.get(), unsplit->name);
+
+                // with mmap the tensor is pointed to the mapped data
+                if (!ml.use_mmap) {
+                    read_buf.resize(ggml_nbytes(src));
+                    src->data = read_buf.data();
+                }
+                ml.load_data_for(src);
+
+                const uint8_t * data = (const uint8_t *) src->data;
+                src->data = nullptr;
+
+                // offset of the shard in the tensor (up, gate) or in each row (down)
+                size_t offs = 0;
+
+                for (const auto & shard : split.shards) {
+                    if (unsplit != split.down) {
+                        ggml_tensor * dst = unsplit == split.up ? shard.up : shard.gate;
+                        ggml_backend_tensor_set(dst, data + offs, 0, ggml_nbytes(dst));
+                        offs += ggml_nbytes(dst);
+                    } else {
+                        ggml_tensor * dst = shard.down;
+                        down_buf.resize(ggml_nbytes(dst));
+                        for (int64_t i1 = 0; i1 < dst->ne[1]; ++i1) {
+                            memcpy(down_buf.data() + i1*dst->nb[1], data + i1*src->nb[1] + offs, dst->nb[1]);
+                        }
+                        ggml_backend_tensor_set(dst, down_buf.data(), 0, ggml_nbytes(dst));
+                        offs += dst->nb[1];
+                    }
+                }
+            }
+        }
+
+        pimpl->ctxs.emplace_back(std::move(ctx_ffn_unsplit));
+    }
+
     // load tensor data
     for (auto & it : ctx_bufs) {
         ggml_context * ctx = it.first;
@@ -6150,6 +6357,42 @@ ggml_tensor * llama_model::get_rope_factors(const llama_cparams & cparams, int i
     return layers[il].rope_short;
 }
 
+bool llama_model::expert_lock(int32_t il, int32_t ie) const {
+    std::lock_guard<std::mutex> lock(pimpl->expert_lock_mutex);
+
+    auto & cnt = pimpl->expert_lock_cnt[{ il, ie }];
+    if (cnt == 0) {
+        const auto tensors = llama_expert_tensors(layers[il]);
+
+        for (size_t i = 0; i < tensors.size(); ++i) {
+            if (!llama_mem_lock_range(tensors[i].data + ie*tensors[i].nb, tensors[i].nb)) {
+                for (size_t j = 0; j < i; ++j) {
+                    llama_mem_unlock_range(tensors[j].data + ie*tensors[j].nb, tensors[j].nb);
+                }
+                pimpl->expert_lock_cnt.erase({ il, ie });
+                return false;
+            }
+        }
+    }
+    cnt++;
+
+    return true;
+}
+
+void llama_model::expert_unlock(int32_t il, int32_t ie) const {
+    std::lock_guard<std::mutex> lock(pimpl->expert_lock_mutex);
+
+    auto it = pimpl->expert_lock_cnt.find({ il, ie });
+    GGML_ASSERT(it != pimpl->expert_lock_cnt.end());
+
+    if (--it->second == 0) {
+        for (const auto & t : llama_expert_tensors(layers[il])) {
+            llama_mem_unlock_range(t.data + ie*t.nb, t.nb);
+        }
+        pimpl->expert_lock_cnt.erase(it);
+    }
+}
+
 struct llm_build_llama : public llm_graph_context {
     llm_build_llama(const llama_model & model, const llm_graph_params & params) : llm_graph_context(params) {
         const int64_t n_embd_head = hparams.n_embd_head_v;
@@ -18678,6 +18921,7 @@ llama_memory_i * llama_model::create_memory(const llama_memory_params & params,
                         /* model             */ *this,
                         /* attn_type_k       */ params.type_k,
                         /* attn_type_v       */ params.type_v,
+                        /* attn_smooth_k     */ params.smooth_k,
                         /* attn_v_trans      */ !cparams.flash_attn,
                         /* attn_kv_size      */ cparams.n_ctx,
                         /* attn_n_pad        */ padding,
@@ -18728,6 +18972,7 @@ llama_memory_i * llama_model::create_memory(const llama_memory_params & params,
                                 *this,
                                 params.type_k,
                                 params.type_v,
+                                params.smooth_k,
                                 !cparams.flash_attn,
                                 cparams.offload_kqv,
                                 params.swa_full,
@@ -18745,6 +18990,7 @@ llama_memory_i * llama_model::create_memory(const llama_memory_params & params,
                                 *this,
                                 params.type_k,
                                 params.type_v,
+                                params.smooth_k,
                                 !cparams.flash_attn,
                                 cparams.offload_kqv,
                                 cparams.kv_unified,
@@ -19139,7 +19385,28 @@ ggml_cgraph * llama_model::build_graph(const llm_graph_params & params) const {
     // add on pooling layer
     llm->build_pooling(cls, cls_b, cls_out, cls_out_b);
 
-    return llm->res->get_gf();
+    ggml_cgraph * gf = llm->res->get_gf();
+
+    if (!ffn_split.empty()) {
+        // the unsplit FFN weights are not allocated, make sure that the graph only uses the shards
+        std::unordered_set<const ggml_tensor *> unsplit;
+        for (const auto & split : ffn_split) {
+            unsplit.insert({ split.up, split.gate, split.down });
+        }
+        unsplit.erase(nullptr);
+
+        for (int i = 0; i < ggml_graph_n_nodes(gf); ++i) {
+            const ggml_tensor * node = ggml_graph_node(gf, i);
+            for (int j = 0; j < GGML_MAX_SRC; ++j) {
+                if (node->src[j] && unsplit.count(node->src[j])) {
+                    throw std::runtime_error(format("%s: tensor '%s' is used outside of build_ffn, the %s architecture does not support split mode tensor",
+                            __func__, node->src[j]->name, llm_arch_name(arch)));
+                }
+            }
+        }
+    }
+
+    return gf;
 }
 
 
@@ -421,6 +421,9 @@ struct llama_model {
 
     std::vector<llama_layer> layers;
 
+    // LLAMA_SPLIT_MODE_TENSOR: the FFN shards of each layer, empty if not split
+    std::vector<llm_ffn_split> ffn_split;
+
     llama_model_params params;
 
     // gguf metadata
@@ -472,6 +475,12 @@ struct llama_model {
 
     ggml_tensor * get_rope_factors(const llama_cparams & cparams, int il) const;
 
+    // MoE expert cache: lock the weights of expert ie of layer il that are in host memory
+    // the locks are counted across the contexts of the model, the expert is unlocked by the last one
+    // returns false if the weights could not be locked (e.g. RLIMIT_MEMLOCK)
+    bool expert_lock  (int32_t il, int32_t ie) const;
+    void expert_unlock(int32_t il, int32_t ie) const;
+
     // note: can mutate `cparams`
     // TODO: move this to new llm_arch_model_i interface
     llama_memory_i * create_memory(const llama_memory_params & params, llama_cparams & cparams) const;
@@ -8,6 +8,7 @@
 #include "unicode.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <cfloat>
@@ -16,9 +17,13 @@
 #include <cstring>
 #include <forward_list>
 #include <limits>
+#include <list>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <set>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 
 //
@@ -257,6 +262,10 @@ public:
         return item;
     }
 
+    void clear() {
+        this->c.clear();
+    }
+
     void pop() =  delete;
 };
 
@@ -271,7 +280,6 @@ struct llm_bigram_bpe {
     using queue = llama_priority_queue<llm_bigram_bpe, queue_storage, comparator>;
     llm_symbol::index left;
     llm_symbol::index right;
-    std::string text;
     int rank;
     size_t size;
 };
@@ -447,6 +455,57 @@ struct llm_tokenizer_bpe : llm_tokenizer {
     }
 
     std::vector<std::string> regex_exprs;
+
+    // LRU cache of pre-tokenized words -> token ids, shared by all sessions of the vocab
+    // long words are rare and cheap to miss, so they are not cached
+    static constexpr size_t cache_max_words    = 65536;
+    static constexpr size_t cache_max_word_len = 128;
+
+    bool cache_get(const std::string & word, std::vector<llama_token> & output) const {
+        if (word.size() > cache_max_word_len) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+
+        auto it = cache_map.find(std::string_view(word));
+        if (it == cache_map.end()) {
+            return false;
+        }
+
+        cache_lru.splice(cache_lru.begin(), cache_lru, it->second);
+        output.insert(output.end(), it->second->second.begin(), it->second->second.end());
+
+        return true;
+    }
+
+    void cache_put(const std::string & word, const llama_token * tokens, size_t n_tokens) const {
+        if (word.size() > cache_max_word_len) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+
+        if (cache_map.find(std::string_view(word)) != cache_map.end()) {
+            return; // inserted concurrently by another session
+        }
+
+        if (cache_lru.size() >= cache_max_words) {
+            cache_map.erase(std::string_view(cache_lru.back().first));
+            cache_lru.pop_back();
+        }
+
+        cache_lru.emplace_front(word, std::vector<llama_token>(tokens, tokens + n_tokens));
+        cache_map.emplace(std::string_view(cache_lru.front().first), cache_lru.begin());
+    }
+
+private:
+    using cache_list = std::list<std::pair<std::string, std::vector<llama_token>>>;
+
+    // the map keys are views into the strings owned by the list nodes
+    mutable std::mutex cache_mutex;
+    mutable cache_list cache_lru; // most recently used first
+    mutable std::unordered_map<std::string_view, cache_list::iterator> cache_map;
 };
 
 struct llm_tokenizer_bpe_session {
@@ -489,118 +548,152 @@ struct llm_tokenizer_bpe_session {
         }
     }
 
-    void tokenize(const std::string & text, std::vector<llama_token> & output) {
-        int final_prev_index = -1;
+    // n_threads > 1: the pre-tokenized words of large inputs are split into contiguous chunks that are merged in parallel
+    void tokenize(const std::string & text, std::vector<llama_token> & output, int32_t n_threads = 1) {
         const auto word_collection = unicode_regex_split(text, tokenizer.regex_exprs);
 
-        symbols_final.clear();
+        const size_t n_words = word_collection.size();
+        const size_t n_chunk = n_threads > 1 ? std::min<size_t>(n_threads, n_words/n_words_per_chunk_min) : 1;
+
+        if (n_chunk <= 1) {
+            tokenize_words(word_collection, 0, n_words, output);
+            return;
+        }
+
+        std::vector<std::vector<llama_token>> outputs(n_chunk);
 
-        for (const auto & word : word_collection) {
-            work_queue = llm_bigram_bpe::queue();
-            symbols.clear();
+        const auto chunk_begin = [&](size_t ic) { return ic*n_words/n_chunk; };
 
-            int index = 0;
-            size_t offset = 0;
+        std::vector<std::thread> workers;
+        workers.reserve(n_chunk - 1);
 
-            //if (vocab.tokenizer_ignore_merges && vocab.token_to_id.find(word) != vocab.token_to_id.end()) {
-            if (vocab.get_ignore_merges() && vocab.text_to_token(word) != LLAMA_TOKEN_NULL) {
-                symbols.emplace_back(llm_symbol{-1, -1, word.c_str(), word.size()});
-                offset = word.size();
-            }
+        for (size_t ic = 1; ic < n_chunk; ++ic) {
+            workers.emplace_back([&, ic]() {
+                llm_tokenizer_bpe_session session(vocab, tokenizer);
+                session.tokenize_words(word_collection, chunk_begin(ic), chunk_begin(ic + 1), outputs[ic]);
+            });
+        }
 
-            while (offset < word.size()) {
-                llm_symbol sym;
-                size_t char_len = std::min(word.size() - offset, (size_t) unicode_len_utf8(word[offset]));
-                sym.text = word.c_str() + offset;
-                sym.n = char_len;
-                offset += sym.n;
-                sym.prev = index - 1;
-                sym.next = offset == word.size() ? -1 : index + 1;
-                index++;
-                symbols.emplace_back(sym);
-            }
-            for (int i = 1; i < (int) symbols.size(); ++i) {
-                add_new_bigram(i - 1, i);
+        tokenize_words(word_collection, chunk_begin(0), chunk_begin(1), outputs[0]);
+
+        for (auto & worker : workers) {
+            worker.join();
+        }
+
+        for (const auto & out : outputs) {
+            output.insert(output.end(), out.begin(), out.end());
+        }
+    }
+
+private:
+    // chunks smaller than this are not worth the thread startup cost
+    static constexpr size_t n_words_per_chunk_min = 4096;
+
+    void tokenize_words(const std::vector<std::string> & words, size_t i0, size_t i1, std::vector<llama_token> & output) {
+        for (size_t i = i0; i < i1; ++i) {
+            tokenize_word(words[i], output);
+        }
+    }
+
+    void tokenize_word(const std::string & word, std::vector<llama_token> & output) {
+        //if (vocab.tokenizer_ignore_merges && vocab.token_to_id.find(word) != vocab.token_to_id.end()) {
+        if (vocab.get_ignore_merges()) {
+            const llama_token token = vocab.text_to_token(word);
+            if (token != LLAMA_TOKEN_NULL) {
+                output.push_back(token);
+                return;
             }
+        }
 
-            // build token(s)
-            while (!work_queue.empty()) {
-                auto bigram = work_queue.pop_move();
+        if (tokenizer.cache_get(word, output)) {
+            return;
+        }
 
-                auto & left_symbol = symbols[bigram.left];
-                auto & right_symbol = symbols[bigram.right];
+        const size_t n_output_prev = output.size();
 
-                if (left_symbol.n == 0 || right_symbol.n == 0) {
-                    continue;
-                }
-                std::string left_token = std::string(left_symbol.text, left_symbol.n);
-                std::string right_token = std::string(right_symbol.text, right_symbol.n);
-                if (left_token + right_token != bigram.text) {
-                    continue;  // Skip this bigram if it's outdated
-                }
+        // the symbol and queue buffers are reused across words to avoid allocations
+        work_queue.clear();
+        symbols.clear();
 
-                // merge the right sym into the left one
-                left_symbol.n += right_symbol.n;
-                right_symbol.n = 0;
+        int index = 0;
+        size_t offset = 0;
 
-                // remove the right sym from the chain
-                left_symbol.next = right_symbol.next;
-                if (right_symbol.next >= 0) {
-                    symbols[right_symbol.next].prev = bigram.left;
-                }
+        while (offset < word.size()) {
+            llm_symbol sym;
+            size_t char_len = std::min(word.size() - offset, (size_t) unicode_len_utf8(word[offset]));
+            sym.text = word.c_str() + offset;
+            sym.n = char_len;
+            offset += sym.n;
+            sym.prev = index - 1;
+            sym.next = offset == word.size() ? -1 : index + 1;
+            index++;
+            symbols.emplace_back(sym);
+        }
+        for (int i = 1; i < (int) symbols.size(); ++i) {
+            add_new_bigram(i - 1, i);
+        }
+
+        // build token(s)
+        while (!work_queue.empty()) {
+            auto bigram = work_queue.pop_move();
+
+            auto & left_symbol = symbols[bigram.left];
+            auto & right_symbol = symbols[bigram.right];
 
-                add_new_bigram(left_symbol.prev, bigram.left);  // left side of current symbol
-                add_new_bigram(bigram.left, left_symbol.next);  // right side of current symbol
+            if (left_symbol.n == 0 || right_symbol.n == 0) {
+                continue;
+            }
+            // the symbols are adjacent and the left one never moves its start, so the merged text
+            // is unchanged if and only if the combined length is unchanged
+            if (left_symbol.n + right_symbol.n != bigram.size) {
+                continue;  // Skip this bigram if it's outdated
             }
 
-            // add the finished tokens to the final list keeping correct order for next and prev
-            for (auto & sym : symbols) {
-                if (sym.n > 0) {
-                    sym.prev = final_prev_index;
-                    sym.next = -1;
-                    if (final_prev_index != -1) {
-                        symbols_final[final_prev_index].next = symbols_final.size();
-                    }
-                    symbols_final.emplace_back(sym);
-                    final_prev_index = symbols_final.size() - 1;
-                }
+            // merge the right sym into the left one
+            left_symbol.n += right_symbol.n;
+            right_symbol.n = 0;
+
+            // remove the right sym from the chain
+            left_symbol.next = right_symbol.next;
+            if (right_symbol.next >= 0) {
+                symbols[right_symbol.next].prev = bigram.left;
             }
-        }
 
-        symbols = symbols_final;
+            add_new_bigram(left_symbol.prev, bigram.left);  // left side of current symbol
+            add_new_bigram(bigram.left, left_symbol.next);  // right side of current symbol
+        }
 
-        if (!symbols.empty()) {
-            for (int i = 0; i != -1; i = symbols[i].next) {
-                auto & symbol = symbols[i];
-                if (symbol.n == 0) {
-                    continue;
-                }
+        // the merged symbols remain in chain order within the buffer
+        for (const auto & symbol : symbols) {
+            if (symbol.n == 0) {
+                continue;
+            }
 
-                const std::string str = std::string(symbol.text, symbol.n);
-                const auto token = vocab.text_to_token(str);
+            piece.assign(symbol.text, symbol.n);
+            const auto token = vocab.text_to_token(piece);
 
-                if (token == LLAMA_TOKEN_NULL) {
-                    for (auto j = str.begin(); j != str.end(); ++j) {
-                        std::string byte_str(1, *j);
-                        auto token_multibyte = vocab.text_to_token(byte_str);
-                        if (token_multibyte != LLAMA_TOKEN_NULL) {
-                            output.push_back(token_multibyte);
-                        }
+            if (token == LLAMA_TOKEN_NULL) {
+                for (auto j = piece.begin(); j != piece.end(); ++j) {
+                    std::string byte_str(1, *j);
+                    auto token_multibyte = vocab.text_to_token(byte_str);
+                    if (token_multibyte != LLAMA_TOKEN_NULL) {
+                        output.push_back(token_multibyte);
                     }
-                } else {
-                    output.push_back(token);
                 }
+            } else {
+                output.push_back(token);
             }
         }
+
+        tokenizer.cache_put(word, output.data() + n_output_prev, output.size() - n_output_prev);
     }
 
-private:
     void add_new_bigram(int left, int right) {
         if (left == -1 || right == -1) {
             return;
         }
-        std::string left_token  = std::string(symbols[left].text,  symbols[left].n);
-        std::string right_token = std::string(symbols[right].text, symbols[right].n);
+        left_token.assign (symbols[left].text,  symbols[left].n);
+        right_token.assign(symbols[right].text, symbols[right].n);
 
         int rank_found = -1;
 
@@ -614,7 +707,6 @@ private:
 
         bigram.left  = left;
         bigram.right = right;
-        bigram.text  = left_token + right_token;
         bigram.size  = left_token.size() + right_token.size();
         bigram.rank  = rank_found;
 
@@ -625,8 +717,12 @@ private:
     const llm_tokenizer_bpe & tokenizer;
 
     std::vector<llm_symbol> symbols;
-    std::vector<llm_symbol> symbols_final;
     llm_bigram_bpe::queue work_queue;
+
+    // scratch buffers
+    std::string left_token;
+    std::string right_token;
+    std::string piece;
 };
 
 //
@@ -1619,7 +1715,8 @@ struct llama_vocab::impl {
     std::vector<llama_token> tokenize(
             const std::string & raw_text,
                          bool   add_special,
-                         bool   parse_special = false) const;
+                         bool   parse_special = false,
+                      int32_t   n_threads     = 1) const;
 
     int32_t tokenize(
                    const char * text,
@@ -2767,7 +2864,8 @@ static std::string llama_decode_text(const std::string & text) {
 std::vector<llama_token> llama_vocab::impl::tokenize(
         const std::string & raw_text,
         bool add_special,
-        bool parse_special) const {
+        bool parse_special,
+        int32_t n_threads) const {
     GGML_ASSERT(tokenizer && "Tokenizer not initialized. Call llama_vocab::init_tokenizer() first.");
 
     std::vector<llama_token> output;
@@ -2845,7 +2943,7 @@ std::vector<llama_token> llama_vocab::impl::tokenize(
 #ifdef PRETOKENIZERDEBUG
                         LLAMA_LOG_WARN("TT: (%ld %ld %ld) '%s'\n", text.length(), fragment.offset, fragment.length, text.c_str());
 #endif
-                        session.tokenize(text, output);
+                        session.tokenize(text, output, n_threads);
                     } else { // if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_TOKEN)
                         session.append(fragment.token, output);
                     }
@@ -3484,8 +3582,9 @@ int32_t llama_vocab::tokenize(
                  llama_token * tokens,
                      int32_t   n_tokens_max,
                         bool   add_special,
-                        bool   parse_special) const {
-    auto res = tokenize(std::string(text, text_len), add_special, parse_special);
+                        bool   parse_special,
+                     int32_t   n_threads) const {
+    auto res = tokenize(std::string(text, text_len), add_special, parse_special, n_threads);
     if (res.size() >= static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
         LLAMA_LOG_ERROR("%s: tokenization result size %zu exceeds int32_t limit\n", __func__, res.size());
         return std::numeric_limits<int32_t>::min();
@@ -3506,8 +3605,64 @@ int32_t llama_vocab::tokenize(
 std::vector<llama_token> llama_vocab::tokenize(
         const std::string & raw_text,
         bool add_special,
-        bool parse_special) const {
-    return pimpl->tokenize(raw_text, add_special, parse_special);
+        bool parse_special,
+        int32_t n_threads) const {
+    return pimpl->tokenize(raw_text, add_special, parse_special, n_threads);
+}
+
+int32_t llama_vocab::tokenize_batch(
+          const char * const * texts,
+               const int32_t * text_lens,
+                     int32_t   n_texts,
+                 llama_token * tokens,
+                     int32_t   n_tokens_max,
+                     int32_t * offsets,
+                        bool   add_special,
+                        bool   parse_special,
+                     int32_t   n_threads) const {
+    std::vector<std::vector<llama_token>> res(std::max(n_texts, 0));
+
+    // texts are picked dynamically, since their lengths can vary a lot
+    std::atomic<int32_t> next { 0 };
+
+    const auto worker = [&]() {
+        for (int32_t i = next++; i < n_texts; i = next++) {
+            res[i] = tokenize(std::string(texts[i], text_lens[i]), add_special, parse_special);
+        }
+    };
+
+    const int32_t n_workers = std::min(std::max(n_threads, 1), std::max(n_texts, 1));
+
+    std::vector<std::thread> workers;
+    workers.reserve(n_workers - 1);
+    for (int32_t i = 1; i < n_workers; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    size_t n_total = 0;
+    for (int32_t i = 0; i < n_texts; ++i) {
+        if (n_total + res[i].size() >= static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+            LLAMA_LOG_ERROR("%s: tokenization result size exceeds int32_t limit\n", __func__);
+            return std::numeric_limits<int32_t>::min();
+        }
+        offsets[i] = n_total;
+        n_total += res[i].size();
+    }
+    offsets[std::max(n_texts, 0)] = n_total;
+
+    if (n_tokens_max < (int) n_total) {
+        return -((int) n_total);
+    }
+
+    for (int32_t i = 0; i < n_texts; ++i) {
+        std::copy(res[i].begin(), res[i].end(), tokens + offsets[i]);
+    }
+
+    return n_total;
 }
 
 const std::string & llama_vocab::token_to_piece(llama_token token) const {
@@ -3770,6 +3925,32 @@ int32_t llama_tokenize(
     return vocab->tokenize(text, text_len, tokens, n_tokens_max, add_special, parse_special);
 }
 
+int32_t llama_tokenize_parallel(
+    const struct llama_vocab * vocab,
+                  const char * text,
+                     int32_t   text_len,
+                 llama_token * tokens,
+                     int32_t   n_tokens_max,
+                        bool   add_special,
+                        bool   parse_special,
+                     int32_t   n_threads) {
+    return vocab->tokenize(text, text_len, tokens, n_tokens_max, add_special, parse_special, n_threads);
+}
+
+int32_t llama_tokenize_batch(
+    const struct llama_vocab * vocab,
+          const char * const * texts,
+               const int32_t * text_lens,
+                     int32_t   n_texts,
+                 llama_token * tokens,
+                     int32_t   n_tokens_max,
+                     int32_t * offsets,
+                        bool   add_special,
+                        bool   parse_special,
+                     int32_t   n_threads) {
+    return vocab->tokenize_batch(texts, text_lens, n_texts, tokens, n_tokens_max, offsets, add_special, parse_special, n_threads);
+}
+
 int32_t llama_token_to_piece(
     const struct llama_vocab * vocab,
                  llama_token   token,
@@ -138,12 +138,25 @@ struct llama_vocab {
                   llama_token * tokens,
                       int32_t   n_tokens_max,
                          bool   add_special,
-                         bool   parse_special) const;
+                         bool   parse_special,
+                      int32_t   n_threads = 1) const;
 
     std::vector<llama_token> tokenize(
             const std::string & raw_text,
                          bool   add_special,
-                         bool   parse_special = false) const;
+                         bool   parse_special = false,
+                      int32_t   n_threads     = 1) const;
+
+    int32_t tokenize_batch(
+            const char * const * texts,
+                 const int32_t * text_lens,
+                       int32_t   n_texts,
+                   llama_token * tokens,
+                       int32_t   n_tokens_max,
+                       int32_t * offsets,
+                          bool   add_special,
+                          bool   parse_special,
+                       int32_t   n_threads) const;
 
     // does not write null-terminator to buf
     int32_t token_to_piece(
@@ -10,6 +10,7 @@
 #include <codecvt>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <locale>
 #include <map>
 #include <regex>
@@ -798,6 +799,18 @@ std::vector<uint32_t> unicode_cpts_from_utf8(const std::string & utf8) {
     result.reserve(utf8.size());
     size_t offset = 0;
     while (offset < utf8.size()) {
+        // fast path: 8 bytes at a time while the input is plain ASCII
+        if (offset + 8 <= utf8.size()) {
+            uint64_t chunk;
+            memcpy(&chunk, utf8.data() + offset, sizeof(chunk));
+            if ((chunk & 0x8080808080808080ULL) == 0) {
+                for (size_t i = 0; i < 8; ++i) {
+                    result.push_back((uint8_t) utf8[offset + i]);
+                }
+                offset += 8;
+                continue;
+            }
+        }
         try {
             result.push_back(unicode_cpt_from_utf8(utf8, offset));
         }
@@ -0,0 +1,324 @@
+// Tests the offline planner of ggml-gallocr (GGML_ALLOC_PLANNER=1) against the dynamic allocator.
+//
+// Random graphs with tensors of very different sizes are allocated with and without the planner. With the planner,
+// the tensors whose lifetimes overlap must not overlap in memory, the buffer must not be larger than the one of the
+// dynamic allocator, and the outputs must be the same.
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+
+static void set_planner(bool enabled) {
+    // the planner is enabled when the allocator is created
+#ifdef _WIN32
+    _putenv_s("GGML_ALLOC_PLANNER", enabled ? "1" : "0");
+#else
+    setenv("GGML_ALLOC_PLANNER", enabled ? "1" : "0", 1);
+#endif
+}
+
+struct planner_graph {
+    ggml_context * ctx = nullptr;
+    ggml_cgraph  * gf  = nullptr;
+    ggml_gallocr_t galloc = nullptr;
+
+    std::vector<ggml_tensor *> inputs;
+    std::vector<ggml_tensor *> outputs;
+
+    ~planner_graph() {
+        ggml_gallocr_free(galloc);
+        ggml_free(ctx);
+    }
+};
+
+// a random chain of projections, element-wise ops and views, the element-wise ops are computed in place by gallocr
+// when their input has no other use
+// the widths of the activations vary from 16 to 2048, so the large short-lived tensors leave holes in the buffer
+static void build_graph(planner_graph & g, int seed, int64_t n_tokens) {
+    ggml_init_params params = {
+        /* .mem_size   = */ ggml_tensor_overhead()*1024 + ggml_graph_overhead(),
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ true,
+    };
+
+    g.ctx = ggml_init(params);
+
+    std::mt19937 rng(seed);
+
+    const int64_t widths[] = { 16, 64, 256, 2048 };
+
+    auto rand_int = [&](int n) {
+        return (int) (rng() % n);
+    };
+
+    auto new_input = [&](int64_t ne0, int64_t ne1) {
+        ggml_tensor * t = ggml_new_tensor_2d(g.ctx, GGML_TYPE_F32, ne0, ne1);
+        ggml_set_input(t);
+        g.inputs.push_back(t);
+        return t;
+    };
+
+    // live activations [width, n_tokens]
+    std::vector<ggml_tensor *> pool = { new_input(64, n_tokens) };
+
+    g.gf = ggml_new_graph(g.ctx);
+
+    for (int i = 0; i < 48; ++i) {
+        ggml_tensor * a = pool[rand_int(pool.size())];
+        ggml_tensor * cur = nullptr;
+
+        switch (rand_int(6)) {
+            case 0:
+            case 1:
+                {
+                    const int64_t n_out = widths[rand_int(4)];
+                    cur = ggml_mul_mat(g.ctx, new_input(a->ne[0], n_out), a);
+                } break;
+            case 2:
+                {
+                    // another activation of the same width, or the input itself
+                    ggml_tensor * b = a;
+                    for (ggml_tensor * t : pool) {
+                        if (t != a && t->ne[0] == a->ne[0] && rand_int(2)) {
+                            b = t;
+                        }
+                    }
+                    cur = ggml_add(g.ctx, a, b);
+                } break;
+            case 3:
+                {
+                    cur = ggml_rms_norm(g.ctx, a, 1e-5f);
+                    cur = ggml_tanh(g.ctx, cur);
+                } break;
+            case 4:
+                {
+                    cur = ggml_scale(g.ctx, a, 0.5f);
+                } break;
+            case 5:
+                {
+                    // the second half of the rows
+                    cur = ggml_view_2d(g.ctx, a, a->ne[0]/2, a->ne[1], a->nb[1], (a->ne[0]/2)*ggml_element_size(a));
+                    cur = ggml_cont(g.ctx, cur);
+                } break;
+        }
+
+        // keep some activations alive until the end of the graph
+        if (rand_int(8) == 0) {
+            ggml_set_output(cur);
+            g.outputs.push_back(cur);
+            ggml_build_forward_expand(g.gf, cur);
+        }
+
+        // the older activations are used less and less
+        if (pool.size() >= 4) {
+            pool.erase(pool.begin() + rand_int(pool.size()));
+        }
+        pool.push_back(cur);
+    }
+
+    for (ggml_tensor * t : pool) {
+        ggml_set_output(t);
+        g.outputs.push_back(t);
+        ggml_build_forward_expand(g.gf, t);
+    }
+
+    for (size_t i = 0; i < g.inputs.size(); ++i) {
+        ggml_format_name(g.inputs[i], "input_%d", (int) i);
+    }
+
+    g.galloc = ggml_gallocr_new(ggml_backend_cpu_buffer_type());
+    if (!ggml_gallocr_alloc_graph(g.galloc, g.gf)) {
+        fprintf(stderr, "failed to allocate the graph\n");
+        exit(1);
+    }
+}
+
+// returns the number of pairs of tensors with overlapping lifetimes that overlap in memory
+static int check_overlap(const planner_graph & g) {
+    struct lifetime {
+        int start;
+        int end;
+    };
+
+    // in steps of the graph: -1 are the inputs, i is the node i, n_nodes is after the last node
+    const int n_nodes = ggml_graph_n_nodes(g.gf);
+
+    std::map<ggml_tensor *, lifetime> lt;
+
+    for (int i = 0; i < n_nodes; ++i) {
+        ggml_tensor * node = ggml_graph_node(g.gf, i);
+        if (node->view_src == nullptr) {
+            lt[node] = { i, i };
+        }
+
+        // a view keeps its source alive
+        for (int j = 0; j < GGML_MAX_SRC; ++j) {
+            ggml_tensor * src = node->src[j];
+            if (src == nullptr) {
+                continue;
+            }
+            if (src->view_src) {
+                src = src->view_src;
+            }
+            if (src->flags & GGML_TENSOR_FLAG_INPUT && !lt.count(src)) {
+                lt[src] = { -1, i };
+            }
+            lt[src].end = i;
+        }
+    }
+
+    for (ggml_tensor * t : g.outputs) {
+        lt[t->view_src ? t->view_src : t].end = n_nodes;
+    }
+
+    // the source of a node computed in place shares its memory with the node, its lifetime ends when the node starts
+    auto is_inplace = [&](ggml_tensor * a, ggml_tensor * b) {
+        if (a->data != b->data || lt[a].end != lt[b].start) {
+            return false;
+        }
+        for (int j = 0; j < GGML_MAX_SRC; ++j) {
+            ggml_tensor * src = b->src[j];
+            if (src && (src == a || src->view_src == a)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    std::vector<ggml_tensor *> tensors;
+    for (const auto & it : lt) {
+        tensors.push_back(it.first);
+    }
+
+    int n_fail = 0;
+
+    for (size_t i = 0; i < tensors.size(); ++i) {
+        for (size_t j = i + 1; j < tensors.size(); ++j) {
+            ggml_tensor * a = tensors[i];
+            ggml_tensor * b = tensors[j];
+
+            const lifetime la = lt[a];
+            const lifetime lb = lt[b];
+
+            if (la.end < lb.start || lb.end < la.start) {
+                continue;
+            }
+
+            const char * a0 = (const char *) a->data;
+            const char * b0 = (const char *) b->data;
+
+            if (a0 + ggml_nbytes(a) <= b0 || b0 + ggml_nbytes(b) <= a0) {
+                continue;
+            }
+
+            if (is_inplace(a, b) || is_inplace(b, a)) {
+                continue;
+            }
+
+            fprintf(stderr, "FAIL: %s [%d, %d] and %s [%d, %d] overlap in memory\n",
+                    ggml_get_name(a), la.start, la.end, ggml_get_name(b), lb.start, lb.end);
+            n_fail++;
+        }
+    }
+
+    return n_fail;
+}
+
+static std::vector<std::vector<float>> compute(ggml_backend_t backend, const planner_graph & g, int seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    for (ggml_tensor * t : g.inputs) {
+        // the inputs of the activations that are not used are not in the graph
+        if (t->buffer == nullptr) {
+            continue;
+        }
+        std::vector<float> v(ggml_nelements(t));
+        for (auto & x : v) {
+            x = dist(rng);
+        }
+        ggml_backend_tensor_set(t, v.data(), 0, ggml_nbytes(t));
+    }
+
+    if (ggml_backend_graph_compute(backend, g.gf) != GGML_STATUS_SUCCESS) {
+        fprintf(stderr, "failed to compute the graph\n");
+        exit(1);
+    }
+
+    std::vector<std::vector<float>> res;
+    for (ggml_tensor * t : g.outputs) {
+        res.emplace_back(ggml_nelements(t));
+        ggml_backend_tensor_get(t, res.back().data(), 0, ggml_nbytes(t));
+    }
+
+    return res;
+}
+
+int main(void) {
+    ggml_backend_t backend = ggml_backend_cpu_init();
+
+    int n_fail = 0;
+
+    // number of graphs that need less memory with the planner
+    int n_smaller = 0;
+
+    for (int seed = 0; seed < 32; ++seed) {
+        for (int64_t n_tokens : { 1, 7 }) {
+            planner_graph ref;
+            set_planner(false);
+            build_graph(ref, seed, n_tokens);
+
+            planner_graph res;
+            set_planner(true);
+            build_graph(res, seed, n_tokens);
+
+            const size_t size_ref = ggml_gallocr_get_buffer_size(ref.galloc, 0);
+            const size_t size_res = ggml_gallocr_get_buffer_size(res.galloc, 0);
+
+            if (size_res > size_ref) {
+                fprintf(stderr, "FAIL: seed = %d, n_tokens = %d, planner %zu bytes > dynamic allocator %zu bytes\n",
+                        seed, (int) n_tokens, size_res, size_ref);
+                n_fail++;
+            }
+            n_smaller += size_res < size_ref;
+
+            const int n_overlap = check_overlap(res);
+            if (n_overlap > 0) {
+                fprintf(stderr, "FAIL: seed = %d, n_tokens = %d, %d tensors overlap\n", seed, (int) n_tokens, n_overlap);
+                n_fail++;
+            }
+
+            if (compute(backend, res, seed) != compute(backend, ref, seed)) {
+                fprintf(stderr, "FAIL: seed = %d, n_tokens = %d, outputs differ from the dynamic allocator\n", seed, (int) n_tokens);
+                n_fail++;
+            }
+        }
+    }
+
+    set_planner(false);
+
+    ggml_backend_free(backend);
+
+    // otherwise the planned offsets were never used
+    if (n_smaller == 0) {
+        fprintf(stderr, "FAIL: the planner never needed less memory than the dynamic allocator\n");
+        n_fail++;
+    }
+
+    if (n_fail > 0) {
+        fprintf(stderr, "%d tests failed\n", n_fail);
+        return 1;
+    }
+
+    printf("OK (%d graphs smaller with the planner)\n", n_smaller);
+    return 0;
+}
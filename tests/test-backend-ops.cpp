@@ -4874,8 +4874,10 @@ struct test_flash_attn_ext : public test_case {
     const ggml_type type_KV;
     std::array<int32_t, 4> permute;
 
+    const bool mask_blk; // mask with fully masked and all-zero KV blocks, and its block summary
+
     std::string vars() override {
-        return VARS_TO_STR13(hsk, hsv, nh, nr23, kv, nb, mask, sinks, max_bias, logit_softcap, prec, type_KV, permute);
+        return VARS_TO_STR14(hsk, hsv, nh, nr23, kv, nb, mask, sinks, max_bias, logit_softcap, prec, type_KV, permute, mask_blk);
     }
 
     double max_nmse_err() override {
@@ -4891,8 +4893,9 @@ struct test_flash_attn_ext : public test_case {
 
     test_flash_attn_ext(int64_t hsk = 128, int64_t hsv = 128, int64_t nh = 32, std::array<int64_t, 2> nr23 = {1, 1}, int64_t kv = 96, int64_t nb = 8,
                         bool mask = true, bool sinks = false, float max_bias = 0.0f, float logit_softcap = 0.0f, ggml_prec prec = GGML_PREC_F32,
-                        ggml_type type_KV = GGML_TYPE_F16, std::array<int32_t, 4> permute = {0, 1, 2, 3})
-        : hsk(hsk), hsv(hsv), nh(nh), nr23(nr23), kv(kv), nb(nb), mask(mask), sinks(sinks), max_bias(max_bias), logit_softcap(logit_softcap), prec(prec), type_KV(type_KV), permute(permute) {}
+                        ggml_type type_KV = GGML_TYPE_F16, std::array<int32_t, 4> permute = {0, 1, 2, 3}, bool mask_blk = false)
+        : hsk(hsk), hsv(hsv), nh(nh), nr23(nr23), kv(kv), nb(nb), mask(mask), sinks(sinks), max_bias(max_bias), logit_softcap(logit_softcap), prec(prec), type_KV(type_KV), permute(permute),
+          mask_blk(mask_blk) {}
 
     ggml_tensor * build_graph(ggml_context * ctx) override {
         const int64_t hsk_padded = GGML_PAD(hsk, ggml_blck_size(type_KV));
@@ -4938,17 +4941,71 @@ struct test_flash_attn_ext : public test_case {
             ggml_set_name(s, "s");
         }
 
+        ggml_tensor * blk = nullptr;
+        if (mask_blk) {
+            GGML_ASSERT(mask);
+            blk = ggml_new_tensor_4d(ctx, GGML_TYPE_I8, (kv + GGML_KQ_MASK_BLK - 1)/GGML_KQ_MASK_BLK, m->ne[1], m->ne[2], m->ne[3]);
+            ggml_set_name(blk, "blk");
+        }
+
         ggml_tensor * out = ggml_flash_attn_ext(ctx, q, k, v, m, 1.0f/sqrtf(hsk), max_bias, logit_softcap);
-        ggml_flash_attn_ext_add_sinks(out, s);
-        ggml_flash_attn_ext_set_prec (out, prec);
+        ggml_flash_attn_ext_add_sinks   (out, s);
+        ggml_flash_attn_ext_add_mask_blk(out, blk);
+        ggml_flash_attn_ext_set_prec    (out, prec);
         ggml_set_name(out, "out");
 
         return out;
     }
 
+    // mask with fully masked (-INF) and all-zero KV blocks, the first block of each row is never fully masked
+    // a block is masked for all the rows (b % 4 == 1) or for some of them ((b + r) % 5 == 0)
+    void initialize_mask_blk(ggml_tensor * m, ggml_tensor * blk) {
+        const int64_t n_blk = blk->ne[0];
+        const int64_t nrows = ggml_nrows(m);
+
+        std::vector<float>       data(ggml_nelements(m));
+        std::vector<ggml_fp16_t> data_f16(ggml_nelements(m));
+        std::vector<int8_t>      data_blk(ggml_nelements(blk));
+
+        std::default_random_engine rng(42);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+        for (int64_t r = 0; r < nrows; ++r) {
+            for (int64_t b = 0; b < n_blk; ++b) {
+                int8_t type = GGML_KQ_MASK_BLK_MIXED;
+                if (b > 0 && (b % 4 == 1 || (b + r) % 5 == 0)) {
+                    type = GGML_KQ_MASK_BLK_MASKED;
+                } else if (b % 4 == 2) {
+                    type = GGML_KQ_MASK_BLK_ZERO;
+                }
+
+                for (int64_t i = b*GGML_KQ_MASK_BLK; i < std::min<int64_t>((b + 1)*GGML_KQ_MASK_BLK, kv); ++i) {
+                    float & x = data[r*kv + i];
+                    switch (type) {
+                        case GGML_KQ_MASK_BLK_MASKED: x = -INFINITY; break;
+                        case GGML_KQ_MASK_BLK_ZERO:   x = 0.0f;      break;
+                        default:                      x = dist(rng); break;
+                    }
+                }
+
+                data_blk[r*n_blk + b] = type;
+            }
+        }
+
+        ggml_fp32_to_fp16_row(data.data(), data_f16.data(), data.size());
+
+        ggml_backend_tensor_set(m,   data_f16.data(), 0, ggml_nbytes(m));
+        ggml_backend_tensor_set(blk, data_blk.data(), 0, ggml_nbytes(blk));
+    }
+
     void initialize_tensors(ggml_context * ctx) override {
         for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != NULL; t = ggml_get_next_tensor(ctx, t)) {
-            if (strcmp(t->name, "s") == 0) {
+            if (strcmp(t->name, "blk") == 0) {
+                continue; // set with the mask
+            }
+            if (strcmp(t->name, "m") == 0 && mask_blk) {
+                initialize_mask_blk(t, ggml_get_tensor(ctx, "blk"));
+            } else if (strcmp(t->name, "s") == 0) {
                 // make the sink values more noticable in order to trigger a test failure when the implementation is wrong
                 init_tensor_uniform(t, -10.0f, 10.0f);
             } else {
@@ -6159,6 +6216,13 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
             test_cases.emplace_back(new test_mul_mat(type_a, type_b, 16, 1, 256, {1,  1}, {1, 1}));
         }
     }
+    // K-quant tiles of the CPU sgemm (up to 2 rows x 4 columns), odd sizes for the edge tiles
+    for (ggml_type type_a : {GGML_TYPE_Q4_K, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K, GGML_TYPE_IQ4_XS}) {
+        for (int n : {2, 3, 5, 8}) {
+            test_cases.emplace_back(new test_mul_mat(type_a, GGML_TYPE_F32, 15, n, 1024, {1,  1}, {1, 1}));
+            test_cases.emplace_back(new test_mul_mat(type_a, GGML_TYPE_F32, 16, n,  512, {3,  2}, {1, 1}));
+        }
+    }
 #else
     // m = a rows
     // n = b rows
@@ -6503,6 +6567,35 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
         }
     }
 
+    // CPU tiled flash attention
+    // decode with few heads and a long KV sequence: the KV sequence is split between the threads
+    for (int kv : { 1000, 4096, }) {
+        for (int nr2 : { 1, 4, }) {
+            for (ggml_type type_KV : {GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0}) {
+                test_cases.emplace_back(new test_flash_attn_ext(128, 128, 1, {nr2, 1}, kv, 1, true, false, 0.0f, 0.0f, GGML_PREC_F32, type_KV));
+            }
+            test_cases.emplace_back(new test_flash_attn_ext(128, 128, 1, {nr2, 1}, kv, 1, true, true,  0.0f, 0.0f, GGML_PREC_F32, GGML_TYPE_F16));
+        }
+    }
+    // GQA ratios that do not divide the query tile, a KV length that is not a multiple of the KV tile,
+    // and a ratio larger than the query tile
+    for (int nr2 : { 3, 6, 12, 40, }) {
+        for (int nb : { 1, 7, 33, }) {
+            test_cases.emplace_back(new test_flash_attn_ext(64, 64, 2, {nr2, 1}, 100, nb, true, false, 0.0f, 0.0f, GGML_PREC_F32, GGML_TYPE_F16));
+            test_cases.emplace_back(new test_flash_attn_ext(64, 64, 2, {nr2, 1}, 100, nb, true, false, 8.0f, 0.0f, GGML_PREC_F32, GGML_TYPE_Q8_0));
+        }
+    }
+    // fully masked KV blocks, skipped with the block summary of the mask
+    for (int kv : { 512, 300, }) {
+        for (int nr2 : { 1, 4, }) {
+            for (int nb : { 1, 8, 35, }) {
+                for (ggml_type type_KV : {GGML_TYPE_F16, GGML_TYPE_Q4_0}) {
+                    test_cases.emplace_back(new test_flash_attn_ext(128, 128, 4, {nr2, 1}, kv, nb, true, false, 0.0f, 0.0f, GGML_PREC_F32, type_KV, {0, 1, 2, 3}, true));
+                }
+            }
+        }
+    }
+
     test_cases.emplace_back(new test_cross_entropy_loss     (GGML_TYPE_F32, {   10, 5, 4, 3}));
     test_cases.emplace_back(new test_cross_entropy_loss     (GGML_TYPE_F32, {30000, 1, 1, 1}));
     test_cases.emplace_back(new test_cross_entropy_loss_back(GGML_TYPE_F32, {   10, 5, 4, 3}));
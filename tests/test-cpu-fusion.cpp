@@ -0,0 +1,178 @@
+// Tests the node fusion of the CPU backend against the same graph computed without fusion.
+//
+// The graphs are allocated with ggml-gallocr, which computes RMS_NORM and MUL in place on their input
+// when it has no other use (e.g. the output norm before lm_head). The fused graphs are also computed
+// while tuning the matmuls (GGML_CPU_TUNE=tune).
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+struct fusion_graph {
+    ggml_context * ctx = nullptr;
+    ggml_cgraph  * gf  = nullptr;
+    ggml_gallocr_t galloc = nullptr;
+
+    ggml_tensor * a   = nullptr;
+    ggml_tensor * b   = nullptr;
+    ggml_tensor * w   = nullptr;
+    ggml_tensor * wmm = nullptr;
+    ggml_tensor * out = nullptr;
+
+    ~fusion_graph() {
+        ggml_gallocr_free(galloc);
+        ggml_free(ctx);
+    }
+};
+
+// out = mul_mat(wmm, rms_norm(a + b) * w)
+// fused: the nodes are only used by the next one, so RMS_NORM -> MUL -> MUL_MAT is fused
+// not fused: the result of MUL is also an output of the graph
+static void build_graph(fusion_graph & g, ggml_backend_t backend, ggml_type type, int64_t n_embd, int64_t n_out, int64_t n_tokens, bool fused) {
+    ggml_init_params params = {
+        /* .mem_size   = */ ggml_tensor_overhead()*16 + ggml_graph_overhead(),
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ true,
+    };
+
+    g.ctx = ggml_init(params);
+
+    g.a   = ggml_new_tensor_2d(g.ctx, GGML_TYPE_F32, n_embd, n_tokens);
+    g.b   = ggml_new_tensor_2d(g.ctx, GGML_TYPE_F32, n_embd, n_tokens);
+    g.w   = ggml_new_tensor_1d(g.ctx, GGML_TYPE_F32, n_embd);
+    g.wmm = ggml_new_tensor_2d(g.ctx, type, n_embd, n_out);
+
+    ggml_set_input(g.a);
+    ggml_set_input(g.b);
+    ggml_set_input(g.w);
+    ggml_set_input(g.wmm);
+
+    ggml_tensor * x = ggml_add(g.ctx, g.a, g.b);
+    ggml_tensor * cur = ggml_rms_norm(g.ctx, x, 1e-5f);
+    cur = ggml_mul(g.ctx, cur, g.w);
+
+    g.gf = ggml_new_graph(g.ctx);
+
+    if (!fused) {
+        ggml_set_output(cur);
+        ggml_build_forward_expand(g.gf, cur);
+    }
+
+    g.out = ggml_mul_mat(g.ctx, g.wmm, cur);
+    ggml_set_output(g.out);
+
+    ggml_build_forward_expand(g.gf, g.out);
+
+    g.galloc = ggml_gallocr_new(ggml_backend_get_default_buffer_type(backend));
+    if (!ggml_gallocr_alloc_graph(g.galloc, g.gf)) {
+        fprintf(stderr, "failed to allocate the graph\n");
+        exit(1);
+    }
+}
+
+static std::vector<float> compute(ggml_backend_t backend, ggml_type type, int64_t n_embd, int64_t n_out, int64_t n_tokens, bool fused) {
+    fusion_graph g;
+    build_graph(g, backend, type, n_embd, n_out, n_tokens, fused);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    auto rand_vec = [&](size_t n) {
+        std::vector<float> v(n);
+        for (auto & x : v) {
+            x = dist(rng);
+        }
+        return v;
+    };
+
+    const auto a   = rand_vec(ggml_nelements(g.a));
+    const auto b   = rand_vec(ggml_nelements(g.b));
+    const auto w   = rand_vec(ggml_nelements(g.w));
+    const auto wmm = rand_vec(ggml_nelements(g.wmm));
+
+    std::vector<uint8_t> wmm_q(ggml_nbytes(g.wmm));
+    ggml_quantize_chunk(type, wmm.data(), wmm_q.data(), 0, n_out, n_embd, nullptr);
+
+    ggml_backend_tensor_set(g.a,   a.data(),     0, ggml_nbytes(g.a));
+    ggml_backend_tensor_set(g.b,   b.data(),     0, ggml_nbytes(g.b));
+    ggml_backend_tensor_set(g.w,   w.data(),     0, ggml_nbytes(g.w));
+    ggml_backend_tensor_set(g.wmm, wmm_q.data(), 0, ggml_nbytes(g.wmm));
+
+    if (ggml_backend_graph_compute(backend, g.gf) != GGML_STATUS_SUCCESS) {
+        fprintf(stderr, "failed to compute the graph\n");
+        exit(1);
+    }
+
+    std::vector<float> res(ggml_nelements(g.out));
+    ggml_backend_tensor_get(g.out, res.data(), 0, ggml_nbytes(g.out));
+
+    return res;
+}
+
+static double nmse(const std::vector<float> & a, const std::vector<float> & b) {
+    double err = 0.0;
+    double ref = 0.0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        err += (a[i] - b[i])*(a[i] - b[i]);
+        ref += b[i]*b[i];
+    }
+    return err/ref;
+}
+
+int main(void) {
+    ggml_backend_t backend = ggml_backend_cpu_init();
+
+    int n_fail = 0;
+
+    for (ggml_type type : { GGML_TYPE_Q4_0, GGML_TYPE_Q8_0, GGML_TYPE_F16 }) {
+        for (int n_threads : { 1, 3, 8 }) {
+            // a single row (decode) is split across the threads
+            for (int64_t n_tokens : { 1, 2, 16 }) {
+                ggml_backend_cpu_set_n_threads(backend, n_threads);
+
+                const auto ref = compute(backend, type, 4096, 64, n_tokens, false);
+
+                for (int rep = 0; rep < 4; ++rep) {
+                    const auto res = compute(backend, type, 4096, 64, n_tokens, true);
+                    const double err = nmse(res, ref);
+
+                    if (!(err < 1e-6)) {
+                        fprintf(stderr, "FAIL: type = %s, n_threads = %d, n_tokens = %d, nmse = %g\n",
+                                ggml_type_name(type), n_threads, (int) n_tokens, err);
+                        n_fail++;
+                        break;
+                    }
+                }
+
+                // the tuning runs each candidate several times, the fused rows must not be recomputed from their own output
+                ggml_cpu_tune_set_mode(GGML_CPU_TUNE_MODE_TUNE);
+                const auto res = compute(backend, type, 4096, 64, n_tokens, true);
+                ggml_cpu_tune_set_mode(GGML_CPU_TUNE_MODE_OFF);
+
+                const double err = nmse(res, ref);
+                if (!(err < 1e-6)) {
+                    fprintf(stderr, "FAIL: tune, type = %s, n_threads = %d, n_tokens = %d, nmse = %g\n",
+                            ggml_type_name(type), n_threads, (int) n_tokens, err);
+                    n_fail++;
+                }
+            }
+        }
+    }
+
+    ggml_backend_free(backend);
+
+    if (n_fail > 0) {
+        fprintf(stderr, "%d tests failed\n", n_fail);
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
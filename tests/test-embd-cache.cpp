@@ -0,0 +1,177 @@
+//  Tests common_embd_cache (LRU eviction, reload from the file, recovery of a truncated file).
+
+#include "embd-cache.h"
+#include "llama.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+template <class T> static void assert_equals(const T & expected, const T & actual) {
+    if (expected != actual) {
+        std::cerr << "Expected: " << expected << std::endl;
+        std::cerr << "  Actual: " << actual << std::endl;
+        std::cerr << std::flush;
+        throw std::runtime_error("Test failed");
+    }
+}
+
+static std::vector<float> make_embd(int i, size_t n) {
+    std::vector<float> res(n);
+    for (size_t j = 0; j < n; ++j) {
+        res[j] = 0.5f*i + 0.25f*j;
+    }
+    return res;
+}
+
+static uint64_t make_key(const common_embd_cache & cache, int i) {
+    return cache.key({ 1, 2, i }, 2, COMMON_EMBD_CACHE_EMBD);
+}
+
+static void assert_get(common_embd_cache & cache, int i, size_t n) {
+    std::vector<float> res;
+    assert_equals(true, cache.get(make_key(cache, i), res));
+    assert_equals(true, res == make_embd(i, n));
+}
+
+static void assert_miss(common_embd_cache & cache, int i) {
+    std::vector<float> res;
+    assert_equals(false, cache.get(make_key(cache, i), res));
+}
+
+static void test_key(const llama_model * model) {
+    common_embd_cache cache(model, LLAMA_POOLING_TYPE_MEAN, 4);
+    common_embd_cache cache_cls(model, LLAMA_POOLING_TYPE_CLS, 4);
+
+    const std::vector<llama_token> tokens = { 1, 2, 3 };
+
+    assert_equals(cache.key(tokens, 2, COMMON_EMBD_CACHE_EMBD), cache.key(tokens, 2, COMMON_EMBD_CACHE_EMBD));
+
+    assert_equals(false, cache.key(tokens, 2, COMMON_EMBD_CACHE_EMBD) == cache.key(tokens, 2, COMMON_EMBD_CACHE_RERANK));
+    assert_equals(false, cache.key(tokens, 2, COMMON_EMBD_CACHE_EMBD) == cache.key(tokens, -1, COMMON_EMBD_CACHE_EMBD));
+    assert_equals(false, cache.key(tokens, 2, COMMON_EMBD_CACHE_EMBD) == cache.key({ 1, 2 }, 2, COMMON_EMBD_CACHE_EMBD));
+    assert_equals(false, cache.key(tokens, 2, COMMON_EMBD_CACHE_EMBD) == cache_cls.key(tokens, 2, COMMON_EMBD_CACHE_EMBD));
+}
+
+static void test_lru(const llama_model * model) {
+    const size_t n = 8;
+
+    common_embd_cache cache(model, LLAMA_POOLING_TYPE_MEAN, 2);
+
+    for (int i = 0; i < 2; ++i) {
+        const auto embd = make_embd(i, n);
+        cache.put(make_key(cache, i), embd.data(), embd.size());
+    }
+
+    // 0 becomes the most recently used, 1 is evicted
+    assert_get(cache, 0, n);
+
+    const auto embd = make_embd(2, n);
+    cache.put(make_key(cache, 2), embd.data(), embd.size());
+
+    assert_equals<size_t>(2, cache.n_entries());
+    assert_equals(false, cache.contains(make_key(cache, 1)));
+
+    assert_miss(cache, 1);
+    assert_get (cache, 0, n);
+    assert_get (cache, 2, n);
+
+    assert_equals<uint64_t>(3, cache.n_hit);
+    assert_equals<uint64_t>(1, cache.n_miss);
+}
+
+static void test_file(const llama_model * model, const std::string & fname) {
+    const size_t n = 16;
+
+    std::filesystem::remove(fname);
+
+    {
+        // a single result in memory, the others are only in the file
+        common_embd_cache cache(model, LLAMA_POOLING_TYPE_MEAN, 1, fname);
+
+        for (int i = 0; i < 3; ++i) {
+            const auto embd = make_embd(i, n);
+            cache.put(make_key(cache, i), embd.data(), embd.size());
+        }
+
+        assert_equals<size_t>(3, cache.n_entries());
+        assert_get(cache, 0, n);
+
+        // the file is locked while it is used
+        common_embd_cache cache_other(model, LLAMA_POOLING_TYPE_MEAN, 1, fname);
+        assert_equals<size_t>(0, cache_other.n_entries());
+    }
+
+    {
+        common_embd_cache cache(model, LLAMA_POOLING_TYPE_MEAN, 1, fname);
+
+        assert_equals<size_t>(3, cache.n_entries());
+        for (int i = 0; i < 3; ++i) {
+            assert_get(cache, i, n);
+        }
+
+        // the results of another pooling type are not mixed up
+        common_embd_cache cache_cls(model, LLAMA_POOLING_TYPE_CLS, 1);
+        assert_equals(false, cache.contains(make_key(cache_cls, 0)));
+    }
+
+    // the process was killed while writing the last record
+    std::filesystem::resize_file(fname, std::filesystem::file_size(fname) - 5);
+
+    {
+        common_embd_cache cache(model, LLAMA_POOLING_TYPE_MEAN, 1, fname);
+
+        assert_equals<size_t>(2, cache.n_entries());
+        assert_get (cache, 0, n);
+        assert_get (cache, 1, n);
+        assert_miss(cache, 2);
+
+        // a shorter record is written where the incomplete one was
+        const auto embd = make_embd(3, n/2);
+        cache.put(make_key(cache, 3), embd.data(), embd.size());
+    }
+
+    {
+        common_embd_cache cache(model, LLAMA_POOLING_TYPE_MEAN, 1, fname);
+
+        assert_equals<size_t>(3, cache.n_entries());
+        assert_get (cache, 0, n);
+        assert_get (cache, 1, n);
+        assert_get (cache, 3, n/2);
+        assert_miss(cache, 2);
+    }
+
+    std::filesystem::remove(fname);
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <vocab-file>\n", argv[0]);
+        return 1;
+    }
+
+    llama_backend_init();
+
+    auto mparams = llama_model_default_params();
+    mparams.vocab_only = true;
+
+    llama_model * model = llama_model_load_from_file(argv[1], mparams);
+    if (model == NULL) {
+        fprintf(stderr, "%s: error: failed to load vocab '%s'\n", __func__, argv[1]);
+        return 1;
+    }
+
+    const std::string fname = (std::filesystem::temp_directory_path() / "test-embd-cache.bin").string();
+
+    test_key(model);
+    test_lru(model);
+    test_file(model, fname);
+
+    llama_model_free(model);
+    llama_backend_free();
+
+    return 0;
+}
@@ -252,6 +252,61 @@ int main(int argc, char **argv) {
         threads[i].join();
     }
 
+    // chunked tokenization of a large input must match the serial result
+    if (!k_tests.empty()) {
+        std::string text;
+        while (text.size() < 256*1024) {
+            for (const auto & test_kv : k_tests) {
+                text += test_kv.first;
+                text += "\n";
+            }
+        }
+
+        const llama_vocab * vocab = llama_model_get_vocab(model);
+
+        std::vector<llama_token> res_serial  (text.size() + 2);
+        std::vector<llama_token> res_parallel(text.size() + 2);
+
+        const int n_serial   = llama_tokenize         (vocab, text.data(), text.size(), res_serial.data(),   res_serial.size(),   add_special, false);
+        const int n_parallel = llama_tokenize_parallel(vocab, text.data(), text.size(), res_parallel.data(), res_parallel.size(), add_special, false, 4);
+
+        res_serial.resize  (std::max(n_serial,   0));
+        res_parallel.resize(std::max(n_parallel, 0));
+
+        if (n_serial < 0 || res_serial != res_parallel) {
+            fprintf(stderr, "%s : failed test: parallel tokenization (%d tokens) differs from serial (%d tokens)\n", __func__, n_parallel, n_serial);
+            success = false;
+        }
+    }
+
+    // batched tokenization of all tests at once
+    if (!k_tests.empty()) {
+        std::vector<const char *> texts;
+        std::vector<int32_t>      text_lens;
+        size_t n_tokens_max = 0;
+        for (const auto & test_kv : k_tests) {
+            texts.push_back(test_kv.first.data());
+            text_lens.push_back(test_kv.first.size());
+            n_tokens_max += test_kv.first.size() + 2;
+        }
+
+        std::vector<llama_token> tokens(n_tokens_max);
+        std::vector<int32_t>     offsets(k_tests.size() + 1);
+
+        const int n_tokens = llama_tokenize_batch(llama_model_get_vocab(model), texts.data(), text_lens.data(), texts.size(),
+                tokens.data(), tokens.size(), offsets.data(), add_special, false, nthread);
+
+        size_t i = 0;
+        for (const auto & test_kv : k_tests) {
+            const std::vector<llama_token> res(tokens.begin() + offsets[i], tokens.begin() + offsets[i + 1]);
+            if (n_tokens < 0 || res != test_kv.second) {
+                fprintf(stderr, "%s : failed test: batched tokenization of '%s'\n", __func__, test_kv.first.c_str());
+                success = false;
+            }
+            i++;
+        }
+    }
+
     // single threaded tokenization
     if (!fname_text.empty()) {
         fprintf(stderr, "%s : tokenizing: '%s'\n", __func__, fname_text.c_str());
@@ -9,6 +9,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <fstream>
 #include <iterator>
 #include <map>
 #include <numeric>
@@ -184,6 +185,8 @@ static const char * split_mode_str(llama_split_mode mode) {
             return "layer";
         case LLAMA_SPLIT_MODE_ROW:
             return "row";
+        case LLAMA_SPLIT_MODE_TENSOR:
+            return "tensor";
         default:
             GGML_ABORT("invalid split mode");
     }
@@ -267,6 +270,8 @@ struct cmd_params {
     bool                             verbose;
     bool                             progress;
     bool                             no_warmup;
+    std::string                      cpu_tune;
+    std::string                      cpu_tune_validate;
     output_formats                   output_format;
     output_formats                   output_format_stderr;
 };
@@ -303,6 +308,8 @@ static const cmd_params cmd_params_defaults = {
     /* verbose              */ false,
     /* progress             */ false,
     /* no_warmup            */ false,
+    /* cpu_tune             */ "",
+    /* cpu_tune_validate    */ "",
     /* output_format        */ MARKDOWN,
     /* output_format_stderr */ NONE,
 };
@@ -326,6 +333,10 @@ static void print_usage(int /* argc */, char ** argv) {
     printf("  -v, --verbose                             verbose output\n");
     printf("  --progress                                print test progress indicators\n");
     printf("  --no-warmup                               skip warmup runs before benchmarking\n");
+    printf("  --cpu-tune <file>                         tune the CPU matmul work distribution of the shapes that are not\n");
+    printf("                                            in <file> during the warmup runs and save the results to <file>\n");
+    printf("  --cpu-tune-validate <file>                run each test with the CPU matmul configurations of <file> and\n");
+    printf("                                            with the default heuristics, and print the difference\n");
     printf("\n");
     printf("test parameters:\n");
     printf("  -m, --model <filename>                    (default: %s)\n", join(cmd_params_defaults.model, ",").c_str());
@@ -357,7 +368,7 @@ static void print_usage(int /* argc */, char ** argv) {
         printf("  -rpc, --rpc <rpc_servers>                 (default: %s)\n",
                join(cmd_params_defaults.rpc_servers, ",").c_str());
     }
-    printf("  -sm, --split-mode <none|layer|row>        (default: %s)\n",
+    printf("  -sm, --split-mode <none|layer|row|tensor> (default: %s)\n",
            join(transform_to_str(cmd_params_defaults.split_mode, split_mode_str), ",").c_str());
     printf("  -mg, --main-gpu <i>                       (default: %s)\n",
            join(cmd_params_defaults.main_gpu, ",").c_str());
@@ -425,6 +436,8 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
     params.delay                = cmd_params_defaults.delay;
     params.progress             = cmd_params_defaults.progress;
     params.no_warmup            = cmd_params_defaults.no_warmup;
+    params.cpu_tune             = cmd_params_defaults.cpu_tune;
+    params.cpu_tune_validate    = cmd_params_defaults.cpu_tune_validate;
 
     for (int i = 1; i < argc; i++) {
         arg = argv[i];
@@ -586,6 +599,8 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
                         mode = LLAMA_SPLIT_MODE_LAYER;
                     } else if (m == "row") {
                         mode = LLAMA_SPLIT_MODE_ROW;
+                    } else if (m == "tensor") {
+                        mode = LLAMA_SPLIT_MODE_TENSOR;
                     } else {
                         invalid_param = true;
                         break;
@@ -793,6 +808,18 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
                 params.progress = true;
             } else if (arg == "--no-warmup") {
                 params.no_warmup = true;
+            } else if (arg == "--cpu-tune") {
+                if (++i >= argc) {
+                    invalid_param = true;
+                    break;
+                }
+                params.cpu_tune = argv[i];
+            } else if (arg == "--cpu-tune-validate") {
+                if (++i >= argc) {
+                    invalid_param = true;
+                    break;
+                }
+                params.cpu_tune_validate = argv[i];
             } else {
                 invalid_param = true;
                 break;
@@ -810,6 +837,11 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
         exit(1);
     }
 
+    if (!params.cpu_tune.empty() && !params.cpu_tune_validate.empty()) {
+        fprintf(stderr, "error: --cpu-tune and --cpu-tune-validate cannot be used together\n");
+        exit(1);
+    }
+
     // set defaults
     if (params.model.empty()) {
         params.model = cmd_params_defaults.model;
@@ -1806,6 +1838,52 @@ static std::unique_ptr<printer> create_printer(output_formats format) {
     GGML_ABORT("fatal error");
 }
 
+static void run_test_reps(llama_context * ctx, const cmd_params & params, int params_idx, size_t params_count, test & t) {
+    for (int i = 0; i < params.reps; i++) {
+        llama_memory_clear(llama_get_memory(ctx), false);
+
+        if (t.n_depth > 0) {
+            if (params.progress) {
+                fprintf(stderr, "llama-bench: benchmark %d/%zu: depth run %d/%d\n", params_idx, params_count,
+                        i + 1, params.reps);
+            }
+            bool res = test_prompt(ctx, t.n_depth, t.n_batch, t.n_threads);
+            if (!res) {
+                fprintf(stderr, "%s: error: failed to run depth\n", __func__);
+                exit(1);
+            }
+        }
+
+        uint64_t t_start = get_time_ns();
+
+        if (t.n_prompt > 0) {
+            if (params.progress) {
+                fprintf(stderr, "llama-bench: benchmark %d/%zu: prompt run %d/%d\n", params_idx, params_count,
+                        i + 1, params.reps);
+            }
+            bool res = test_prompt(ctx, t.n_prompt, t.n_batch, t.n_threads);
+            if (!res) {
+                fprintf(stderr, "%s: error: failed to run prompt\n", __func__);
+                exit(1);
+            }
+        }
+        if (t.n_gen > 0) {
+            if (params.progress) {
+                fprintf(stderr, "llama-bench: benchmark %d/%zu: generation run %d/%d\n", params_idx, params_count,
+                        i + 1, params.reps);
+            }
+            bool res = test_gen(ctx, t.n_gen, t.n_threads);
+            if (!res) {
+                fprintf(stderr, "%s: error: failed to run gen\n", __func__);
+                exit(1);
+            }
+        }
+
+        uint64_t t_ns = get_time_ns() - t_start;
+        t.samples_ns.push_back(t_ns);
+    }
+}
+
 int main(int argc, char ** argv) {
     // try to set locale for unicode characters in markdown
     setlocale(LC_CTYPE, ".UTF-8");
@@ -1836,6 +1914,34 @@ int main(int argc, char ** argv) {
     auto * ggml_threadpool_new_fn = (decltype(ggml_threadpool_new) *) ggml_backend_reg_get_proc_address(cpu_reg, "ggml_threadpool_new");
     auto * ggml_threadpool_free_fn = (decltype(ggml_threadpool_free) *) ggml_backend_reg_get_proc_address(cpu_reg, "ggml_threadpool_free");
 
+    auto * ggml_cpu_tune_set_mode_fn  = (decltype(ggml_cpu_tune_set_mode)  *) ggml_backend_reg_get_proc_address(cpu_reg, "ggml_cpu_tune_set_mode");
+    auto * ggml_cpu_tune_n_entries_fn = (decltype(ggml_cpu_tune_n_entries) *) ggml_backend_reg_get_proc_address(cpu_reg, "ggml_cpu_tune_n_entries");
+    auto * ggml_cpu_tune_load_fn      = (decltype(ggml_cpu_tune_load)      *) ggml_backend_reg_get_proc_address(cpu_reg, "ggml_cpu_tune_load");
+    auto * ggml_cpu_tune_save_fn      = (decltype(ggml_cpu_tune_save)      *) ggml_backend_reg_get_proc_address(cpu_reg, "ggml_cpu_tune_save");
+
+    if (!params.cpu_tune.empty() || !params.cpu_tune_validate.empty()) {
+        if (!ggml_cpu_tune_set_mode_fn || !ggml_cpu_tune_n_entries_fn || !ggml_cpu_tune_load_fn || !ggml_cpu_tune_save_fn) {
+            fprintf(stderr, "%s: error: the CPU backend does not support matmul tuning\n", __func__);
+            return 1;
+        }
+
+        if (!params.cpu_tune.empty()) {
+            // the shapes that are already in the file are not tuned again
+            if (std::ifstream(params.cpu_tune).good() && !ggml_cpu_tune_load_fn(params.cpu_tune.c_str())) {
+                return 1;
+            }
+            if (params.no_warmup) {
+                fprintf(stderr, "%s: warning: with --no-warmup the tuning is done in the first repetition of each test\n", __func__);
+            }
+            ggml_cpu_tune_set_mode_fn(GGML_CPU_TUNE_MODE_TUNE);
+        } else {
+            if (!ggml_cpu_tune_load_fn(params.cpu_tune_validate.c_str())) {
+                return 1;
+            }
+            ggml_cpu_tune_set_mode_fn(GGML_CPU_TUNE_MODE_USE);
+        }
+    }
+
     // initialize llama.cpp
     if (!params.verbose) {
         llama_log_set(llama_null_log_callback, NULL);
@@ -1943,48 +2049,20 @@ int main(int argc, char ** argv) {
             }
         }
 
-        for (int i = 0; i < params.reps; i++) {
-            llama_memory_clear(llama_get_memory(ctx), false);
+        run_test_reps(ctx, params, params_idx, params_count, t);
 
-            if (t.n_depth > 0) {
-                if (params.progress) {
-                    fprintf(stderr, "llama-bench: benchmark %d/%zu: depth run %d/%d\n", params_idx, params_count,
-                            i + 1, params.reps);
-                }
-                bool res = test_prompt(ctx, t.n_depth, t.n_batch, t.n_threads);
-                if (!res) {
-                    fprintf(stderr, "%s: error: failed to run depth\n", __func__);
-                    exit(1);
-                }
-            }
+        if (!params.cpu_tune_validate.empty()) {
+            // same test with the default heuristics
+            test t_ref = t;
+            t_ref.samples_ns.clear();
 
-            uint64_t t_start = get_time_ns();
+            ggml_cpu_tune_set_mode_fn(GGML_CPU_TUNE_MODE_OFF);
+            run_test_reps(ctx, params, params_idx, params_count, t_ref);
+            ggml_cpu_tune_set_mode_fn(GGML_CPU_TUNE_MODE_USE);
 
-            if (t.n_prompt > 0) {
-                if (params.progress) {
-                    fprintf(stderr, "llama-bench: benchmark %d/%zu: prompt run %d/%d\n", params_idx, params_count,
-                            i + 1, params.reps);
-                }
-                bool res = test_prompt(ctx, t.n_prompt, t.n_batch, t.n_threads);
-                if (!res) {
-                    fprintf(stderr, "%s: error: failed to run prompt\n", __func__);
-                    exit(1);
-                }
-            }
-            if (t.n_gen > 0) {
-                if (params.progress) {
-                    fprintf(stderr, "llama-bench: benchmark %d/%zu: generation run %d/%d\n", params_idx, params_count,
-                            i + 1, params.reps);
-                }
-                bool res = test_gen(ctx, t.n_gen, t.n_threads);
-                if (!res) {
-                    fprintf(stderr, "%s: error: failed to run gen\n", __func__);
-                    exit(1);
-                }
-            }
-
-            uint64_t t_ns = get_time_ns() - t_start;
-            t.samples_ns.push_back(t_ns);
+            fprintf(stderr, "llama-bench: benchmark %d/%zu: cpu tune: default %.2f ± %.2f t/s, tuned %.2f ± %.2f t/s (%+.1f%%)\n",
+                    params_idx, params_count, t_ref.avg_ts(), t_ref.stdev_ts(), t.avg_ts(), t.stdev_ts(),
+                    100.0*(t.avg_ts()/t_ref.avg_ts() - 1.0));
         }
 
         if (p) {
@@ -2006,6 +2084,14 @@ int main(int argc, char ** argv) {
 
     llama_model_free(lmodel);
 
+    if (!params.cpu_tune.empty()) {
+        if (!ggml_cpu_tune_save_fn(params.cpu_tune.c_str())) {
+            fprintf(stderr, "%s: error: failed to save the CPU matmul configurations to %s\n", __func__, params.cpu_tune.c_str());
+            return 1;
+        }
+        fprintf(stderr, "%s: saved %d CPU matmul configurations to %s\n", __func__, ggml_cpu_tune_n_entries_fn(), params.cpu_tune.c_str());
+    }
+
     if (p) {
         p->print_footer();
     }
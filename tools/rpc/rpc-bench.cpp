@@ -0,0 +1,217 @@
+// measures the transfer of activations to and from an RPC server with the different GGML_RPC_CODEC encodings
+// the bytes are counted by the RPC client, shared memory is disabled by default so that a local server can be used
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "ggml-cpp.h"
+#include "ggml-rpc.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+struct rpc_bench_params {
+    std::string endpoint = "127.0.0.1:50052";
+    int         n_embd   = 4096;
+    int         n_tokens = 512;
+    int         n_reps   = 10;
+    bool        shm      = false;
+};
+
+static void print_usage(int /*argc*/, char ** argv, const rpc_bench_params & params) {
+    fprintf(stderr, "Usage: %s [options]\n\n", argv[0]);
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h, --help                    show this help message and exit\n");
+    fprintf(stderr, "  -e HOST:PORT, --endpoint      RPC server (default: %s)\n", params.endpoint.c_str());
+    fprintf(stderr, "  -n N, --n-embd N              size of the rows of the activations (default: %d)\n", params.n_embd);
+    fprintf(stderr, "  -t N, --n-tokens N            number of rows of the activations (default: %d)\n", params.n_tokens);
+    fprintf(stderr, "  -r N, --repetitions N         number of transfers for each codec (default: %d)\n", params.n_reps);
+    fprintf(stderr, "  -s, --shm                     use shared memory with a server on the same host, which bypasses the codecs\n");
+    fprintf(stderr, "\n");
+}
+
+static bool rpc_bench_params_parse(int argc, char ** argv, rpc_bench_params & params) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argc, argv, params);
+            exit(0);
+        }
+        if (arg == "-s" || arg == "--shm") {
+            params.shm = true;
+            continue;
+        }
+        if (++i >= argc) {
+            fprintf(stderr, "error: missing value for %s\n", arg.c_str());
+            return false;
+        }
+        if (arg == "-e" || arg == "--endpoint") {
+            params.endpoint = argv[i];
+        } else if (arg == "-n" || arg == "--n-embd") {
+            params.n_embd = std::stoi(argv[i]);
+        } else if (arg == "-t" || arg == "--n-tokens") {
+            params.n_tokens = std::stoi(argv[i]);
+        } else if (arg == "-r" || arg == "--repetitions") {
+            params.n_reps = std::stoi(argv[i]);
+        } else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            return false;
+        }
+    }
+    // q8_0 is encoded in blocks of 32 values
+    if (params.n_embd <= 0 || params.n_embd % 32 != 0 || params.n_tokens <= 0 || params.n_reps <= 0) {
+        fprintf(stderr, "error: n_embd must be a multiple of 32, n_tokens and repetitions must be positive\n");
+        return false;
+    }
+    return true;
+}
+
+static void set_env(const char * name, const char * value) {
+#ifdef _WIN32
+    _putenv_s(name, value);
+#else
+    setenv(name, value, 1);
+#endif
+}
+
+int main(int argc, char ** argv) {
+    rpc_bench_params params;
+    if (!rpc_bench_params_parse(argc, argv, params)) {
+        print_usage(argc, argv, params);
+        return 1;
+    }
+
+    // read by the client when it connects
+    set_env("GGML_RPC_NO_SHM", params.shm ? "0" : "1");
+
+    ggml_backend_load_all();
+
+    ggml_backend_reg_t reg = ggml_backend_reg_by_name("RPC");
+    if (!reg) {
+        fprintf(stderr, "Failed to find RPC backend\n");
+        return 1;
+    }
+    auto add_device_fn = (decltype(ggml_backend_rpc_add_device) *) ggml_backend_reg_get_proc_address(reg, "ggml_backend_rpc_add_device");
+    auto get_stats_fn  = (decltype(ggml_backend_rpc_get_stats)  *) ggml_backend_reg_get_proc_address(reg, "ggml_backend_rpc_get_stats");
+    if (!add_device_fn || !get_stats_fn) {
+        fprintf(stderr, "Failed to obtain RPC backend functions\n");
+        return 1;
+    }
+    ggml_backend_dev_t dev = add_device_fn(params.endpoint.c_str());
+    if (!dev) {
+        fprintf(stderr, "Failed to connect to %s\n", params.endpoint.c_str());
+        return 1;
+    }
+    ggml_backend_buffer_type_t buft = ggml_backend_dev_buffer_type(dev);
+
+    const int64_t n = (int64_t) params.n_embd*params.n_tokens;
+
+    // activations are roughly normally distributed with a few large outliers
+    std::vector<float> src(n);
+    {
+        std::mt19937 rng(42);
+        std::normal_distribution<float> dist(0.0f, 1.0f);
+        for (int64_t i = 0; i < n; i++) {
+            src[i] = dist(rng);
+        }
+        for (int64_t i = 0; i < n; i += 997) {
+            src[i] *= 50.0f;
+        }
+    }
+    std::vector<float> dst(n);
+
+    printf("endpoint: %s, activations: %d x %d f32 (%.2f MiB), repetitions: %d\n\n",
+            params.endpoint.c_str(), params.n_embd, params.n_tokens, n*sizeof(float)/1024.0/1024.0, params.n_reps);
+    // bytes per set + get, including the headers of the commands
+    printf("| codec | encoded | bytes sent | bytes recv | bytes shm | saved | set + get (ms) | speedup | max abs err | rms err / rms |\n");
+    printf("| ----- | ------: | ---------: | ---------: | --------: | ----: | -------------: | ------: | ----------: | ------------: |\n");
+
+    const struct {
+        const char * name;
+        ggml_type    type;
+    } codecs[] = {
+        { "none", GGML_TYPE_F32  },
+        { "f16",  GGML_TYPE_F16  },
+        { "bf16", GGML_TYPE_BF16 },
+        { "q8_0", GGML_TYPE_Q8_0 },
+    };
+
+    double t_none     = 0.0;
+    double bytes_none = 0.0;
+
+    for (const auto & codec : codecs) {
+        // the codec is selected when connecting, the connection is closed when the previous buffer is freed
+        set_env("GGML_RPC_CODEC", codec.name);
+
+        ggml_init_params ctx_params = {
+            /*.mem_size   =*/ ggml_tensor_overhead(),
+            /*.mem_buffer =*/ NULL,
+            /*.no_alloc   =*/ true,
+        };
+        ggml_context_ptr ctx { ggml_init(ctx_params) };
+        ggml_tensor * t = ggml_new_tensor_2d(ctx.get(), GGML_TYPE_F32, params.n_embd, params.n_tokens);
+
+        ggml_backend_buffer_ptr buf { ggml_backend_alloc_ctx_tensors_from_buft(ctx.get(), buft) };
+        if (!buf) {
+            fprintf(stderr, "Failed to allocate the buffer\n");
+            return 1;
+        }
+        // the codec is only used for compute buffers
+        ggml_backend_buffer_set_usage(buf.get(), GGML_BACKEND_BUFFER_USAGE_COMPUTE);
+
+        // warmup
+        ggml_backend_tensor_set(t, src.data(), 0, ggml_nbytes(t));
+        ggml_backend_tensor_get(t, dst.data(), 0, ggml_nbytes(t));
+
+        ggml_backend_rpc_stats stats0;
+        get_stats_fn(&stats0);
+
+        const auto t_start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < params.n_reps; i++) {
+            ggml_backend_tensor_set(t, src.data(), 0, ggml_nbytes(t));
+            ggml_backend_tensor_get(t, dst.data(), 0, ggml_nbytes(t));
+        }
+        const auto t_end = std::chrono::high_resolution_clock::now();
+        const double t_ms = std::chrono::duration<double, std::milli>(t_end - t_start).count()/params.n_reps;
+
+        ggml_backend_rpc_stats stats1;
+        get_stats_fn(&stats1);
+
+        const double bytes_sent = (double) (stats1.bytes_sent - stats0.bytes_sent)/params.n_reps;
+        const double bytes_recv = (double) (stats1.bytes_recv - stats0.bytes_recv)/params.n_reps;
+        const double bytes_shm  = (double) (stats1.bytes_shm  - stats0.bytes_shm)/params.n_reps;
+        // the set and the get of each repetition, the data is sent as f32 if the server does not support the codec
+        // or the values cannot be encoded
+        const uint64_t n_codec  = stats1.n_codec - stats0.n_codec;
+
+        if (codec.type == GGML_TYPE_F32) {
+            t_none     = t_ms;
+            bytes_none = bytes_sent + bytes_recv + bytes_shm;
+        }
+
+        // the data goes through the codec twice, on the way to the server and back
+        double max_err = 0.0;
+        double sum_err = 0.0;
+        double sum_ref = 0.0;
+        for (int64_t i = 0; i < n; i++) {
+            const double err = std::fabs((double) dst[i] - src[i]);
+            max_err  = std::max(max_err, err);
+            sum_err += err*err;
+            sum_ref += (double) src[i]*src[i];
+        }
+
+        const double bytes = bytes_sent + bytes_recv + bytes_shm;
+
+        printf("| %5s | %3d/%-3d | %10.0f | %10.0f | %9.0f | %4.0f%% | %14.3f | %6.2fx | %11.3e | %13.3e |\n",
+                codec.name, (int) n_codec, 2*params.n_reps, bytes_sent, bytes_recv, bytes_shm, 100.0*(1.0 - bytes/bytes_none),
+                t_ms, t_none/t_ms, max_err, std::sqrt(sum_err/sum_ref));
+    }
+
+    return 0;
+}
@@ -3,6 +3,7 @@
 
 #include "arg.h"
 #include "common.h"
+#include "embd-cache.h"
 #include "json-schema-to-grammar.h"
 #include "llama.h"
 #include "log.h"
@@ -18,6 +19,7 @@
 #include "index.html.gz.hpp"
 #include "loading.html.hpp"
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
@@ -68,6 +70,8 @@ enum server_task_type {
     SERVER_TASK_TYPE_SLOT_RESTORE,
     SERVER_TASK_TYPE_SLOT_ERASE,
     SERVER_TASK_TYPE_SET_LORA,
+    SERVER_TASK_TYPE_LOAD_LORA,
+    SERVER_TASK_TYPE_UNLOAD_LORA,
 };
 
 enum oaicompat_type {
@@ -152,7 +156,7 @@ struct slot_params {
 
         json lora = json::array();
         for (size_t i = 0; i < this->lora.size(); ++i) {
-            lora.push_back({{"id", i}, {"scale", this->lora[i].scale}});
+            lora.push_back({{"id", this->lora[i].uid}, {"scale", this->lora[i].scale}});
         }
 
         if (only_metrics) {
@@ -285,9 +289,12 @@ struct server_task {
     // used by SERVER_TASK_TYPE_METRICS
     bool metrics_reset_bucket = false;
 
-    // used by SERVER_TASK_TYPE_SET_LORA
+    // used by SERVER_TASK_TYPE_SET_LORA, SERVER_TASK_TYPE_LOAD_LORA
     std::vector<common_adapter_lora_info> set_lora;
 
+    // used by SERVER_TASK_TYPE_UNLOAD_LORA, common_adapter_lora_info::uid
+    int id_lora = -1;
+
     server_task(server_task_type type) : type(type) {}
 
     static slot_params params_from_json_cmpl(
@@ -1316,6 +1323,9 @@ struct server_task_result_metrics : server_task_result {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    uint64_t n_embd_cache_hit  = 0;
+    uint64_t n_embd_cache_miss = 0;
+
     // while we can also use std::vector<server_slot> this requires copying the slot object which can be quite messy
     // therefore, we use json to temporarily store the slot.to_json() result
     json slots_data = json::array();
@@ -1342,6 +1352,9 @@ struct server_task_result_metrics : server_task_result {
             { "n_decode_total",                  n_decode_total },
             { "n_busy_slots_total",              n_busy_slots_total },
 
+            { "n_embd_cache_hit",                n_embd_cache_hit },
+            { "n_embd_cache_miss",               n_embd_cache_miss },
+
             { "slots",                           slots_data },
         };
     }
@@ -1397,6 +1410,25 @@ struct server_task_result_apply_lora : server_task_result {
     }
 };
 
+struct server_task_result_load_lora : server_task_result {
+    int         id_lora;
+    std::string path;
+    uint64_t    size;
+
+    std::vector<int> evicted;  // ids of the adapters that were offloaded to host memory to stay within --lora-cache-size
+    std::vector<int> unloaded; // ids of the offloaded adapters that were unloaded to stay within --lora-host-cache-size
+
+    virtual json to_json() override {
+        return json {
+            { "id",       id_lora },
+            { "path",     path },
+            { "size",     size },
+            { "evicted",  evicted },
+            { "unloaded", unloaded },
+        };
+    }
+};
+
 struct server_slot {
     int id;
     int id_task = -1;
@@ -1447,6 +1479,8 @@ struct server_slot {
 
     std::string  generated_text;
     llama_tokens generated_tokens;
+
+    server_text_stream text_stream; // UTF-8 and stop string state of generated_text
     common_chat_msg chat_msg;
 
     server_tokens cache_tokens;
@@ -1535,7 +1569,13 @@ struct server_slot {
     }
 
     bool can_batch_with(server_slot & other_slot) const {
-        return task_type == other_slot.task_type && are_lora_equal(lora, other_slot.lora);
+        if (task_type != other_slot.task_type) {
+            return false;
+        }
+
+        // adapters are applied per sequence, so slots with different lora configs can share a batch
+        // aLoRA relies on the activation state of the whole batch, so it still requires equal configs
+        return are_lora_equal(lora, other_slot.lora) || (!lora_all_alora(lora) && !lora_all_alora(other_slot.lora));
     }
 
     bool has_budget(const common_params & global_params) {
@@ -1619,33 +1659,30 @@ struct server_slot {
         return chat_msg;
     }
 
-    size_t find_stopping_strings(const std::string & text, const size_t last_token_size, bool is_full_stop) {
-        size_t stop_pos = std::string::npos;
-
-        for (const std::string & word : params.antiprompt) {
-            size_t pos;
+    // stop strings are matched incrementally by text_stream as the text is generated
+    // returns the position of the (partial) stop string relative to pos, or std::string::npos
+    size_t find_stopping_strings(const size_t pos, bool is_full_stop) {
+        if (is_full_stop) {
+            const size_t  stop_pos  = text_stream.stop_pos;
+            const int32_t stop_word = text_stream.stop_word;
+            text_stream.take_stop();
 
-            if (is_full_stop) {
-                const size_t tmp      = word.size() + last_token_size;
-                const size_t from_pos = text.size() > tmp ? text.size() - tmp : 0;
-
-                pos = text.find(word, from_pos);
-            } else {
-                // otherwise, partial stop
-                pos = string_find_partial_stop(text, word);
+            if (stop_pos == std::string::npos) {
+                return std::string::npos;
             }
 
-            if (pos != std::string::npos && (stop_pos == std::string::npos || pos < stop_pos)) {
-                if (is_full_stop) {
-                    stop           = STOP_TYPE_WORD;
-                    stopping_word  = word;
-                    has_next_token = false;
-                }
-                stop_pos = pos;
-            }
+            stop           = STOP_TYPE_WORD;
+            stopping_word  = text_stream.words[stop_word];
+            has_next_token = false;
+
+            return stop_pos > pos ? stop_pos - pos : 0;
         }
 
-        return stop_pos;
+        // otherwise, partial stop
+        const size_t n_unsent  = generated_text.size() - pos;
+        const size_t n_partial = std::min(text_stream.partial_len(), n_unsent);
+
+        return n_partial > 0 ? n_unsent - n_partial : std::string::npos;
     }
 
     void print_timings() const {
@@ -1756,6 +1793,14 @@ struct server_metrics {
         t_tokens_generation_total  += slot.t_token_generation;
     }
 
+    void on_embd_batch(int32_t n_tokens, double t_ms) {
+        n_prompt_tokens_processed_total += n_tokens;
+        n_prompt_tokens_processed       += n_tokens;
+        t_prompt_processing             += t_ms;
+        t_prompt_processing_total       += t_ms;
+        n_decode_total++;
+    }
+
     void on_decoded(const std::vector<server_slot> & slots) {
         n_decode_total++;
         for (const auto & slot : slots) {
@@ -2080,6 +2125,23 @@ struct server_context {
     common_init_result llama_init;
     common_init_result llama_init_dft;
 
+    // loaded LoRA adapters, in the same order as params_base.lora_adapters
+    // an adapter is either in memory or offloaded to host memory (see --lora-cache-size), the offloaded ones are
+    // loaded back when a task enables them
+    std::vector<llama_adapter_lora_ptr> lora_owned;
+
+    // unloaded LoRA adapters that are still used by a slot
+    std::vector<llama_adapter_lora_ptr> lora_pending_free;
+
+    // time of the last task that used each adapter, for the LRU eviction
+    std::unordered_map<const llama_adapter_lora *, int64_t> lora_t_last_used;
+
+    // next common_adapter_lora_info::uid, the adapters loaded at startup get their index as id
+    uint64_t lora_uid_next = 0;
+
+    // params_base.lora_adapters is only modified by the main loop, but it is also read by the HTTP threads
+    std::mutex mutex_lora;
+
     llama_model * model = nullptr;
     llama_context * ctx = nullptr;
 
@@ -2104,6 +2166,15 @@ struct server_context {
     std::vector<server_slot> slots;
     json default_generation_settings_for_props;
 
+    // embedding and reranking tasks waiting to be batched, see update_embd()
+    std::vector<server_task> embd_pending;
+
+    // results of the previous embedding and reranking inputs (--embd-cache)
+    std::unique_ptr<common_embd_cache> embd_cache;
+
+    // tasks waiting for a slot to finish evaluating an identical input, see update_embd_waiting()
+    std::vector<server_task> embd_waiting;
+
     server_queue    queue_tasks;
     server_response queue_results;
 
@@ -2140,6 +2211,19 @@ struct server_context {
 
         params_base = params;
 
+        if (params_base.embd_batching) {
+            if (!params_base.embedding) {
+                params_base.embd_batching = false;
+                SRV_WRN("%s\n", "embd_batching requires --embeddings, it will be disabled");
+            } else if (!params_base.mmproj.path.empty()) {
+                params_base.embd_batching = false;
+                SRV_WRN("%s\n", "embd_batching is not supported by multimodal, it will be disabled");
+            } else {
+                // the sequences of a batch share the whole context instead of a slot each
+                params_base.kv_unified = true;
+            }
+        }
+
         llama_init = common_init_from_params(params_base);
 
         model = llama_init.model.get();
@@ -2150,6 +2234,11 @@ struct server_context {
             return false;
         }
 
+        lora_owned = std::move(llama_init.lora);
+        for (auto & la : params_base.lora_adapters) {
+            la.uid = lora_uid_next++;
+        }
+
         vocab = llama_model_get_vocab(model);
 
         n_ctx = llama_n_ctx(ctx);
@@ -2247,6 +2336,16 @@ struct server_context {
             }
         }
 
+        if (params_base.embedding && (params_base.embd_cache_size > 0 || !params_base.embd_cache_file.empty())) {
+            if (mctx) {
+                SRV_WRN("%s\n", "embd_cache is not supported by multimodal, it will be disabled");
+            } else if (llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_NONE) {
+                SRV_WRN("%s\n", "embd_cache requires pooling, it will be disabled");
+            } else {
+                embd_cache = std::make_unique<common_embd_cache>(model, llama_pooling_type(ctx), params_base.embd_cache_size, params_base.embd_cache_file);
+            }
+        }
+
         return true;
     }
 
@@ -2400,6 +2499,237 @@ struct server_context {
         return ret;
     }
 
+    // check if an adapter is enabled in any of the processing slots
+    bool lora_is_used(const llama_adapter_lora * lora) const {
+        for (const auto & slot : slots) {
+            if (!slot.is_processing()) {
+                continue;
+            }
+            for (const auto & la : slot.lora) {
+                if (la.ptr == lora && la.scale != 0.0f) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // index of an adapter in params_base.lora_adapters, -1 if it is not loaded
+    int lora_find(uint64_t uid) const {
+        for (size_t i = 0; i < params_base.lora_adapters.size(); ++i) {
+            if (params_base.lora_adapters[i].uid == uid) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    uint64_t lora_total_size(bool offloaded) const {
+        uint64_t total = 0;
+        for (const auto & la : params_base.lora_adapters) {
+            if (llama_adapter_lora_is_offloaded(la.ptr) == offloaded) {
+                total += llama_adapter_lora_size(la.ptr);
+            }
+        }
+        return total;
+    }
+
+    // least recently used adapter that can be offloaded (offloaded = false) or unloaded (offloaded = true), -1 if none
+    // adapters that are enabled by default, used by a slot or in keep are never evicted
+    int lora_find_lru(bool offloaded, const std::vector<uint64_t> & keep) const {
+        int     id_lru = -1;
+        int64_t t_lru  = INT64_MAX;
+        for (size_t i = 0; i < params_base.lora_adapters.size(); ++i) {
+            const auto & la = params_base.lora_adapters[i];
+            if (llama_adapter_lora_is_offloaded(la.ptr) != offloaded || la.scale != 0.0f || lora_is_used(la.ptr) ||
+                std::find(keep.begin(), keep.end(), la.uid) != keep.end()) {
+                continue;
+            }
+            const auto it = lora_t_last_used.find(la.ptr);
+            const int64_t t = it == lora_t_last_used.end() ? 0 : it->second;
+            if (t < t_lru) {
+                id_lru = i;
+                t_lru  = t;
+            }
+        }
+        return id_lru;
+    }
+
+    // offload the least recently used adapters so that size more bytes fit within --lora-cache-size, then unload the
+    // least recently used offloaded adapters to stay within --lora-host-cache-size
+    void lora_make_room(uint64_t size, const std::vector<uint64_t> & keep, std::vector<int> & evicted, std::vector<int> & unloaded) {
+        const uint64_t budget      = (uint64_t) params_base.lora_cache_size*1024*1024;
+        const uint64_t budget_host = (uint64_t) params_base.lora_host_cache_size*1024*1024;
+
+        if (budget > 0) {
+            uint64_t total = size + lora_total_size(false);
+
+            while (total > budget) {
+                const int id_lru = lora_find_lru(false, keep);
+                if (id_lru < 0) {
+                    SRV_WRN("LoRA adapters use %.2f MiB, which exceeds --lora-cache-size = %d MiB, but none can be evicted\n",
+                            total/1024.0/1024.0, params_base.lora_cache_size);
+                    break;
+                }
+
+                total -= llama_adapter_lora_size(params_base.lora_adapters[id_lru].ptr);
+                evicted.push_back(params_base.lora_adapters[id_lru].uid);
+                lora_offload(id_lru);
+            }
+        }
+
+        if (budget_host > 0) {
+            uint64_t total = lora_total_size(true);
+
+            while (total > budget_host) {
+                const int id_lru = lora_find_lru(true, keep);
+                if (id_lru < 0) {
+                    break;
+                }
+
+                total -= llama_adapter_lora_size(params_base.lora_adapters[id_lru].ptr);
+                unloaded.push_back(params_base.lora_adapters[id_lru].uid);
+                lora_unload(id_lru);
+            }
+        }
+    }
+
+    // add an adapter that was loaded by an HTTP thread, evicting the least recently used ones if needed
+    // returns the id of the adapter
+    int lora_add(common_adapter_lora_info info, std::vector<int> & evicted, std::vector<int> & unloaded) {
+        const uint64_t size = llama_adapter_lora_size(info.ptr);
+
+        lora_make_room(size, {}, evicted, unloaded);
+
+        info.uid = lora_uid_next++;
+
+        SRV_INF("adding LoRA adapter %d, '%s', size = %.2f MiB\n", (int) info.uid, info.path.c_str(), size/1024.0/1024.0);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_lora);
+            params_base.lora_adapters.push_back(info);
+        }
+        lora_owned.emplace_back(info.ptr);
+        lora_t_last_used[info.ptr] = ggml_time_us();
+
+        return info.uid;
+    }
+
+    // move the tensors of an adapter that is not used by any slot to host memory
+    void lora_offload(size_t i) {
+        llama_adapter_lora * lora = params_base.lora_adapters[i].ptr;
+
+        SRV_INF("offloading LoRA adapter %d, '%s'\n", (int) params_base.lora_adapters[i].uid, params_base.lora_adapters[i].path.c_str());
+
+        llama_rm_adapter_lora(ctx, lora);
+        for (const auto & slot : slots) {
+            llama_rm_adapter_lora_seq(ctx, lora, slot.id);
+        }
+
+        // the HTTP threads read the size of the adapters
+        std::lock_guard<std::mutex> lock(mutex_lora);
+        llama_adapter_lora_offload(lora);
+    }
+
+    // make sure that the adapters enabled by a lora config are loaded, the offloaded ones are loaded back
+    bool lora_prepare(const std::vector<common_adapter_lora_info> & lora, std::string & err) {
+        std::vector<uint64_t> keep;
+        for (const auto & la : lora) {
+            if (la.scale != 0.0f) {
+                keep.push_back(la.uid);
+            }
+        }
+
+        for (const uint64_t uid : keep) {
+            int i = lora_find(uid);
+            if (i < 0) {
+                err = string_format("LoRA adapter %d was unloaded", (int) uid);
+                return false;
+            }
+
+            llama_adapter_lora * ptr = params_base.lora_adapters[i].ptr;
+            if (!llama_adapter_lora_is_offloaded(ptr)) {
+                continue;
+            }
+
+            std::vector<int> evicted;
+            std::vector<int> unloaded;
+            lora_make_room(llama_adapter_lora_size(ptr), keep, evicted, unloaded);
+
+            SRV_INF("reloading LoRA adapter %d, '%s'\n", (int) uid, params_base.lora_adapters[lora_find(uid)].path.c_str());
+
+            bool ok;
+            {
+                std::lock_guard<std::mutex> lock(mutex_lora);
+                ok = llama_adapter_lora_reload(ptr);
+            }
+            if (!ok) {
+                err = string_format("failed to load LoRA adapter %d back into memory", (int) uid);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // remove an adapter from the list, it is freed once no slot uses it anymore
+    void lora_unload(size_t id) {
+        llama_adapter_lora * lora = params_base.lora_adapters[id].ptr;
+
+        SRV_INF("unloading LoRA adapter %d, '%s'\n", (int) params_base.lora_adapters[id].uid, params_base.lora_adapters[id].path.c_str());
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_lora);
+            params_base.lora_adapters.erase(params_base.lora_adapters.begin() + id);
+        }
+        lora_t_last_used.erase(lora);
+
+        for (auto it = lora_owned.begin(); it != lora_owned.end(); ++it) {
+            if (it->get() == lora) {
+                lora_pending_free.push_back(std::move(*it));
+                lora_owned.erase(it);
+                break;
+            }
+        }
+
+        lora_free_unused();
+    }
+
+    void lora_free_unused() {
+        for (auto it = lora_pending_free.begin(); it != lora_pending_free.end();) {
+            llama_adapter_lora * lora = it->get();
+            if (lora_is_used(lora)) {
+                ++it;
+                continue;
+            }
+
+            for (auto & slot : slots) {
+                llama_rm_adapter_lora_seq(ctx, lora, slot.id);
+
+                if (slot.is_processing()) {
+                    continue;
+                }
+
+                for (auto la = slot.lora.begin(); la != slot.lora.end();) {
+                    if (la->ptr != lora) {
+                        ++la;
+                        continue;
+                    }
+                    if (la->scale != 0.0f) {
+                        // the cached prompt was processed with the adapter
+                        slot.cache_tokens.clear();
+                    }
+                    la = slot.lora.erase(la);
+                }
+            }
+
+            llama_rm_adapter_lora(ctx, lora);
+
+            SRV_DBG("freeing LoRA adapter %p\n", (void *) lora);
+            it = lora_pending_free.erase(it);
+        }
+    }
+
     bool launch_slot_with_task(server_slot & slot, server_task && task) {
         slot.reset();
         slot.id_task       = task.id;
@@ -2408,6 +2738,23 @@ struct server_context {
         slot.params        = std::move(task.params);
         slot.prompt_tokens = std::move(task.prompt_tokens);
 
+        // adapters might have been loaded, offloaded or unloaded after the task was created
+        {
+            std::string err;
+            if (!lora_prepare(slot.params.lora, err)) {
+                send_error(task, err, ERROR_TYPE_INVALID_REQUEST);
+                return false;
+            }
+        }
+        slot.params.lora = lora_rebase(params_base.lora_adapters, slot.params.lora);
+        for (const auto & la : slot.params.lora) {
+            if (la.scale != 0.0f) {
+                lora_t_last_used[la.ptr] = ggml_time_us();
+            }
+        }
+
+        slot.text_stream.init(slot.params.antiprompt);
+
         if (!are_lora_equal(slot.params.lora, slot.lora)) {
             // if lora has changed, check to see if the cache should be cleared
             if (lora_should_clear_cache(slot.lora, slot.params.lora)) {
@@ -2520,29 +2867,29 @@ struct server_context {
         slot.sampled = result.tok;
 
         slot.generated_text += token_str;
+        slot.text_stream.feed(token_str);
         if (slot.params.return_tokens) {
             slot.generated_tokens.push_back(result.tok);
         }
         slot.has_next_token = true;
 
         // check if there is incomplete UTF-8 character at the end
-        bool incomplete = validate_utf8(slot.generated_text) < slot.generated_text.size();
+        bool incomplete = slot.text_stream.incomplete_utf8();
 
         // search stop word and delete it
         if (!incomplete) {
             size_t pos = std::min(slot.n_sent_text, slot.generated_text.size());
 
-            const std::string str_test = slot.generated_text.substr(pos);
             bool send_text = true;
 
-            size_t stop_pos = slot.find_stopping_strings(str_test, token_str.size(), true);
+            size_t stop_pos = slot.find_stopping_strings(pos, true);
             if (stop_pos != std::string::npos) {
                 slot.generated_text.erase(
                     slot.generated_text.begin() + pos + stop_pos,
                     slot.generated_text.end());
                 pos = std::min(slot.n_sent_text, slot.generated_text.size());
             } else if (slot.has_next_token) {
-                stop_pos = slot.find_stopping_strings(str_test, token_str.size(), false);
+                stop_pos = slot.find_stopping_strings(pos, false);
                 send_text = stop_pos == std::string::npos;
             }
 
@@ -2841,58 +3188,70 @@ struct server_context {
     }
 
     void send_embedding(const server_slot & slot, const llama_batch & batch) {
+        send_embedding(slot.id_task, slot.index, slot.prompt_tokens, slot.params, slot.id, batch);
+    }
+
+    void send_embedding(const int id_task, const int index, const server_tokens & tokens, const slot_params & params, const llama_seq_id seq_id, const llama_batch & batch) {
         auto res = std::make_unique<server_task_result_embd>();
-        res->id        = slot.id_task;
-        res->index     = slot.index;
-        res->n_tokens  = slot.n_prompt_tokens;
-        res->oaicompat = slot.params.oaicompat;
+        res->id        = id_task;
+        res->index     = index;
+        res->n_tokens  = tokens.size();
+        res->oaicompat = params.oaicompat;
 
         const int n_embd = llama_model_n_embd(model);
 
         std::vector<float> embd_res(n_embd, 0.0f);
 
         for (int i = 0; i < batch.n_tokens; ++i) {
-            if (!batch.logits[i] || batch.seq_id[i][0] != slot.id) {
+            if (!batch.logits[i] || batch.seq_id[i][0] != seq_id) {
                 continue;
             }
 
             const float * embd = nullptr;
-            if (llama_pooling_type(slot.ctx) == LLAMA_POOLING_TYPE_NONE) {
+            if (llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_NONE) {
                 embd = llama_get_embeddings_ith(ctx, i);
             } else {
                 embd = llama_get_embeddings_seq(ctx, batch.seq_id[i][0]);
             }
 
             if (embd == nullptr) {
-                SLT_ERR(slot, "failed to get embeddings, token = %d, seq_id = %d\n", batch.token[i], batch.seq_id[i][0]);
+                SRV_ERR("failed to get embeddings, id_task = %d, token = %d, seq_id = %d\n", id_task, batch.token[i], batch.seq_id[i][0]);
 
                 res->embedding.push_back(std::vector<float>(n_embd, 0.0f));
                 continue;
             }
 
             // normalize only when there is pooling
-            if (llama_pooling_type(slot.ctx) != LLAMA_POOLING_TYPE_NONE) {
-                common_embd_normalize(embd, embd_res.data(), n_embd, slot.params.embd_normalize);
+            if (llama_pooling_type(ctx) != LLAMA_POOLING_TYPE_NONE) {
+                common_embd_normalize(embd, embd_res.data(), n_embd, params.embd_normalize);
                 res->embedding.push_back(embd_res);
+
+                if (embd_cache) {
+                    embd_cache->put(embd_cache_key(SERVER_TASK_TYPE_EMBEDDING, tokens, params), embd_res.data(), n_embd);
+                }
                 break;
             } else {
                 res->embedding.emplace_back(embd, embd + n_embd);
             }
         }
 
-        SLT_DBG(slot, "%s", "sending embeddings\n");
+        SRV_DBG("sending embeddings, id_task = %d\n", id_task);
 
         queue_results.send(std::move(res));
     }
 
     void send_rerank(const server_slot & slot, const llama_batch & batch) {
+        send_rerank(slot.id_task, slot.index, slot.prompt_tokens, slot.params, slot.id, batch);
+    }
+
+    void send_rerank(const int id_task, const int index, const server_tokens & tokens, const slot_params & params, const llama_seq_id seq_id, const llama_batch & batch) {
         auto res = std::make_unique<server_task_result_rerank>();
-        res->id    = slot.id_task;
-        res->index = slot.index;
-        res->n_tokens = slot.n_prompt_tokens;
+        res->id    = id_task;
+        res->index = index;
+        res->n_tokens = tokens.size();
 
         for (int i = 0; i < batch.n_tokens; ++i) {
-            if (!batch.logits[i] || batch.seq_id[i][0] != slot.id) {
+            if (!batch.logits[i] || batch.seq_id[i][0] != seq_id) {
                 continue;
             }
 
@@ -2902,20 +3261,84 @@ struct server_context {
             }
 
             if (embd == NULL) {
-                SLT_ERR(slot, "failed to get embeddings, token = %d, seq_id = %d\n", batch.token[i], batch.seq_id[i][0]);
+                SRV_ERR("failed to get embeddings, id_task = %d, token = %d, seq_id = %d\n", id_task, batch.token[i], batch.seq_id[i][0]);
 
                 res->score = -1e6;
                 continue;
             }
 
             res->score = embd[0];
+
+            if (embd_cache) {
+                embd_cache->put(embd_cache_key(SERVER_TASK_TYPE_RERANK, tokens, params), &res->score, 1);
+            }
         }
 
-        SLT_DBG(slot, "sending rerank result, res.score = %f\n", res->score);
+        SRV_DBG("sending rerank result, id_task = %d, res.score = %f\n", id_task, res->score);
 
         queue_results.send(std::move(res));
     }
 
+    uint64_t embd_cache_key(const server_task_type type, const server_tokens & tokens, const slot_params & params) const {
+        return embd_cache->key(tokens.get_text_tokens(), params.embd_normalize,
+                type == SERVER_TASK_TYPE_RERANK ? COMMON_EMBD_CACHE_RERANK : COMMON_EMBD_CACHE_EMBD);
+    }
+
+    // send the result of a task from the cache, returns false if it is not cached
+    bool send_embd_cached(const server_task & task, const uint64_t key) {
+        std::vector<float> data;
+        if (!embd_cache->get(key, data)) {
+            return false;
+        }
+
+        SRV_DBG("sending cached result, id_task = %d\n", task.id);
+
+        if (task.type == SERVER_TASK_TYPE_RERANK) {
+            auto res = std::make_unique<server_task_result_rerank>();
+            res->id       = task.id;
+            res->index    = task.index;
+            res->n_tokens = task.prompt_tokens.size();
+            res->score    = data.empty() ? -1e6 : data[0];
+
+            queue_results.send(std::move(res));
+        } else {
+            auto res = std::make_unique<server_task_result_embd>();
+            res->id        = task.id;
+            res->index     = task.index;
+            res->n_tokens  = task.prompt_tokens.size();
+            res->oaicompat = task.params.oaicompat;
+            res->embedding.push_back(std::move(data));
+
+            queue_results.send(std::move(res));
+        }
+
+        return true;
+    }
+
+    // the deferred tasks are resumed one at a time when a slot is released, a resumed task that did not take a slot
+    // passes its turn to the next one
+    void embd_cache_pass_deferred() {
+        for (const auto & slot : slots) {
+            if (!slot.is_processing()) {
+                queue_tasks.pop_deferred_task();
+                return;
+            }
+        }
+    }
+
+    // true if a slot is evaluating the same input
+    bool embd_cache_in_flight(const uint64_t key) const {
+        for (const auto & slot : slots) {
+            if (!slot.is_processing() || (slot.task_type != SERVER_TASK_TYPE_EMBEDDING && slot.task_type != SERVER_TASK_TYPE_RERANK)) {
+                continue;
+            }
+            if (embd_cache_key(slot.task_type, slot.prompt_tokens, slot.params) == key) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     //
     // Functions to create new task(s) and receive result(s)
     //
@@ -3021,10 +3444,31 @@ struct server_context {
 
     void process_single_task(server_task && task) {
         switch (task.type) {
-            case SERVER_TASK_TYPE_COMPLETION:
-            case SERVER_TASK_TYPE_INFILL:
             case SERVER_TASK_TYPE_EMBEDDING:
             case SERVER_TASK_TYPE_RERANK:
+                if (embd_cache) {
+                    const uint64_t key = embd_cache_key(task.type, task.prompt_tokens, task.params);
+
+                    // wait for the result of the identical input instead of evaluating it again
+                    if (!params_base.embd_batching && embd_cache_in_flight(key)) {
+                        SRV_DBG("identical input is being processed, waiting for it, id_task = %d\n", task.id);
+                        embd_waiting.push_back(std::move(task));
+                        embd_cache_pass_deferred();
+                        break;
+                    }
+
+                    if (embd_cache->contains(key) && send_embd_cached(task, key)) {
+                        embd_cache_pass_deferred();
+                        break;
+                    }
+                }
+                if (params_base.embd_batching) {
+                    embd_pending.push_back(std::move(task));
+                    break;
+                }
+                // fall through
+            case SERVER_TASK_TYPE_COMPLETION:
+            case SERVER_TASK_TYPE_INFILL:
                 {
                     const int id_slot = task.id_selected_slot;
 
@@ -3048,6 +3492,11 @@ struct server_context {
                         SRV_ERR("failed to launch slot with task, id_task = %d\n", task.id);
                         break;
                     }
+
+                    // the misses are counted when the input is evaluated, the lookups are repeated for the deferred tasks
+                    if (embd_cache && server_task_type_need_embd(slot->task_type)) {
+                        embd_cache->n_miss++;
+                    }
                 } break;
             case SERVER_TASK_TYPE_CANCEL:
                 {
@@ -3058,6 +3507,11 @@ struct server_context {
                             break;
                         }
                     }
+
+                    embd_pending.erase(std::remove_if(embd_pending.begin(), embd_pending.end(),
+                        [&](const server_task & t) { return t.id == task.id_target; }), embd_pending.end());
+                    embd_waiting.erase(std::remove_if(embd_waiting.begin(), embd_waiting.end(),
+                        [&](const server_task & t) { return t.id == task.id_target; }), embd_waiting.end());
                 } break;
             case SERVER_TASK_TYPE_NEXT_RESPONSE:
                 {
@@ -3106,6 +3560,11 @@ struct server_context {
                     res->n_decode_total          = metrics.n_decode_total;
                     res->n_busy_slots_total      = metrics.n_busy_slots_total;
 
+                    if (embd_cache) {
+                        res->n_embd_cache_hit  = embd_cache->n_hit;
+                        res->n_embd_cache_miss = embd_cache->n_miss;
+                    }
+
                     if (task.metrics_reset_bucket) {
                         metrics.reset_bucket();
                     }
@@ -3228,7 +3687,56 @@ struct server_context {
                 } break;
             case SERVER_TASK_TYPE_SET_LORA:
                 {
-                    params_base.lora_adapters = std::move(task.set_lora);
+                    std::string err;
+                    if (!lora_prepare(task.set_lora, err)) {
+                        send_error(task, err, ERROR_TYPE_INVALID_REQUEST);
+                        break;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_lora);
+                        params_base.lora_adapters = lora_rebase(params_base.lora_adapters, task.set_lora);
+                    }
+                    auto res = std::make_unique<server_task_result_apply_lora>();
+                    res->id = task.id;
+                    queue_results.send(std::move(res));
+                } break;
+            case SERVER_TASK_TYPE_LOAD_LORA:
+                {
+                    const auto & info = task.set_lora[0];
+
+                    auto res = std::make_unique<server_task_result_load_lora>();
+                    res->id   = task.id;
+                    res->path = info.path;
+
+                    // the same file may have been loaded by a concurrent request since the HTTP thread checked
+                    int i_lora = -1;
+                    for (size_t i = 0; i < params_base.lora_adapters.size(); ++i) {
+                        if (params_base.lora_adapters[i].path == info.path) {
+                            i_lora = i;
+                            break;
+                        }
+                    }
+
+                    if (i_lora >= 0) {
+                        llama_adapter_lora_free(info.ptr);
+                        res->id_lora = params_base.lora_adapters[i_lora].uid;
+                        res->size    = llama_adapter_lora_size(params_base.lora_adapters[i_lora].ptr);
+                    } else {
+                        res->id_lora = lora_add(info, res->evicted, res->unloaded);
+                        res->size    = llama_adapter_lora_size(info.ptr);
+                    }
+                    queue_results.send(std::move(res));
+                } break;
+            case SERVER_TASK_TYPE_UNLOAD_LORA:
+                {
+                    const int i_lora = task.id_lora < 0 ? -1 : lora_find(task.id_lora);
+                    if (i_lora < 0) {
+                        send_error(task, "invalid adapter id", ERROR_TYPE_INVALID_REQUEST);
+                        break;
+                    }
+
+                    lora_unload(i_lora);
+
                     auto res = std::make_unique<server_task_result_apply_lora>();
                     res->id = task.id;
                     queue_results.send(std::move(res));
@@ -3237,7 +3745,177 @@ struct server_context {
         }
     }
 
+    // process the pending embedding and reranking tasks (--embd-batching)
+    // a batch starts with the longest pending input and is filled with the next longest ones that fit in the ubatch,
+    // so that each input is evaluated in a single ubatch (as required by the non-causal models) with as little
+    // unused space as possible. the results are pooled per sequence and sent right after the batch is decoded
+    // with --embd-cache, the identical inputs of a batch are evaluated once and the inputs evaluated by a previous batch are not
+    // the batch uses the sequences of the slots, so it is only decoded when no slot is processing
+    void update_embd() {
+        for (const auto & slot : slots) {
+            if (slot.is_processing()) {
+                return;
+            }
+        }
+
+        const int32_t n_ubatch  = llama_n_ubatch(ctx);
+        const int32_t n_seq_max = llama_n_seq_max(ctx);
+
+        // longest first, by arrival for equal lengths
+        std::stable_sort(embd_pending.begin(), embd_pending.end(), [](const server_task & a, const server_task & b) {
+            return a.prompt_tokens.size() > b.prompt_tokens.size();
+        });
+
+        common_batch_clear(batch);
+
+        std::vector<server_task> tasks;
+        std::vector<server_task> rest;
+
+        // sequence of each task in the batch, the tasks with an identical input share the sequence of the first one
+        std::vector<llama_seq_id>                  task_seq;
+        std::unordered_map<uint64_t, llama_seq_id> key_seq;
+
+        llama_seq_id n_seq = 0;
+
+        for (auto & task : embd_pending) {
+            const int32_t n_tokens = task.prompt_tokens.size();
+
+            if (n_tokens > n_ubatch) {
+                send_error(task, "input is too large to process. increase the physical batch size", ERROR_TYPE_SERVER);
+                continue;
+            }
+
+            uint64_t key = 0;
+            if (embd_cache) {
+                key = embd_cache_key(task.type, task.prompt_tokens, task.params);
+
+                auto it = key_seq.find(key);
+                if (it != key_seq.end()) {
+                    embd_cache->n_hit++;
+                    task_seq.push_back(it->second);
+                    tasks.push_back(std::move(task));
+                    continue;
+                }
+
+                // an identical input was evaluated by a previous batch
+                if (embd_cache->contains(key) && send_embd_cached(task, key)) {
+                    continue;
+                }
+            }
+
+            if (n_seq >= n_seq_max || batch.n_tokens + n_tokens > n_ubatch) {
+                rest.push_back(std::move(task));
+                continue;
+            }
+
+            const llama_seq_id seq_id = n_seq++;
+            for (int32_t i = 0; i < n_tokens; ++i) {
+                common_batch_add(batch, task.prompt_tokens[i], i, { seq_id }, true);
+            }
+
+            if (embd_cache) {
+                embd_cache->n_miss++;
+                key_seq[key] = seq_id;
+            }
+
+            task_seq.push_back(seq_id);
+            tasks.push_back(std::move(task));
+        }
+
+        embd_pending = std::move(rest);
+
+        if (tasks.empty()) {
+            return;
+        }
+
+        SRV_DBG("decoding embedding batch, n_tasks = %zu, n_seqs = %d, n_tokens = %d, n_pending = %zu\n", tasks.size(), n_seq, batch.n_tokens, embd_pending.size());
+
+        // the sequences may hold the cached prompts of the slots
+        auto * mem = llama_get_memory(ctx);
+        for (auto & slot : slots) {
+            if (slot.id < n_seq) {
+                if (mem) {
+                    llama_memory_seq_rm(mem, slot.id, -1, -1);
+                }
+                slot.cache_tokens.clear();
+            }
+        }
+
+        // same as the slot path, where the embedding tasks do not use the adapters
+        llama_clear_adapter_lora_seq(ctx, -1);
+        llama_clear_adapter_lora(ctx);
+
+        llama_set_embeddings(ctx, true);
+
+        const int64_t t_start = ggml_time_us();
+
+        int ret = llama_decode(ctx, batch);
+        if (ret == 1 && mem) {
+            // the cache is full of the prompts of the other slots
+            for (auto & slot : slots) {
+                llama_memory_seq_rm(mem, slot.id, -1, -1);
+                slot.cache_tokens.clear();
+            }
+            ret = llama_decode(ctx, batch);
+        }
+
+        metrics.on_embd_batch(batch.n_tokens, (ggml_time_us() - t_start) / 1e3);
+
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            const auto & task = tasks[i];
+
+            if (ret != 0) {
+                send_error(task, "Compute error.", ERROR_TYPE_SERVER);
+            } else if (task.type == SERVER_TASK_TYPE_RERANK) {
+                send_rerank(task.id, task.index, task.prompt_tokens, task.params, task_seq[i], batch);
+            } else {
+                send_embedding(task.id, task.index, task.prompt_tokens, task.params, task_seq[i], batch);
+            }
+        }
+
+        if (mem) {
+            for (llama_seq_id seq_id = 0; seq_id < n_seq; ++seq_id) {
+                llama_memory_seq_rm(mem, seq_id, -1, -1);
+            }
+        }
+
+        // continue with the remaining tasks after the new ones have been added to the pending list
+        if (!embd_pending.empty()) {
+            server_task task(SERVER_TASK_TYPE_NEXT_RESPONSE);
+            task.id = queue_tasks.get_new_id();
+            queue_tasks.post(std::move(task));
+        }
+    }
+
+    // the waiting tasks are processed again once their identical input is no longer evaluated by a slot,
+    // the result is then in the cache
+    void update_embd_waiting() {
+        std::vector<server_task> waiting;
+        std::swap(waiting, embd_waiting);
+
+        for (auto & task : waiting) {
+            if (embd_cache_in_flight(embd_cache_key(task.type, task.prompt_tokens, task.params))) {
+                embd_waiting.push_back(std::move(task));
+                continue;
+            }
+
+            process_single_task(std::move(task));
+        }
+    }
+
     void update_slots() {
+        if (!lora_pending_free.empty()) {
+            lora_free_unused();
+        }
+
+        if (!embd_pending.empty()) {
+            update_embd();
+        }
+
+        if (!embd_waiting.empty()) {
+            update_embd_waiting();
+        }
+
         // check if all slots are idle
         {
             bool all_idle = true;
@@ -3740,7 +4418,17 @@ struct server_context {
 
         if (slot_batched) {
             // apply lora, only need to do it once per batch
-            common_set_adapter_lora(ctx, slot_batched->lora);
+            llama_clear_adapter_lora_seq(ctx, -1);
+            if (lora_all_alora(slot_batched->lora)) {
+                common_set_adapter_lora(ctx, slot_batched->lora);
+            } else {
+                llama_clear_adapter_lora(ctx);
+                for (auto & slot : slots) {
+                    if (slot.is_processing()) {
+                        common_set_adapter_lora_seq(ctx, slot.id, slot.lora);
+                    }
+                }
+            }
 
             // if the lora is temporarily disabled for an alora, re-enable it
             // for next time
@@ -4354,6 +5042,14 @@ int main(int argc, char ** argv) {
                     {"name",  "n_busy_slots_per_decode"},
                     {"help",  "Average number of busy slots per llama_decode() call"},
                     {"value",  (float) res_metrics->n_busy_slots_total / std::max((float) res_metrics->n_decode_total, 1.f)}
+            }, {
+                    {"name",  "embd_cache_hits_total"},
+                    {"help",  "Number of embedding and reranking inputs found in the cache."},
+                    {"value",  res_metrics->n_embd_cache_hit}
+            }, {
+                    {"name",  "embd_cache_misses_total"},
+                    {"help",  "Number of embedding and reranking inputs not found in the cache."},
+                    {"value",  res_metrics->n_embd_cache_miss}
             }}},
             {"gauge", {{
                     {"name",  "prompt_tokens_seconds"},
@@ -4371,6 +5067,10 @@ int main(int argc, char ** argv) {
                     {"name",  "requests_deferred"},
                     {"help",  "Number of requests deferred."},
                     {"value",  (uint64_t) res_metrics->n_tasks_deferred}
+            },{
+                    {"name",  "embd_cache_hit_ratio"},
+                    {"help",  "Fraction of the embedding and reranking inputs found in the cache."},
+                    {"value",  (double) res_metrics->n_embd_cache_hit / std::max<uint64_t>(res_metrics->n_embd_cache_hit + res_metrics->n_embd_cache_miss, 1)}
             }}}
         };
 
@@ -4623,10 +5323,13 @@ int main(int argc, char ** argv) {
                 task.index = i;
 
                 task.prompt_tokens    = std::move(inputs[i]);
-                task.params           = server_task::params_from_json_cmpl(
-                        ctx_server.ctx,
-                        ctx_server.params_base,
-                        data);
+                {
+                    std::lock_guard<std::mutex> lock(ctx_server.mutex_lora);
+                    task.params       = server_task::params_from_json_cmpl(
+                            ctx_server.ctx,
+                            ctx_server.params_base,
+                            data);
+                }
                 task.id_selected_slot = json_value(data, "id_slot", -1);
 
                 // OAI-compat
@@ -4889,7 +5592,7 @@ int main(int argc, char ** argv) {
             const bool parse_special = json_value(body, "parse_special", true);
             const bool with_pieces = json_value(body, "with_pieces", false);
 
-            llama_tokens tokens = tokenize_mixed(ctx_server.vocab, body.at("content"), add_special, parse_special);
+            llama_tokens tokens = tokenize_mixed(ctx_server.vocab, body.at("content"), add_special, parse_special, ctx_server.params_base.cpuparams_batch.n_threads);
 
             if (with_pieces) {
                 for (const auto& token : tokens) {
@@ -4970,7 +5673,7 @@ int main(int argc, char ** argv) {
             }
         }
 
-        auto tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, ctx_server.mctx, prompt, true, true);
+        auto tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, ctx_server.mctx, prompt, true, true, ctx_server.params_base.cpuparams_batch.n_threads);
         for (const auto & tokens : tokenized_prompts) {
             // this check is necessary for models that do not add BOS token to the input
             if (tokens.empty()) {
@@ -5138,13 +5841,16 @@ int main(int argc, char ** argv) {
 
     const auto handle_lora_adapters_list = [&](const httplib::Request &, httplib::Response & res) {
         json result = json::array();
+        std::lock_guard<std::mutex> lock(ctx_server.mutex_lora);
         const auto & loras = ctx_server.params_base.lora_adapters;
         for (size_t i = 0; i < loras.size(); ++i) {
             auto & lora = loras[i];
             json entry = {
-                {"id", i},
+                {"id", lora.uid},
                 {"path", lora.path},
                 {"scale", lora.scale},
+                {"size", llama_adapter_lora_size(lora.ptr)},
+                {"offloaded", llama_adapter_lora_is_offloaded(lora.ptr)},
                 {"task_name", lora.task_name},
                 {"prompt_prefix", lora.prompt_prefix},
             };
@@ -5177,7 +5883,115 @@ int main(int argc, char ** argv) {
         {
             server_task task(SERVER_TASK_TYPE_SET_LORA);
             task.id = task_id;
-            task.set_lora = parse_lora_request(ctx_server.params_base.lora_adapters, body);
+            {
+                std::lock_guard<std::mutex> lock(ctx_server.mutex_lora);
+                task.set_lora = parse_lora_request(ctx_server.params_base.lora_adapters, body);
+            }
+            ctx_server.queue_results.add_waiting_task_id(task_id);
+            ctx_server.queue_tasks.post(std::move(task));
+        }
+
+        // get the result
+        server_task_result_ptr result = ctx_server.queue_results.recv(task_id);
+        ctx_server.queue_results.remove_waiting_task_id(task_id);
+
+        if (result->is_error()) {
+            res_error(res, result->to_json());
+            return;
+        }
+
+        GGML_ASSERT(dynamic_cast<server_task_result_apply_lora*>(result.get()) != nullptr);
+        res_ok(res, result->to_json());
+    };
+
+    const auto handle_lora_adapters_load = [&](const httplib::Request & req, httplib::Response & res) {
+        if (params.lora_dir.empty()) {
+            res_error(res, format_error_response("This server does not support loading LoRA adapters. Start it with `--lora-dir`", ERROR_TYPE_NOT_SUPPORTED));
+            return;
+        }
+
+        const json body = json::parse(req.body);
+        if (!body.contains("path") || !body.at("path").is_string()) {
+            res_error(res, format_error_response("\"path\" must be provided", ERROR_TYPE_INVALID_REQUEST));
+            return;
+        }
+
+        // only the files of --lora-dir can be loaded: absolute paths, directories and ".." are rejected
+        const std::string filename = body.at("path").get<std::string>();
+        if (!fs_validate_filename(filename)) {
+            res_error(res, format_error_response("Invalid adapter file name", ERROR_TYPE_INVALID_REQUEST));
+            return;
+        }
+
+        common_adapter_lora_info info = { params.lora_dir + filename, json_value(body, "scale", 0.0f), "", "", nullptr };
+
+        {
+            std::lock_guard<std::mutex> lock(ctx_server.mutex_lora);
+            const auto & loras = ctx_server.params_base.lora_adapters;
+            for (size_t i = 0; i < loras.size(); ++i) {
+                if (loras[i].path == info.path) {
+                    res_ok(res, {
+                        { "id",        loras[i].uid },
+                        { "path",      info.path },
+                        { "size",      llama_adapter_lora_size(loras[i].ptr) },
+                        { "evicted",   json::array() },
+                        { "unloaded",  json::array() },
+                        { "t_load_ms", 0.0 },
+                    });
+                    return;
+                }
+            }
+        }
+
+        // the adapter is loaded here, so that the main loop is not blocked while reading the file
+        const int64_t t_start_us = ggml_time_us();
+
+        info.ptr = llama_adapter_lora_init(ctx_server.model, info.path.c_str());
+        if (info.ptr == nullptr) {
+            res_error(res, format_error_response("failed to load LoRA adapter '" + filename + "'", ERROR_TYPE_INVALID_REQUEST));
+            return;
+        }
+
+        char buf[1024];
+        llama_adapter_meta_val_str(info.ptr, "adapter.lora.task_name", buf, sizeof(buf));
+        info.task_name = buf;
+        llama_adapter_meta_val_str(info.ptr, "adapter.lora.prompt_prefix", buf, sizeof(buf));
+        info.prompt_prefix = buf;
+
+        const double t_load_ms = (ggml_time_us() - t_start_us) / 1000.0;
+
+        int task_id = ctx_server.queue_tasks.get_new_id();
+        {
+            server_task task(SERVER_TASK_TYPE_LOAD_LORA);
+            task.id = task_id;
+            task.set_lora.push_back(info);
+            ctx_server.queue_results.add_waiting_task_id(task_id);
+            ctx_server.queue_tasks.post(std::move(task));
+        }
+
+        // get the result
+        server_task_result_ptr result = ctx_server.queue_results.recv(task_id);
+        ctx_server.queue_results.remove_waiting_task_id(task_id);
+
+        if (result->is_error()) {
+            res_error(res, result->to_json());
+            return;
+        }
+
+        GGML_ASSERT(dynamic_cast<server_task_result_load_lora*>(result.get()) != nullptr);
+        json data = result->to_json();
+        data["t_load_ms"] = t_load_ms;
+        res_ok(res, data);
+    };
+
+    const auto handle_lora_adapters_unload = [&](const httplib::Request & req, httplib::Response & res) {
+        const json body = json::parse(req.body);
+
+        int task_id = ctx_server.queue_tasks.get_new_id();
+        {
+            server_task task(SERVER_TASK_TYPE_UNLOAD_LORA);
+            task.id = task_id;
+            task.id_lora = json_value(body, "id", -1);
             ctx_server.queue_results.add_waiting_task_id(task_id);
             ctx_server.queue_tasks.post(std::move(task));
         }
@@ -5256,6 +6070,8 @@ int main(int argc, char ** argv) {
     // LoRA adapters hotswap
     svr->Get (params.api_prefix + "/lora-adapters",       handle_lora_adapters_list);
     svr->Post(params.api_prefix + "/lora-adapters",       handle_lora_adapters_apply);
+    svr->Post(params.api_prefix + "/lora-adapters/load",  handle_lora_adapters_load);
+    svr->Post(params.api_prefix + "/lora-adapters/unload", handle_lora_adapters_unload);
     // Save & load slots
     svr->Get (params.api_prefix + "/slots",               handle_slots);
     svr->Post(params.api_prefix + "/slots/:id_slot",      handle_slots_action);
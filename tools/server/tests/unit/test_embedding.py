@@ -1,6 +1,9 @@
 import base64
+import os
 import struct
+import tempfile
 import pytest
+import requests
 from openai import OpenAI
 from utils import *
 
@@ -156,6 +159,126 @@ def test_embedding_openai_library_multiple():
         assert len(d.embedding) > 1
 
 
+def test_embedding_batching_same_as_slots():
+    global server
+    server.pooling = 'mean'
+    server.n_slots = 4
+    inputs = [
+        "I believe the meaning of life is",
+        "Write a joke about AI from a very long prompt which will not be truncated",
+        "This is a test",
+        "This is another test",
+        "This is a test",
+        "a",
+    ]
+
+    server.start()
+    res_slots = server.make_request("POST", "/v1/embeddings", data={"input": inputs})
+    assert res_slots.status_code == 200
+    server.stop()
+
+    # the inputs are packed into shared ubatches instead of one slot each
+    server.embd_batching = True
+    server.start()
+    res = server.make_request("POST", "/v1/embeddings", data={"input": inputs})
+    assert res.status_code == 200
+    assert res.body['usage'] == res_slots.body['usage']
+    assert len(res.body['data']) == len(inputs)
+    for d, d_slots in zip(res.body['data'], res_slots.body['data']):
+        assert d['index'] == d_slots['index']
+        for x, y in zip(d['embedding'], d_slots['embedding']):
+            assert abs(x - y) < EPSILON
+
+
+def test_embedding_batching_parallel_requests():
+    global server
+    server.pooling = 'mean'
+    server.n_slots = 4
+    server.embd_batching = True
+    server.start()
+    inputs = [f"This is test number {i} " * (i + 1) for i in range(8)]
+    tasks = [(server.make_request, ("POST", "/v1/embeddings", {"input": input})) for input in inputs]
+    results = parallel_function_calls(tasks)
+    for input, res in zip(inputs, results):
+        assert res.status_code == 200
+        # same result as a request with a single input
+        res_single = server.make_request("POST", "/v1/embeddings", data={"input": input})
+        for x, y in zip(res.body['data'][0]['embedding'], res_single.body['data'][0]['embedding']):
+            assert abs(x - y) < EPSILON
+
+
+def get_embd_cache_metrics():
+    res = requests.get(f"http://{server.server_host}:{server.server_port}/metrics")
+    assert res.status_code == 200
+    metrics = {}
+    for line in res.text.splitlines():
+        if line.startswith("llamacpp:embd_cache_"):
+            name, value = line.split()
+            metrics[name[len("llamacpp:embd_cache_"):]] = float(value)
+    return metrics
+
+
+def test_embedding_cache_hit():
+    global server
+    server.pooling = 'mean'
+    server.server_metrics = True
+    server.embd_cache = 16
+    server.start()
+    inputs = [
+        "I believe the meaning of life is",
+        "This is a test",
+        "I believe the meaning of life is",
+    ]
+    res = server.make_request("POST", "/v1/embeddings", data={"input": inputs})
+    assert res.status_code == 200
+    # the repeated input is evaluated once
+    metrics = get_embd_cache_metrics()
+    assert metrics["misses_total"] == 2
+    assert metrics["hits_total"] == 1
+
+    res_hit = server.make_request("POST", "/v1/embeddings", data={"input": inputs})
+    assert res_hit.status_code == 200
+    metrics = get_embd_cache_metrics()
+    assert metrics["misses_total"] == 2
+    assert metrics["hits_total"] == 4
+    assert abs(metrics["hit_ratio"] - 4 / 6) < EPSILON
+
+    # the cached results are the evaluated ones
+    assert res_hit.body['usage'] == res.body['usage']
+    for d, d_hit in zip(res.body['data'], res_hit.body['data']):
+        assert d['index'] == d_hit['index']
+        assert d['embedding'] == d_hit['embedding']
+
+    # another normalization is another result
+    res_norm = server.make_request("POST", "/embeddings", data={"content": inputs[0], "embd_normalize": -1})
+    assert res_norm.status_code == 200
+    assert get_embd_cache_metrics()["misses_total"] == 3
+
+
+def test_embedding_cache_file():
+    global server
+    server.pooling = 'mean'
+    server.server_metrics = True
+    server.embd_cache_file = os.path.join(tempfile.mkdtemp(), "embd-cache.bin")
+    inputs = ["I believe the meaning of life is", "This is a test"]
+
+    server.start()
+    res = server.make_request("POST", "/v1/embeddings", data={"input": inputs})
+    assert res.status_code == 200
+    assert get_embd_cache_metrics()["misses_total"] == 2
+    server.stop()
+
+    # the next run reads the results back from the file
+    server.start()
+    res_file = server.make_request("POST", "/v1/embeddings", data={"input": inputs})
+    assert res_file.status_code == 200
+    metrics = get_embd_cache_metrics()
+    assert metrics["misses_total"] == 0
+    assert metrics["hits_total"] == 2
+    for d, d_file in zip(res.body['data'], res_file.body['data']):
+        assert d['embedding'] == d_file['embedding']
+
+
 def test_embedding_error_prompt_too_long():
     global server
     server.pooling = 'last'
@@ -1,3 +1,5 @@
+import os
+import shutil
 import pytest
 from utils import *
 
@@ -66,6 +68,166 @@ def test_lora_per_request():
         assert match_regex(re_test, res.body["content"])
 
 
+def test_lora_load_unload():
+    global server
+    lora_file = download_file(LORA_FILE_URL)
+    server.lora_files = None
+    server.lora_dir = os.path.dirname(lora_file)
+    server.start()
+
+    res = server.make_request("POST", "/lora-adapters/load", data={"path": os.path.basename(lora_file), "scale": 1.0})
+    assert res.status_code == 200
+    assert res.body["id"] == 0
+    assert res.body["evicted"] == []
+    assert res.body["size"] > 0
+
+    res = server.make_request("POST", "/completion", data={"prompt": "Look in thy glass"})
+    assert res.status_code == 200
+    assert match_regex("(eye|love|glass|sun)+", res.body["content"])
+
+    # loading the same file again returns the same adapter
+    res = server.make_request("POST", "/lora-adapters/load", data={"path": os.path.basename(lora_file)})
+    assert res.status_code == 200
+    assert res.body["id"] == 0
+    res = server.make_request("GET", "/lora-adapters")
+    assert len(res.body) == 1
+
+    res = server.make_request("POST", "/lora-adapters/unload", data={"id": 0})
+    assert res.status_code == 200
+    res = server.make_request("GET", "/lora-adapters")
+    assert len(res.body) == 0
+
+    res = server.make_request("POST", "/completion", data={"prompt": "Look in thy glass"})
+    assert res.status_code == 200
+    assert match_regex("(little|girl|three|years|old)+", res.body["content"])
+
+    res = server.make_request("POST", "/lora-adapters/unload", data={"id": 0})
+    assert res.status_code == 400
+
+
+def make_lora_copy(lora_file: str) -> str:
+    lora_copy = os.path.join(os.path.dirname(lora_file), "moe_shakespeare15M_copy.gguf")
+    if not os.path.exists(lora_copy):
+        shutil.copyfile(lora_file, lora_copy)
+    return lora_copy
+
+
+def test_lora_load_unload_stable_id():
+    global server
+    lora_file = download_file(LORA_FILE_URL)
+    lora_copy = make_lora_copy(lora_file)
+    server.lora_files = None
+    server.lora_dir = os.path.dirname(lora_file)
+    server.start()
+
+    res = server.make_request("POST", "/lora-adapters/load", data={"path": os.path.basename(lora_file)})
+    assert res.status_code == 200
+    assert res.body["id"] == 0
+    res = server.make_request("POST", "/lora-adapters/load", data={"path": os.path.basename(lora_copy)})
+    assert res.status_code == 200
+    assert res.body["id"] == 1
+
+    # the id of the second adapter does not change, and the id of the first one is not reused
+    res = server.make_request("POST", "/lora-adapters/unload", data={"id": 0})
+    assert res.status_code == 200
+    res = server.make_request("GET", "/lora-adapters")
+    assert [la["id"] for la in res.body] == [1]
+
+    res = server.make_request("POST", "/completion", data={"prompt": "Look in thy glass", "lora": [{"id": 0, "scale": 1.0}]})
+    assert res.status_code == 400
+    res = server.make_request("POST", "/completion", data={"prompt": "Look in thy glass", "lora": [{"id": 1, "scale": 1.0}]})
+    assert res.status_code == 200
+    assert match_regex("(eye|love|glass|sun)+", res.body["content"])
+
+    res = server.make_request("POST", "/lora-adapters/load", data={"path": os.path.basename(lora_file)})
+    assert res.status_code == 200
+    assert res.body["id"] == 2
+
+
+def test_lora_load_eviction():
+    global server
+    lora_file = download_file(LORA_FILE_URL)
+    lora_copy = make_lora_copy(lora_file)
+    server.lora_files = None
+    server.lora_dir = os.path.dirname(lora_file)
+    server.lora_cache_size = 1 # MiB, smaller than one adapter
+    server.start()
+
+    res = server.make_request("POST", "/lora-adapters/load", data={"path": os.path.basename(lora_file)})
+    assert res.status_code == 200
+    if res.body["size"] <= 1024*1024:
+        pytest.skip("the adapter is smaller than the cache size")
+    assert res.body["id"] == 0
+
+    # the first adapter is disabled and not used, so it is offloaded to host memory
+    res = server.make_request("POST", "/lora-adapters/load", data={"path": os.path.basename(lora_copy)})
+    assert res.status_code == 200
+    assert res.body["id"] == 1
+    assert res.body["evicted"] == [0]
+    assert res.body["unloaded"] == []
+
+    res = server.make_request("GET", "/lora-adapters")
+    assert [(la["id"], la["offloaded"]) for la in res.body] == [(0, True), (1, False)]
+
+    # a request with the offloaded adapter loads it back, and offloads the other one
+    res = server.make_request("POST", "/completion", data={"prompt": "Look in thy glass", "lora": [{"id": 0, "scale": 1.0}]})
+    assert res.status_code == 200
+    assert match_regex("(eye|love|glass|sun)+", res.body["content"])
+
+    res = server.make_request("GET", "/lora-adapters")
+    assert [(la["id"], la["offloaded"]) for la in res.body] == [(0, False), (1, True)]
+
+
+def test_lora_load_eviction_host_cache():
+    global server
+    lora_file = download_file(LORA_FILE_URL)
+    lora_copy = make_lora_copy(lora_file)
+    server.lora_files = None
+    server.lora_dir = os.path.dirname(lora_file)
+    server.lora_cache_size = 1 # MiB, smaller than one adapter
+    server.lora_host_cache_size = 1
+    server.start()
+
+    res = server.make_request("POST", "/lora-adapters/load", data={"path": os.path.basename(lora_file)})
+    assert res.status_code == 200
+    if res.body["size"] <= 1024*1024:
+        pytest.skip("the adapter is smaller than the cache size")
+
+    # the first adapter does not fit in the host cache either, so it is unloaded
+    res = server.make_request("POST", "/lora-adapters/load", data={"path": os.path.basename(lora_copy)})
+    assert res.status_code == 200
+    assert res.body["evicted"] == [0]
+    assert res.body["unloaded"] == [0]
+
+    res = server.make_request("GET", "/lora-adapters")
+    assert [la["id"] for la in res.body] == [1]
+
+
+def test_lora_load_without_lora_dir():
+    global server
+    server.start()
+    res = server.make_request("POST", "/lora-adapters/load", data={"path": "moe_shakespeare15M.gguf"})
+    assert res.status_code == 501 # ERROR_TYPE_NOT_SUPPORTED
+
+
+@pytest.mark.parametrize("path", [
+    "/etc/passwd",
+    "../moe_shakespeare15M.gguf",
+    "..",
+    "sub/moe_shakespeare15M.gguf",
+    "",
+])
+def test_lora_load_rejected_path(path: str):
+    global server
+    lora_file = download_file(LORA_FILE_URL)
+    server.lora_dir = os.path.dirname(lora_file)
+    server.start()
+    res = server.make_request("POST", "/lora-adapters/load", data={"path": path})
+    assert res.status_code == 400
+    res = server.make_request("GET", "/lora-adapters")
+    assert len(res.body) == 1
+
+
 @pytest.mark.skipif(not is_slow_test_allowed(), reason="skipping slow test")
 def test_with_big_model():
     server = ServerProcess()
@@ -64,6 +64,31 @@ def test_rerank_tei_format():
     assert least_relevant["index"] == 3
 
 
+def test_rerank_batching_same_as_slots():
+    global server
+    server.n_slots = 4
+    server.start()
+    res_slots = server.make_request("POST", "/rerank", data={
+        "query": "Machine learning is",
+        "documents": TEST_DOCUMENTS,
+    })
+    assert res_slots.status_code == 200
+    server.stop()
+
+    server.embd_batching = True
+    server.start()
+    res = server.make_request("POST", "/rerank", data={
+        "query": "Machine learning is",
+        "documents": TEST_DOCUMENTS,
+    })
+    assert res.status_code == 200
+    scores_slots = {doc["index"]: doc["relevance_score"] for doc in res_slots.body["results"]}
+    scores       = {doc["index"]: doc["relevance_score"] for doc in res.body["results"]}
+    assert scores.keys() == scores_slots.keys()
+    for i in scores:
+        assert abs(scores[i] - scores_slots[i]) < 1e-3
+
+
 @pytest.mark.parametrize("documents", [
     [],
     None,
@@ -71,12 +71,18 @@ class ServerProcess:
     server_continuous_batching: bool | None = False
     server_embeddings: bool | None = False
     server_reranking: bool | None = False
+    embd_batching: bool | None = False
+    embd_cache: int | None = None
+    embd_cache_file: str | None = None
     server_metrics: bool | None = False
     server_slots: bool | None = False
     pooling: str | None = None
     draft: int | None = None
     api_key: str | None = None
     lora_files: List[str] | None = None
+    lora_dir: str | None = None
+    lora_cache_size: int | None = None
+    lora_host_cache_size: int | None = None
     enable_ctx_shift: int | None = False
     draft_min: int | None = None
     draft_max: int | None = None
@@ -147,6 +153,12 @@ class ServerProcess:
             server_args.append("--embedding")
         if self.server_reranking:
             server_args.append("--reranking")
+        if self.embd_batching:
+            server_args.append("--embd-batching")
+        if self.embd_cache is not None:
+            server_args.extend(["--embd-cache", self.embd_cache])
+        if self.embd_cache_file:
+            server_args.extend(["--embd-cache-file", self.embd_cache_file])
         if self.server_metrics:
             server_args.append("--metrics")
         if self.server_slots:
@@ -180,6 +192,12 @@ class ServerProcess:
         if self.lora_files:
             for lora_file in self.lora_files:
                 server_args.extend(["--lora", lora_file])
+        if self.lora_dir:
+            server_args.extend(["--lora-dir", self.lora_dir])
+        if self.lora_cache_size:
+            server_args.extend(["--lora-cache-size", self.lora_cache_size])
+        if self.lora_host_cache_size:
+            server_args.extend(["--lora-host-cache-size", self.lora_host_cache_size])
         if self.enable_ctx_shift:
             server_args.append("--context-shift")
         if self.api_key:
@@ -163,31 +163,36 @@ static json json_get_nested_values(const std::vector<std::string> & paths, const
  * - only string, example: "string"
  * - mixed string and tokens, example: [12, 34, "string", 56, 78]
  */
-static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_prompt, bool add_special, bool parse_special) {
+static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_prompt, bool add_special, bool parse_special, int32_t n_threads = 1) {
     // If `add_bos` is true, we only add BOS, when json_prompt is a string,
     // or the first element of the json_prompt array is a string.
     llama_tokens prompt_tokens;
 
     if (json_prompt.is_array()) {
-        bool first = true;
-        for (const auto & p : json_prompt) {
-            if (p.is_string()) {
-                auto s = p.template get<std::string>();
+        const bool first_special = add_special && !json_prompt.empty() && json_prompt[0].is_string();
+
+        // the remaining string parts are tokenized as one batch
+        std::vector<std::string> texts;
+        for (size_t i = first_special ? 1 : 0; i < json_prompt.size(); ++i) {
+            if (json_prompt[i].is_string()) {
+                texts.push_back(json_prompt[i].template get<std::string>());
+            }
+        }
+
+        const auto parts = common_tokenize_batch(vocab, texts, false, parse_special, n_threads);
 
-                llama_tokens p;
-                if (first) {
-                    p = common_tokenize(vocab, s, add_special, parse_special);
-                    first = false;
+        size_t i_part = 0;
+        for (size_t i = 0; i < json_prompt.size(); ++i) {
+            const auto & p = json_prompt[i];
+            if (p.is_string()) {
+                if (i == 0 && first_special) {
+                    const llama_tokens tmp = common_tokenize(vocab, p.template get<std::string>(), true, parse_special);
+                    prompt_tokens.insert(prompt_tokens.end(), tmp.begin(), tmp.end());
                 } else {
-                    p = common_tokenize(vocab, s, false, parse_special);
+                    const llama_tokens & tmp = parts[i_part++];
+                    prompt_tokens.insert(prompt_tokens.end(), tmp.begin(), tmp.end());
                 }
-
-                prompt_tokens.insert(prompt_tokens.end(), p.begin(), p.end());
             } else {
-                if (first) {
-                    first = false;
-                }
-
                 prompt_tokens.push_back(p.template get<llama_token>());
             }
         }
@@ -229,6 +234,145 @@ static size_t validate_utf8(const std::string& text) {
     return len;
 }
 
+// incremental state of a generated text stream: UTF-8 decoder state and an Aho-Corasick matcher over the stop strings
+// feeding a piece costs O(piece length), independent of the length of the text generated so far
+struct server_text_stream {
+    struct node {
+        std::vector<std::pair<uint8_t, int32_t>> next;
+
+        int32_t fail  = 0;
+        int32_t depth = 0;
+        int32_t word  = -1; // longest stop string that is a suffix of this node, -1 if none
+    };
+
+    std::vector<node>        nodes;
+    std::vector<std::string> words;
+
+    int32_t state = 0;
+    size_t  n_fed = 0;
+
+    int32_t n_utf8_pending = 0; // continuation bytes still expected for the last character
+
+    // earliest full match that ended since the last take_stop()
+    size_t  stop_pos  = std::string::npos;
+    int32_t stop_word = -1;
+
+    void init(const std::vector<std::string> & stop_words) {
+        words = stop_words;
+        nodes.assign(1, node());
+
+        for (size_t iw = 0; iw < words.size(); ++iw) {
+            if (words[iw].empty()) {
+                continue;
+            }
+            int32_t cur = 0;
+            for (const char c : words[iw]) {
+                int32_t nxt = child(cur, (uint8_t) c);
+                if (nxt < 0) {
+                    nxt = nodes.size();
+                    nodes.emplace_back();
+                    nodes[nxt].depth = nodes[cur].depth + 1;
+                    nodes[cur].next.emplace_back((uint8_t) c, nxt);
+                }
+                cur = nxt;
+            }
+            nodes[cur].word = iw;
+        }
+
+        // failure links in BFS order, so the parent's link is always ready
+        std::vector<int32_t> queue = { 0 };
+        for (size_t iq = 0; iq < queue.size(); ++iq) {
+            const int32_t cur = queue[iq];
+            for (const auto & [c, nxt] : nodes[cur].next) {
+                nodes[nxt].fail = cur == 0 ? 0 : step(nodes[cur].fail, c);
+                if (nodes[nxt].word < 0) {
+                    nodes[nxt].word = nodes[nodes[nxt].fail].word;
+                }
+                queue.push_back(nxt);
+            }
+        }
+
+        state = 0;
+        n_fed = 0;
+        n_utf8_pending = 0;
+        take_stop();
+    }
+
+    void feed(const std::string & piece) {
+        for (const char ch : piece) {
+            const uint8_t c = ch;
+
+            if ((c & 0x80) == 0x00) {
+                n_utf8_pending = 0;
+            } else if ((c & 0xC0) == 0x80) {
+                n_utf8_pending = std::max(n_utf8_pending - 1, 0);
+            } else if ((c & 0xE0) == 0xC0) {
+                n_utf8_pending = 1;
+            } else if ((c & 0xF0) == 0xE0) {
+                n_utf8_pending = 2;
+            } else if ((c & 0xF8) == 0xF0) {
+                n_utf8_pending = 3;
+            } else {
+                n_utf8_pending = 0;
+            }
+
+            n_fed++;
+
+            if (nodes.size() <= 1) {
+                continue;
+            }
+
+            state = step(state, c);
+
+            const int32_t iw = nodes[state].word;
+            if (iw >= 0) {
+                const size_t pos = n_fed - words[iw].size();
+                if (pos < stop_pos) {
+                    stop_pos  = pos;
+                    stop_word = iw;
+                }
+            }
+        }
+    }
+
+    bool incomplete_utf8() const {
+        return n_utf8_pending > 0;
+    }
+
+    // length of the longest suffix of the text that is a prefix of a stop string
+    size_t partial_len() const {
+        return nodes.empty() ? 0 : nodes[state].depth;
+    }
+
+    void take_stop() {
+        stop_pos  = std::string::npos;
+        stop_word = -1;
+    }
+
+private:
+    int32_t child(int32_t cur, uint8_t c) const {
+        for (const auto & [cc, nxt] : nodes[cur].next) {
+            if (cc == c) {
+                return nxt;
+            }
+        }
+        return -1;
+    }
+
+    int32_t step(int32_t cur, uint8_t c) const {
+        while (true) {
+            const int32_t nxt = child(cur, c);
+            if (nxt >= 0) {
+                return nxt;
+            }
+            if (cur == 0) {
+                return 0;
+            }
+            cur = nodes[cur].fail;
+        }
+    }
+};
+
 //
 // template utils
 //
@@ -1044,11 +1188,11 @@ static bool lora_should_clear_cache(
 }
 
 // parse lora config from JSON request, returned a copy of lora_base with updated scale
+// the adapters are identified by their uid, which does not change when other adapters are loaded or unloaded
 static std::vector<common_adapter_lora_info> parse_lora_request(
         const std::vector<common_adapter_lora_info> & lora_base,
         const json & data) {
     std::vector<common_adapter_lora_info> lora(lora_base);
-    int max_idx = lora.size();
 
     // clear existing value
     for (auto & entry : lora) {
@@ -1059,16 +1203,39 @@ static std::vector<common_adapter_lora_info> parse_lora_request(
     for (const auto & entry : data) {
         int id      = json_value(entry, "id", -1);
         float scale = json_value(entry, "scale", 0.0f);
-        if (0 <= id && id < max_idx) {
-            lora[id].scale = scale;
-        } else {
+        auto it = std::find_if(lora.begin(), lora.end(), [id](const common_adapter_lora_info & la) {
+            return id >= 0 && la.uid == (uint64_t) id;
+        });
+        if (it == lora.end()) {
             throw std::runtime_error("invalid adapter id");
         }
+        it->scale = scale;
     }
 
     return lora;
 }
 
+// map a lora config onto the current list of adapters: the scales are matched by adapter uid (the address of an
+// unloaded adapter can be reused by a new one), adapters that are no longer loaded are dropped and newly loaded
+// ones are disabled
+static std::vector<common_adapter_lora_info> lora_rebase(
+        const std::vector<common_adapter_lora_info> & lora_base,
+        const std::vector<common_adapter_lora_info> & lora) {
+    std::vector<common_adapter_lora_info> res(lora_base);
+
+    for (auto & entry : res) {
+        entry.scale = 0.0f;
+        for (const auto & other : lora) {
+            if (other.uid == entry.uid) {
+                entry.scale = other.scale;
+                break;
+            }
+        }
+    }
+
+    return res;
+}
+
 //
 // utils for interacting with libmtmd
 // (may need to refactor in near future)
@@ -1439,13 +1606,13 @@ static server_tokens process_mtmd_prompt(mtmd_context * mctx, std::string prompt
  * - "prompt": [12, 34, "string", 56, 78]
  * - "prompt": { "prompt_string": "string", "multimodal_data": [ "base64" ] }
  */
-static server_tokens tokenize_input_subprompt(const llama_vocab * vocab, mtmd_context * mctx, const json & json_prompt, bool add_special, bool parse_special) {
+static server_tokens tokenize_input_subprompt(const llama_vocab * vocab, mtmd_context * mctx, const json & json_prompt, bool add_special, bool parse_special, int32_t n_threads = 1) {
     constexpr char JSON_STRING_PROMPT_KEY[] = "prompt_string";
     constexpr char JSON_MTMD_DATA_KEY[] = "multimodal_data";
     const bool has_mtmd = mctx != nullptr;
     if (json_prompt.is_string() || json_is_array_of_mixed_numbers_strings(json_prompt)) {
         // string or mixed
-        llama_tokens tmp = tokenize_mixed(vocab, json_prompt, add_special, parse_special);
+        llama_tokens tmp = tokenize_mixed(vocab, json_prompt, add_special, parse_special, n_threads);
         return server_tokens(tmp, false);
     } else if (json_is_array_of_numbers(json_prompt)) {
         // array of tokens
@@ -1486,12 +1653,22 @@ static server_tokens tokenize_input_subprompt(const llama_vocab * vocab, mtmd_co
  * - "prompt": [[12, 34, 56], [78, 90, 12]]
  * - "prompt": [[12, 34, "string", 56, 78], [12, 34, 56], { "prompt_string": "string", "multimodal_data": [ "base64" ]}]
  */
-static std::vector<server_tokens> tokenize_input_prompts(const llama_vocab * vocab, mtmd_context * mctx, const json & json_prompt, bool add_special, bool parse_special) {
+static std::vector<server_tokens> tokenize_input_prompts(const llama_vocab * vocab, mtmd_context * mctx, const json & json_prompt, bool add_special, bool parse_special, int32_t n_threads = 1) {
     std::vector<server_tokens> result;
     if (json_prompt.is_array() && !json_is_array_and_contains_numbers(json_prompt)) {
         result.reserve(json_prompt.size());
-        for (const auto & p : json_prompt) {
-            result.push_back(tokenize_input_subprompt(vocab, mctx, p,add_special, parse_special));
+
+        const bool all_strings = std::all_of(json_prompt.begin(), json_prompt.end(), [](const json & p) { return p.is_string(); });
+        if (all_strings) {
+            // multiple plain strings (e.g. a batch of embedding inputs) are tokenized as one batch
+            const auto texts = json_prompt.get<std::vector<std::string>>();
+            for (auto & tmp : common_tokenize_batch(vocab, texts, add_special, parse_special, n_threads)) {
+                result.push_back(server_tokens(tmp, false));
+            }
+        } else {
+            for (const auto & p : json_prompt) {
+                result.push_back(tokenize_input_subprompt(vocab, mctx, p, add_special, parse_special, n_threads));
+            }
         }
     } else {
         result.push_back(tokenize_input_subprompt(vocab, mctx, json_prompt, add_special, parse_special));